@@ -0,0 +1,223 @@
+/*
+** C benchmarks of the Lua suite: costs seen through the C API.
+** usage: cbench [runs [scale]]
+** Output has the same format as run.lua.
+** The suite builds with the headers of any Lua 5.3. Benchmarks of API
+** functions that only this distribution has are compiled only when its
+** headers are detected (or CBENCH_EXTAPI is defined) and are reported
+** as skipped otherwise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/* LUAL_POOLMAXBLOCK comes with the pooled allocator in 'luaconf.h' */
+#if !defined(CBENCH_EXTAPI) && defined(LUAL_POOLMAXBLOCK)
+#define CBENCH_EXTAPI
+#endif
+
+#if defined(CBENCH_EXTAPI)
+#define EXTBENCH(f)	f
+#else
+#define EXTBENCH(f)	NULL
+#endif
+
+
+typedef long (*BenchF) (lua_State *L, int scale);
+
+
+static long b_newstate (lua_State *L, int scale) {
+  int i;
+  (void)L;
+  for (i = 0; i < 500 * scale; i++) {
+    lua_State *L1 = luaL_newstate();
+    luaL_openlibs(L1);
+    lua_close(L1);
+  }
+  return i;
+}
+
+
+/* string interning (lstring.c) */
+static long b_pushstring (lua_State *L, int scale) {
+  long i, n = 0;
+  char buff[32];
+  for (i = 0; i < 1000000L * scale; i++) {
+    int l = snprintf(buff, sizeof(buff), "key%ld", i % 10000);
+    n += (long)lua_rawlen(L, (lua_pushlstring(L, buff, l), -1));
+    lua_pop(L, 1);
+  }
+  return n;
+}
+
+
+/* interning of words of various lengths, as when parsing input */
+static long b_pushwords (lua_State *L, int scale) {
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyzabcdefghijk";
+  long i, n = 0;
+  char buff[64];
+  for (i = 0; i < 1000000L * scale; i++) {
+    int l = snprintf(buff, sizeof(buff), "%ld_%.*s", i % 20000,
+                     (int)(i % 37) + 1, letters);
+    n += (long)lua_rawlen(L, (lua_pushlstring(L, buff, l), -1));
+    lua_pop(L, 1);
+  }
+  return n;
+}
+
+
+static long b_rawseti (lua_State *L, int scale) {
+  long n = 0;
+  int r, i;
+  for (r = 0; r < 20 * scale; r++) {
+    lua_createtable(L, 0, 0);
+    for (i = 1; i <= 100000; i++) {
+      lua_pushinteger(L, i);
+      lua_rawseti(L, -2, i);
+    }
+    for (i = 1; i <= 100000; i++) {
+      lua_rawgeti(L, -1, i);
+      n += (long)lua_tointeger(L, -1);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+  return n;
+}
+
+
+#if defined(CBENCH_EXTAPI)	/* { */
+
+static long b_newstate_pooled (lua_State *L, int scale) {
+  int i;
+  (void)L;
+  for (i = 0; i < 500 * scale; i++) {
+    lua_State *L1 = luaL_newstate_pooled();
+    luaL_openlibs(L1);
+    lua_close(L1);
+  }
+  return i;
+}
+
+
+/* same table as 'b_rawseti', built with bulk appends */
+static long b_rawappend (lua_State *L, int scale) {
+  long n = 0;
+  int r, i, j;
+  for (r = 0; r < 20 * scale; r++) {
+    lua_createtable(L, 0, 0);
+    for (i = 1; i <= 100000; i += 10) {
+      for (j = 0; j < 10; j++)
+        lua_pushinteger(L, i + j);
+      lua_rawappend(L, -11, 10);
+    }
+    n += (long)lua_rawlen(L, -1);
+    lua_pop(L, 1);
+  }
+  return n;
+}
+
+#endif				/* } */
+
+
+static long b_setfield (lua_State *L, int scale) {
+  static const char *const names[] = {"alpha", "beta", "gamma", "delta"};
+  long i, n = 0;
+  lua_newtable(L);
+  for (i = 0; i < 2000000L * scale; i++) {
+    const char *k = names[i & 3];
+    lua_pushinteger(L, i);
+    lua_setfield(L, -2, k);
+    lua_getfield(L, -1, k);
+    n += (long)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return n;
+}
+
+
+/* calls from C into Lua */
+static long b_pcall (lua_State *L, int scale) {
+  long i, n = 0;
+  luaL_loadstring(L, "local a, b = ... return a + b");
+  for (i = 0; i < 1000000L * scale; i++) {
+    lua_pushvalue(L, -1);
+    lua_pushinteger(L, i);
+    lua_pushinteger(L, 1);
+    lua_pcall(L, 2, 1, 0);
+    n += (long)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return n;
+}
+
+
+static const struct {
+  const char *name;
+  BenchF f;
+} benchmarks[] = {
+  {"c.newstate", b_newstate},
+  {"c.newstate_pooled", EXTBENCH(b_newstate_pooled)},
+  {"c.pushstring", b_pushstring},
+  {"c.pushwords", b_pushwords},
+  {"c.rawseti", b_rawseti},
+  {"c.rawappend", EXTBENCH(b_rawappend)},
+  {"c.setfield", b_setfield},
+  {"c.pcall", b_pcall},
+  {NULL, NULL}
+};
+
+
+static int cmptime (const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+int main (int argc, char **argv) {
+  int runs = (argc > 1) ? atoi(argv[1]) : 5;
+  int scale = (argc > 2) ? atoi(argv[2]) : 1;
+  lua_State *L = luaL_newstate();
+  double *times;
+  int b, i;
+  if (runs < 1) runs = 1;
+  if (scale < 1) scale = 1;
+  times = (double *)malloc(runs * sizeof(double));
+  if (L == NULL || times == NULL) {
+    fprintf(stderr, "cbench: not enough memory\n");
+    return EXIT_FAILURE;
+  }
+  luaL_openlibs(L);
+  printf("# cbench\t%s\truns %d\tscale %d\n", LUA_RELEASE, runs, scale);
+  for (b = 0; benchmarks[b].name != NULL; b++) {
+    double median;
+    if (benchmarks[b].f == NULL) {
+      printf("# %s\tskipped (not supported)\n", benchmarks[b].name);
+      continue;
+    }
+    for (i = 0; i < runs; i++) {
+      clock_t t0;
+      lua_gc(L, LUA_GCCOLLECT, 0);
+      t0 = clock();
+      benchmarks[b].f(L, scale);
+      times[i] = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    }
+    qsort(times, runs, sizeof(double), cmptime);
+    median = (runs % 2 == 1) ? times[runs / 2]
+                             : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    printf("%s\t%.4f\t%.4f\t%.4f\n", benchmarks[b].name, median,
+           times[0], times[runs - 1]);
+    fflush(stdout);
+  }
+  free(times);
+  lua_close(L);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+-- Compare two outputs of the benchmark suite (run.lua and cbench).
+-- usage: lua compare.lua old new [threshold]
+-- Prints, for each benchmark present in both files, the old and new
+-- median times and their ratio (new/old). Ratios above 1 + threshold
+-- (default 0.05) are marked as regressions, those below 1 - threshold
+-- as improvements. Exits with status 1 if there is any regression.
+
+local threshold = tonumber(arg[3]) or 0.05
+
+local function load (fname)
+  local res, order = {}, {}
+  for l in io.lines(fname) do
+    if l:sub(1, 1) ~= "#" then
+      local name, med = l:match("^([^\t]+)\t([^\t]+)")
+      if name then
+        if not res[name] then order[#order + 1] = name end
+        res[name] = tonumber(med)
+      end
+    end
+  end
+  return res, order
+end
+
+assert(arg[1] and arg[2], "usage: lua compare.lua old new [threshold]")
+local old = load(arg[1])
+local new, order = load(arg[2])
+local regressions = 0
+
+print("# name\told\tnew\tratio")
+for _, name in ipairs(order) do
+  local o, n = old[name], new[name]
+  if o then
+    local ratio = (o > 0) and n / o or 1
+    local mark = ""
+    if ratio > 1 + threshold then
+      mark = "\tslower"; regressions = regressions + 1
+    elseif ratio < 1 - threshold then
+      mark = "\tfaster"
+    end
+    print(string.format("%s\t%.4f\t%.4f\t%.3f%s", name, o, n, ratio, mark))
+  end
+end
+os.exit(regressions == 0 and 0 or 1)
@@ -0,0 +1,127 @@
+-- Micro benchmark for the specialized opcodes (GETFIELD, ADDI, LTI,
+-- EQK, ...) and their inline caches. Each case runs the same loop
+-- twice: once written so that the compiler must emit the generic
+-- opcode (operand in a register) and once in the form that gets the
+-- specialized opcode. Use 'luac -l' on this file to see which opcodes
+-- each loop uses.
+-- usage: lua opcodes.lua [iterations]
+
+local N = tonumber(arg and arg[1]) or 10000000
+local clock = os.clock
+
+local function time (f)
+  local t0 = clock()
+  f(N)
+  return clock() - t0
+end
+
+local cases = {}
+
+-- field access by constant short string: GETTABLE x GETFIELD
+cases[#cases + 1] = {"getfield",
+  function (n)
+    local t, k, s = {x = 1}, "x", 0
+    for i = 1, n do s = s + t[k] end
+    return s
+  end,
+  function (n)
+    local t, s = {x = 1}, 0
+    for i = 1, n do s = s + t.x end
+    return s
+  end}
+
+-- field assignment: SETTABLE x SETFIELD
+cases[#cases + 1] = {"setfield",
+  function (n)
+    local t, k = {x = 1}, "x"
+    for i = 1, n do t[k] = i end
+    return t.x
+  end,
+  function (n)
+    local t = {x = 1}
+    for i = 1, n do t.x = i end
+    return t.x
+  end}
+
+-- global access: GETTABUP x GETUPFIELD
+cases[#cases + 1] = {"getglobal",
+  function (n)
+    local k, s = "bench_g", 0
+    for i = 1, n do s = s + _ENV[k] end
+    return s
+  end,
+  function (n)
+    local s = 0
+    for i = 1, n do s = s + bench_g end
+    return s
+  end}
+bench_g = 1
+
+-- method call through a class table ('__index'): GETTABLE x SELF
+-- (the specialized form also uses the inline cache of the instruction)
+cases[#cases + 1] = {"self",
+  function (n)
+    local o, k, s = bench_obj, "get", 0
+    for i = 1, n do s = s + o[k](o) end
+    return s
+  end,
+  function (n)
+    local o, s = bench_obj, 0
+    for i = 1, n do s = s + o:get() end
+    return s
+  end}
+do
+  local C = {}
+  for i = 1, 50 do C["m" .. i] = i end  -- a crowded class
+  C.__index = C
+  function C.get (self) return self.v end
+  bench_obj = setmetatable({v = 1}, C)
+end
+
+-- addition of an integer constant: ADD x ADDI
+cases[#cases + 1] = {"addi",
+  function (n)
+    local x, one = 0, 1
+    for i = 1, n do x = x + one end
+    return x
+  end,
+  function (n)
+    local x = 0
+    for i = 1, n do x = x + 1 end
+    return x
+  end}
+
+-- order comparison with an integer constant: LT x LTI
+cases[#cases + 1] = {"lti",
+  function (n)
+    local c, lim = 0, 100
+    for i = 1, n do if (i & 255) < lim then c = c + 1 end end
+    return c
+  end,
+  function (n)
+    local c = 0
+    for i = 1, n do if (i & 255) < 100 then c = c + 1 end end
+    return c
+  end}
+
+-- equality with a constant: EQ x EQK
+cases[#cases + 1] = {"eqk",
+  function (n)
+    local c, s, k = 0, "b", "a"
+    for i = 1, n do if s == k then c = c + 1 end end
+    return c
+  end,
+  function (n)
+    local c, s = 0, "b"
+    for i = 1, n do if s == "a" then c = c + 1 end end
+    return c
+  end}
+
+print("case", "generic", "special", "speedup")
+for _, c in ipairs(cases) do
+  local name, generic, special = c[1], c[2], c[3]
+  assert(generic(1000) == special(1000))
+  local tg, ts = time(generic), time(special)
+  print(name, string.format("%.3f", tg), string.format("%.3f", ts),
+        string.format("%.2f", tg / ts))
+end
@@ -0,0 +1,59 @@
+-- Runner of the Lua benchmark suite.
+-- usage: lua run.lua [runs [scale [pattern]]]
+-- Runs each benchmark of suite.lua whose name matches 'pattern' 'runs'
+-- times and prints one tab-separated line per benchmark:
+--   name <TAB> median <TAB> min <TAB> max
+-- with times in seconds of CPU. Lines starting with '#' are comments
+-- describing the run, including benchmarks that this Lua cannot run;
+-- compare.lua compares two such outputs.
+-- To measure the JIT compiler, turn it on before the runner starts:
+--   lua -e 'require"jit".on()' run.lua
+
+local SUITE_VERSION = 1
+
+local runs = tonumber(arg[1]) or 5
+local scale = tonumber(arg[2]) or 1
+local pattern = arg[3] or ""
+
+local dir = arg[0]:match("^(.*[/\\])") or ""
+local suite = dofile(dir .. "suite.lua")
+
+local clock = os.clock
+
+local function measure (b)
+  local times = {}
+  local result
+  for i = 1, runs do
+    collectgarbage()
+    local t0 = clock()
+    local r = b.run(scale)
+    times[i] = clock() - t0
+    assert(result == nil or r == result, b.name .. ": unstable result")
+    result = r
+  end
+  table.sort(times)
+  local median
+  if runs % 2 == 1 then median = times[(runs + 1) // 2]
+  else median = (times[runs // 2] + times[runs // 2 + 1]) / 2
+  end
+  return median, times[1], times[runs]
+end
+
+io.write(string.format("# suite %d\t%s\truns %d\tscale %s\n",
+                       SUITE_VERSION, _VERSION, runs, scale))
+if package.preload.jit and require("jit").status() then
+  io.write("# jit on\n")
+end
+io.write("# name\tmedian\tmin\tmax\n")
+for _, b in ipairs(suite.benchmarks) do
+  if not b.name:find(pattern, 1, true) then
+    -- not selected
+  elseif not b.run then
+    io.write(string.format("# %s\tskipped (not supported)\n", b.name))
+  else
+    local med, min, max = measure(b)
+    io.write(string.format("%s\t%.4f\t%.4f\t%.4f\n", b.name, med, min, max))
+    io.flush()
+  end
+end
+suite.cleanup()
@@ -0,0 +1,456 @@
+-- Benchmarks of the Lua suite (see run.lua). Each entry is a name and a
+-- function that does a fixed amount of work, times 'scale'. Names are
+-- stable: change SUITE_VERSION in run.lua when the work of an existing
+-- entry changes, so that old results are not compared with new ones.
+-- Entries that need features of this distribution have no function
+-- when the Lua running the suite lacks them, so that the rest of the
+-- suite still runs on other Lua 5.3 implementations.
+
+local suite = {}
+
+local function add (name, f)
+  suite[#suite + 1] = {name = name, run = f}
+end
+
+
+-- {==================================================================
+-- VM (luaV_execute)
+-- ===================================================================
+
+add("vm.intarith", function (scale)
+  local x = 0
+  for i = 1, 5000000 * scale do
+    x = (x + i * 3 - (i >> 2)) & 0xffffff
+  end
+  return x
+end)
+
+add("vm.fltarith", function (scale)
+  local x = 0.0
+  for i = 1, 5000000 * scale do
+    x = x * 0.5 + i / 3.0
+  end
+  return x
+end)
+
+add("vm.calls", function (scale)
+  local function f (a, b) return a + b end
+  local x = 0
+  for i = 1, 2000000 * scale do x = f(x, i) end
+  return x
+end)
+
+add("vm.closures", function (scale)
+  local x = 0
+  for i = 1, 500000 * scale do
+    local f = function () return i end
+    x = x + f()
+  end
+  return x
+end)
+
+add("vm.methods", function (scale)
+  local C = {}
+  C.__index = C
+  function C:inc (d) self.n = self.n + d end
+  local o = setmetatable({n = 0}, C)
+  for i = 1, 2000000 * scale do o:inc(1) end
+  return o.n
+end)
+
+-- }==================================================================
+
+
+-- {==================================================================
+-- Tables (ltable.c)
+-- ===================================================================
+
+add("table.append", function (scale)
+  local n = 0
+  for _ = 1, 20 * scale do
+    local t = {}
+    for i = 1, 100000 do t[#t + 1] = i end
+    n = n + #t
+  end
+  return n
+end)
+
+add("table.hashinsert", function (scale)
+  local n = 0
+  for _ = 1, 10 * scale do
+    local t = {}
+    for i = 1, 100000 do t[i * 7919] = i end
+    n = n + t[7919]
+  end
+  return n
+end)
+
+add("table.strlookup", function (scale)
+  local keys = {}
+  for i = 1, 1000 do keys[i] = "key" .. i end
+  local t = {}
+  for i = 1, #keys do t[keys[i]] = i end
+  local s = 0
+  for _ = 1, 2000 * scale do
+    for i = 1, #keys do s = s + t[keys[i]] end
+  end
+  return s
+end)
+
+add("table.fields", function (scale)
+  local p = {x = 1, y = 2, z = 3}
+  local s = 0
+  for _ = 1, 3000000 * scale do
+    s = s + p.x + p.y + p.z
+  end
+  return s
+end)
+
+add("table.pairs", function (scale)
+  local t = {}
+  for i = 1, 10000 do t["k" .. i] = i end
+  local s = 0
+  for _ = 1, 200 * scale do
+    for _, v in pairs(t) do s = s + v end
+  end
+  return s
+end)
+
+add("table.sort", function (scale)
+  local n = 0
+  for r = 1, 5 * scale do
+    local t = {}
+    local x = r
+    for i = 1, 50000 do x = (x * 1103515245 + 12345) % 2^31; t[i] = x end
+    table.sort(t)
+    n = n + #t
+  end
+  return n
+end)
+
+-- }==================================================================
+
+
+-- {==================================================================
+-- Strings (lstring.c, lstrlib.c)
+-- ===================================================================
+
+add("string.intern", function (scale)
+  local n = 0
+  for i = 1, 1000000 * scale do
+    local s = "s" .. (i % 5000)
+    n = n + #s
+  end
+  return n
+end)
+
+add("string.words", function (scale)
+  -- interning of words of various lengths, as when parsing input
+  local words = {}
+  for i = 1, 2000 do
+    words[i] = string.rep(string.char(97 + i % 26), i % 37 + 1) .. i
+  end
+  local text = table.concat(words, " ")
+  local n = 0
+  for _ = 1, 200 * scale do
+    for w in string.gmatch(text, "%S+") do n = n + #w end
+  end
+  return n
+end)
+
+add("string.longkeys", function (scale)
+  -- long keys sharing most of their bytes (hashing and comparison of
+  -- long strings)
+  local prefix = string.rep("/usr/local/share/lua/5.3/", 4)
+  local keys = {}
+  for i = 1, 5000 do
+    keys[i] = prefix .. i .. string.rep("x", 40) .. ".lua"
+  end
+  local n = 0
+  for _ = 1, 10 * scale do
+    local t = {}
+    for i = 1, #keys do t[keys[i]] = i end
+    for i = 1, #keys do
+      n = n + t[prefix .. i .. string.rep("x", 40) .. ".lua"]
+    end
+  end
+  return n
+end)
+
+add("string.concat", function (scale)
+  local n = 0
+  for _ = 1, 200 * scale do
+    local s = ""
+    for i = 1, 500 do s = s .. "x" end
+    n = n + #s
+  end
+  return n
+end)
+
+add("string.append", function (scale)
+  local n = 0
+  for k = 1, scale do
+    local s = ""
+    for i = 1, 20000 do
+      s = s .. "item " .. i .. ";"
+    end
+    n = n + #s
+  end
+  return n
+end)
+
+add("string.buffer", string.buffer and function (scale)
+  local b = string.buffer()
+  local n = 0
+  for _ = 1, 20 * scale do
+    b:reset()
+    for i = 1, 20000 do b:put("item ", i, ";") end
+    b:putf("%d items\n", 20000)
+    n = n + #b:tostring()
+  end
+  return n
+end)
+
+add("string.tostring", function (scale)
+  local n = 0
+  for i = 1, 500000 * scale do
+    n = n + #tostring(i) + #tostring(i + 0.5)
+  end
+  return n
+end)
+
+add("string.numconv", function (scale)
+  local s = 0.0
+  for i = 1, 200000 * scale do
+    local x = i / 7 * 1.0001 ^ (i % 500)
+    s = s + tonumber(tostring(x)) + tonumber("0.25e-" .. i % 30)
+  end
+  return s
+end)
+
+add("string.format", function (scale)
+  local n = 0
+  for i = 1, 300000 * scale do
+    n = n + #string.format("%d: %s = %5.2f", i, "value", i / 7)
+  end
+  return n
+end)
+
+add("string.formatrow", function (scale)
+  local n = 0
+  for i = 1, 100000 * scale do
+    n = n + #string.format("%-12s %8d %10.2f %6.1f%% %x", "item", i, i / 3,
+                           i % 1000 / 10, i)
+  end
+  return n
+end)
+
+add("string.gsub", function (scale)
+  local text = string.rep("the quick brown fox jumps over the lazy dog ", 200)
+  local n = 0
+  for _ = 1, 100 * scale do
+    local s, c = string.gsub(text, "%w+", function (w) return w:upper() end)
+    n = n + c + #s
+  end
+  return n
+end)
+
+add("string.find", function (scale)
+  local text = string.rep("a", 1000) .. "needle" .. string.rep("b", 1000)
+  local n = 0
+  for _ = 1, 20000 * scale do
+    n = n + string.find(text, "ne+dle") + string.find(text, "needle", 1, true)
+  end
+  return n
+end)
+
+add("string.logparse", function (scale)
+  local lines = {}
+  for i = 1, 200 do
+    lines[i] = string.format("2016-05-%02d 12:%02d:%02d [%s] req=%d path=/a/b/%d ms=%d",
+      i % 28 + 1, i % 60, i * 7 % 60, i % 3 == 0 and "WARN" or "INFO",
+      i * 31, i, i % 97)
+  end
+  local log = table.concat(lines, "\n") .. "\n"
+  local n = 0
+  for _ = 1, 100 * scale do
+    for line in string.gmatch(log, "[^\n]*") do
+      local d, lvl, rest = string.match(line, "^(%d+%-%d+%-%d+) [%d:]+ %[(%u+)%] (.*)$")
+      if d then
+        for k, v in string.gmatch(rest, "(%w+)=(%S+)") do n = n + #k + #v end
+        n = n + #lvl
+      end
+    end
+    n = n + select(2, string.gsub(log, "ms=(%d+)", "ms=<%1>"))
+    n = n + select(2, string.gsub(log, "%s+", " "))
+  end
+  return n
+end)
+
+-- }==================================================================
+
+
+-- {==================================================================
+-- Garbage collector (lgc.c)
+-- ===================================================================
+
+add("gc.smalltables", function (scale)
+  local n = 0
+  for i = 1, 2000000 * scale do
+    local t = {i, i}
+    n = n + #t
+  end
+  return n
+end)
+
+add("gc.retained", function (scale)
+  local keep = {}
+  for i = 1, 500000 * scale do
+    keep[i % 50000 + 1] = {i}  -- a large, slowly changing live set
+  end
+  return #keep
+end)
+
+add("gc.strings", function (scale)
+  local n = 0
+  for i = 1, 300000 * scale do
+    n = n + #(string.rep("x", i % 100) .. i)
+  end
+  return n
+end)
+
+-- }==================================================================
+
+
+-- {==================================================================
+-- I/O (liolib.c)
+-- ===================================================================
+
+local tmpname
+
+local function tmpfile ()
+  if not tmpname then
+    tmpname = os.tmpname()
+    local f = assert(io.open(tmpname, "w"))
+    for i = 1, 100000 do
+      f:write("line ", i, " of the benchmark input file\n")
+    end
+    f:close()
+  end
+  return tmpname
+end
+
+add("io.lines", function (scale)
+  local name = tmpfile()
+  local n = 0
+  for _ = 1, 5 * scale do
+    for l in io.lines(name) do n = n + #l end
+  end
+  return n
+end)
+
+add("io.readall", function (scale)
+  local name = tmpfile()
+  local n = 0
+  for _ = 1, 20 * scale do
+    local f = assert(io.open(name))
+    n = n + #f:read("a")
+    f:close()
+  end
+  return n
+end)
+
+add("io.write", function (scale)
+  local name = os.tmpname()
+  local f = assert(io.open(name, "w"))
+  for i = 1, 300000 * scale do f:write(i, " ", i / 3, "\n") end
+  f:close()
+  os.remove(name)
+  return 0
+end)
+
+-- }==================================================================
+
+
+-- {==================================================================
+-- Macro benchmarks
+-- ===================================================================
+
+add("macro.binarytrees", function (scale)
+  local function bottomup (d)
+    if d == 0 then return {} end
+    d = d - 1
+    return {bottomup(d), bottomup(d)}
+  end
+  local function check (t)
+    if t[1] then return 1 + check(t[1]) + check(t[2]) end
+    return 1
+  end
+  local n = 0
+  for _ = 1, scale do
+    local long = bottomup(14)
+    for d = 4, 14, 2 do
+      for _ = 1, 2 ^ (14 - d) do n = n + check(bottomup(d)) end
+    end
+    n = n + check(long)
+  end
+  return n
+end)
+
+add("macro.nbody", function (scale)
+  local bodies = {}
+  for i = 1, 5 do
+    bodies[i] = {x = i, y = i * 2, z = -i, vx = 0, vy = 0, vz = 0,
+                 mass = 1 / i}
+  end
+  local nb = #bodies
+  for _ = 1, 100000 * scale do
+    for i = 1, nb do
+      local bi = bodies[i]
+      for j = i + 1, nb do
+        local bj = bodies[j]
+        local dx, dy, dz = bi.x - bj.x, bi.y - bj.y, bi.z - bj.z
+        local d2 = dx * dx + dy * dy + dz * dz
+        local mag = 0.01 / (d2 * math.sqrt(d2))
+        bi.vx = bi.vx - dx * bj.mass * mag
+        bj.vx = bj.vx + dx * bi.mass * mag
+        bi.vy = bi.vy - dy * bj.mass * mag
+        bj.vy = bj.vy + dy * bi.mass * mag
+        bi.vz = bi.vz - dz * bj.mass * mag
+        bj.vz = bj.vz + dz * bi.mass * mag
+      end
+    end
+    for i = 1, nb do
+      local b = bodies[i]
+      b.x, b.y, b.z = b.x + 0.01 * b.vx, b.y + 0.01 * b.vy, b.z + 0.01 * b.vz
+    end
+  end
+  return bodies[1].x
+end)
+
+add("macro.wordfreq", function (scale)
+  local words = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta"}
+  local parts = {}
+  for i = 1, 20000 do parts[i] = words[i % #words + 1] .. (i % 97) end
+  local text = table.concat(parts, " ")
+  local best
+  for _ = 1, 5 * scale do
+    local freq = {}
+    for w in text:gmatch("%a+%d*") do freq[w] = (freq[w] or 0) + 1 end
+    local list = {}
+    for w, c in pairs(freq) do list[#list + 1] = {w, c} end
+    table.sort(list, function (a, b) return a[2] > b[2] or
+                                            (a[2] == b[2] and a[1] < b[1]) end)
+    best = list[1][1]
+  end
+  return best
+end)
+
+-- }==================================================================
+
+
+local function cleanup ()
+  if tmpname then os.remove(tmpname) end
+end
+
+return {benchmarks = suite, cleanup = cleanup}
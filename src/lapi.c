@@ -385,6 +385,15 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
   }
   if (len != NULL)
     *len = vslen(o);
+#if defined(LUA_USE_STRBUILDER)
+  if (isbuilder(tsvalue(o))) {
+    const char *s;
+    lua_lock(L);  /* 'luaS_flatten' may need a new buffer */
+    s = luaS_flatten(L, tsvalue(o));
+    lua_unlock(L);
+    return s;
+  }
+#endif
   return svalue(o);
 }
 
@@ -826,6 +835,33 @@ LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
 }
 
 
+/*
+** Append the 'n' values on the top of the stack to the table at 'idx'
+** (as raw assignments to t[#t + 1], t[#t + 2], ...), growing its array
+** part once for all of them, and pop them.
+*/
+LUA_API void lua_rawappend (lua_State *L, int idx, int n) {
+  StkId o;
+  Table *t;
+  lua_Integer len;
+  int i;
+  lua_lock(L);
+  api_checknelems(L, n);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  t = hvalue(o);
+  len = luaH_getn(t);
+  luaH_reservearray(L, t, l_castS2U(len) + n);
+  for (i = 0; i < n; i++) {
+    TValue *v = L->top - n + i;
+    luaH_setint(L, t, len + 1 + i, v);
+    luaC_barrierback(L, t, v);
+  }
+  L->top -= n;
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
   StkId o;
   TValue k, *slot;
@@ -988,14 +1024,15 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
-LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
-                      const char *chunkname, const char *mode) {
-  ZIO z;
+/*
+** Parse the chunk from 'z' and, if it has upvalues, set the global
+** table as its first one
+*/
+static int load (lua_State *L, ZIO *z, const char *chunkname,
+                 const char *mode) {
   int status;
-  lua_lock(L);
   if (!chunkname) chunkname = "?";
-  luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname, mode);
+  status = luaD_protectedparser(L, z, chunkname, mode);
   if (status == LUA_OK) {  /* no errors? */
     LClosure *f = clLvalue(L->top - 1);  /* get newly created function */
     if (f->nupvalues >= 1) {  /* does it have an upvalue? */
@@ -1007,6 +1044,55 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
       luaC_upvalbarrier(L, f->upvals[0]);
     }
   }
+  return status;
+}
+
+
+LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname, const char *mode) {
+  ZIO z;
+  int status;
+  lua_lock(L);
+  luaZ_init(L, &z, reader, data);
+  status = load(L, &z, chunkname, mode);
+  lua_unlock(L);
+  return status;
+}
+
+
+/* reader for 'lua_loadmapped': the whole block at once */
+typedef struct MapReader {
+  const char *chunk;
+  size_t size;
+} MapReader;
+
+static const char *getmapped (lua_State *L, void *ud, size_t *size) {
+  MapReader *mr = (MapReader *)ud;
+  (void)L;
+  *size = mr->size;
+  mr->size = 0;
+  return (*size > 0) ? mr->chunk : NULL;
+}
+
+
+LUA_API int lua_loadmapped (lua_State *L, const char *chunk, size_t size,
+                            const char *chunkname, const char *mode,
+                            lua_Unmap unmap, void *ud) {
+  ZIO z;
+  MapReader mr;
+  int status;
+  lua_lock(L);
+  api_check(L, unmap != NULL, "invalid unmap function");
+  mr.chunk = chunk;
+  mr.size = size;
+  luaZ_init(L, &z, getmapped, &mr);
+  z.unmap = unmap;
+  z.ud = ud;
+  status = load(L, &z, chunkname, mode);
+  if (z.map != NULL)  /* some prototype uses the block? */
+    luaF_releasemapping(L, z.map);  /* drop reference from the loader */
+  else
+    (*unmap)(ud);  /* block not needed anymore */
   lua_unlock(L);
   return status;
 }
@@ -1019,7 +1105,7 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   api_checknelems(L, 1);
   o = L->top - 1;
   if (isLfunction(o))
-    status = luaU_dump(L, getproto(o), writer, data, strip);
+    status = luaU_dump(L, getproto(o), writer, data, strip, 0);
   else
     status = 1;
   lua_unlock(L);
@@ -1097,6 +1183,64 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: {
+      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {
+      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, KGC_INC);
+      break;
+    }
+    case LUA_GCSETMINORMUL: {
+      res = g->genminormul;
+      if (data < 1) data = 1;  /* avoid a null minor cycle */
+      g->genminormul = data;
+      break;
+    }
+    case LUA_GCSETMAJORMUL: {
+      res = g->genmajormul;
+      if (data < 1) data = 1;
+      g->genmajormul = data;
+      break;
+    }
+    default: res = -1;  /* invalid option */
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** JIT-compiler control function
+*/
+
+LUA_API int lua_jit (lua_State *L, int what, int data) {
+  int res = 0;
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  switch (what) {
+    case LUA_JITOFF: {
+      g->jiton = 0;
+      break;
+    }
+    case LUA_JITON: {
+      g->jiton = LUA_USE_JIT;  /* cannot turn on a JIT that is not there */
+      res = g->jiton;
+      break;
+    }
+    case LUA_JITISON: {
+      res = g->jiton;
+      break;
+    }
+    case LUA_JITSETHOT: {
+      res = g->jithot;
+      if (data < 1) data = 1;
+      g->jithot = data;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1136,6 +1280,25 @@ LUA_API int lua_next (lua_State *L, int idx) {
 }
 
 
+LUA_API int lua_nextcursor (lua_State *L, int idx, lua_Unsigned *cursor) {
+  StkId t;
+  unsigned int i;
+  int more;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  i = (*cursor <= UINT_MAX) ? cast(unsigned int, *cursor) : UINT_MAX;
+  more = luaH_nextcursor(L, hvalue(t), &i, L->top);
+  if (more) {
+    api_incr_top(L);
+    api_incr_top(L);
+    *cursor = i;
+  }
+  lua_unlock(L);
+  return more;
+}
+
+
 LUA_API void lua_concat (lua_State *L, int n) {
   lua_lock(L);
   api_checknelems(L, n);
@@ -1180,6 +1343,13 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
 }
 
 
+LUA_API void lua_reservestrings (lua_State *L, int n) {
+  lua_lock(L);
+  luaS_reserve(L, n);
+  lua_unlock(L);
+}
+
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
   lua_lock(L);
@@ -1292,6 +1462,7 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
   *up1 = *up2;
   (*up1)->refcount++;
   if (upisopen(*up1)) (*up1)->u.open.touched = 1;
+  if (isold(f1)) (*up1)->old = 1;  /* now used by an old closure */
   luaC_upvalbarrier(L, *up1);
 }
 
@@ -701,6 +701,61 @@ static int skipcomment (LoadF *lf, int *cp) {
 }
 
 
+/*
+** Binary chunks in regular files are loaded from a read-only mapping of
+** the file, so that the code of their functions is shared with the
+** page cache instead of copied (see 'lua_loadmapped'). 'loadmapped'
+** returns false if the file cannot be mapped; otherwise, it loads the
+** chunk, whose first character was just read from 'f', and sets
+** '*status' to the result.
+*/
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct MappedF {
+  void *base;
+  size_t size;
+} MappedF;
+
+
+static void unmapF (void *ud) {
+  MappedF *mf = (MappedF *)ud;
+  munmap(mf->base, mf->size);
+  free(mf);
+}
+
+
+static int loadmapped (lua_State *L, FILE *f, const char *chunkname,
+                       const char *mode, int *status) {
+  struct stat st;
+  long pos = ftell(f) - 1;  /* start of the chunk */
+  MappedF *mf;
+  if (pos < 0 || fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size <= pos || (off_t)(size_t)st.st_size != st.st_size)
+    return 0;
+  mf = (MappedF *)malloc(sizeof(MappedF));
+  if (mf == NULL) return 0;
+  mf->size = (size_t)st.st_size;
+  mf->base = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (mf->base == MAP_FAILED) {
+    free(mf);
+    return 0;
+  }
+  *status = lua_loadmapped(L, (const char *)mf->base + pos, mf->size - pos,
+                           chunkname, mode, unmapF, mf);
+  return 1;
+}
+
+#else				/* }{ */
+
+/* ISO C cannot map files */
+#define loadmapped(L,f,n,m,s)	((void)(L), (void)(f), 0)
+
+#endif				/* } */
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
@@ -722,6 +777,12 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
     lf.f = freopen(filename, "rb", lf.f);  /* reopen in binary mode */
     if (lf.f == NULL) return errfile(L, "reopen", fnameindex);
     skipcomment(&lf, &c);  /* re-read initial portion */
+    if (c == LUA_SIGNATURE[0] &&
+        loadmapped(L, lf.f, lua_tostring(L, -1), mode, &status)) {
+      fclose(lf.f);
+      lua_remove(L, fnameindex);
+      return status;
+    }
   }
   if (c != EOF)
     lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
@@ -1022,6 +1083,251 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+
+/*
+** {======================================================
+** Pooled allocator
+** =======================================================
+*/
+
+/*
+** Blocks of up to LUAL_POOLMAXBLOCK bytes are rounded up to a multiple
+** of LUAL_POOLGRAIN and served from per-class free lists. These lists
+** are refilled a page at a time, and pages are never returned to the
+** system while the state lives. Larger blocks go to 'realloc'. Each
+** state owns its pool, so no locking is needed. All pages are released
+** together when the state is closed, that is, when its main block
+** (the first block allocated by 'lua_newstate') is freed. That block
+** always comes from 'malloc', whatever its size, so that it can be
+** freed on its own.
+**
+** Lua assumes that shrinking a block never fails, but moving a block to
+** a smaller class may need a new page. When none can be allocated, a
+** pooled block stays where it is (it is later freed into the list of
+** its new class, wasting its extra bytes), and a large block moves to a
+** free block of a larger class, taken if needed from a spare page kept
+** for that purpose. The spare page is refilled before the next
+** allocation that is allowed to fail.
+*/
+
+#if !defined(LUAL_POOLGRAIN)
+#define LUAL_POOLGRAIN		16
+#endif
+
+#if !defined(LUAL_POOLPAGESIZE)
+#define LUAL_POOLPAGESIZE	(16 * 1024)
+#endif
+
+#define POOLCLASSES	(LUAL_POOLMAXBLOCK / LUAL_POOLGRAIN)
+
+/* class of a block of size 's' (> 0); POOLCLASSES for large blocks */
+#define sizeclass(s)  \
+	((s) > LUAL_POOLMAXBLOCK ? POOLCLASSES : (int)(((s) - 1) / LUAL_POOLGRAIN))
+
+#define classsize(c)	(((size_t)(c) + 1) * LUAL_POOLGRAIN)
+
+
+/* a page; its blocks start at the first grain after the header */
+typedef struct PoolPage {
+  struct PoolPage *next;
+} PoolPage;
+
+/* a free block */
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+} PoolBlock;
+
+
+typedef struct Pool {
+  void *mainblock;  /* block of the main thread (NULL before creation) */
+  PoolPage *pages;  /* list of all pages */
+  void *spare;  /* page reserved for shrinking large blocks */
+  PoolBlock *free[POOLCLASSES];  /* free lists */
+  luaL_PoolStats stats[POOLCLASSES + 1];  /* last entry is for 'realloc' */
+} Pool;
+
+
+/*
+** Carve 'page' into blocks of class 'c'. Blocks are linked so that
+** they are handed out in address order.
+*/
+static void addpage (Pool *p, int c, char *page) {
+  size_t bsize = classsize(c);
+  size_t n = (LUAL_POOLPAGESIZE - LUAL_POOLGRAIN) / bsize;
+  char *b;
+  ((PoolPage *)page)->next = p->pages;
+  p->pages = (PoolPage *)page;
+  b = page + LUAL_POOLGRAIN + (n - 1) * bsize;  /* last block */
+  for (; n > 0; n--, b -= bsize) {
+    ((PoolBlock *)b)->next = p->free[c];
+    p->free[c] = (PoolBlock *)b;
+  }
+  p->stats[c].npages++;
+}
+
+
+static int newpage (Pool *p, int c) {
+  char *page = (char *)malloc(LUAL_POOLPAGESIZE);
+  if (page == NULL) return 0;
+  addpage(p, c, page);
+  return 1;
+}
+
+
+static void countalloc (luaL_PoolStats *st) {
+  st->nallocs++;
+  if (++st->inuse > st->peak) st->peak = st->inuse;
+}
+
+
+static void *poolget (Pool *p, int c) {
+  PoolBlock *b = p->free[c];
+  if (b == NULL) {
+    if (!newpage(p, c)) return NULL;
+    b = p->free[c];
+  }
+  p->free[c] = b->next;
+  countalloc(&p->stats[c]);
+  return b;
+}
+
+
+/*
+** Get a block for class 'c' when 'poolget' failed, to shrink a large
+** block: take a free block of a larger class, using the spare page if
+** there is none. The block is later freed as a block of class 'c'.
+*/
+static void *poolspare (Pool *p, int c) {
+  PoolBlock *b;
+  int k = c + 1;
+  while (k < POOLCLASSES && p->free[k] == NULL) k++;
+  if (k == POOLCLASSES) {  /* no larger free block? */
+    if (p->spare == NULL) return NULL;
+    k = POOLCLASSES - 1;  /* its blocks fit any class */
+    addpage(p, k, (char *)p->spare);
+    p->spare = NULL;
+  }
+  b = p->free[k];
+  p->free[k] = b->next;
+  countalloc(&p->stats[c]);
+  return b;
+}
+
+
+static void poolput (Pool *p, int c, void *block) {
+  PoolBlock *b = (PoolBlock *)block;
+  b->next = p->free[c];
+  p->free[c] = b;
+  p->stats[c].inuse--;
+}
+
+
+static void freepool (Pool *p) {
+  PoolPage *page = p->pages;
+  while (page != NULL) {
+    PoolPage *next = page->next;
+    free(page);
+    page = next;
+  }
+  free(p->spare);
+  free(p);
+}
+
+
+static void *pool_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  int oc = (ptr == NULL) ? -1 : sizeclass(osize);
+  int nc = (nsize == 0) ? -1 : sizeclass(nsize);
+  void *nptr;
+  if (nc == oc) {  /* same class? */
+    if (nc < POOLCLASSES) return ptr;  /* pooled block already fits */
+    return realloc(ptr, nsize);  /* large block ('nsize' is not 0 here) */
+  }
+  if (nc == -1) {  /* freeing a block? */
+    if (ptr == p->mainblock) {  /* closing the state? */
+      free(ptr);
+      freepool(p);
+    }
+    else if (oc < POOLCLASSES)
+      poolput(p, oc, ptr);
+    else {
+      free(ptr);
+      p->stats[POOLCLASSES].inuse--;
+    }
+    return NULL;
+  }
+  if (ptr != NULL && nsize < osize) {  /* shrinking? (cannot fail) */
+    if ((nptr = poolget(p, nc)) == NULL) {
+      if (oc < POOLCLASSES) {  /* keep block in place */
+        p->stats[oc].inuse--;
+        countalloc(&p->stats[nc]);
+        return ptr;
+      }
+      nptr = poolspare(p, nc);  /* NULL only if spare is still used */
+    }
+  }
+  else if (p->spare == NULL &&  /* spare page was used? */
+           (p->spare = malloc(LUAL_POOLPAGESIZE)) == NULL)
+    return NULL;  /* refill it first */
+  else if (nc < POOLCLASSES && p->mainblock != NULL)
+    nptr = poolget(p, nc);
+  else if ((nptr = malloc(nsize)) != NULL)  /* large or main block */
+    countalloc(&p->stats[POOLCLASSES]);
+  if (p->mainblock == NULL) {  /* creating the state? */
+    if (nptr == NULL) {  /* 'lua_newstate' will fail */
+      freepool(p);
+      return NULL;
+    }
+    p->mainblock = nptr;
+  }
+  if (nptr == NULL || ptr == NULL) return nptr;
+  memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+  pool_alloc(ud, ptr, osize, 0);  /* free old block */
+  return nptr;
+}
+
+
+/*
+** Create a new state whose memory comes from a private pool. Best
+** suited for many short-lived states in one process. The pool and all
+** its pages are released by 'lua_close'.
+*/
+LUALIB_API lua_State *luaL_newstate_pooled (void) {
+  lua_State *L;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(Pool));
+  if ((p->spare = malloc(LUAL_POOLPAGESIZE)) == NULL) {
+    free(p);
+    return NULL;
+  }
+  L = lua_newstate(pool_alloc, p);  /* frees 'p' in case of errors */
+  if (L) lua_atpanic(L, &panic);
+  return L;
+}
+
+
+/*
+** Get the statistics of class 'c' (0 <= c < n) of the pool of state
+** 'L', where 'n' is the value returned. The entry 'n - 1' counts the
+** large blocks handled by 'realloc'. Returns 0 if 'L' was not created
+** by 'luaL_newstate_pooled'.
+*/
+LUALIB_API int luaL_poolstats (lua_State *L, int c, luaL_PoolStats *st) {
+  void *ud;
+  Pool *p;
+  if (lua_getallocf(L, &ud) != pool_alloc) return 0;
+  p = (Pool *)ud;
+  if (st != NULL && 0 <= c && c <= POOLCLASSES) {
+    *st = p->stats[c];
+    st->size = (c < POOLCLASSES) ? classsize(c) : 0;
+  }
+  return POOLCLASSES + 1;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   const lua_Number *v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
@@ -82,6 +82,18 @@ LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_newstate_pooled) (void);
+
+/* usage statistics of one size class of a pooled state */
+typedef struct luaL_PoolStats {
+  size_t size;  /* block size of the class (0 for large blocks) */
+  size_t inuse;  /* blocks currently allocated */
+  size_t peak;  /* maximum value of 'inuse' */
+  size_t nallocs;  /* total number of allocations */
+  size_t npages;  /* pages owned by the class */
+} luaL_PoolStats;
+
+LUALIB_API int (luaL_poolstats) (lua_State *L, int c, luaL_PoolStats *st);
 
 LUALIB_API lua_Integer (luaL_len) (lua_State *L, int idx);
 
@@ -191,6 +203,33 @@ typedef struct luaL_Stream {
 
 
 
+/*
+** {======================================================
+** String buffers for string library
+** =======================================================
+*/
+
+/*
+** A string buffer is a userdata with metatable 'LUA_BUFFERHANDLE' and
+** structure 'luaL_StrBuffer'. Its contents are the bytes from 'b + r'
+** to 'b + n'; block 'b' is allocated with the allocation function of
+** the state.
+*/
+
+#define LUA_BUFFERHANDLE        "BUFFER*"
+
+
+typedef struct luaL_StrBuffer {
+  char *b;  /* block with the contents (NULL if 'size' is 0) */
+  size_t size;  /* size of block 'b' */
+  size_t r;  /* start of the contents (bytes before it were read) */
+  size_t n;  /* end of the contents */
+} luaL_StrBuffer;
+
+/* }====================================================== */
+
+
+
 /* compatibility with old module system */
 #if defined(LUA_COMPAT_MODULE)
 
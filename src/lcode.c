@@ -470,7 +470,7 @@ int luaK_stringK (FuncState *fs, TString *s) {
 */
 int luaK_intK (FuncState *fs, lua_Integer n) {
   TValue k, o;
-  setpvalue(&k, cast(void*, cast(size_t, n)));
+  setpvalue(&k, cast(void*, cast(size_t, l_castS2U(n))));
   setivalue(&o, n);
   return addk(fs, &k, &o);
 }
@@ -550,6 +550,15 @@ void luaK_setoneret (FuncState *fs, expdesc *e) {
 }
 
 
+/*
+** Check whether R/K index 'rk' is a constant short string (a key that
+** can use the specialized field-access opcodes).
+*/
+static int isKstr (FuncState *fs, int rk) {
+  return (ISK(rk) && ttisshrstring(&fs->f->k[INDEXK(rk)]));
+}
+
+
 /*
 ** Ensure that expression 'e' is not a variable.
 */
@@ -569,11 +578,12 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
       freereg(fs, e->u.ind.idx);
       if (e->u.ind.vt == VLOCAL) {  /* is 't' in a register? */
         freereg(fs, e->u.ind.t);
-        op = OP_GETTABLE;
+        op = isKstr(fs, e->u.ind.idx) ? OP_GETFIELD : OP_GETTABLE;
       }
       else {
         lua_assert(e->u.ind.vt == VUPVAL);
-        op = OP_GETTABUP;  /* 't' is in an upvalue */
+        /* 't' is in an upvalue */
+        op = isKstr(fs, e->u.ind.idx) ? OP_GETUPFIELD : OP_GETTABUP;
       }
       e->u.info = luaK_codeABC(fs, op, 0, e->u.ind.t, e->u.ind.idx);
       e->k = VRELOCABLE;
@@ -792,7 +802,10 @@ void luaK_storevar (FuncState *fs, expdesc *var, expdesc *ex) {
       break;
     }
     case VINDEXED: {
-      OpCode op = (var->u.ind.vt == VLOCAL) ? OP_SETTABLE : OP_SETTABUP;
+      int field = isKstr(fs, var->u.ind.idx);
+      OpCode op = (var->u.ind.vt == VLOCAL)
+                  ? (field ? OP_SETFIELD : OP_SETTABLE)
+                  : (field ? OP_SETUPFIELD : OP_SETTABUP);
       int e = luaK_exp2RK(fs, ex);
       luaK_codeABC(fs, op, var->u.ind.t, var->u.ind.idx, e);
       break;
@@ -1026,14 +1039,101 @@ static void codebinexpval (FuncState *fs, OpCode op,
 }
 
 
+/*
+** Check whether expression 'e' is an integer numeral that fits in an
+** 'sC' immediate; if so, return its value in '*pi'.
+*/
+static int isSCint (expdesc *e, int *pi) {
+  TValue v;
+  if (tonumeral(e, &v) && ttisinteger(&v) && fitssC(ivalue(&v))) {
+    *pi = cast_int(ivalue(&v));
+    return 1;
+  }
+  else return 0;
+}
+
+
+/*
+** Try to emit code for 'e1 + k' or 'e1 - k', with 'k' a small integer
+** numeral, using an opcode with an immediate operand. ('k + e1' is not
+** handled, as its metamethod must receive the operands in that order.)
+** Return true iff code was emitted; then 'e1' has the result.
+*/
+static int codearithimm (FuncState *fs, BinOpr opr,
+                         expdesc *e1, expdesc *e2, int line) {
+  int im;
+  if ((opr != OPR_ADD && opr != OPR_SUB) || e1->k != VNONRELOC ||
+      !isSCint(e2, &im))
+    return 0;
+  freeexp(fs, e1);
+  e1->u.info = luaK_codeABC(fs, (opr == OPR_ADD) ? OP_ADDI : OP_SUBI,
+                            0, e1->u.info, int2sC(im));
+  e1->k = VRELOCABLE;
+  luaK_fixline(fs, line);
+  return 1;
+}
+
+
+/*
+** Try to emit code for a comparison between a register and a constant
+** (an equality against any constant or an order against a small
+** integer). Order comparisons keep the operands in their original
+** order: '(k < x)' becomes '(x > k)', and so on, so that the opcode
+** can call the metamethod with the operands in the right order.
+** Return the position of the comparison or -1 if not possible.
+*/
+static int codecompk (FuncState *fs, BinOpr opr, expdesc *e1, expdesc *e2) {
+  int im;
+  if (opr == OPR_EQ || opr == OPR_NE) {
+    int rk1 = luaK_exp2RK(fs, e1);
+    int rk2 = luaK_exp2RK(fs, e2);
+    int cond = (opr == OPR_EQ);
+    if (ISK(rk1) == ISK(rk2))
+      return -1;  /* two registers or two constants */
+    freeexps(fs, e1, e2);
+    return ISK(rk2) ? condjump(fs, OP_EQK, cond, rk1, rk2)
+                    : condjump(fs, OP_EQK, cond, rk2, rk1);
+  }
+  else {
+    int r, inv;
+    OpCode op;
+    if (e1->k == VNONRELOC && isSCint(e2, &im)) {  /* 'x op k'? */
+      r = e1->u.info;
+      inv = 0;
+    }
+    else if (isSCint(e1, &im) && !tonumeral(e2, NULL)) {  /* 'k op x'? */
+      r = luaK_exp2anyreg(fs, e2);
+      inv = 1;  /* 'k < x' ==> 'x > k', etc. */
+    }
+    else
+      return -1;
+    switch (opr) {
+      case OPR_LT: op = inv ? OP_GTI : OP_LTI; break;
+      case OPR_LE: op = inv ? OP_GEI : OP_LEI; break;
+      case OPR_GT: op = inv ? OP_LTI : OP_GTI; break;
+      default: lua_assert(opr == OPR_GE); op = inv ? OP_LEI : OP_GEI; break;
+    }
+    freeexps(fs, e1, e2);
+    return condjump(fs, op, 1, r, int2sC(im));
+  }
+}
+
+
 /*
 ** Emit code for comparisons.
-** 'e1' was already put in R/K form by 'luaK_infix'.
+** 'e1' was already put in R/K form by 'luaK_infix', unless it is a
+** numeral.
 */
 static void codecomp (FuncState *fs, BinOpr opr, expdesc *e1, expdesc *e2) {
-  int rk1 = (e1->k == VK) ? RKASK(e1->u.info)
-                          : check_exp(e1->k == VNONRELOC, e1->u.info);
-  int rk2 = luaK_exp2RK(fs, e2);
+  int rk1, rk2;
+  int pc = codecompk(fs, opr, e1, e2);
+  if (pc >= 0) {  /* could use a specialized opcode? */
+    e1->u.info = pc;
+    e1->k = VJMP;
+    return;
+  }
+  rk1 = luaK_exp2RK(fs, e1);
+  rk2 = luaK_exp2RK(fs, e2);
   freeexps(fs, e1, e2);
   switch (opr) {
     case OPR_NE: {  /* '(a ~= b)' ==> 'not (a == b)' */
@@ -1103,6 +1203,12 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
       /* else keep numeral, which may be folded with 2nd operand */
       break;
     }
+    case OPR_LT: case OPR_LE: case OPR_GT: case OPR_GE: {
+      if (!tonumeral(v, NULL))
+        luaK_exp2RK(fs, v);
+      /* else keep numeral, which may be an immediate operand */
+      break;
+    }
     default: {
       luaK_exp2RK(fs, v);
       break;
@@ -1153,7 +1259,8 @@ void luaK_posfix (FuncState *fs, BinOpr op,
     case OPR_IDIV: case OPR_MOD: case OPR_POW:
     case OPR_BAND: case OPR_BOR: case OPR_BXOR:
     case OPR_SHL: case OPR_SHR: {
-      if (!constfolding(fs, op + LUA_OPADD, e1, e2))
+      if (!constfolding(fs, op + LUA_OPADD, e1, e2) &&
+          !codearithimm(fs, op, e1, e2, line))
         codebinexpval(fs, cast(OpCode, op + OP_ADD), e1, e2, line);
       break;
     }
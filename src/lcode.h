@@ -84,5 +84,8 @@ LUAI_FUNC void luaK_posfix (FuncState *fs, BinOpr op, expdesc *v1,
                             expdesc *v2, int line);
 LUAI_FUNC void luaK_setlist (FuncState *fs, int base, int nelems, int tostore);
 
+/* from lopt.c */
+LUAI_FUNC void luaK_optimize (FuncState *fs);
+
 
 #endif
@@ -435,11 +435,12 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
           return getobjname(p, pc, b, name);  /* get name for 'b' */
         break;
       }
-      case OP_GETTABUP:
-      case OP_GETTABLE: {
+      case OP_GETTABUP: case OP_GETUPFIELD:
+      case OP_GETTABLE: case OP_GETFIELD: {
         int k = GETARG_C(i);  /* key index */
         int t = GETARG_B(i);  /* table index */
-        const char *vn = (op == OP_GETTABLE)  /* name of indexed variable */
+        /* name of indexed variable */
+        const char *vn = (op == OP_GETTABLE || op == OP_GETFIELD)
                          ? luaF_getlocalname(p, t + 1, pc)
                          : upvalname(p, t);
         kname(p, pc, k, name);
@@ -490,11 +491,15 @@ static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
     }
     /* all other instructions can call only through metamethods */
     case OP_SELF: case OP_GETTABUP: case OP_GETTABLE:
+    case OP_GETFIELD: case OP_GETUPFIELD:
       tm = TM_INDEX;
       break;
     case OP_SETTABUP: case OP_SETTABLE:
+    case OP_SETFIELD: case OP_SETUPFIELD:
       tm = TM_NEWINDEX;
       break;
+    case OP_ADDI: tm = TM_ADD; break;
+    case OP_SUBI: tm = TM_SUB; break;
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
     case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND:
     case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: {
@@ -507,8 +512,8 @@ static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
     case OP_LEN: tm = TM_LEN; break;
     case OP_CONCAT: tm = TM_CONCAT; break;
     case OP_EQ: tm = TM_EQ; break;
-    case OP_LT: tm = TM_LT; break;
-    case OP_LE: tm = TM_LE; break;
+    case OP_LT: case OP_LTI: case OP_GTI: tm = TM_LT; break;
+    case OP_LE: case OP_LEI: case OP_GEI: tm = TM_LE; break;
     default: lua_assert(0);  /* other instructions cannot call a function */
   }
   *name = getstr(G(L)->tmname[tm]);
@@ -532,8 +537,8 @@ static int isinstack (CallInfo *ci, const TValue *o) {
 
 /*
 ** Checks whether value 'o' came from an upvalue. (That can only happen
-** with instructions OP_GETTABUP/OP_SETTABUP, which operate directly on
-** upvalues.)
+** with instructions OP_GETTABUP/OP_SETTABUP and their field variants,
+** which operate directly on upvalues.)
 */
 static const char *getupvalname (CallInfo *ci, const TValue *o,
                                  const char **name) {
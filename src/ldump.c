@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -24,7 +25,10 @@ typedef struct {
   lua_Writer writer;
   void *data;
   int strip;
+  int aligned;  /* pad vectors (LUAC_FORMATALIGNED)? */
+  int format;  /* format byte of the header */
   int status;
+  size_t offset;  /* bytes written so far */
 } DumpState;
 
 
@@ -43,6 +47,21 @@ static void DumpBlock (const void *b, size_t size, DumpState *D) {
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
   }
+  D->offset += size;
+}
+
+
+/*
+** In the aligned format, pad the output so that the next vector starts
+** at an offset multiple of 'align' (see LUAC_FORMATALIGNED)
+*/
+static void DumpAlign (size_t align, DumpState *D) {
+  if (D->aligned) {
+    static const char zeros[16] = {0};
+    size_t n = (align - D->offset % align) % align;
+    lua_assert(align <= sizeof(zeros));
+    DumpBlock(zeros, n, D);
+  }
 }
 
 
@@ -89,6 +108,7 @@ static void DumpString (const TString *s, DumpState *D) {
 
 static void DumpCode (const Proto *f, DumpState *D) {
   DumpInt(f->sizecode, D);
+  DumpAlign(sizeof(Instruction), D);
   DumpVector(f->code, f->sizecode, D);
 }
 
@@ -148,6 +168,7 @@ static void DumpDebug (const Proto *f, DumpState *D) {
   int i, n;
   n = (D->strip) ? 0 : f->sizelineinfo;
   DumpInt(n, D);
+  DumpAlign(sizeof(int), D);
   DumpVector(f->lineinfo, n, D);
   n = (D->strip) ? 0 : f->sizelocvars;
   DumpInt(n, D);
@@ -184,7 +205,7 @@ static void DumpFunction (const Proto *f, TString *psource, DumpState *D) {
 static void DumpHeader (DumpState *D) {
   DumpLiteral(LUA_SIGNATURE, D);
   DumpByte(LUAC_VERSION, D);
-  DumpByte(LUAC_FORMAT, D);
+  DumpByte(D->format, D);
   DumpLiteral(LUAC_DATA, D);
   DumpByte(sizeof(int), D);
   DumpByte(sizeof(size_t), D);
@@ -196,17 +217,36 @@ static void DumpHeader (DumpState *D) {
 }
 
 
+/*
+** Check whether 'f' and its nested functions use only the official
+** opcodes, so that any Lua 5.3 can run them
+*/
+static int stockcode (const Proto *f) {
+  int i;
+  for (i = 0; i < f->sizecode; i++)
+    if (GET_OPCODE(f->code[i]) > OP_EXTRAARG) return 0;
+  for (i = 0; i < f->sizep; i++)
+    if (!stockcode(f->p[i])) return 0;
+  return 1;
+}
+
+
 /*
 ** dump Lua function as precompiled chunk
 */
 int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
-              int strip) {
+              int strip, int aligned) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
+  D.aligned = aligned;
+  D.format = aligned ? LUAC_FORMATALIGNED : LUAC_FORMAT;
+  if (!stockcode(f))
+    D.format |= LUAC_FORMATEXT;
   D.status = 0;
+  D.offset = 0;
   DumpHeader(&D);
   DumpByte(f->sizeupvalues, &D);
   DumpFunction(f, NULL, &D);
@@ -16,8 +16,10 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -47,6 +49,7 @@ void luaF_initupvals (lua_State *L, LClosure *cl) {
   for (i = 0; i < cl->nupvalues; i++) {
     UpVal *uv = luaM_new(L, UpVal);
     uv->refcount = 1;
+    uv->old = 0;
     uv->v = &uv->u.value;  /* make it closed */
     setnilvalue(uv->v);
     cl->upvals[i] = uv;
@@ -68,6 +71,7 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
   /* not found: create a new upvalue */
   uv = luaM_new(L, UpVal);
   uv->refcount = 0;
+  uv->old = 0;
   uv->u.open.next = *pp;  /* link it to list of open upvalues */
   uv->u.open.touched = 1;
   *pp = uv;
@@ -105,7 +109,13 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->map = NULL;
+  f->mapped = 0;
+  f->jit = NULL;
+  f->hotcount = G(L)->jithot;
   f->sizecode = 0;
+  f->icache = NULL;
+  f->sizeicache = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
   f->upvalues = NULL;
@@ -122,13 +132,64 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** Create the inline caches of a prototype, once its code is complete.
+** Each field access with a constant short-string key keeps, in its
+** entry, the index of the node where the key was last found (see
+** 'luaH_getshortstrcached'). Prototypes without such accesses get no
+** caches at all.
+*/
+void luaF_newicache (lua_State *L, Proto *f) {
+  int pc;
+  lua_assert(f->icache == NULL);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    switch (GET_OPCODE(f->code[pc])) {
+      case OP_GETFIELD: case OP_GETUPFIELD: case OP_SETFIELD:
+      case OP_SETUPFIELD: case OP_SELF: {
+        int i;
+        f->icache = luaM_newvector(L, f->sizecode, unsigned int);
+        f->sizeicache = f->sizecode;
+        for (i = 0; i < f->sizeicache; i++)
+          f->icache[i] = 0;
+        return;
+      }
+      default: break;
+    }
+  }
+}
+
+
+Mapping *luaF_newmapping (lua_State *L, lua_Unmap unmap, void *ud) {
+  Mapping *m = luaM_new(L, Mapping);
+  m->unmap = unmap;
+  m->ud = ud;
+  m->refs = 1;
+  return m;
+}
+
+
+void luaF_releasemapping (lua_State *L, Mapping *m) {
+  lua_assert(m->refs > 0);
+  if (--m->refs == 0) {
+    (*m->unmap)(m->ud);
+    luaM_free(L, m);
+  }
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  if (!(f->mapped & MAPCODE))
+    luaM_freearray(L, f->code, f->sizecode);
+  luaM_freearray(L, f->icache, f->sizeicache);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+  if (!(f->mapped & MAPLINEINFO))
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  if (f->map != NULL)
+    luaF_releasemapping(L, f->map);
+  luaJ_free(L, f);
   luaM_free(L, f);
 }
 
@@ -29,12 +29,31 @@
 #define MAXUPVAL	255
 
 
+/*
+** A block of memory holding a binary chunk that can outlive its load
+** (see 'lua_loadmapped'). Prototypes loaded from it may keep their code
+** and line information in the block instead of copying them; the block
+** is released when the last of them is freed.
+*/
+typedef struct Mapping {
+  lua_Unmap unmap;  /* function to release the block */
+  void *ud;  /* argument to 'unmap' */
+  int refs;  /* prototypes using the block (+1 while loading) */
+} Mapping;
+
+
+/* bits in 'Proto.mapped' */
+#define MAPCODE		1	/* 'code' lives in 'map' */
+#define MAPLINEINFO	2	/* 'lineinfo' lives in 'map' */
+
+
 /*
 ** Upvalues for Lua closures
 */
 struct UpVal {
   TValue *v;  /* points to stack or to its own value */
   lu_mem refcount;  /* reference counter */
+  lu_byte old;  /* true if it may be used by an old closure (gen. mode) */
   union {
     struct {  /* (when open) */
       UpVal *next;  /* linked list */
@@ -53,6 +72,9 @@ LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nelems);
 LUAI_FUNC void luaF_initupvals (lua_State *L, LClosure *cl);
 LUAI_FUNC UpVal *luaF_findupval (lua_State *L, StkId level);
 LUAI_FUNC void luaF_close (lua_State *L, StkId level);
+LUAI_FUNC void luaF_newicache (lua_State *L, Proto *f);
+LUAI_FUNC Mapping *luaF_newmapping (lua_State *L, lua_Unmap unmap, void *ud);
+LUAI_FUNC void luaF_releasemapping (lua_State *L, Mapping *m);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
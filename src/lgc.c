@@ -67,9 +67,15 @@
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
+/* mask to erase all GC bits (colors and age) */
+#define maskgcbits	(maskcolors & ~AGEBITS)
+
 #define white2gray(x)	resetbits(x->marked, WHITEBITS)
 #define black2gray(x)	resetbit(x->marked, BLACKBIT)
 
+/* make an object gray, whatever its current color */
+#define set2gray(x)	resetbits(x->marked, WHITEBITS | bitmask(BLACKBIT))
+
 
 #define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
 
@@ -107,12 +113,74 @@ static void reallymarkobject (global_State *g, GCObject *o);
 #define gnodelast(h)	gnode(h, cast(size_t, sizenode(h)))
 
 
+/*
+** A table may have two hash parts: 'node' and, while it is growing
+** incrementally, 'oldnode' (see 'ltable.c'). Part 'p' spans from
+** 'firstnode(h,p)' up to (but not including) 'lastnode(h,p)'.
+*/
+#if defined(LUA_USE_INCRHASH)
+#define nodeparts(h)	((h)->oldnode != NULL ? 2 : 1)
+#define firstnode(h,p)	((p) == 0 ? gnode(h, 0) : (h)->oldnode)
+#define lastnode(h,p)  \
+	((p) == 0 ? gnodelast(h) : (h)->oldnode + twoto((h)->oldlsize))
+#define oldnodesize(h)	\
+	((h)->oldnode != NULL ? cast(size_t, twoto((h)->oldlsize)) : 0)
+#else
+#define nodeparts(h)	1
+#define firstnode(h,p)	gnode(h, 0)
+#define lastnode(h,p)	gnodelast(h)
+#define oldnodesize(h)	0
+#endif
+
+
 /*
 ** link collectable object 'o' into list pointed by 'p'
 */
 #define linkgclist(o,p)	((o)->gclist = (p), (p) = obj2gco(o))
 
 
+/*
+** Return the address of field 'gclist' of an object that can be
+** in a gray list.
+*/
+static GCObject **getgclist (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: return &gco2t(o)->gclist;
+    case LUA_TLCL: return &gco2lcl(o)->gclist;
+    case LUA_TCCL: return &gco2ccl(o)->gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+/*
+** Flag all upvalues of an old Lua closure. Upvalues are not collectable
+** objects, so they have no age of their own; a closure that gets old
+** is not traversed by young collections anymore, so any new value
+** assigned to one of its upvalues must be made old too (see
+** 'luaC_upvalbarrier_').
+*/
+static void oldupvals (LClosure *cl) {
+  int i;
+  for (i = 0; i < cl->nupvalues; i++) {
+    if (cl->upvals[i] != NULL)
+      cl->upvals[i]->old = 1;
+  }
+}
+
+
+/*
+** Make a marked object old in the current cycle (generational mode).
+*/
+static void setold0 (GCObject *o) {
+  setage(o, G_OLD0);
+  if (o->tt == LUA_TLCL)
+    oldupvals(gco2lcl(o));
+}
+
+
 /*
 ** If key is not marked, mark its entry as dead. This allows key to be
 ** collected, but keeps its entry in the table.  A dead node is needed
@@ -155,24 +223,35 @@ static int iscleared (global_State *g, const TValue *o) {
 void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
-  if (keepinvariant(g))  /* must keep invariant? */
+  if (keepinvariant(g)) {  /* must keep invariant? */
     reallymarkobject(g, v);  /* restore invariant */
+    if (isold(o)) {
+      lua_assert(!isold(v));  /* white object could not be old */
+      setold0(v);  /* restore generational invariant */
+    }
+  }
   else {  /* sweep phase */
     lua_assert(issweepphase(g));
-    makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
+    if (g->gckind == KGC_INC)  /* incremental mode? */
+      makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
   }
 }
 
 
 /*
 ** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** pointing to a white object as gray again. (In generational mode, the
+** table also becomes "touched", so that it is visited by the next two
+** young collections.)
 */
 void luaC_barrierback_ (lua_State *L, Table *t) {
   global_State *g = G(L);
   lua_assert(isblack(t) && !isdead(g, t));
   black2gray(t);  /* make table gray (again) */
-  linkgclist(t, g->grayagain);
+  if (getage(t) != G_TOUCHED2)  /* not already in a gray list? */
+    linkgclist(t, g->grayagain);
+  if (isold(t))  /* generational mode? */
+    setage(t, G_TOUCHED1);  /* touched in current cycle */
 }
 
 
@@ -180,14 +259,18 @@ void luaC_barrierback_ (lua_State *L, Table *t) {
 ** barrier for assignments to closed upvalues. Because upvalues are
 ** shared among closures, it is impossible to know the color of all
 ** closures pointing to it. So, we assume that the object being assigned
-** must be marked.
+** must be marked. In generational mode, if the upvalue may be used by
+** an old closure, the object must also become old.
 */
 void luaC_upvalbarrier_ (lua_State *L, UpVal *uv) {
   global_State *g = G(L);
   GCObject *o = gcvalue(uv->v);
   lua_assert(!upisopen(uv));  /* ensured by macro luaC_upvalbarrier */
-  if (keepinvariant(g))
+  if (keepinvariant(g)) {
     markobject(g, o);
+    if (uv->old && g->gckind == KGC_GEN && !isold(o))
+      setold0(o);
+  }
 }
 
 
@@ -195,6 +278,7 @@ void luaC_fix (lua_State *L, GCObject *o) {
   global_State *g = G(L);
   lua_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
   white2gray(o);  /* they will be gray forever */
+  setage(o, G_OLD);  /* and old forever */
   g->allgc = o->next;  /* remove object from 'allgc' list */
   o->next = g->fixedgc;  /* link it to 'fixedgc' list */
   g->fixedgc = o;
@@ -230,11 +314,13 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 ** mark an object. Userdata, strings, and closed upvalues are visited
 ** and turned black here. Other objects are marked gray and added
 ** to appropriate list to be visited (and turned black) later. (Open
-** upvalues are already linked in 'headuv' list.)
+** upvalues are already linked in 'headuv' list.) In generational mode,
+** this function is also called over black OLD1 objects, to visit them
+** again.
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
  reentry:
-  white2gray(o);
+  set2gray(o);
   switch (o->tt) {
     case LUA_TSHRSTR: {
       gray2black(o);
@@ -243,7 +329,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
     }
     case LUA_TLNGSTR: {
       gray2black(o);
-      g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+      g->GCmemtrav += sizelngstr(gco2ts(o));
       break;
     }
     case LUA_TUSERDATA: {
@@ -325,18 +411,29 @@ static void remarkupvals (global_State *g) {
           markvalue(g, uv->v);  /* remark upvalue's value */
           uv->u.open.touched = 0;
         }
+        if (uv->old && g->gckind == KGC_GEN && iscollectable(uv->v)) {
+          /* thread may die now, leaving the value only in an old closure */
+          GCObject *o = gcvalue(uv->v);
+          markobject(g, o);
+          if (!isold(o)) setold0(o);
+        }
       }
     }
   }
 }
 
 
+static void cleargraylists (global_State *g) {
+  g->gray = g->grayagain = NULL;
+  g->weak = g->allweak = g->ephemeron = NULL;
+}
+
+
 /*
 ** mark root set and reset all gray lists, to start a new collection
 */
 static void restartcollection (global_State *g) {
-  g->gray = g->grayagain = NULL;
-  g->weak = g->allweak = g->ephemeron = NULL;
+  cleargraylists(g);
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
@@ -352,32 +449,57 @@ static void restartcollection (global_State *g) {
 ** =======================================================
 */
 
+/*
+** In generational mode, a table touched by a barrier in the current
+** cycle must stay in 'grayagain', to be visited again by the next young
+** collection (its new references are still young). A table touched in
+** the previous cycle becomes a regular old object.
+*/
+static void genlink (global_State *g, Table *h) {
+  lua_assert(isblack(h));
+  if (getage(h) == G_TOUCHED1) {  /* touched in this cycle? */
+    black2gray(h);
+    linkgclist(h, g->grayagain);  /* link it back in 'grayagain' */
+  }  /* everything else do not need to be linked back */
+  else if (getage(h) == G_TOUCHED2)
+    changeage(h, G_TOUCHED2, G_OLD);  /* advance age */
+}
+
+
 /*
 ** Traverse a table with weak values and link it to proper list. During
 ** propagate phase, keep it in 'grayagain' list, to be revisited in the
 ** atomic phase. In the atomic phase, if table has any white value,
-** put it in 'weak' list, to be cleared.
+** put it in 'weak' list, to be cleared; otherwise keep it in
+** 'grayagain' (so that generational mode can see it).
 */
 static void traverseweakvalue (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int p;
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
-  int hasclears = (h->sizearray > 0);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    checkdeadkey(n);
-    if (ttisnil(gval(n)))  /* entry is empty? */
-      removeentry(n);  /* remove it */
-    else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
-      if (!hasclears && iscleared(g, gval(n)))  /* is there a white value? */
-        hasclears = 1;  /* table will have to be cleared */
+  int hasclears = (sizeboxed(h) > 0);
+#if defined(LUA_USE_SHAPES)
+  if (numslots(h) > 0)  /* same for slots */
+    hasclears = 1;
+#endif
+  for (p = 0; p < nodeparts(h); p++) {  /* traverse hash part(s) */
+    for (n = firstnode(h, p), limit = lastnode(h, p); n < limit; n++) {
+      checkdeadkey(n);
+      if (ttisnil(gval(n)))  /* entry is empty? */
+        removeentry(n);  /* remove it */
+      else {
+        lua_assert(!ttisnil(gkey(n)));
+        markvalue(g, gkey(n));  /* mark key */
+        if (!hasclears && iscleared(g, gval(n)))  /* a white value? */
+          hasclears = 1;  /* table will have to be cleared */
+      }
     }
   }
-  if (g->gcstate == GCSpropagate)
-    linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
-  else if (hasclears)
+  if (g->gcstate == GCSinsideatomic && hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else
+    linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
 }
 
 
@@ -395,28 +517,39 @@ static int traverseephemeron (global_State *g, Table *h) {
   int marked = 0;  /* true if an object is marked in this traversal */
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int p;
   unsigned int i;
   /* traverse array part */
-  for (i = 0; i < h->sizearray; i++) {
+  for (i = 0; i < sizeboxed(h); i++) {
     if (valiswhite(&h->array[i])) {
       marked = 1;
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
-  /* traverse hash part */
-  for (n = gnode(h, 0); n < limit; n++) {
-    checkdeadkey(n);
-    if (ttisnil(gval(n)))  /* entry is empty? */
-      removeentry(n);  /* remove it */
-    else if (iscleared(g, gkey(n))) {  /* key is not marked (yet)? */
-      hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
-        hasww = 1;  /* white-white entry */
-    }
-    else if (valiswhite(gval(n))) {  /* value not marked yet? */
+#if defined(LUA_USE_SHAPES)
+  for (i = 0; i < cast(unsigned int, numslots(h)); i++) {  /* slots */
+    if (valiswhite(&h->slots[i])) {  /* (their keys are strings) */
       marked = 1;
-      reallymarkobject(g, gcvalue(gval(n)));  /* mark it now */
+      reallymarkobject(g, gcvalue(&h->slots[i]));
+    }
+  }
+#endif
+  /* traverse hash part(s) */
+  for (p = 0; p < nodeparts(h); p++) {
+    for (n = firstnode(h, p), limit = lastnode(h, p); n < limit; n++) {
+      checkdeadkey(n);
+      if (ttisnil(gval(n)))  /* entry is empty? */
+        removeentry(n);  /* remove it */
+      else if (iscleared(g, gkey(n))) {  /* key is not marked (yet)? */
+        hasclears = 1;  /* table must be cleared */
+        if (valiswhite(gval(n)))  /* value not marked yet? */
+          hasww = 1;  /* white-white entry */
+      }
+      else if (valiswhite(gval(n))) {  /* value not marked yet? */
+        marked = 1;
+        reallymarkobject(g, gcvalue(gval(n)));  /* mark it now */
+      }
     }
   }
   /* link table into proper list */
@@ -426,35 +559,71 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else
+    linkgclist(h, g->grayagain);  /* keep it in some gray list */
   return marked;
 }
 
 
 static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int p;
   unsigned int i;
-  for (i = 0; i < h->sizearray; i++)  /* traverse array part */
+  for (i = 0; i < sizeboxed(h); i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    checkdeadkey(n);
-    if (ttisnil(gval(n)))  /* entry is empty? */
-      removeentry(n);  /* remove it */
-    else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
-      markvalue(g, gval(n));  /* mark value */
+#if defined(LUA_USE_SHAPES)
+  for (i = 0; i < cast(unsigned int, numslots(h)); i++)  /* slots */
+    markvalue(g, &h->slots[i]);
+#endif
+  for (p = 0; p < nodeparts(h); p++) {  /* traverse hash part(s) */
+    for (n = firstnode(h, p), limit = lastnode(h, p); n < limit; n++) {
+      checkdeadkey(n);
+      if (ttisnil(gval(n)))  /* entry is empty? */
+        removeentry(n);  /* remove it */
+      else {
+        lua_assert(!ttisnil(gkey(n)));
+        markvalue(g, gkey(n));  /* mark key */
+        markvalue(g, gval(n));  /* mark value */
+      }
     }
   }
+  genlink(g, h);
 }
 
 
+#if defined(LUA_USE_STRBUILDER)
+
+/*
+** Search char 'c' in weak mode 'mode', as 'strchr' would do; a builder
+** string may be followed by other bytes in its buffer.
+*/
+static const char *modechr (const TValue *mode, int c) {
+  const char *s = svalue(mode);
+  const char *p = cast(const char *, memchr(s, c, vslen(mode)));
+  return (p != NULL && memchr(s, '\0', p - s) == NULL) ? p : NULL;
+}
+
+#else
+
+#define modechr(mode,c)		strchr(svalue(mode), c)
+
+#endif
+
+
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   markobjectN(g, h->metatable);
+#if defined(LUA_USE_SHAPES)
+  {  /* mark keys of slots (strings, which are never weak) */
+    int i;
+    for (i = 0; i < numslots(h); i++)
+      markobject(g, h->shape->keys[i]);
+  }
+#endif
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
-      ((weakkey = strchr(svalue(mode), 'k')),
-       (weakvalue = strchr(svalue(mode), 'v')),
+      ((weakkey = modechr(mode, 'k')),
+       (weakvalue = modechr(mode, 'v')),
        (weakkey || weakvalue))) {  /* is really weak? */
     black2gray(h);  /* keep table gray */
     if (!weakkey)  /* strong keys? */
@@ -467,7 +636,11 @@ static lu_mem traversetable (global_State *g, Table *h) {
   else  /* not weak */
     traversestrongtable(g, h);
   return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, sizenode(h));
+#if defined(LUA_USE_SHAPES)
+                         sizeof(TValue) * numslots(h) +
+#endif
+                         sizeof(Node) * (cast(size_t, sizenode(h)) +
+                                         oldnodesize(h));
 }
 
 
@@ -490,6 +663,7 @@ static int traverseproto (global_State *g, Proto *f) {
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                         sizeof(unsigned int) * f->sizeicache +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
@@ -545,7 +719,7 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
       g->twups = th;
     }
   }
-  else if (g->gckind != KGC_EMERGENCY)
+  else if (!g->gcemergency)
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
   return (sizeof(lua_State) + sizeof(TValue) * th->stacksize +
           sizeof(CallInfo) * th->nci);
@@ -554,12 +728,13 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
 
 /*
 ** traverse one gray object, turning it to black (except for threads,
-** which are always gray).
+** which are always gray). (In generational mode, 'grayagain' may also
+** contain black TOUCHED2 tables.)
 */
 static void propagatemark (global_State *g) {
   lu_mem size;
   GCObject *o = g->gray;
-  lua_assert(isgray(o));
+  lua_assert(!iswhite(o));
   gray2black(o);
   switch (o->tt) {
     case LUA_TTABLE: {
@@ -639,11 +814,14 @@ static void convergeephemerons (global_State *g) {
 static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* and remove entry from table */
+    Node *n, *limit;
+    int p;
+    for (p = 0; p < nodeparts(h); p++) {
+      for (n = firstnode(h, p), limit = lastnode(h, p); n < limit; n++) {
+        if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
+          setnilvalue(gval(n));  /* remove value ... */
+          removeentry(n);  /* and remove entry from table */
+        }
       }
     }
   }
@@ -657,17 +835,27 @@ static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
 static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
+    Node *n, *limit;
+    int p;
     unsigned int i;
-    for (i = 0; i < h->sizearray; i++) {
+    for (i = 0; i < sizeboxed(h); i++) {
       TValue *o = &h->array[i];
       if (iscleared(g, o))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* and remove entry from table */
+#if defined(LUA_USE_SHAPES)
+    for (i = 0; i < cast(unsigned int, numslots(h)); i++) {
+      TValue *o = &h->slots[i];
+      if (iscleared(g, o))  /* value was collected? */
+        setnilvalue(o);  /* remove value (key stays in the shape) */
+    }
+#endif
+    for (p = 0; p < nodeparts(h); p++) {
+      for (n = firstnode(h, p), limit = lastnode(h, p); n < limit; n++) {
+        if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
+          setnilvalue(gval(n));  /* remove value ... */
+          removeentry(n);  /* and remove entry from table */
+        }
       }
     }
   }
@@ -712,7 +900,11 @@ static void freeobj (lua_State *L, GCObject *o) {
       luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
       break;
     case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
+#if defined(LUA_USE_STRBUILDER)
+      if (isbuilder(gco2ts(o)))
+        luaS_freebuffer(L, sbuffer(gco2ts(o)));
+#endif
+      luaM_freemem(L, o, sizelngstr(gco2ts(o)));
       break;
     }
     default: lua_assert(0);
@@ -775,9 +967,10 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 ** If possible, shrink string table
 */
 static void checkSizes (lua_State *L, global_State *g) {
-  if (g->gckind != KGC_EMERGENCY) {
+  if (!g->gcemergency) {
     l_mem olddebt = g->GCdebt;
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
+    if (g->strt.nuse < g->strt.size / 4 &&  /* string table too big? */
+        g->strt.oldsize == g->strt.size)  /* and not being resized? */
       luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
   }
@@ -793,6 +986,8 @@ static GCObject *udata2finalize (global_State *g) {
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
+  else if (getage(o) == G_OLD1)
+    g->firstold1 = o;  /* it is the first OLD1 object in the list */
   return o;
 }
 
@@ -824,7 +1019,7 @@ static void GCTM (lua_State *L, int propagateerrors) {
     if (status != LUA_OK && propagateerrors) {  /* error while running __gc? */
       if (status == LUA_ERRRUN) {  /* is there an error object? */
         const char *msg = (ttisstring(L->top - 1))
-                            ? svalue(L->top - 1)
+                            ? getcstr(L, tsvalue(L->top - 1))
                             : "no message";
         luaO_pushfstring(L, "error in __gc metamethod (%s)", msg);
         status = LUA_ERRGCMM;  /* error in __gc metamethod */
@@ -872,17 +1067,21 @@ static GCObject **findlast (GCObject **p) {
 
 /*
 ** move all unreachable objects (or 'all' objects) that need
-** finalization from list 'finobj' to list 'tobefnz' (to be finalized)
+** finalization from list 'finobj' to list 'tobefnz' (to be finalized).
+** (In generational mode, old objects cannot be unreachable in a young
+** collection, so the traversal stops at 'finobjold1'.)
 */
 static void separatetobefnz (global_State *g, int all) {
   GCObject *curr;
   GCObject **p = &g->finobj;
   GCObject **lastnext = findlast(&g->tobefnz);
-  while ((curr = *p) != NULL) {  /* traverse all finalizable objects */
+  while ((curr = *p) != g->finobjold1) {  /* traverse finalizable objects */
     lua_assert(tofinalize(curr));
     if (!(iswhite(curr) || all))  /* not being collected? */
       p = &curr->next;  /* don't bother with it */
     else {
+      if (curr == g->finobjsur)  /* removing 'finobjsur'? */
+        g->finobjsur = curr->next;  /* correct it */
       *p = curr->next;  /* remove 'curr' from 'finobj' list */
       curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
       *lastnext = curr;
@@ -892,6 +1091,27 @@ static void separatetobefnz (global_State *g, int all) {
 }
 
 
+/*
+** If pointer 'p' points to 'o', move it to the next element.
+*/
+static void checkpointer (GCObject **p, GCObject *o) {
+  if (o == *p)
+    *p = o->next;
+}
+
+
+/*
+** Correct pointers to objects inside 'allgc' list when
+** object 'o' is being removed from the list.
+*/
+static void correctpointers (global_State *g, GCObject *o) {
+  checkpointer(&g->survival, o);
+  checkpointer(&g->old1, o);
+  checkpointer(&g->reallyold, o);
+  checkpointer(&g->firstold1, o);
+}
+
+
 /*
 ** if object 'o' has a finalizer, remove it from 'allgc' list (must
 ** search the list to find it) and link it in 'finobj' list.
@@ -908,6 +1128,8 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
       if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
         g->sweepgc = sweeptolive(L, g->sweepgc);  /* change 'sweepgc' */
     }
+    else
+      correctpointers(g, o);
     /* search for pointer pointing to 'o' */
     for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
     *p = o->next;  /* remove 'o' from 'allgc' list */
@@ -963,12 +1185,12 @@ static void entersweep (lua_State *L) {
 
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  luaC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
   lua_assert(g->tobefnz == NULL);
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
-  g->gckind = KGC_NORMAL;
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
   sweepwholelist(L, &g->fixedgc);  /* collect fixed objects */
@@ -981,6 +1203,7 @@ static l_mem atomic (lua_State *L) {
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -989,6 +1212,7 @@ static l_mem atomic (lua_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  propagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
   propagateall(g);  /* propagate changes */
@@ -1043,7 +1267,7 @@ static lu_mem singlestep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
-      g->GCmemtrav = g->strt.size * sizeof(GCObject*);
+      g->GCmemtrav = strtablen(&g->strt) * sizeof(GCObject*);
       restartcollection(g);
       g->gcstate = GCSpropagate;
       return g->GCmemtrav;
@@ -1080,7 +1304,7 @@ static lu_mem singlestep (lua_State *L) {
       return 0;
     }
     case GCScallfin: {  /* call remaining finalizers */
-      if (g->tobefnz && g->gckind != KGC_EMERGENCY) {
+      if (g->tobefnz && !g->gcemergency) {
         int n = runafewfinalizers(L);
         return (n * GCFINALIZECOST);
       }
@@ -1105,6 +1329,418 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 }
 
 
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Generational Collector
+** =======================================================
+*/
+
+
+/*
+** Sweep a list of objects in a young collection, deleting dead ones
+** and advancing the age of the survivors. New objects become
+** survivals and go back to white; all other survivors keep their
+** colors. Return where the sweep stopped, so that the caller can find
+** the last live element of the list.
+*/
+static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
+                            GCObject *limit, GCObject **pfirstold1) {
+  static const lu_byte nextage[] = {
+    G_SURVIVAL,  /* from G_NEW */
+    G_OLD1,      /* from G_SURVIVAL */
+    G_OLD1,      /* from G_OLD0 */
+    G_OLD,       /* from G_OLD1 */
+    G_OLD,       /* from G_OLD (do not change) */
+    G_TOUCHED1,  /* from G_TOUCHED1 (do not change) */
+    G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
+  };
+  int white = luaC_white(g);
+  GCObject *curr;
+  while ((curr = *p) != limit) {
+    if (iswhite(curr)) {  /* is 'curr' dead? */
+      lua_assert(!isold(curr) && isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* correct mark and age */
+      if (getage(curr) == G_NEW) {  /* new objects go back to white */
+        int marked = curr->marked & maskgcbits;  /* erase GC bits */
+        curr->marked = cast_byte(marked | (G_SURVIVAL << AGEBIT) | white);
+      }
+      else {  /* all other objects will be old, and so keep their color */
+        setage(curr, nextage[getage(curr)]);
+        if (curr->tt == LUA_TLCL)
+          oldupvals(gco2lcl(curr));
+        if (getage(curr) == G_OLD1 && *pfirstold1 == NULL)
+          *pfirstold1 = curr;  /* first OLD1 object in the list */
+      }
+      p = &curr->next;  /* go to next element */
+    }
+  }
+  return p;
+}
+
+
+/*
+** Traverse a list making all its elements white and clearing their
+** age. In incremental mode, all objects are 'new' all the time.
+*/
+static void whitelist (global_State *g, GCObject *p) {
+  int white = luaC_white(g);
+  for (; p != NULL; p = p->next)
+    p->marked = cast_byte((p->marked & maskgcbits) | white);
+}
+
+
+/*
+** Correct a list of gray objects after a young collection. Return a
+** pointer to where the rest of the list should be linked.
+** Because this correction is done after sweeping, young objects might
+** be turned white and still be in the list. They are only removed.
+** 'TOUCHED1' objects are advanced to 'TOUCHED2' and remain on the list;
+** non-white threads also remain on the list; everything else is made
+** black (as old objects do not need to be traversed again) and removed.
+*/
+static GCObject **correctgraylist (GCObject **p) {
+  GCObject *curr;
+  while ((curr = *p) != NULL) {
+    GCObject **next = getgclist(curr);
+    if (iswhite(curr))
+      goto remove;  /* remove all white objects */
+    else if (getage(curr) == G_TOUCHED1) {  /* touched in this cycle? */
+      lua_assert(isgray(curr));
+      gray2black(curr);  /* make it black, for next barrier */
+      changeage(curr, G_TOUCHED1, G_TOUCHED2);
+      goto remain;  /* keep it in the list and go to next element */
+    }
+    else if (curr->tt == LUA_TTHREAD) {
+      lua_assert(isgray(curr));
+      goto remain;  /* keep non-white threads on the list */
+    }
+    else {  /* everything else is removed */
+      lua_assert(isold(curr));  /* young objects should be white here */
+      if (getage(curr) == G_TOUCHED2)  /* advance from TOUCHED2... */
+        changeage(curr, G_TOUCHED2, G_OLD);  /* ... to OLD */
+      gray2black(curr);  /* make object black (to be removed) */
+      goto remove;
+    }
+    remove: *p = *next; continue;
+    remain: p = next; continue;
+  }
+  return p;
+}
+
+
+/*
+** Correct all gray lists, coalescing them into 'grayagain'.
+*/
+static void correctgraylists (global_State *g) {
+  GCObject **list = correctgraylist(&g->grayagain);
+  *list = g->weak; g->weak = NULL;
+  list = correctgraylist(list);
+  *list = g->allweak; g->allweak = NULL;
+  list = correctgraylist(list);
+  *list = g->ephemeron; g->ephemeron = NULL;
+  correctgraylist(list);
+}
+
+
+/*
+** Mark black 'OLD1' objects when starting a new young collection.
+** Gray objects are already in some gray list, and so will be visited
+** in the atomic step.
+*/
+static void markold (global_State *g, GCObject *from, GCObject *to) {
+  GCObject *p;
+  for (p = from; p != to; p = p->next) {
+    if (getage(p) == G_OLD1) {
+      lua_assert(!iswhite(p));
+      changeage(p, G_OLD1, G_OLD);  /* now they are old */
+      if (isblack(p))
+        reallymarkobject(g, p);
+    }
+  }
+}
+
+
+/*
+** Sweep a list making all surviving objects old (the whole world is
+** old after a full collection in generational mode). Threads are kept
+** gray and linked in 'grayagain', so that they are always traversed.
+*/
+static void sweep2old (lua_State *L, GCObject **p) {
+  GCObject *curr;
+  global_State *g = G(L);
+  while ((curr = *p) != NULL) {
+    if (iswhite(curr)) {  /* is 'curr' dead? */
+      lua_assert(isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* all surviving objects become old */
+      setage(curr, G_OLD);
+      if (curr->tt == LUA_TTHREAD) {  /* threads must be watched */
+        lua_State *th = gco2th(curr);
+        linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
+      }
+      else {  /* everything else is black */
+        if (curr->tt == LUA_TLCL)
+          oldupvals(gco2lcl(curr));
+        gray2black(curr);
+      }
+      p = &curr->next;  /* go to next element */
+    }
+  }
+}
+
+
+/*
+** Finish a young-generation collection.
+*/
+static void finishgencycle (lua_State *L, global_State *g) {
+  correctgraylists(g);
+  checkSizes(L, g);
+  g->gcstate = GCSpropagate;  /* skip restart */
+  if (!g->gcemergency)
+    callallpendingfinalizers(L);
+}
+
+
+/*
+** Set debt for the next minor collection, which will happen when
+** memory grows 'genminormul'%.
+*/
+static void setminordebt (global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->genminormul));
+}
+
+
+/*
+** Does a young collection. First, mark 'OLD1' objects. Then does the
+** atomic step. Then, sweep all lists and advance pointers. Finally,
+** finish the collection.
+*/
+static void youngcollection (lua_State *L, global_State *g) {
+  GCObject **psurvival;  /* to point to first non-dead survival object */
+  GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
+  lua_assert(g->gcstate == GCSpropagate);
+  if (g->firstold1) {  /* are there regular OLD1 objects? */
+    markold(g, g->firstold1, g->reallyold);  /* mark them */
+    g->firstold1 = NULL;  /* no more OLD1 objects (for now) */
+  }
+  markold(g, g->finobj, g->finobjrold);
+  markold(g, g->tobefnz, NULL);
+  atomic(L);
+  /* sweep nursery and get a pointer to its last live element */
+  g->gcstate = GCSswpallgc;
+  psurvival = sweepgen(L, g, &g->allgc, g->survival, &g->firstold1);
+  /* sweep 'survival' */
+  sweepgen(L, g, psurvival, g->old1, &g->firstold1);
+  g->reallyold = g->old1;
+  g->old1 = *psurvival;  /* 'survival' survivals are old now */
+  g->survival = g->allgc;  /* all news are survivals */
+  /* repeat for 'finobj' lists */
+  dummy = NULL;  /* no 'firstold1' optimization for 'finobj' lists */
+  psurvival = sweepgen(L, g, &g->finobj, g->finobjsur, &dummy);
+  /* sweep 'survival' */
+  sweepgen(L, g, psurvival, g->finobjold1, &dummy);
+  g->finobjrold = g->finobjold1;
+  g->finobjold1 = *psurvival;  /* 'survival' survivals are old now */
+  g->finobjsur = g->finobj;  /* all news are survivals */
+  sweepgen(L, g, &g->tobefnz, NULL, &dummy);
+  finishgencycle(L, g);
+}
+
+
+/*
+** Clears all gray lists, sweeps objects, and prepares sublists to enter
+** generational mode. The sweeps remove dead objects and turn all
+** surviving objects to old. (The main thread is not in any list, so it
+** is handled apart.) Threads go back to 'grayagain'; everything else
+** is turned black (not in any gray list).
+*/
+static void atomic2gen (lua_State *L, global_State *g) {
+  cleargraylists(g);
+  /* sweep all elements making them old */
+  g->gcstate = GCSswpallgc;
+  sweep2old(L, &g->allgc);
+  /* everything alive now is old */
+  g->reallyold = g->old1 = g->survival = g->allgc;
+  g->firstold1 = NULL;  /* there are no OLD1 objects anywhere */
+  /* repeat for 'finobj' lists */
+  sweep2old(L, &g->finobj);
+  g->finobjrold = g->finobjold1 = g->finobjsur = g->finobj;
+  sweep2old(L, &g->tobefnz);
+  setage(g->mainthread, G_OLD);
+  linkgclist(g->mainthread, g->grayagain);
+  g->gckind = KGC_GEN;
+  g->lastatomic = 0;
+  g->GCestimate = gettotalbytes(g);  /* base for memory control */
+  finishgencycle(L, g);
+}
+
+
+/*
+** Enter generational mode. Must go until the end of an atomic cycle
+** to ensure that all objects are correctly marked and weak tables
+** are cleared. Then, turn all objects into old and finishes the
+** collection.
+*/
+static lu_mem entergen (lua_State *L, global_State *g) {
+  lu_mem numobjs;
+  luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  numobjs = atomic(L);  /* propagates all and then do the atomic stuff */
+  atomic2gen(L, g);
+  setminordebt(g);  /* set debt assuming next cycle will be minor */
+  return numobjs;
+}
+
+
+/*
+** Enter incremental mode. Turn all objects white, make all
+** intermediate lists point to NULL (to avoid invalid pointers),
+** and go to the pause state.
+*/
+static void enterinc (global_State *g) {
+  whitelist(g, g->allgc);
+  g->reallyold = g->old1 = g->survival = NULL;
+  whitelist(g, g->finobj);
+  whitelist(g, g->tobefnz);
+  g->finobjrold = g->finobjold1 = g->finobjsur = NULL;
+  g->mainthread->marked =
+      cast_byte((g->mainthread->marked & maskgcbits) | luaC_white(g));
+  g->gcstate = GCSpause;
+  g->gckind = KGC_INC;
+  g->lastatomic = 0;
+}
+
+
+/*
+** Change collector mode to 'newmode'.
+*/
+void luaC_changemode (lua_State *L, int newmode) {
+  global_State *g = G(L);
+  if (newmode != g->gckind) {
+    if (newmode == KGC_GEN)  /* entering generational mode? */
+      entergen(L, g);
+    else
+      enterinc(g);  /* entering incremental mode */
+  }
+  g->lastatomic = 0;
+}
+
+
+/*
+** Does a full collection in generational mode.
+*/
+static lu_mem fullgen (lua_State *L, global_State *g) {
+  enterinc(g);
+  return entergen(L, g);
+}
+
+
+/*
+** Does a major collection after last collection was a "bad collection".
+**
+** When the program is building a big structure, it allocates lots of
+** memory but generates very little garbage. In those scenarios,
+** the generational mode just wastes time doing small collections, and
+** major collections are frequently what we call a "bad collection", a
+** collection that frees too few objects. To avoid the cost of switching
+** between generational mode and the incremental mode needed for full
+** (major) collections, the collector tries to stay in incremental mode
+** after a bad collection, and to switch back to generational mode only
+** after a "good" collection (one that traverses less than 9/8 objects
+** of the previous one).
+** The collector must choose whether to stay in incremental mode or to
+** switch back to generational mode before sweeping. At this point, it
+** does not know the real memory in use, so it cannot use memory to
+** decide whether to return to generational mode. Instead, it uses the
+** amount of work done by 'atomic' as an approximation of the amount of
+** live memory. In case of a 'bad' collection, it stores this amount in
+** 'lastatomic' to be used in the next step.
+*/
+static void stepgenfull (lua_State *L, global_State *g) {
+  lu_mem newatomic;  /* work done by this collection */
+  lu_mem lastatomic = g->lastatomic;  /* work from last collection */
+  if (g->gckind == KGC_GEN)  /* still in generational mode? */
+    enterinc(g);  /* enter incremental mode */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  newatomic = atomic(L);  /* mark everybody */
+  if (newatomic < lastatomic + (lastatomic >> 3)) {  /* good collection? */
+    atomic2gen(L, g);  /* return to generational mode */
+    setminordebt(g);
+  }
+  else {  /* another bad collection; stay in incremental mode */
+    entersweep(L);
+    g->GCestimate = gettotalbytes(g);  /* first estimate */;
+    luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
+    setpause(g);
+    g->lastatomic = newatomic;
+  }
+}
+
+
+/*
+** Does a generational "step". Usually that means doing a minor
+** collection and setting the debt to make another collection when
+** memory grows 'genminormul'% larger.
+**
+** However, there are exceptions. If memory grows 'genmajormul'%
+** larger than it was at the end of the last major collection (kept
+** in 'GCestimate'), the function does a major collection. At the end,
+** it checks whether the major collection was able to free a decent
+** amount of memory (at least half the growth in memory since previous
+** major collection). If so, the collector keeps its state, and the next
+** collection will probably be minor again. Otherwise, we have what we
+** call a "bad collection". In that case, set the field 'lastatomic' to
+** signal that fact, so that the next collection will go to
+** 'stepgenfull'.
+**
+** 'GCdebt <= 0' means an explicit call to GC step with "size" zero;
+** in that case, do a minor collection.
+*/
+static void genstep (lua_State *L, global_State *g) {
+  if (g->lastatomic != 0)  /* last collection was a bad one? */
+    stepgenfull(L, g);  /* do a full step */
+  else {
+    lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
+    lu_mem majorinc = (majorbase / 100) * g->genmajormul;
+    if (g->GCdebt > 0 && gettotalbytes(g) > majorbase + majorinc) {
+      lu_mem numobjs = fullgen(L, g);  /* do a major collection */
+      if (gettotalbytes(g) < majorbase + (majorinc / 2)) {
+        /* collected at least half of memory growth since last major
+           collection; keep doing minor collections */
+        lua_assert(g->lastatomic == 0);
+      }
+      else {  /* bad collection */
+        g->lastatomic = numobjs;  /* signal that last collection was bad */
+        setpause(g);  /* do a long wait for next (major) collection */
+      }
+    }
+    else {  /* regular case; do a minor collection */
+      youngcollection(L, g);
+      setminordebt(g);
+      g->GCestimate = majorbase;  /* preserve base value */
+    }
+  }
+  lua_assert(isdecGCmodegen(g));
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** GC control (continued)
+** =======================================================
+*/
+
+
 /*
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
@@ -1120,16 +1756,12 @@ static l_mem getdebt (global_State *g) {
   }
 }
 
+
 /*
-** performs a basic GC step when collector is running
+** performs a basic incremental step
 */
-void luaC_step (lua_State *L) {
-  global_State *g = G(L);
+static void incstep (lua_State *L, global_State *g) {
   l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
-  if (!g->gcrunning) {  /* not running? */
-    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
-    return;
-  }
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1145,21 +1777,29 @@ void luaC_step (lua_State *L) {
 
 
 /*
-** Performs a full GC cycle; if 'isemergency', set a flag to avoid
-** some operations which could change the interpreter state in some
-** unexpected ways (running finalizers and shrinking some structures).
+** performs a basic GC step when collector is running
+*/
+void luaC_step (lua_State *L) {
+  global_State *g = G(L);
+  if (!g->gcrunning)  /* not running? */
+    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
+  else if (isdecGCmodegen(g))
+    genstep(L, g);
+  else
+    incstep(L, g);
+}
+
+
+/*
+** Performs a full GC cycle in incremental mode.
 ** Before running the collection, check 'keepinvariant'; if it is true,
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
 ** changed, nothing will be collected).
 */
-void luaC_fullgc (lua_State *L, int isemergency) {
-  global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
-  if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
-  if (keepinvariant(g)) {  /* black objects? */
+static void fullinc (lua_State *L, global_State *g) {
+  if (keepinvariant(g))  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
-  }
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
   luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
@@ -1167,10 +1807,26 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
   setpause(g);
 }
 
+
+/*
+** Performs a full GC cycle; if 'isemergency', set a flag to avoid
+** some operations which could change the interpreter state in some
+** unexpected ways (running finalizers and shrinking some structures).
+*/
+void luaC_fullgc (lua_State *L, int isemergency) {
+  global_State *g = G(L);
+  lua_assert(!g->gcemergency);
+  g->gcemergency = isemergency;  /* set flag */
+  if (g->gckind == KGC_INC)
+    fullinc(L, g);
+  else
+    fullgen(L, g);
+  g->gcemergency = 0;
+}
+
 /* }====================================================== */
 
 
@@ -22,10 +22,32 @@
 ** allweak, ephemeron) so that it can be visited again before finishing
 ** the collection cycle. These lists have no meaning when the invariant
 ** is not being enforced (e.g., sweep phase).
+**
+** In generational mode, objects also have an age (see below). Old
+** objects are not traversed by young (minor) collections, so the
+** collector must also keep a second invariant: an old object cannot
+** point to a young one. Old objects stay black (or gray) between
+** collections, so that the barriers can detect when that invariant
+** is about to be broken.
 */
 
 
 
+/*
+** default values for the generational-mode parameters: a minor
+** collection happens after memory grows 'LUAI_GENMINORMUL'% since the
+** last collection; a major collection happens when memory grows
+** 'LUAI_GENMAJORMUL'% since the last major collection
+*/
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL	100
+#endif
+
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL	20
+#endif
+
+
 /* how much to allocate before next GC step */
 #if !defined(GCSTEPSIZE)
 /* ~100 small strings */
@@ -79,6 +101,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define AGEBIT		4  /* bits 4-6 keep the object age */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -101,6 +124,38 @@
 #define luaC_white(g)	cast(lu_byte, (g)->currentwhite & WHITEBITS)
 
 
+/* object age in generational mode */
+#define G_NEW		0	/* created in current cycle */
+#define G_SURVIVAL	1	/* created in previous cycle */
+#define G_OLD0		2	/* marked old by frw. barrier in this cycle */
+#define G_OLD1		3	/* first full cycle as old */
+#define G_OLD		4	/* really old object (not to be visited) */
+#define G_TOUCHED1	5	/* old object touched this cycle */
+#define G_TOUCHED2	6	/* old object touched in previous cycle */
+
+#define AGEBITS		(7 << AGEBIT)  /* all age bits (111) */
+
+#define getage(o)	(((o)->marked & AGEBITS) >> AGEBIT)
+#define setage(o,a)  ((o)->marked = cast_byte(((o)->marked & (~AGEBITS)) | \
+                                              ((a) << AGEBIT)))
+#define isold(o)	(getage(o) > G_SURVIVAL)
+
+#define changeage(o,f,t)  \
+	check_exp(getage(o) == (f), (o)->marked ^= (((f)^(t)) << AGEBIT))
+
+
+/* kinds of Garbage Collection */
+#define KGC_INC		0	/* incremental gc */
+#define KGC_GEN		1	/* generational gc */
+
+/*
+** true if the collector is (or is trying to get back) in generational
+** mode; after a major collection that did not free enough memory, the
+** collector stays temporarily in incremental mode (see 'genstep')
+*/
+#define isdecGCmodegen(g)	((g)->gckind == KGC_GEN || (g)->lastatomic != 0)
+
+
 /*
 ** Does one step of collection when debt becomes positive. 'pre'/'pos'
 ** allows some adjustments to be done only when needed. macro
@@ -142,6 +197,7 @@ LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
+LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
 
 
 #endif
@@ -622,6 +622,14 @@ static int g_write (lua_State *L, FILE *f, int arg) {
                 : fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg));
       status = status && (len > 0);
     }
+    else if (lua_type(L, arg) == LUA_TUSERDATA &&
+             luaL_testudata(L, arg, LUA_BUFFERHANDLE) != NULL) {
+      /* write the contents of a string buffer, without copying them */
+      luaL_StrBuffer *sb = (luaL_StrBuffer *)lua_touserdata(L, arg);
+      size_t l = sb->n - sb->r;
+      status = status &&
+               (l == 0 || fwrite(sb->b + sb->r, sizeof(char), l, f) == l);
+    }
     else {
       size_t l;
       const char *s = luaL_checklstring(L, arg, &l);
@@ -0,0 +1,1781 @@
+/*
+** $Id: ljit.c $
+** Template JIT compiler for x86-64
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS */
+#endif
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+
+#if LUA_USE_JIT		/* { */
+
+#if defined(LUA_NANBOX_INT32)
+#error "the JIT compiler does not support LUA_NANBOX_INT32"
+#endif
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+
+/*
+** The compiler translates each instruction of a prototype into a fixed
+** template of x86-64 code, with no register allocation across
+** instructions: all Lua values stay in the Lua stack, so native code
+** and the interpreter can hand execution to each other at any
+** instruction boundary. Templates inline the common cases of
+** arithmetic, comparisons, numeric loops, and table accesses (array
+** part with integer keys, fields through the inline caches) and call
+** helper functions, with the same code as the interpreter, for
+** everything else.
+**
+** Native code of a function runs inside 'luaJ_hot', called by the
+** interpreter at the function's hot events. It returns to 'luaJ_hot'
+** when the running frame changes (calls to and returns from Lua
+** functions), so that calls do not nest C frames, and when it "exits"
+** at loop back edges because a hook is set (so that hooks, and the
+** signals that set them, keep working). An exit leaves 'savedpc'
+** pointing to the instruction where the interpreter must go on. An
+** opcode without a template also exits, to run in the interpreter.
+**
+** Register usage in native code (all callee-saved in the SysV ABI):
+** rbx = base, r12 = L, r13 = ci, r14 = k (constants), r15 = closure.
+** 'base' is reloaded after each helper call, as the stack may move.
+*/
+
+
+/* maximum size of the machine code for one instruction */
+#define MAXTEMPLATE	384
+
+/* size of the entry and exit stubs */
+#define STUBSIZE	64
+
+/* maximum number of pending jumps to a label */
+#define MAXFWD		8
+
+
+/* x86-64 registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* registers with fixed roles */
+#define XBASE	RBX
+#define XL	R12
+#define XCI	R13
+#define XK	R14
+#define XCL	R15
+
+/* condition codes (the negation of 'cc' is 'cc ^ 1') */
+enum { CC_B = 2, CC_AE, CC_E, CC_NE, CC_BE, CC_A, CC_S, CC_NS,
+       CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+
+/* unconditional jump */
+#define CC_ALWAYS	(-1)
+
+
+/* layout of the structures used by native code */
+#define VOFF		cast_int(offsetof(TValue, value_))
+#define TOFF		cast_int(offsetof(TValue, tt_))
+#define SZV		cast_int(sizeof(TValue))
+#define OFF(t,f)	cast_int(offsetof(t, f))
+
+
+typedef struct JitState {
+  Proto *p;
+  unsigned char *buff;  /* where to put the machine code */
+  size_t size;  /* size of 'buff' */
+  size_t n;  /* bytes emitted so far (may exceed 'size') */
+  unsigned int *entry;  /* native offset of each instruction */
+  size_t epilogue;  /* offset of the code that returns from native code */
+} JitState;
+
+
+/*
+** A position in the code: either known ('bound') or a forward
+** position inside a template, with a list of jumps waiting for it.
+*/
+typedef struct Label {
+  int bound;
+  size_t target;
+  int n;  /* number of pending jumps */
+  size_t pos[MAXFWD];  /* offsets of their rel32 fields */
+} Label;
+
+
+/* a value operand: a register or a constant (or any [base + disp]) */
+typedef struct Opnd {
+  int base;
+  int disp;
+  const TValue *k;  /* value of a constant (NULL otherwise) */
+} Opnd;
+
+
+
+/*
+** {======================================================
+** Machine-code emission
+** =======================================================
+*/
+
+static void emitb (JitState *J, int b) {
+  if (J->n < J->size)
+    J->buff[J->n] = cast_byte(b);
+  J->n++;
+}
+
+
+static void emit32 (JitState *J, unsigned int v) {
+  int i;
+  for (i = 0; i < 4; i++, v >>= 8)
+    emitb(J, v & 0xff);
+}
+
+
+static void emit64 (JitState *J, size_t v) {
+  int i;
+  for (i = 0; i < 8; i++, v >>= 8)
+    emitb(J, cast_int(v & 0xff));
+}
+
+
+static void patch32 (JitState *J, size_t pos, unsigned int v) {
+  int i;
+  for (i = 0; i < 4 && pos + i < J->size; i++, v >>= 8)
+    J->buff[pos + i] = cast_byte(v & 0xff);
+}
+
+
+/* emit ModRM (+ SIB + displacement) for operand [base + disp] */
+static void modrm (JitState *J, int reg, int base, int disp) {
+  int mod = (disp == 0 && (base & 7) != RBP) ? 0
+          : (-128 <= disp && disp <= 127) ? 1 : 2;
+  emitb(J, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP)
+    emitb(J, 0x24);  /* SIB for rsp/r12 */
+  if (mod == 1) emitb(J, disp & 0xff);
+  else if (mod == 2) emit32(J, cast(unsigned int, disp));
+}
+
+
+/*
+** emit '[pfx] [REX] op ModRM' with a memory operand [base + disp];
+** 'w' selects 64-bit operands; 'op' may have two bytes (0x0fxx)
+*/
+static void emitmem (JitState *J, int pfx, int w, int op, int reg,
+                     int base, int disp) {
+  int rex = (w << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+  if (pfx) emitb(J, pfx);
+  if (rex) emitb(J, 0x40 | rex);
+  if (op > 0xff) emitb(J, op >> 8);
+  emitb(J, op & 0xff);
+  modrm(J, reg, base, disp);
+}
+
+
+/* same, with register operand 'rm' */
+static void emitreg (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  int rex = (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+  if (pfx) emitb(J, pfx);
+  if (rex) emitb(J, 0x40 | rex);
+  if (op > 0xff) emitb(J, op >> 8);
+  emitb(J, op & 0xff);
+  emitb(J, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/* integer opcodes 'op r64, r/m64' */
+#define XADD	0x03
+#define XOR	0x0b
+#define XAND	0x23
+#define XSUB	0x2b
+#define XXOR	0x33
+#define XCMP	0x3b
+#define XTEST	0x85
+#define XMOV	0x8b
+#define XIMUL	0x0faf
+
+/* float opcodes 'op xmm, xmm/m64' (prefix 0xf2) */
+#define XADDSD	0x0f58
+#define XMULSD	0x0f59
+#define XSUBSD	0x0f5c
+#define XDIVSD	0x0f5e
+
+
+static void ldq (JitState *J, int r, int base, int disp) {
+  emitmem(J, 0, 1, XMOV, r, base, disp);  /* mov r64, [m] */
+}
+
+static void stq (JitState *J, int base, int disp, int r) {
+  emitmem(J, 0, 1, 0x89, r, base, disp);  /* mov [m], r64 */
+}
+
+static void ldd (JitState *J, int r, int base, int disp) {
+  emitmem(J, 0, 0, XMOV, r, base, disp);  /* mov r32, [m] */
+}
+
+static void stdimm (JitState *J, int base, int disp, int imm) {
+  emitmem(J, 0, 0, 0xc7, 0, base, disp);  /* mov dword [m], imm32 */
+  emit32(J, cast(unsigned int, imm));
+}
+
+static void cmpimm (JitState *J, int w, int base, int disp, int imm) {
+  if (-128 <= imm && imm <= 127) {
+    emitmem(J, 0, w, 0x83, 7, base, disp);  /* cmp [m], imm8 */
+    emitb(J, imm & 0xff);
+  }
+  else {
+    emitmem(J, 0, w, 0x81, 7, base, disp);  /* cmp [m], imm32 */
+    emit32(J, cast(unsigned int, imm));
+  }
+}
+
+static void cmpbimm (JitState *J, int base, int disp, int imm) {
+  emitmem(J, 0, 0, 0x80, 7, base, disp);  /* cmp byte [m], imm8 */
+  emitb(J, imm);
+}
+
+static void testbimm (JitState *J, int base, int disp, int imm) {
+  emitmem(J, 0, 0, 0xf6, 0, base, disp);  /* test byte [m], imm8 */
+  emitb(J, imm);
+}
+
+static void alu (JitState *J, int op, int r, int base, int disp) {
+  emitmem(J, 0, 1, op, r, base, disp);  /* op r64, [m] */
+}
+
+static void alurr (JitState *J, int op, int r, int rm) {
+  emitreg(J, 0, 1, op, r, rm);  /* op r64, rm64 */
+}
+
+static void lea (JitState *J, int r, int base, int disp) {
+  emitmem(J, 0, 1, 0x8d, r, base, disp);
+}
+
+static void movimm (JitState *J, int r, size_t v) {
+  if (v <= 0xffffffffu) {  /* 'mov r32, imm32' zero-extends */
+    if (r & 8) emitb(J, 0x41);
+    emitb(J, 0xb8 | (r & 7));
+    emit32(J, cast(unsigned int, v));
+  }
+  else {
+    emitb(J, 0x48 | ((r & 8) >> 3));
+    emitb(J, 0xb8 | (r & 7));
+    emit64(J, v);
+  }
+}
+
+/* load an 'int' argument */
+static void movint (JitState *J, int r, int v) {
+  movimm(J, r, cast(unsigned int, v));
+}
+
+static void push (JitState *J, int r) {
+  if (r & 8) emitb(J, 0x41);
+  emitb(J, 0x50 | (r & 7));
+}
+
+static void pop (JitState *J, int r) {
+  if (r & 8) emitb(J, 0x41);
+  emitb(J, 0x58 | (r & 7));
+}
+
+static void ldv (JitState *J, int x, int base, int disp) {
+  emitmem(J, 0, 0, 0x0f10, x, base, disp);  /* movups xmm, [m] */
+}
+
+static void stv (JitState *J, int base, int disp, int x) {
+  emitmem(J, 0, 0, 0x0f11, x, base, disp);  /* movups [m], xmm */
+}
+
+static void ldsd (JitState *J, int x, int base, int disp) {
+  emitmem(J, 0xf2, 0, 0x0f10, x, base, disp);  /* movsd xmm, [m] */
+}
+
+static void stsd (JitState *J, int base, int disp, int x) {
+  emitmem(J, 0xf2, 0, 0x0f11, x, base, disp);  /* movsd [m], xmm */
+}
+
+static void cvtsd (JitState *J, int x, int base, int disp) {
+  emitmem(J, 0xf2, 1, 0x0f2a, x, base, disp);  /* cvtsi2sd xmm, [m] */
+}
+
+static void ucomisd (JitState *J, int x, int y) {
+  emitreg(J, 0x66, 0, 0x0f2e, x, y);
+}
+
+/* load float 'n' into register 'x' */
+static void ldflt (JitState *J, int x, lua_Number n) {
+  size_t bits;
+  lua_assert(sizeof(bits) == sizeof(n));
+  memcpy(&bits, &n, sizeof(n));
+  movimm(J, RAX, bits);
+  emitreg(J, 0x66, 1, 0x0f6e, x, RAX);  /* movq xmm, rax */
+}
+
+/* copy a value */
+static void copyv (JitState *J, int dbase, int ddisp, int sbase, int sdisp) {
+  ldv(J, 0, sbase, sdisp);
+  stv(J, dbase, ddisp, 0);
+}
+
+
+/* jump (cc == CC_ALWAYS: unconditional) to native offset 'target' */
+static void jmpto (JitState *J, int cc, size_t target) {
+  if (cc == CC_ALWAYS)
+    emitb(J, 0xe9);
+  else {
+    emitb(J, 0x0f);
+    emitb(J, 0x80 | cc);
+  }
+  emit32(J, cast(unsigned int, target - (J->n + 4)));
+}
+
+
+static void jmpl (JitState *J, int cc, Label *l) {
+  if (l->bound)
+    jmpto(J, cc, l->target);
+  else {
+    jmpto(J, cc, J->n);  /* target to be patched */
+    lua_assert(l->n < MAXFWD);
+    l->pos[l->n++] = J->n - 4;
+  }
+}
+
+
+/* bind label 'l' to the current position */
+static void here (JitState *J, Label *l) {
+  int i;
+  for (i = 0; i < l->n; i++)
+    patch32(J, l->pos[i], cast(unsigned int, J->n - (l->pos[i] + 4)));
+  l->bound = 1;
+  l->target = J->n;
+  l->n = 0;
+}
+
+
+static void callf (JitState *J, size_t f) {
+  movimm(J, RAX, f);
+  emitb(J, 0xff); emitb(J, 0xd0);  /* call rax */
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Helpers (called from native code)
+** =======================================================
+*/
+
+#define checkGC(L,c)  \
+	{ luaC_condGC(L, L->top = (c), L->top = ci->top); \
+          luai_threadyield(L); }
+
+
+/* raw access to a short-string key through an inline cache */
+#define getcached(h,key)	luaH_getshortstrcached(h, key, hint)
+
+
+static void gettable (lua_State *L, const TValue *t, TValue *key, StkId ra) {
+  luaV_gettable(L, t, key, ra);
+}
+
+
+static void settable (lua_State *L, const TValue *t, TValue *key,
+                      TValue *val) {
+  luaV_settable(L, t, key, val);
+}
+
+
+static void getfield (lua_State *L, const TValue *t, TValue *key, StkId ra,
+                      unsigned int *hint) {
+  const TValue *slot;
+  if (luaV_fastget(L, t, tsvalue(key), slot, getcached)) {
+    setobj2s(L, ra, slot);
+  }
+  else luaV_finishget(L, t, key, ra, slot);
+}
+
+
+static void setfield (lua_State *L, const TValue *t, TValue *key,
+                      TValue *val, unsigned int *hint) {
+  const TValue *slot;
+  if (!luaV_fastset(L, t, tsvalue(key), slot, getcached, val))
+    luaV_finishset(L, t, key, val, slot);
+}
+
+
+/* OP_SELF (see 'luaV_execute') */
+static void self (lua_State *L, StkId ra, StkId rb, TValue *rc,
+                  unsigned int *hint) {
+  const TValue *aux;
+  TString *key = tsvalue(rc);
+  setobjs2s(L, ra + 1, rb);
+  if (!ttisshrstring(rc)) {
+    if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+      setobj2s(L, ra, aux);
+    }
+    else luaV_finishget(L, rb, rc, ra, aux);
+  }
+  else if (luaV_fastget(L, rb, key, aux, getcached)) {
+    setobj2s(L, ra, aux);
+  }
+  else {
+    const TValue *tm = (aux == NULL) ? NULL
+                     : fasttm(L, hvalue(rb)->metatable, TM_INDEX);
+    const TValue *mslot;
+    if (tm != NULL && luaV_fastget(L, tm, key, mslot, getcached)) {
+      setobj2s(L, ra, mslot);
+    }
+    else luaV_finishget(L, rb, rc, ra, aux);
+  }
+}
+
+
+static void setupval (lua_State *L, UpVal *uv, StkId ra) {
+  setobj(L, uv->v, ra);
+  luaC_upvalbarrier(L, uv);
+}
+
+
+static void newtable (lua_State *L, StkId ra, int b, int c) {
+  CallInfo *ci = L->ci;
+  Table *t = luaH_new(L);
+  sethvalue(L, ra, t);
+  if (b != 0 || c != 0)
+    luaH_resize(L, t, luaO_fb2int(b), luaH_hashhint(luaO_fb2int(c)));
+  checkGC(L, ra + 1);
+}
+
+
+/* arithmetic with an immediate operand (OP_ADDI/OP_SUBI) */
+static void arithimm (lua_State *L, StkId ra, const TValue *rb, int ic,
+                    int op) {
+  TValue vc;
+  setivalue(&vc, ic);
+  luaO_arith(L, op, rb, &vc, ra);
+}
+
+
+/* order comparison with an immediate operand (OP_LTI etc.) */
+static int orderimm (lua_State *L, const TValue *rb, int ic, int op) {
+  TValue vc;
+  setivalue(&vc, ic);
+  switch (op) {
+    case OP_LTI: return luaV_lessthan(L, rb, &vc);
+    case OP_LEI: return luaV_lessequal(L, rb, &vc);
+    case OP_GTI: return luaV_lessthan(L, &vc, rb);
+    default: lua_assert(op == OP_GEI); return luaV_lessequal(L, &vc, rb);
+  }
+}
+
+
+static void closure (lua_State *L, StkId ra, int bx) {
+  CallInfo *ci = L->ci;
+  LClosure *cl = clLvalue(ci->func);
+  luaV_closure(L, cl->p->p[bx], cl->upvals, ci->u.l.base, ra);
+  checkGC(L, ra + 1);
+}
+
+
+static void concat (lua_State *L, int a, int b, int c) {
+  CallInfo *ci = L->ci;
+  StkId ra, rb;
+  L->top = ci->u.l.base + c + 1;  /* mark the end of concat operands */
+  luaV_concat(L, c - b + 1);
+  ra = ci->u.l.base + a;  /* 'luaV_concat' may move the stack */
+  rb = ci->u.l.base + b;
+  setobjs2s(L, ra, rb);
+  checkGC(L, (ra >= rb ? ra + 1 : rb));
+  L->top = ci->top;  /* restore top */
+}
+
+
+/*
+** After a call to a C function: if it set a hook (e.g., 'debug.sethook'),
+** go on in the interpreter ('luaJ_hot' treats JIT_NEWFRAME with the same
+** frame as a plain return to the interpreter)
+*/
+#define hookset(L)	((L)->hookmask ? JIT_NEWFRAME : JIT_CONTINUE)
+
+
+static int call (lua_State *L, StkId ra, int b, int nresults) {
+  if (b != 0) L->top = ra + b;  /* else previous instruction set top */
+  if (luaD_precall(L, ra, nresults)) {  /* C function? */
+    if (nresults >= 0)
+      L->top = L->ci->top;  /* adjust results */
+    return hookset(L);
+  }
+  else
+    return JIT_NEWFRAME;  /* run the called Lua function */
+}
+
+
+static int tailcall (lua_State *L, StkId ra, int b) {
+  CallInfo *ci = L->ci;
+  Proto *p = clLvalue(ci->func)->p;
+  if (b != 0) L->top = ra + b;  /* else previous instruction set top */
+  if (luaD_precall(L, ra, LUA_MULTRET))  /* C function? */
+    return hookset(L);
+  else {
+    /* tail call: put called frame (n) in place of caller one (o) */
+    CallInfo *nci = L->ci;  /* called frame */
+    CallInfo *oci = nci->previous;  /* caller frame */
+    StkId nfunc = nci->func;  /* called function */
+    StkId ofunc = oci->func;  /* caller function */
+    /* last stack slot filled by 'precall' */
+    StkId lim = nci->u.l.base + getproto(nfunc)->numparams;
+    int aux;
+    /* close all upvalues from previous call */
+    if (p->sizep > 0) luaF_close(L, oci->u.l.base);
+    /* move new frame into old one */
+    for (aux = 0; nfunc + aux < lim; aux++)
+      setobjs2s(L, ofunc + aux, nfunc + aux);
+    oci->u.l.base = ofunc + (nci->u.l.base - nfunc);  /* correct base */
+    oci->top = L->top = ofunc + (L->top - nfunc);  /* correct top */
+    oci->u.l.savedpc = nci->u.l.savedpc;
+    oci->callstatus |= CIST_TAIL;  /* function was tail called */
+    L->ci = oci;  /* remove new frame */
+    lua_assert(L->top == oci->u.l.base + getproto(ofunc)->maxstacksize);
+    return JIT_NEWFRAME;
+  }
+}
+
+
+static int ret (lua_State *L, StkId ra, int b) {
+  CallInfo *ci = L->ci;
+  if (clLvalue(ci->func)->p->sizep > 0) luaF_close(L, ci->u.l.base);
+  b = luaD_poscall(L, ci, ra, (b != 0 ? b - 1 : cast_int(L->top - ra)));
+  if (ci->callstatus & CIST_FRESH)  /* 'ci' still from callee */
+    return JIT_RETURN;  /* 'luaV_execute' must return */
+  else {
+    ci = L->ci;
+    if (b) L->top = ci->top;
+    lua_assert(isLua(ci));
+    lua_assert(GET_OPCODE(*((ci)->u.l.savedpc - 1)) == OP_CALL);
+    return JIT_NEWFRAME;  /* continue with the caller */
+  }
+}
+
+
+static void tforcall (lua_State *L, StkId ra, int c) {
+  CallInfo *ci = L->ci;
+  StkId cb = ra + 3;  /* call base */
+  setobjs2s(L, cb+2, ra+2);
+  setobjs2s(L, cb+1, ra+1);
+  setobjs2s(L, cb, ra);
+  L->top = cb + 3;  /* func. + 2 args (state and index) */
+  luaD_call(L, cb, c);
+  L->top = ci->top;
+}
+
+
+static void setlist (lua_State *L, StkId ra, int n, int c) {
+  CallInfo *ci = L->ci;
+  unsigned int last;
+  Table *h;
+  if (n == 0) n = cast_int(L->top - ra) - 1;
+  h = hvalue(ra);
+  last = ((c-1)*LFIELDS_PER_FLUSH) + n;
+  if (last > h->sizearray)  /* needs more space? */
+    luaH_resizearray(L, h, last);  /* preallocate it at once */
+  for (; n > 0; n--) {
+    TValue *val = ra+n;
+    luaH_setint(L, h, last--, val);
+    luaC_barrierback(L, h, val);
+  }
+  L->top = ci->top;  /* correct top (in case of previous open call) */
+}
+
+
+static void vararg (lua_State *L, int a, int b) {
+  CallInfo *ci = L->ci;
+  StkId base = ci->u.l.base;
+  StkId ra = base + a;
+  int j;
+  int n = cast_int(base - ci->func) - clLvalue(ci->func)->p->numparams - 1;
+  b--;  /* required results */
+  if (n < 0)  /* less arguments than parameters? */
+    n = 0;  /* no vararg arguments */
+  if (b < 0) {  /* B == 0? */
+    b = n;  /* get all var. arguments */
+    luaD_checkstack(L, n);
+    base = ci->u.l.base;  /* previous call may change the stack */
+    ra = base + a;
+    L->top = ra + n;
+  }
+  for (j = 0; j < b && j < n; j++)
+    setobjs2s(L, ra + j, base - n + j);
+  for (; j < b; j++)  /* complete required results with nil */
+    setnilvalue(ra + j);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+#define helper(f)	cast(size_t, (f))
+
+#define code(J,pc)	cast(size_t, (J)->p->code + (pc))
+
+
+static Opnd reg (int r) {
+  Opnd o;
+  o.base = XBASE; o.disp = r * SZV; o.k = NULL;
+  return o;
+}
+
+
+static Opnd kst (JitState *J, int idx) {
+  Opnd o;
+  o.base = XK; o.disp = idx * SZV; o.k = J->p->k + idx;
+  return o;
+}
+
+
+static Opnd rk (JitState *J, int x) {
+  return ISK(x) ? kst(J, INDEXK(x)) : reg(x);
+}
+
+
+/* operand in register 'r' (a pointer to a value) */
+static Opnd ptr (int r) {
+  Opnd o;
+  o.base = r; o.disp = 0; o.k = NULL;
+  return o;
+}
+
+
+/* can the operand be an integer? a float? a number? */
+#define canint(o)	((o).k == NULL || ttisinteger((o).k))
+#define canflt(o)	((o).k == NULL || ttisfloat((o).k))
+#define cannum(o)	((o).k == NULL || ttisnumber((o).k))
+
+
+static void leaop (JitState *J, int r, Opnd o) {
+  lea(J, r, o.base, o.disp);
+}
+
+
+/* jump to 'l' if operand 'o' (not a constant) does not have tag 't' */
+static void guardtag (JitState *J, Opnd o, int t, Label *l) {
+  if (o.k == NULL) {
+    cmpimm(J, 0, o.base, o.disp + TOFF, t);
+    jmpl(J, CC_NE, l);
+  }
+}
+
+
+/* set the saved pc for instruction 'pc' and call helper 'f' */
+static void callhelper (JitState *J, int pc, size_t f) {
+  movimm(J, RAX, code(J, pc + 1));
+  stq(J, XCI, OFF(CallInfo, u.l.savedpc), RAX);
+  callf(J, f);
+  ldq(J, XBASE, XCI, OFF(CallInfo, u.l.base));  /* stack may have moved */
+}
+
+
+/* leave native code, going on in the interpreter from instruction 'pc' */
+static void exitto (JitState *J, int pc) {
+  movimm(J, RAX, code(J, pc));
+  stq(J, XCI, OFF(CallInfo, u.l.savedpc), RAX);
+  alurr(J, XXOR, RAX, RAX);  /* JIT_CONTINUE */
+  jmpto(J, CC_ALWAYS, J->epilogue);
+}
+
+
+/* jump back to instruction 'pc' (exiting instead if there is a hook) */
+static void backedge (JitState *J, int pc) {
+  Label hooked = {0};
+  cmpimm(J, 0, XL, OFF(lua_State, hookmask), 0);
+  jmpl(J, CC_NE, &hooked);
+  jmpto(J, CC_ALWAYS, J->entry[pc]);
+  here(J, &hooked);
+  exitto(J, pc);
+}
+
+
+/*
+** Finish a test instruction whose result is in the flags ('cc' holds
+** when the result is true): skip the jump that follows it unless the
+** result equals 'a'.
+*/
+static void condjump (JitState *J, int pc, int cc, int a) {
+  jmpto(J, a ? (cc ^ 1) : cc, J->entry[pc + 2]);
+  jmpto(J, CC_ALWAYS, J->entry[pc + 1]);
+}
+
+
+/* jump to 'l' if operand 'o' is false ('iffalse') or true (otherwise) */
+static void jmptruth (JitState *J, Opnd o, int iffalse, Label *l) {
+  Label other = {0};
+  ldd(J, RAX, o.base, o.disp + TOFF);
+  emitreg(J, 0, 0, 0x85, RAX, RAX);  /* test eax, eax */
+  jmpl(J, CC_E, iffalse ? l : &other);  /* nil */
+  emitreg(J, 0, 0, 0x83, 7, RAX);  /* cmp eax, LUA_TBOOLEAN */
+  emitb(J, LUA_TBOOLEAN);
+  jmpl(J, CC_NE, iffalse ? &other : l);  /* not a boolean: true */
+  cmpimm(J, 0, o.base, o.disp + VOFF, 0);
+  jmpl(J, iffalse ? CC_E : CC_NE, l);
+  here(J, &other);
+}
+
+
+/* load number 'o' as a float into register 'x' (or jump to 'l') */
+static void loadflt (JitState *J, int x, Opnd o, Label *l) {
+  if (o.k != NULL) {
+    if (ttisfloat(o.k)) ldsd(J, x, o.base, o.disp + VOFF);
+    else cvtsd(J, x, o.base, o.disp + VOFF);
+  }
+  else {
+    Label isflt = {0}, done = {0};
+    cmpimm(J, 0, o.base, o.disp + TOFF, LUA_TNUMFLT);
+    jmpl(J, CC_E, &isflt);
+    cmpimm(J, 0, o.base, o.disp + TOFF, LUA_TNUMINT);
+    jmpl(J, CC_NE, l);
+    cvtsd(J, x, o.base, o.disp + VOFF);
+    jmpl(J, CC_ALWAYS, &done);
+    here(J, &isflt);
+    ldsd(J, x, o.base, o.disp + VOFF);
+    here(J, &done);
+  }
+}
+
+
+static void setint (JitState *J, Opnd a, int r) {
+  stq(J, a.base, a.disp + VOFF, r);
+  stdimm(J, a.base, a.disp + TOFF, LUA_TNUMINT);
+}
+
+
+static void setflt (JitState *J, Opnd a, int x) {
+  stsd(J, a.base, a.disp + VOFF, x);
+  stdimm(J, a.base, a.disp + TOFF, LUA_TNUMFLT);
+}
+
+
+/* call 'luaO_arith(L, op, b, c, a)' */
+static void callarith (JitState *J, int pc, int op, Opnd a, Opnd b,
+                       Opnd c) {
+  alurr(J, XMOV, RDI, XL);
+  movint(J, RSI, op);
+  leaop(J, RDX, b);
+  leaop(J, RCX, c);
+  leaop(J, R8, a);
+  callhelper(J, pc, helper(luaO_arith));
+}
+
+
+/*
+** Binary arithmetic: integer ('iop', when not 0) and float ('fop',
+** when not 0) fast paths, with 'luaO_arith' for everything else
+*/
+static void arith (JitState *J, int pc, Instruction i, int op, int iop,
+                   int fop) {
+  Opnd a = reg(GETARG_A(i));
+  Opnd b = rk(J, GETARG_B(i));
+  Opnd c = rk(J, GETARG_C(i));
+  Label notint = {0}, slow = {0}, done = {0};
+  if (iop != 0 && canint(b) && canint(c)) {
+    guardtag(J, b, LUA_TNUMINT, &notint);
+    guardtag(J, c, LUA_TNUMINT, &notint);
+    ldq(J, RAX, b.base, b.disp + VOFF);
+    alu(J, iop, RAX, c.base, c.disp + VOFF);
+    setint(J, a, RAX);
+    jmpl(J, CC_ALWAYS, &done);
+  }
+  here(J, &notint);
+  if (fop != 0 && cannum(b) && cannum(c)) {
+    loadflt(J, 0, b, &slow);
+    loadflt(J, 1, c, &slow);
+    emitreg(J, 0xf2, 0, fop, 0, 1);
+    setflt(J, a, 0);
+    jmpl(J, CC_ALWAYS, &done);
+  }
+  here(J, &slow);
+  callarith(J, pc, op, a, b, c);
+  here(J, &done);
+}
+
+
+/*
+** Integer modulo and floor division by a positive constant; other
+** cases go to 'luaO_arith'
+*/
+static void arithdiv (JitState *J, int pc, Instruction i, int op) {
+  Opnd a = reg(GETARG_A(i));
+  Opnd b = rk(J, GETARG_B(i));
+  Opnd c = rk(J, GETARG_C(i));
+  Label slow = {0}, done = {0}, pos = {0};
+  if (c.k != NULL && ttisinteger(c.k) && ivalue(c.k) > 0 &&
+      ivalue(c.k) <= INT_MAX && canint(b)) {
+    guardtag(J, b, LUA_TNUMINT, &slow);
+    ldq(J, RAX, b.base, b.disp + VOFF);
+    emitb(J, 0x48); emitb(J, 0x99);  /* cqo */
+    movint(J, RCX, cast_int(ivalue(c.k)));
+    emitreg(J, 0, 1, 0xf7, 7, RCX);  /* idiv rcx */
+    alurr(J, 0x85, RDX, RDX);  /* test rdx, rdx (remainder) */
+    jmpl(J, CC_NS, &pos);
+    if (op == LUA_OPMOD)
+      alurr(J, XADD, RDX, RCX);  /* negative remainder: add divisor */
+    else
+      emitreg(J, 0, 1, 0xff, 1, RAX);  /* round quotient down: dec rax */
+    here(J, &pos);
+    setint(J, a, (op == LUA_OPMOD) ? RDX : RAX);
+    jmpl(J, CC_ALWAYS, &done);
+  }
+  here(J, &slow);
+  callarith(J, pc, op, a, b, c);
+  here(J, &done);
+}
+
+
+static void unary (JitState *J, int pc, Instruction i, int op) {
+  Opnd a = reg(GETARG_A(i));
+  Opnd b = reg(GETARG_B(i));
+  Label notint = {0}, slow = {0}, done = {0};
+  guardtag(J, b, LUA_TNUMINT, &notint);
+  ldq(J, RAX, b.base, b.disp + VOFF);
+  emitreg(J, 0, 1, 0xf7, (op == LUA_OPUNM) ? 3 : 2, RAX);  /* neg/not */
+  setint(J, a, RAX);
+  jmpl(J, CC_ALWAYS, &done);
+  here(J, &notint);
+  if (op == LUA_OPUNM) {
+    guardtag(J, b, LUA_TNUMFLT, &slow);
+    ldq(J, RAX, b.base, b.disp + VOFF);
+    emitreg(J, 0, 1, 0x0fba, 7, RAX);  /* btc rax, 63 (flip sign) */
+    emitb(J, 63);
+    stq(J, a.base, a.disp + VOFF, RAX);
+    stdimm(J, a.base, a.disp + TOFF, LUA_TNUMFLT);
+    jmpl(J, CC_ALWAYS, &done);
+  }
+  here(J, &slow);
+  callarith(J, pc, op, a, b, b);
+  here(J, &done);
+}
+
+
+/* OP_EQ, OP_LT, OP_LE */
+static void compare (JitState *J, int pc, Instruction i, OpCode op) {
+  Opnd b = rk(J, GETARG_B(i));
+  Opnd c = rk(J, GETARG_C(i));
+  int a = GETARG_A(i);
+  Label notint = {0}, slow = {0};
+  if (canint(b) && canint(c)) {
+    guardtag(J, b, LUA_TNUMINT, &notint);
+    guardtag(J, c, LUA_TNUMINT, &notint);
+    ldq(J, RAX, b.base, b.disp + VOFF);
+    alu(J, XCMP, RAX, c.base, c.disp + VOFF);
+    condjump(J, pc, (op == OP_EQ) ? CC_E : (op == OP_LT) ? CC_L : CC_LE, a);
+  }
+  here(J, &notint);
+  if (op != OP_EQ && canflt(b) && canflt(c)) {
+    guardtag(J, b, LUA_TNUMFLT, &slow);
+    guardtag(J, c, LUA_TNUMFLT, &slow);
+    ldsd(J, 0, c.base, c.disp + VOFF);
+    ldsd(J, 1, b.base, b.disp + VOFF);
+    ucomisd(J, 0, 1);  /* c ? b: "above" means b < c (false if NaN) */
+    condjump(J, pc, (op == OP_LT) ? CC_A : CC_AE, a);
+  }
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, b);
+  leaop(J, RDX, c);
+  callhelper(J, pc, (op == OP_EQ) ? helper(luaV_equalobj)
+                  : (op == OP_LT) ? helper(luaV_lessthan)
+                  : helper(luaV_lessequal));
+  alurr(J, 0x85, RAX, RAX);  /* test rax, rax */
+  condjump(J, pc, CC_NE, a);
+}
+
+
+/* OP_LTI, OP_LEI, OP_GTI, OP_GEI */
+static void compareI (JitState *J, int pc, Instruction i, OpCode op) {
+  Opnd b = reg(GETARG_B(i));
+  int ic = sC2int(GETARG_C(i));
+  int a = GETARG_A(i);
+  Label notint = {0}, slow = {0};
+  guardtag(J, b, LUA_TNUMINT, &notint);
+  cmpimm(J, 1, b.base, b.disp + VOFF, ic);
+  condjump(J, pc, (op == OP_LTI) ? CC_L : (op == OP_LEI) ? CC_LE
+                : (op == OP_GTI) ? CC_G : CC_GE, a);
+  here(J, &notint);
+  guardtag(J, b, LUA_TNUMFLT, &slow);
+  ldsd(J, 0, b.base, b.disp + VOFF);
+  ldflt(J, 1, cast_num(ic));
+  if (op == OP_LTI || op == OP_LEI)
+    ucomisd(J, 1, 0);  /* ic ? b */
+  else
+    ucomisd(J, 0, 1);  /* b ? ic */
+  condjump(J, pc, (op == OP_LTI || op == OP_GTI) ? CC_A : CC_AE, a);
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, b);
+  movint(J, RDX, ic);
+  movint(J, RCX, op);
+  callhelper(J, pc, helper(orderimm));
+  alurr(J, 0x85, RAX, RAX);
+  condjump(J, pc, CC_NE, a);
+}
+
+
+static void eqk (JitState *J, int pc, Instruction i) {
+  Opnd b = reg(GETARG_B(i));
+  Opnd c = kst(J, INDEXK(GETARG_C(i)));
+  int a = GETARG_A(i);
+  Label slow = {0};
+  if (ttisshrstring(c.k)) {  /* short strings are internalized */
+    cmpimm(J, 0, b.base, b.disp + TOFF, ctb(LUA_TSHRSTR));
+    jmpto(J, CC_NE, J->entry[pc + (a ? 2 : 1)]);  /* different: false */
+    movimm(J, RAX, cast(size_t, tsvalue(c.k)));
+    alu(J, XCMP, RAX, b.base, b.disp + VOFF);
+    condjump(J, pc, CC_E, a);
+    return;
+  }
+  if (ttisinteger(c.k)) {
+    guardtag(J, b, LUA_TNUMINT, &slow);
+    movimm(J, RAX, l_castS2U(ivalue(c.k)));
+    alu(J, XCMP, RAX, b.base, b.disp + VOFF);
+    condjump(J, pc, CC_E, a);
+  }
+  here(J, &slow);
+  alurr(J, XXOR, RDI, RDI);  /* raw equality: L == NULL */
+  leaop(J, RSI, b);
+  leaop(J, RDX, c);
+  callhelper(J, pc, helper(luaV_equalobj));
+  alurr(J, 0x85, RAX, RAX);
+  condjump(J, pc, CC_NE, a);
+}
+
+
+/*
+** RCX = address of 't[key]' in the array part of table 't' (RAX = the
+** table), for an integer 'key'; jump to 'l' if there is no such slot.
+** If the array part is unboxed, jump to 'u' instead, with RCX = the
+** address of the element (see 'ltable.h').
+*/
+static void arrayslot (JitState *J, Opnd t, Opnd key, Label *l, Label *u) {
+  guardtag(J, t, ctb(LUA_TTABLE), l);
+  guardtag(J, key, LUA_TNUMINT, l);
+  ldq(J, RAX, t.base, t.disp + VOFF);
+  ldq(J, RCX, key.base, key.disp + VOFF);
+  lea(J, RCX, RCX, -1);
+  ldd(J, RDX, RAX, OFF(Table, sizearray));
+  alurr(J, XCMP, RCX, RDX);
+  jmpl(J, CC_AE, l);  /* (unsigned) key - 1 >= sizearray? */
+  lua_assert(sizeof(UValue) == 8);
+  lua_assert(SZV == 2 * sizeof(UValue));
+  emitreg(J, 0, 1, 0xc1, 4, RCX);  /* shl rcx, 3 */
+  emitb(J, 3);
+  alurr(J, XMOV, RDX, RCX);
+  alu(J, XADD, RCX, RAX, OFF(Table, array));
+  cmpbimm(J, RAX, OFF(Table, flags), ARREMPTY << 6);
+  jmpl(J, CC_AE, u);  /* unboxed array? */
+  alurr(J, XADD, RCX, RDX);  /* TValues take twice as much */
+}
+
+
+/* jump to 'l' unless the array part of table RAX has kind 'kind' */
+static void guardkind (JitState *J, int kind, Label *l) {
+  emitmem(J, 0, 0, 0x0fb6, RDX, RAX, OFF(Table, flags));  /* movzx */
+  emitreg(J, 0, 0, 0xc1, 5, RDX);  /* shr edx, 6 */
+  emitb(J, 6);
+  emitreg(J, 0, 0, 0x83, 7, RDX);  /* cmp edx, kind */
+  emitb(J, kind);
+  jmpl(J, CC_NE, l);
+}
+
+
+/*
+** R8 = address of the value of short-string 'key' in table 't' (RAX =
+** the table), according to the inline cache '*hint'; jump to 'l' if
+** the cached node (or slot, in a table with a shape) does not hold
+** that key
+*/
+static void cachedslot (JitState *J, Opnd t, const TValue *key,
+                        unsigned int *hint, Label *l) {
+#if defined(LUA_USE_SHAPES)
+  Label shaped = {0}, found = {0};
+#endif
+  guardtag(J, t, ctb(LUA_TTABLE), l);
+  ldq(J, RAX, t.base, t.disp + VOFF);
+  movimm(J, RDX, cast(size_t, hint));
+  ldd(J, R8, RDX, 0);
+#if defined(LUA_USE_SHAPES)
+  ldq(J, R9, RAX, OFF(Table, shape));
+  alurr(J, XTEST, R9, R9);
+  jmpl(J, CC_NE, &shaped);
+#endif
+  emitmem(J, 0, 0, 0x0fb6, RCX, RAX, OFF(Table, lsizenode));  /* movzx */
+  movint(J, RDX, 1);
+  emitreg(J, 0, 0, 0xd3, 4, RDX);  /* shl edx, cl: edx = sizenode */
+  emitreg(J, 0, 0, XCMP, R8, RDX);
+  jmpl(J, CC_AE, l);  /* hint out of range? */
+  emitreg(J, 0, 1, 0x69, R8, R8);  /* imul r8, r8, sizeof(Node) */
+  emit32(J, cast(unsigned int, sizeof(Node)));
+  alu(J, XADD, R8, RAX, OFF(Table, node));
+  cmpimm(J, 0, R8, OFF(Node, i_key.nk.tt_), ctb(LUA_TSHRSTR));
+  jmpl(J, CC_NE, l);
+  movimm(J, RDX, cast(size_t, tsvalue(key)));
+  alu(J, XCMP, RDX, R8, OFF(Node, i_key.nk.value_));
+  jmpl(J, CC_NE, l);
+  lea(J, R8, R8, OFF(Node, i_val));
+#if defined(LUA_USE_SHAPES)
+  jmpl(J, CC_ALWAYS, &found);
+  here(J, &shaped);  /* R9 = shape; the hint is a slot index */
+  emitmem(J, 0, 0, 0x0fb6, RCX, R9, OFF(Shape, nkeys));  /* movzx */
+  emitreg(J, 0, 0, XCMP, R8, RCX);
+  jmpl(J, CC_AE, l);  /* hint out of range? */
+  alurr(J, XMOV, R11, R8);
+  emitreg(J, 0, 1, 0xc1, 4, R8);  /* shl r8, 3 */
+  emitb(J, 3);
+  alurr(J, XADD, R8, R9);
+  movimm(J, RDX, cast(size_t, tsvalue(key)));
+  alu(J, XCMP, RDX, R8, OFF(Shape, keys));
+  jmpl(J, CC_NE, l);
+  emitreg(J, 0, 1, 0xc1, 4, R11);  /* shl r11, 4 */
+  emitb(J, 4);
+  lua_assert(SZV == 16);
+  ldq(J, R8, RAX, OFF(Table, slots));
+  alurr(J, XADD, R8, R11);
+  here(J, &found);
+#endif
+}
+
+
+/* jump to 'l' if storing 'v' into table RAX needs a barrier */
+static void tbarrier (JitState *J, Opnd v, Label *l) {
+  Label ok = {0};
+  if (v.k != NULL && !iscollectable(v.k))
+    return;
+  if (v.k == NULL) {
+    testbimm(J, v.base, v.disp + TOFF, BIT_ISCOLLECTABLE);
+    jmpl(J, CC_E, &ok);
+  }
+  testbimm(J, RAX, OFF(Table, marked), bitmask(BLACKBIT));
+  jmpl(J, CC_NE, l);
+  here(J, &ok);
+}
+
+
+/* load in R10 the value of upvalue 'n' */
+static Opnd upval (JitState *J, int n) {
+  ldq(J, R10, XCL, OFF(LClosure, upvals) + n * cast_int(sizeof(UpVal *)));
+  ldq(J, R10, R10, OFF(UpVal, v));
+  return ptr(R10);
+}
+
+
+static void gettab (JitState *J, int pc, Opnd t, Opnd key, Opnd a) {
+  Label slow = {0}, done = {0};
+  if (canint(key)) {
+    Label unboxed = {0}, flt = {0};
+    arrayslot(J, t, key, &slow, &unboxed);
+    cmpimm(J, 0, RCX, TOFF, LUA_TNIL);
+    jmpl(J, CC_E, &slow);  /* nil: may need a metamethod */
+    copyv(J, a.base, a.disp, RCX, 0);
+    jmpl(J, CC_ALWAYS, &done);
+    here(J, &unboxed);
+    guardkind(J, ARRINT, &flt);
+    ldq(J, RDX, RCX, 0);
+    movimm(J, R8, l_castS2U(NILINT));
+    alurr(J, XCMP, RDX, R8);
+    jmpl(J, CC_E, &slow);  /* nil element */
+    setint(J, a, RDX);
+    jmpl(J, CC_ALWAYS, &done);
+    here(J, &flt);
+    guardkind(J, ARRFLT, &slow);
+    ldsd(J, 0, RCX, 0);
+    ucomisd(J, 0, 0);
+    jmpl(J, CC_P, &slow);  /* NaN: nil element */
+    setflt(J, a, 0);
+    jmpl(J, CC_ALWAYS, &done);
+  }
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, t);
+  leaop(J, RDX, key);
+  leaop(J, RCX, a);
+  callhelper(J, pc, helper(gettable));
+  here(J, &done);
+}
+
+
+static void settab (JitState *J, int pc, Opnd t, Opnd key, Opnd v) {
+  Label slow = {0}, done = {0};
+  if (canint(key)) {
+    Label unboxed = {0}, uslow = {0};
+    arrayslot(J, t, key, &slow, &unboxed);
+    cmpimm(J, 0, RCX, TOFF, LUA_TNIL);
+    jmpl(J, CC_E, &slow);  /* nil: may need a metamethod */
+    tbarrier(J, v, &slow);
+    copyv(J, RCX, 0, v.base, v.disp);
+    jmpl(J, CC_ALWAYS, &done);
+    here(J, &unboxed);  /* only non-nil elements of the same kind */
+    if (v.k == NULL || ttisinteger(v.k)) {
+      Label flt = {0};
+      guardkind(J, ARRINT, &flt);
+      guardtag(J, v, LUA_TNUMINT, &uslow);
+      movimm(J, R8, l_castS2U(NILINT));
+      alu(J, XCMP, R8, RCX, 0);
+      jmpl(J, CC_E, &uslow);
+      ldq(J, RDX, v.base, v.disp + VOFF);
+      alurr(J, XCMP, RDX, R8);
+      jmpl(J, CC_E, &uslow);
+      stq(J, RCX, 0, RDX);
+      jmpl(J, CC_ALWAYS, &done);
+      here(J, &flt);
+    }
+    if (v.k == NULL || ttisfloat(v.k)) {
+      guardkind(J, ARRFLT, &uslow);
+      guardtag(J, v, LUA_TNUMFLT, &uslow);
+      ldsd(J, 0, RCX, 0);
+      ucomisd(J, 0, 0);
+      jmpl(J, CC_P, &uslow);
+      ldsd(J, 0, v.base, v.disp + VOFF);
+      ucomisd(J, 0, 0);
+      jmpl(J, CC_P, &uslow);
+      stsd(J, RCX, 0, 0);
+      jmpl(J, CC_ALWAYS, &done);
+    }
+    here(J, &uslow);
+  }
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, t);
+  leaop(J, RDX, key);
+  leaop(J, RCX, v);
+  callhelper(J, pc, helper(settable));
+  here(J, &done);
+}
+
+
+static void getfld (JitState *J, int pc, Opnd t, Opnd key, Opnd a) {
+  unsigned int *hint = J->p->icache + pc;
+  Label slow = {0}, done = {0};
+  cachedslot(J, t, key.k, hint, &slow);
+  cmpimm(J, 0, R8, TOFF, LUA_TNIL);
+  jmpl(J, CC_E, &slow);
+  copyv(J, a.base, a.disp, R8, 0);
+  jmpl(J, CC_ALWAYS, &done);
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, t);
+  leaop(J, RDX, key);
+  leaop(J, RCX, a);
+  movimm(J, R8, cast(size_t, hint));
+  callhelper(J, pc, helper(getfield));
+  here(J, &done);
+}
+
+
+static void setfld (JitState *J, int pc, Opnd t, Opnd key, Opnd v) {
+  unsigned int *hint = J->p->icache + pc;
+  Label slow = {0}, done = {0};
+  cachedslot(J, t, key.k, hint, &slow);
+  cmpimm(J, 0, R8, TOFF, LUA_TNIL);
+  jmpl(J, CC_E, &slow);
+  tbarrier(J, v, &slow);
+  copyv(J, R8, 0, v.base, v.disp);
+  jmpl(J, CC_ALWAYS, &done);
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, t);
+  leaop(J, RDX, key);
+  leaop(J, RCX, v);
+  movimm(J, R8, cast(size_t, hint));
+  callhelper(J, pc, helper(setfield));
+  here(J, &done);
+}
+
+
+static void selfop (JitState *J, int pc, Instruction i) {
+  Opnd a = reg(GETARG_A(i));
+  Opnd b = reg(GETARG_B(i));
+  Opnd c = rk(J, GETARG_C(i));
+  unsigned int *hint = J->p->icache + pc;
+  Label slow = {0}, done = {0};
+  if (c.k != NULL && ttisshrstring(c.k)) {
+    cachedslot(J, b, c.k, hint, &slow);
+    cmpimm(J, 0, R8, TOFF, LUA_TNIL);
+    jmpl(J, CC_E, &slow);
+    copyv(J, a.base, a.disp + SZV, b.base, b.disp);
+    copyv(J, a.base, a.disp, R8, 0);
+    jmpl(J, CC_ALWAYS, &done);
+  }
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, a);
+  leaop(J, RDX, b);
+  leaop(J, RCX, c);
+  movimm(J, R8, cast(size_t, hint));
+  callhelper(J, pc, helper(self));
+  here(J, &done);
+}
+
+
+/* OP_ADDI, OP_SUBI */
+static void arithI (JitState *J, int pc, Instruction i, int op) {
+  Opnd a = reg(GETARG_A(i));
+  Opnd b = reg(GETARG_B(i));
+  int ic = sC2int(GETARG_C(i));
+  Label notint = {0}, slow = {0}, done = {0};
+  guardtag(J, b, LUA_TNUMINT, &notint);
+  ldq(J, RAX, b.base, b.disp + VOFF);
+  movint(J, RCX, ic);
+  emitreg(J, 0, 1, 0x63, RCX, RCX);  /* movsxd rcx, ecx */
+  alurr(J, (op == LUA_OPADD) ? XADD : XSUB, RAX, RCX);
+  setint(J, a, RAX);
+  jmpl(J, CC_ALWAYS, &done);
+  here(J, &notint);
+  guardtag(J, b, LUA_TNUMFLT, &slow);
+  ldsd(J, 0, b.base, b.disp + VOFF);
+  ldflt(J, 1, cast_num(ic));
+  emitreg(J, 0xf2, 0, (op == LUA_OPADD) ? XADDSD : XSUBSD, 0, 1);
+  setflt(J, a, 0);
+  jmpl(J, CC_ALWAYS, &done);
+  here(J, &slow);
+  alurr(J, XMOV, RDI, XL);
+  leaop(J, RSI, a);
+  leaop(J, RDX, b);
+  movint(J, RCX, ic);
+  movint(J, R8, op);
+  callhelper(J, pc, helper(arithimm));
+  here(J, &done);
+}
+
+
+static void forloop (JitState *J, int pc, Instruction i) {
+  Opnd a = reg(GETARG_A(i));
+  int target = pc + 1 + GETARG_sBx(i);
+  Label notint = {0}, neg = {0}, cont = {0}, fpos = {0}, fcont = {0};
+  Label done = {0};
+  guardtag(J, a, LUA_TNUMINT, &notint);
+  ldq(J, RAX, a.base, a.disp + VOFF);  /* index */
+  ldq(J, RCX, a.base, a.disp + 2*SZV + VOFF);  /* step */
+  alurr(J, XADD, RAX, RCX);
+  ldq(J, RDX, a.base, a.disp + SZV + VOFF);  /* limit */
+  alurr(J, 0x85, RCX, RCX);
+  jmpl(J, CC_LE, &neg);
+  alurr(J, XCMP, RAX, RDX);
+  jmpl(J, CC_G, &done);  /* index > limit: loop ends */
+  jmpl(J, CC_ALWAYS, &cont);
+  here(J, &neg);
+  alurr(J, XCMP, RDX, RAX);
+  jmpl(J, CC_G, &done);  /* limit > index: loop ends */
+  here(J, &cont);
+  stq(J, a.base, a.disp + VOFF, RAX);  /* update internal index... */
+  setint(J, reg(GETARG_A(i) + 3), RAX);  /* ...and external index */
+  backedge(J, target);
+  here(J, &notint);  /* floating loop */
+  ldsd(J, 0, a.base, a.disp + VOFF);
+  emitmem(J, 0xf2, 0, XADDSD, 0, a.base, a.disp + 2*SZV + VOFF);
+  ldsd(J, 1, a.base, a.disp + SZV + VOFF);  /* limit */
+  ldsd(J, 2, a.base, a.disp + 2*SZV + VOFF);  /* step */
+  emitreg(J, 0, 0, 0x0f57, 3, 3);  /* xorps xmm3, xmm3 */
+  ucomisd(J, 2, 3);
+  jmpl(J, CC_A, &fpos);  /* 0 < step? */
+  ucomisd(J, 0, 1);
+  jmpl(J, CC_B, &done);  /* not (limit <= index): loop ends */
+  jmpl(J, CC_ALWAYS, &fcont);
+  here(J, &fpos);
+  ucomisd(J, 1, 0);
+  jmpl(J, CC_B, &done);  /* not (index <= limit): loop ends */
+  here(J, &fcont);
+  stsd(J, a.base, a.disp + VOFF, 0);
+  setflt(J, reg(GETARG_A(i) + 3), 0);
+  backedge(J, target);
+  here(J, &done);
+}
+
+
+/* translate instruction 'pc' */
+static void emitop (JitState *J, int pc) {
+  Proto *p = J->p;
+  Instruction i = p->code[pc];
+  OpCode op = GET_OPCODE(i);
+  Opnd a = reg(GETARG_A(i));
+  switch (op) {
+    case OP_MOVE: {
+      Opnd b = reg(GETARG_B(i));
+      copyv(J, a.base, a.disp, b.base, b.disp);
+      break;
+    }
+    case OP_LOADK: {
+      Opnd b = kst(J, GETARG_Bx(i));
+      copyv(J, a.base, a.disp, b.base, b.disp);
+      break;
+    }
+    case OP_LOADKX: {
+      Opnd b = kst(J, GETARG_Ax(p->code[pc + 1]));
+      copyv(J, a.base, a.disp, b.base, b.disp);
+      break;  /* OP_EXTRAARG emits no code */
+    }
+    case OP_LOADBOOL: {
+      stdimm(J, a.base, a.disp + VOFF, GETARG_B(i));
+      stdimm(J, a.base, a.disp + TOFF, LUA_TBOOLEAN);
+      if (GETARG_C(i))
+        jmpto(J, CC_ALWAYS, J->entry[pc + 2]);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      if (b < 8) {
+        int j;
+        for (j = 0; j <= b; j++)
+          stdimm(J, a.base, a.disp + j * SZV + TOFF, LUA_TNIL);
+      }
+      else {
+        size_t loop;
+        lea(J, RAX, a.base, a.disp);
+        movint(J, RCX, b + 1);
+        loop = J->n;
+        stdimm(J, RAX, TOFF, LUA_TNIL);
+        emitreg(J, 0, 1, 0x83, 0, RAX);  /* add rax, sizeof(TValue) */
+        emitb(J, SZV);
+        emitreg(J, 0, 0, 0xff, 1, RCX);  /* dec ecx */
+        jmpto(J, CC_NE, loop);
+      }
+      break;
+    }
+    case OP_GETUPVAL: {
+      Opnd u = upval(J, GETARG_B(i));
+      copyv(J, a.base, a.disp, u.base, u.disp);
+      break;
+    }
+    case OP_SETUPVAL: {
+      Label slow = {0}, done = {0};
+      int b = GETARG_B(i);
+      ldq(J, RSI, XCL, OFF(LClosure, upvals) + b * cast_int(sizeof(UpVal *)));
+      testbimm(J, a.base, a.disp + TOFF, BIT_ISCOLLECTABLE);
+      jmpl(J, CC_NE, &slow);  /* may need a barrier */
+      ldq(J, RCX, RSI, OFF(UpVal, v));
+      copyv(J, RCX, 0, a.base, a.disp);
+      jmpl(J, CC_ALWAYS, &done);
+      here(J, &slow);
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RDX, a);
+      callhelper(J, pc, helper(setupval));
+      here(J, &done);
+      break;
+    }
+    case OP_GETTABUP: {
+      gettab(J, pc, upval(J, GETARG_B(i)), rk(J, GETARG_C(i)), a);
+      break;
+    }
+    case OP_GETTABLE: {
+      gettab(J, pc, reg(GETARG_B(i)), rk(J, GETARG_C(i)), a);
+      break;
+    }
+    case OP_SETTABUP: {
+      settab(J, pc, upval(J, GETARG_A(i)), rk(J, GETARG_B(i)),
+                    rk(J, GETARG_C(i)));
+      break;
+    }
+    case OP_SETTABLE: {
+      settab(J, pc, a, rk(J, GETARG_B(i)), rk(J, GETARG_C(i)));
+      break;
+    }
+    case OP_GETFIELD: {
+      getfld(J, pc, reg(GETARG_B(i)), kst(J, INDEXK(GETARG_C(i))), a);
+      break;
+    }
+    case OP_GETUPFIELD: {
+      getfld(J, pc, upval(J, GETARG_B(i)), kst(J, INDEXK(GETARG_C(i))), a);
+      break;
+    }
+    case OP_SETFIELD: {
+      setfld(J, pc, a, kst(J, INDEXK(GETARG_B(i))), rk(J, GETARG_C(i)));
+      break;
+    }
+    case OP_SETUPFIELD: {
+      setfld(J, pc, upval(J, GETARG_A(i)), kst(J, INDEXK(GETARG_B(i))),
+                    rk(J, GETARG_C(i)));
+      break;
+    }
+    case OP_NEWTABLE: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      movint(J, RDX, GETARG_B(i));
+      movint(J, RCX, GETARG_C(i));
+      callhelper(J, pc, helper(newtable));
+      break;
+    }
+    case OP_SELF: {
+      selfop(J, pc, i);
+      break;
+    }
+    case OP_ADD: arith(J, pc, i, LUA_OPADD, XADD, XADDSD); break;
+    case OP_SUB: arith(J, pc, i, LUA_OPSUB, XSUB, XSUBSD); break;
+    case OP_MUL: arith(J, pc, i, LUA_OPMUL, XIMUL, XMULSD); break;
+    case OP_DIV: arith(J, pc, i, LUA_OPDIV, 0, XDIVSD); break;
+    case OP_BAND: arith(J, pc, i, LUA_OPBAND, XAND, 0); break;
+    case OP_BOR: arith(J, pc, i, LUA_OPBOR, XOR, 0); break;
+    case OP_BXOR: arith(J, pc, i, LUA_OPBXOR, XXOR, 0); break;
+    case OP_SHL: arith(J, pc, i, LUA_OPSHL, 0, 0); break;
+    case OP_SHR: arith(J, pc, i, LUA_OPSHR, 0, 0); break;
+    case OP_POW: arith(J, pc, i, LUA_OPPOW, 0, 0); break;
+    case OP_MOD: arithdiv(J, pc, i, LUA_OPMOD); break;
+    case OP_IDIV: arithdiv(J, pc, i, LUA_OPIDIV); break;
+    case OP_UNM: unary(J, pc, i, LUA_OPUNM); break;
+    case OP_BNOT: unary(J, pc, i, LUA_OPBNOT); break;
+    case OP_ADDI: arithI(J, pc, i, LUA_OPADD); break;
+    case OP_SUBI: arithI(J, pc, i, LUA_OPSUB); break;
+    case OP_NOT: {
+      Label isfalse = {0}, done = {0};
+      jmptruth(J, reg(GETARG_B(i)), 1, &isfalse);
+      stdimm(J, a.base, a.disp + VOFF, 0);
+      jmpl(J, CC_ALWAYS, &done);
+      here(J, &isfalse);
+      stdimm(J, a.base, a.disp + VOFF, 1);
+      here(J, &done);
+      stdimm(J, a.base, a.disp + TOFF, LUA_TBOOLEAN);
+      break;
+    }
+    case OP_LEN: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      leaop(J, RDX, reg(GETARG_B(i)));
+      callhelper(J, pc, helper(luaV_objlen));
+      break;
+    }
+    case OP_CONCAT: {
+      alurr(J, XMOV, RDI, XL);
+      movint(J, RSI, GETARG_A(i));
+      movint(J, RDX, GETARG_B(i));
+      movint(J, RCX, GETARG_C(i));
+      callhelper(J, pc, helper(concat));
+      break;
+    }
+    case OP_JMP: {
+      int target = pc + 1 + GETARG_sBx(i);
+      if (GETARG_A(i) != 0) {  /* close upvalues? */
+        alurr(J, XMOV, RDI, XL);
+        lea(J, RSI, XBASE, (GETARG_A(i) - 1) * SZV);
+        callhelper(J, pc, helper(luaF_close));
+      }
+      if (target <= pc)
+        backedge(J, target);
+      else
+        jmpto(J, CC_ALWAYS, J->entry[target]);
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {
+      compare(J, pc, i, op);
+      break;
+    }
+    case OP_EQK: {
+      eqk(J, pc, i);
+      break;
+    }
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      compareI(J, pc, i, op);
+      break;
+    }
+    case OP_TEST: {
+      Label skip = {0};
+      jmptruth(J, a, GETARG_C(i), &skip);
+      jmpto(J, CC_ALWAYS, J->entry[pc + 1]);
+      here(J, &skip);
+      jmpto(J, CC_ALWAYS, J->entry[pc + 2]);
+      break;
+    }
+    case OP_TESTSET: {
+      Opnd b = reg(GETARG_B(i));
+      Label skip = {0};
+      jmptruth(J, b, GETARG_C(i), &skip);
+      copyv(J, a.base, a.disp, b.base, b.disp);
+      jmpto(J, CC_ALWAYS, J->entry[pc + 1]);
+      here(J, &skip);
+      jmpto(J, CC_ALWAYS, J->entry[pc + 2]);
+      break;
+    }
+    case OP_CALL: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      movint(J, RDX, GETARG_B(i));
+      movint(J, RCX, GETARG_C(i) - 1);
+      callhelper(J, pc, helper(call));
+      alurr(J, 0x85, RAX, RAX);
+      jmpto(J, CC_NE, J->epilogue);  /* called a Lua function? */
+      break;
+    }
+    case OP_TAILCALL: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      movint(J, RDX, GETARG_B(i));
+      callhelper(J, pc, helper(tailcall));
+      alurr(J, 0x85, RAX, RAX);
+      jmpto(J, CC_NE, J->epilogue);  /* called a Lua function? */
+      break;
+    }
+    case OP_RETURN: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      movint(J, RDX, GETARG_B(i));
+      callhelper(J, pc, helper(ret));
+      jmpto(J, CC_ALWAYS, J->epilogue);
+      break;
+    }
+    case OP_FORLOOP: {
+      forloop(J, pc, i);
+      break;
+    }
+    case OP_FORPREP: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      callhelper(J, pc, helper(luaV_forprep));
+      jmpto(J, CC_ALWAYS, J->entry[pc + 1 + GETARG_sBx(i)]);
+      break;
+    }
+    case OP_TFORCALL: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      movint(J, RDX, GETARG_C(i));
+      callhelper(J, pc, helper(tforcall));
+      break;  /* go on to the OP_TFORLOOP */
+    }
+    case OP_TFORLOOP: {
+      Label done = {0};
+      cmpimm(J, 0, a.base, a.disp + SZV + TOFF, LUA_TNIL);
+      jmpl(J, CC_E, &done);
+      copyv(J, a.base, a.disp, a.base, a.disp + SZV);
+      backedge(J, pc + 1 + GETARG_sBx(i));
+      here(J, &done);
+      break;
+    }
+    case OP_SETLIST: {
+      int c = GETARG_C(i);
+      if (c == 0)
+        c = GETARG_Ax(p->code[pc + 1]);
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      movint(J, RDX, GETARG_B(i));
+      movint(J, RCX, c);
+      callhelper(J, pc, helper(setlist));
+      break;  /* OP_EXTRAARG emits no code */
+    }
+    case OP_CLOSURE: {
+      alurr(J, XMOV, RDI, XL);
+      leaop(J, RSI, a);
+      movint(J, RDX, GETARG_Bx(i));
+      callhelper(J, pc, helper(closure));
+      break;
+    }
+    case OP_VARARG: {
+      alurr(J, XMOV, RDI, XL);
+      movint(J, RSI, GETARG_A(i));
+      movint(J, RDX, GETARG_B(i));
+      callhelper(J, pc, helper(vararg));
+      break;
+    }
+    case OP_EXTRAARG: {
+      break;
+    }
+    default: {  /* no template; let the interpreter do it */
+      exitto(J, pc);
+      break;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Compilation
+** =======================================================
+*/
+
+/*
+** The code starts with the entry stub, called as
+** 'int f (lua_State *L, const void *target)': it saves the callee-saved
+** registers, sets up the fixed ones, and jumps to 'target'. The exit
+** stub (epilogue) returns the value in eax.
+*/
+static void stubs (JitState *J) {
+  push(J, RBX); push(J, R12); push(J, R13); push(J, R14); push(J, R15);
+  alurr(J, XMOV, XL, RDI);
+  ldq(J, XCI, XL, OFF(lua_State, ci));
+  ldq(J, XBASE, XCI, OFF(CallInfo, u.l.base));
+  ldq(J, RAX, XCI, OFF(CallInfo, func));
+  ldq(J, XCL, RAX, VOFF);
+  ldq(J, RAX, XCL, OFF(LClosure, p));
+  ldq(J, XK, RAX, OFF(Proto, k));
+  emitb(J, 0xff); emitb(J, 0xe6);  /* jmp rsi */
+  J->epilogue = J->n;
+  pop(J, R15); pop(J, R14); pop(J, R13); pop(J, R12); pop(J, RBX);
+  emitb(J, 0xc3);  /* ret */
+}
+
+
+static void emitcode (JitState *J) {
+  int pc;
+  J->n = 0;
+  stubs(J);
+  for (pc = 0; pc < J->p->sizecode; pc++) {
+    size_t start = J->n;
+    J->entry[pc] = cast(unsigned int, start);
+    emitop(J, pc);
+    lua_assert(J->n - start <= MAXTEMPLATE);
+  }
+  J->entry[pc] = cast(unsigned int, J->n);
+  emitb(J, 0x0f); emitb(J, 0x0b);  /* ud2 (code never gets here) */
+}
+
+
+/*
+** Compile prototype 'p'. Code is generated twice: the first pass
+** computes the offsets of all instructions, so that the second can
+** emit forward jumps. Returns 0 if it could not allocate executable
+** memory.
+*/
+static int compile (Proto *p) {
+  JitState J;
+  size_t page = cast(size_t, sysconf(_SC_PAGESIZE));
+  size_t head = offsetof(JitCode, entry) +
+                (p->sizecode + 1) * sizeof(unsigned int);
+  size_t size, used;
+  JitCode *jc;
+  head = (head + 15) & ~cast(size_t, 15);  /* align the code */
+  size = head + STUBSIZE + cast(size_t, p->sizecode) * MAXTEMPLATE;
+  size = (size + page - 1) & ~(page - 1);
+  jc = cast(JitCode *, mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (jc == cast(JitCode *, MAP_FAILED))
+    return 0;
+  J.p = p;
+  J.buff = cast(unsigned char *, jc) + head;
+  J.size = size - head;
+  J.entry = jc->entry;
+  emitcode(&J);  /* first pass */
+  emitcode(&J);  /* second pass */
+  lua_assert(J.n <= J.size);
+  used = (head + J.n + page - 1) & ~(page - 1);
+  if (used < size)  /* release unused pages */
+    munmap(cast(char *, jc) + used, size - used);
+  jc->size = used;
+  jc->mcode = J.buff;
+  if (mprotect(jc, used, PROT_READ | PROT_EXEC) != 0) {
+    munmap(jc, used);
+    return 0;
+  }
+  p->jit = jc;
+  return 1;
+}
+
+
+typedef int (*JitFunction) (lua_State *L, const void *target);
+
+
+/* run native code of 'p' from the current instruction of 'ci' */
+static int runjit (lua_State *L, CallInfo *ci, Proto *p) {
+  JitCode *jc = p->jit;
+  JitFunction f = (JitFunction)cast(void *, jc->mcode);
+  lua_assert(ci == L->ci && !L->hookmask);
+  return f(L, jc->mcode + jc->entry[ci->u.l.savedpc - p->code]);
+}
+
+
+/*
+** Called by the interpreter at a hot event of the function running in
+** 'ci' (its counter 'hotcount' reached zero). If the JIT is on, compile
+** the function (if needed) and run its native code until it exits.
+** While native code changes frames, go on running native code in the
+** new frames that are hot too. Returns JIT_CONTINUE if the interpreter
+** must go on running 'ci', JIT_NEWFRAME if it must run 'L->ci', or
+** JIT_RETURN if the frame that started the current 'luaV_execute'
+** returned.
+*/
+int luaJ_hot (lua_State *L, CallInfo *ci) {
+  global_State *g = G(L);
+  int status = JIT_CONTINUE;
+  Proto *p = clLvalue(ci->func)->p;
+  for (;;) {
+    int res;
+    if (!g->jiton || L->hookmask) {  /* no native code now? */
+      p->hotcount = g->jithot;  /* count again */
+      return status;
+    }
+    if (p->jit == NULL && !compile(p)) {
+      p->hotcount = INT_MAX;  /* do not try again */
+      return status;
+    }
+    p->hotcount = 1;  /* run native code at every hot event */
+    res = runjit(L, ci, p);
+    if (res != JIT_NEWFRAME)
+      return (res == JIT_RETURN) ? JIT_RETURN : status;
+    status = JIT_NEWFRAME;
+    ci = L->ci;
+    p = clLvalue(ci->func)->p;
+    if (--p->hotcount > 0)  /* new frame is not hot? */
+      return status;
+  }
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  UNUSED(L);
+  if (p->jit != NULL)
+    munmap(p->jit, p->jit->size);
+}
+
+/* }====================================================== */
+
+
+#else			/* }{ */
+
+
+int luaJ_hot (lua_State *L, CallInfo *ci) {
+  clLvalue(ci->func)->p->hotcount = INT_MAX;
+  UNUSED(L);
+  return JIT_CONTINUE;
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  UNUSED(L); UNUSED(p);
+}
+
+
+#endif			/* } */
+
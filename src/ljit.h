@@ -0,0 +1,45 @@
+/*
+** $Id: ljit.h $
+** Template JIT compiler for x86-64
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** Number of hot events (calls, returns, and loop back edges) a
+** function must go through before being compiled
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	100
+#endif
+
+
+/*
+** Native code of a prototype. It lives at the start of its own block
+** of executable memory, followed by the native offset of each
+** instruction and by the machine code.
+*/
+typedef struct JitCode {
+  size_t size;  /* size of the whole block */
+  unsigned char *mcode;  /* machine code (starting with the entry stub) */
+  unsigned int entry[1];  /* offset in 'mcode' of each instruction */
+} JitCode;
+
+
+/* results of 'luaJ_hot' */
+#define JIT_CONTINUE	0	/* interpreter goes on running the same frame */
+#define JIT_NEWFRAME	1	/* interpreter must run frame 'L->ci' */
+#define JIT_RETURN	2	/* frame fresh from 'luaV_execute' returned */
+
+
+LUAI_FUNC int luaJ_hot (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#endif
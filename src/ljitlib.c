@@ -0,0 +1,60 @@
+/*
+** $Id: ljitlib.c $
+** Library to control the JIT compiler
+** See Copyright Notice in lua.h
+*/
+
+#define ljitlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static int jit_on (lua_State *L) {
+  lua_pushboolean(L, lua_jit(L, LUA_JITON, 0));
+  return 1;
+}
+
+
+static int jit_off (lua_State *L) {
+  lua_jit(L, LUA_JITOFF, 0);
+  return 0;
+}
+
+
+static int jit_status (lua_State *L) {
+  lua_pushboolean(L, lua_jit(L, LUA_JITISON, 0));
+  return 1;
+}
+
+
+static int jit_hot (lua_State *L) {
+  int n = (int)luaL_optinteger(L, 1, 0);
+  int old = lua_jit(L, LUA_JITSETHOT, n);
+  if (n == 0)  /* only a query? */
+    lua_jit(L, LUA_JITSETHOT, old);  /* restore threshold */
+  lua_pushinteger(L, old);
+  return 1;
+}
+
+
+static const luaL_Reg jitlib[] = {
+  {"on", jit_on},
+  {"off", jit_off},
+  {"status", jit_status},
+  {"hot", jit_hot},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_jit (lua_State *L) {
+  luaL_newlib(L, jitlib);
+  return 1;
+}
+
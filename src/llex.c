@@ -136,7 +136,9 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* t[string] = true */
     luaC_checkGC(L);
   }
-  else {  /* string already present */
+  else if (ts->tt == LUA_TLNGSTR) {  /* long string already present? */
+    /* (short strings are internalized; also, their entry may be a slot
+       of a shape, which has no key) */
     ts = tsvalue(keyfromval(o));  /* re-use value previously stored */
   }
   L->top--;  /* remove string from stack */
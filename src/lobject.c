@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <stdarg.h>
@@ -32,6 +33,15 @@
 
 LUAI_DDEF const TValue luaO_nilobject_ = {NILCONSTANT};
 
+#if defined(LUA_NANBOX_INT32)
+LUAI_DDEF const lu_byte luaO_nbtt[16] = {
+  LUA_TNUMFLT, LUA_TNIL, LUA_TBOOLEAN, LUA_TLIGHTUSERDATA,
+  LUA_TNUMINT, LUA_TLCF, ctb(LUA_TLCL), ctb(LUA_TCCL),
+  ctb(LUA_TSHRSTR), ctb(LUA_TLNGSTR), ctb(LUA_TTABLE), ctb(LUA_TUSERDATA),
+  ctb(LUA_TTHREAD), ctb(LUA_TPROTO), LUA_TDEADKEY, LUA_TNUMFLT
+};
+#endif
+
 
 /*
 ** converts an integer to a "floating point byte", represented as
@@ -243,6 +253,426 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
+/*
+** {==================================================================
+** Fast conversions between floats and decimal numerals
+** ===================================================================
+*/
+
+/*
+** These conversions need 64-bit integers and IEEE doubles evaluated
+** without extra precision.
+*/
+#if !defined(LUA_USE_C89) && LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && \
+    DBL_MANT_DIG == 53 && defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define L_FASTNUM
+#endif
+
+
+#if defined(L_FASTNUM)	/* { */
+
+typedef unsigned long long l_uint64;
+
+
+/* powers of 10 that are exact doubles */
+static const double pow10flt[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+#if defined(__SIZEOF_INT128__)
+
+typedef unsigned __int128 l_uint128;
+
+/* powers of 5 that fit in 63 bits */
+static const l_uint64 pow5[] = {
+  1ULL, 5ULL, 25ULL, 125ULL, 625ULL, 3125ULL, 15625ULL, 78125ULL,
+  390625ULL, 1953125ULL, 9765625ULL, 48828125ULL, 244140625ULL,
+  1220703125ULL, 6103515625ULL, 30517578125ULL, 152587890625ULL,
+  762939453125ULL, 3814697265625ULL, 19073486328125ULL, 95367431640625ULL,
+  476837158203125ULL, 2384185791015625ULL, 11920928955078125ULL,
+  59604644775390625ULL, 298023223876953125ULL, 1490116119384765625ULL,
+  7450580596923828125ULL
+};
+
+
+/*
+** Return 'x * 2^e' correctly rounded (ties to even); 'sticky' tells
+** whether the exact value is a little above 'x'.
+*/
+static double int2flt (l_uint128 x, int e, int sticky) {
+  int shift = 0;
+  l_uint64 m;
+  while ((x >> shift) >= ((l_uint128)1 << 53)) shift++;
+  m = (l_uint64)(x >> shift);
+  if (shift > 0) {
+    l_uint128 rest = x & ((((l_uint128)1) << shift) - 1);
+    l_uint128 half = ((l_uint128)1) << (shift - 1);
+    if (rest > half || (rest == half && (sticky || (m & 1))))
+      m++;  /* round up */
+  }
+  return ldexp((double)m, e + shift);
+}
+
+#endif
+
+
+/*
+** Compute 'm * 10^e' correctly rounded into '*res', if machine
+** arithmetic can do it exactly; otherwise return 0.
+*/
+static int dec2flt (l_uint64 m, int e, double *res) {
+  if (m == 0)
+    *res = 0.0;
+  else if (m <= ((l_uint64)1 << 53) && -22 <= e && e <= 22) {
+    /* both 'm' and 10^|e| are exact, so the result has one rounding */
+    *res = (e >= 0) ? (double)m * pow10flt[e] : (double)m / pow10flt[-e];
+  }
+#if defined(__SIZEOF_INT128__)
+  else if (0 <= e && e <= 27)  /* 'm * 5^e' fits in 128 bits */
+    *res = int2flt((l_uint128)m * pow5[e], e, 0);
+  else if (-27 <= e && e < 0) {
+    /* divide 'm' (shifted to 127 bits) by 5^-e; quotient has 64+ bits */
+    int lz = 0;
+    l_uint128 n, q;
+    while (!(m & 0x8000000000000000ULL)) { m <<= 1; lz++; }
+    n = (l_uint128)m << 63;
+    q = n / pow5[-e];
+    *res = int2flt(q, e - lz - 63, (q * pow5[-e] != n));
+  }
+#endif
+  else
+    return 0;
+  return 1;
+}
+
+
+/*
+** Convert a decimal numeral with at most 19 significant digits whose
+** value 'dec2flt' can compute. Return NULL for anything else, which
+** is left to 'lua_str2number'.
+*/
+static const char *l_str2dfast (const char *s, lua_Number *result) {
+  l_uint64 m = 0;  /* significant digits */
+  int nsig = 0;  /* number of significant digits */
+  int ndig = 0;  /* number of digits */
+  int e = 0;  /* decimal exponent */
+  int neg;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (; lisdigit(cast_uchar(*s)); s++, ndig++) {
+    if (nsig == 0 && *s == '0') continue;  /* leading zero */
+    if (nsig++ == 19) return NULL;  /* too many digits */
+    m = m * 10 + (*s - '0');
+  }
+  if (*s == '.') {
+    for (s++; lisdigit(cast_uchar(*s)); s++, ndig++) {
+      e--;
+      if (nsig == 0 && *s == '0') continue;  /* leading zero */
+      if (nsig++ == 19) return NULL;  /* too many digits */
+      m = m * 10 + (*s - '0');
+    }
+  }
+  if (ndig == 0) return NULL;
+  if (*s == 'e' || *s == 'E') {  /* exponent part? */
+    int exp1 = 0;
+    int neg1;
+    s++;  /* skip 'e' */
+    neg1 = isneg(&s);
+    if (!lisdigit(cast_uchar(*s))) return NULL;
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (exp1 < 10000) exp1 = exp1 * 10 + (*s - '0');
+    }
+    e += (neg1) ? -exp1 : exp1;
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0' || !dec2flt(m, e, result)) return NULL;
+  if (neg) *result = -*result;
+  return s;
+}
+
+
+#if !defined(LUA_COMPAT_NUMBER2STR)	/* { */
+
+/*
+** Grisu3 (Florian Loitsch, "Printing Floating-Point Numbers Quickly
+** and Accurately with Integers") finds the shortest digits that read
+** back as a given double using only 64-bit integers. In the few cases
+** where it cannot prove its result, 'fltdigits' falls back to 'printf'.
+*/
+
+/* a floating-point value f * 2^e */
+typedef struct Fp {
+  l_uint64 f;
+  int e;
+} Fp;
+
+
+static Fp fpmake (l_uint64 f, int e) {
+  Fp r;
+  r.f = f; r.e = e;
+  return r;
+}
+
+
+static Fp fpnormalize (Fp x) {
+  while (!(x.f & 0xFFC0000000000000ULL)) { x.f <<= 10; x.e -= 10; }
+  while (!(x.f & 0x8000000000000000ULL)) { x.f <<= 1; x.e--; }
+  return x;
+}
+
+
+/* product of 'x' and 'y', rounded to 64 bits */
+static Fp fpmul (Fp x, Fp y) {
+  l_uint64 a = x.f >> 32, b = x.f & 0xFFFFFFFFu;
+  l_uint64 c = y.f >> 32, d = y.f & 0xFFFFFFFFu;
+  l_uint64 ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  l_uint64 tmp = (bd >> 32) + (ad & 0xFFFFFFFFu) + (bc & 0xFFFFFFFFu);
+  tmp += 1u << 31;  /* round */
+  return fpmake(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64);
+}
+
+
+/* normalized powers 10^k, for k = -348, -340, ..., 340 */
+static const struct {
+  l_uint64 f;
+  short e;
+  short k;
+} cachedpow[] = {
+  {0xfa8fd5a0081c0288ULL, -1220, -348}, {0xbaaee17fa23ebf76ULL, -1193, -340},
+  {0x8b16fb203055ac76ULL, -1166, -332}, {0xcf42894a5dce35eaULL, -1140, -324},
+  {0x9a6bb0aa55653b2dULL, -1113, -316}, {0xe61acf033d1a45dfULL, -1087, -308},
+  {0xab70fe17c79ac6caULL, -1060, -300}, {0xff77b1fcbebcdc4fULL, -1034, -292},
+  {0xbe5691ef416bd60cULL, -1007, -284}, {0x8dd01fad907ffc3cULL, -980, -276},
+  {0xd3515c2831559a83ULL, -954, -268}, {0x9d71ac8fada6c9b5ULL, -927, -260},
+  {0xea9c227723ee8bcbULL, -901, -252}, {0xaecc49914078536dULL, -874, -244},
+  {0x823c12795db6ce57ULL, -847, -236}, {0xc21094364dfb5637ULL, -821, -228},
+  {0x9096ea6f3848984fULL, -794, -220}, {0xd77485cb25823ac7ULL, -768, -212},
+  {0xa086cfcd97bf97f4ULL, -741, -204}, {0xef340a98172aace5ULL, -715, -196},
+  {0xb23867fb2a35b28eULL, -688, -188}, {0x84c8d4dfd2c63f3bULL, -661, -180},
+  {0xc5dd44271ad3cdbaULL, -635, -172}, {0x936b9fcebb25c996ULL, -608, -164},
+  {0xdbac6c247d62a584ULL, -582, -156}, {0xa3ab66580d5fdaf6ULL, -555, -148},
+  {0xf3e2f893dec3f126ULL, -529, -140}, {0xb5b5ada8aaff80b8ULL, -502, -132},
+  {0x87625f056c7c4a8bULL, -475, -124}, {0xc9bcff6034c13053ULL, -449, -116},
+  {0x964e858c91ba2655ULL, -422, -108}, {0xdff9772470297ebdULL, -396, -100},
+  {0xa6dfbd9fb8e5b88fULL, -369, -92}, {0xf8a95fcf88747d94ULL, -343, -84},
+  {0xb94470938fa89bcfULL, -316, -76}, {0x8a08f0f8bf0f156bULL, -289, -68},
+  {0xcdb02555653131b6ULL, -263, -60}, {0x993fe2c6d07b7facULL, -236, -52},
+  {0xe45c10c42a2b3b06ULL, -210, -44}, {0xaa242499697392d3ULL, -183, -36},
+  {0xfd87b5f28300ca0eULL, -157, -28}, {0xbce5086492111aebULL, -130, -20},
+  {0x8cbccc096f5088ccULL, -103, -12}, {0xd1b71758e219652cULL, -77, -4},
+  {0x9c40000000000000ULL, -50, 4}, {0xe8d4a51000000000ULL, -24, 12},
+  {0xad78ebc5ac620000ULL, 3, 20}, {0x813f3978f8940984ULL, 30, 28},
+  {0xc097ce7bc90715b3ULL, 56, 36}, {0x8f7e32ce7bea5c70ULL, 83, 44},
+  {0xd5d238a4abe98068ULL, 109, 52}, {0x9f4f2726179a2245ULL, 136, 60},
+  {0xed63a231d4c4fb27ULL, 162, 68}, {0xb0de65388cc8ada8ULL, 189, 76},
+  {0x83c7088e1aab65dbULL, 216, 84}, {0xc45d1df942711d9aULL, 242, 92},
+  {0x924d692ca61be758ULL, 269, 100}, {0xda01ee641a708deaULL, 295, 108},
+  {0xa26da3999aef774aULL, 322, 116}, {0xf209787bb47d6b85ULL, 348, 124},
+  {0xb454e4a179dd1877ULL, 375, 132}, {0x865b86925b9bc5c2ULL, 402, 140},
+  {0xc83553c5c8965d3dULL, 428, 148}, {0x952ab45cfa97a0b3ULL, 455, 156},
+  {0xde469fbd99a05fe3ULL, 481, 164}, {0xa59bc234db398c25ULL, 508, 172},
+  {0xf6c69a72a3989f5cULL, 534, 180}, {0xb7dcbf5354e9beceULL, 561, 188},
+  {0x88fcf317f22241e2ULL, 588, 196}, {0xcc20ce9bd35c78a5ULL, 614, 204},
+  {0x98165af37b2153dfULL, 641, 212}, {0xe2a0b5dc971f303aULL, 667, 220},
+  {0xa8d9d1535ce3b396ULL, 694, 228}, {0xfb9b7cd9a4a7443cULL, 720, 236},
+  {0xbb764c4ca7a44410ULL, 747, 244}, {0x8bab8eefb6409c1aULL, 774, 252},
+  {0xd01fef10a657842cULL, 800, 260}, {0x9b10a4e5e9913129ULL, 827, 268},
+  {0xe7109bfba19c0c9dULL, 853, 276}, {0xac2820d9623bf429ULL, 880, 284},
+  {0x80444b5e7aa7cf85ULL, 907, 292}, {0xbf21e44003acdd2dULL, 933, 300},
+  {0x8e679c2f5e44ff8fULL, 960, 308}, {0xd433179d9c8cb841ULL, 986, 316},
+  {0x9e19db92b4e31ba9ULL, 1013, 324}, {0xeb96bf6ebadf77d9ULL, 1039, 332},
+  {0xaf87023b9bf0ee6bULL, 1066, 340}
+};
+
+
+/*
+** Get a power 10^k whose product with a normalized number with binary
+** exponent 'e' has an exponent in [-60, -32]
+*/
+static Fp cachedpower (int e, int *k) {
+  int k1 = (int)ceil((-61 - e) * 0.30102999566398114);  /* log10(2) */
+  int i = (348 + k1 - 1) / 8 + 1;
+  *k = cachedpow[i].k;
+  return fpmake(cachedpow[i].f, cachedpow[i].e);
+}
+
+
+/*
+** Move the last digit down while that brings the result closer to the
+** scaled input, then check that the result is surely the closest one
+** inside the (unsafe) interval.
+*/
+static int roundweed (char *buff, int len, l_uint64 distance, l_uint64 unsafe,
+                      l_uint64 rest, l_uint64 tenkappa, l_uint64 unit) {
+  l_uint64 small = distance - unit;
+  l_uint64 big = distance + unit;
+  while (rest < small && unsafe - rest >= tenkappa &&
+         (rest + tenkappa < small ||
+          small - rest >= rest + tenkappa - small)) {
+    buff[len - 1]--;
+    rest += tenkappa;
+  }
+  if (rest < big && unsafe - rest >= tenkappa &&
+      (rest + tenkappa < big || big - rest > rest + tenkappa - big))
+    return 0;
+  return (2 * unit <= rest && rest <= unsafe - 4 * unit);
+}
+
+
+/*
+** Generate into 'buff' the digits of 'w', given its scaled boundaries
+** 'low' and 'high'; the result is 'buff' * 10^kappa.
+*/
+static int digitgen (Fp low, Fp w, Fp high, char *buff, int *len,
+                                                        int *kappa) {
+  static const unsigned int pow10int[] = {1, 10, 100, 1000, 10000, 100000,
+    1000000, 10000000, 100000000, 1000000000};
+  l_uint64 unit = 1;
+  l_uint64 toohigh = high.f + unit;
+  l_uint64 unsafe = toohigh - (low.f - unit);
+  int shift = -w.e;
+  l_uint64 one = (l_uint64)1 << shift;
+  unsigned int integrals = (unsigned int)(toohigh >> shift);
+  l_uint64 fractionals = toohigh & (one - 1);
+  unsigned int divisor;
+  int k = 10;
+  while (k > 0 && integrals < pow10int[k - 1]) k--;
+  divisor = (k > 0) ? pow10int[k - 1] : 0;
+  *len = 0;
+  while (k > 0) {  /* integral digits */
+    l_uint64 rest;
+    buff[(*len)++] = cast(char, '0' + integrals / divisor);
+    integrals %= divisor;
+    k--;
+    rest = ((l_uint64)integrals << shift) + fractionals;
+    if (rest < unsafe) {
+      *kappa = k;
+      return roundweed(buff, *len, toohigh - w.f, unsafe, rest,
+                       (l_uint64)divisor << shift, unit);
+    }
+    divisor /= 10;
+  }
+  for (;;) {  /* fractional digits */
+    fractionals *= 10; unit *= 10; unsafe *= 10;
+    buff[(*len)++] = cast(char, '0' + (int)(fractionals >> shift));
+    fractionals &= one - 1;
+    k--;
+    if (fractionals < unsafe) {
+      *kappa = k;
+      return roundweed(buff, *len, (toohigh - w.f) * unit, unsafe,
+                       fractionals, one, unit);
+    }
+    if (*len == 20) return 0;  /* should not happen */
+  }
+}
+
+
+/*
+** Put in 'buff' the shortest digits that read back as 'x' (a finite
+** positive double), the closest ones to 'x' if there is a choice.
+** Return their number, and in '*k' the decimal exponent of the last.
+*/
+static int fltdigits (double x, char *buff, int *k) {
+  l_uint64 bits;
+  l_uint64 frac;
+  int bexp, len, kappa, mk;
+  Fp w, plus, minus, c;
+  memcpy(&bits, &x, sizeof(bits));
+  frac = bits & 0xFFFFFFFFFFFFFULL;
+  bexp = (int)(bits >> 52);
+  if (bexp == 0)  /* subnormal? */
+    w = fpmake(frac, -1074);
+  else
+    w = fpmake(frac | 0x10000000000000ULL, bexp - 1075);
+  plus = fpnormalize(fpmake((w.f << 1) + 1, w.e - 1));
+  if (frac == 0 && bexp > 1)  /* lower boundary is closer? */
+    minus = fpmake((w.f << 2) - 1, w.e - 2);
+  else
+    minus = fpmake((w.f << 1) - 1, w.e - 1);
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+  w = fpnormalize(w);
+  c = cachedpower(w.e, &mk);
+  if (digitgen(fpmul(minus, c), fpmul(w, c), fpmul(plus, c),
+               buff, &len, &kappa))
+    *k = kappa - mk;
+  else {  /* use the C library with 15, 16, or 17 digits */
+    static const char *const fmt[] = {"%.14e", "%.15e", "%.16e"};
+    char tmp[40];
+    int p, i;
+    for (p = 0; p < 3; p++) {
+      l_sprintf(tmp, sizeof(tmp), fmt[p], x);
+      if (p == 2 || lua_str2number(tmp, NULL) == x) break;
+    }
+    for (i = len = 0; tmp[i] != 'e'; i++) {  /* collect the digits */
+      if (lisdigit(cast_uchar(tmp[i])))
+        buff[len++] = tmp[i];
+    }
+    *k = atoi(tmp + i + 1) - (len - 1);
+  }
+  while (buff[len - 1] == '0') {  /* remove trailing zeros */
+    len--; (*k)++;
+  }
+  return len;
+}
+
+
+/*
+** Convert a double to the shortest numeral that reads back as the
+** same value, laid out as '%.17g' would do it (but always with a dot).
+** Infinities and NaNs keep their usual format.
+*/
+static int tostringflt (char *buff, size_t sz, lua_Number x) {
+  char digits[24];
+  int n, k, x10;  /* number of digits, exponents of last and first ones */
+  char *b = buff;
+  if (x != x || x == HUGE_VAL || x == -HUGE_VAL)  /* inf or NaN? */
+    return lua_number2str(buff, sz, x);
+  if (signbit(x)) {
+    *(b++) = '-';
+    x = -x;
+  }
+  if (x == 0) {
+    *(b++) = '0'; *b = '\0';
+    return cast_int(b - buff);
+  }
+  n = fltdigits(x, digits, &k);
+  x10 = k + n - 1;
+  if (x10 < -4 || x10 >= 17) {  /* d.ddde+XX */
+    *(b++) = digits[0];
+    if (n > 1) {
+      *(b++) = '.';
+      memcpy(b, digits + 1, n - 1); b += n - 1;
+    }
+    b += l_sprintf(b, sz - (b - buff), "e%+03d", x10);
+  }
+  else if (x10 < 0) {  /* 0.000ddd */
+    *(b++) = '0'; *(b++) = '.';
+    memset(b, '0', -x10 - 1); b += -x10 - 1;
+    memcpy(b, digits, n); b += n;
+  }
+  else if (n <= x10 + 1) {  /* ddd000 */
+    memcpy(b, digits, n); b += n;
+    memset(b, '0', x10 + 1 - n); b += x10 + 1 - n;
+  }
+  else {  /* ddd.ddd */
+    memcpy(b, digits, x10 + 1); b += x10 + 1;
+    *(b++) = '.';
+    memcpy(b, digits + x10 + 1, n - x10 - 1); b += n - x10 - 1;
+  }
+  *b = '\0';
+  return cast_int(b - buff);
+}
+
+#endif				/* } */
+
+#endif				/* } */
+
+/* }================================================================== */
+
+
 /* maximum length of a numeral */
 #if !defined (L_MAXLENNUM)
 #define L_MAXLENNUM	200
@@ -277,6 +707,10 @@ static const char *l_str2d (const char *s, lua_Number *result) {
   int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
+#if defined(L_FASTNUM)
+  if (mode != 'x' && (endptr = l_str2dfast(s, result)) != NULL)
+    return endptr;  /* common case */
+#endif
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
   if (endptr == NULL) {  /* failed? may be a different locale */
     char buff[L_MAXLENNUM + 1];
@@ -365,6 +799,15 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 #define MAXNUMBER2STR	50
 
 
+#if defined(L_FASTNUM) && !defined(LUA_COMPAT_NUMBER2STR)
+#define l_number2str(s,sz,n)	tostringflt(s,sz,n)
+#define l_floatpoint()		'.'
+#else
+#define l_number2str(s,sz,n)	lua_number2str(s,sz,n)
+#define l_floatpoint()		lua_getlocaledecpoint()
+#endif
+
+
 /*
 ** Convert a number object to a string
 */
@@ -375,10 +818,10 @@ void luaO_tostring (lua_State *L, StkId obj) {
   if (ttisinteger(obj))
     len = lua_integer2str(buff, sizeof(buff), ivalue(obj));
   else {
-    len = lua_number2str(buff, sizeof(buff), fltvalue(obj));
+    len = l_number2str(buff, sizeof(buff), fltvalue(obj));
 #if !defined(LUA_COMPAT_FLOATSTRING)
     if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
-      buff[len++] = lua_getlocaledecpoint();
+      buff[len++] = l_floatpoint();
       buff[len++] = '0';  /* adds '.0' to result */
     }
 #endif
@@ -107,8 +107,27 @@ typedef union Value {
 } Value;
 
 
+#if !defined(LUA_NANBOX_INT32)
+
 #define TValuefields	Value value_; int tt_
 
+#else
+
+/*
+** With NaN boxing, a value is a single 64-bit word that is either a
+** float or a "boxed" NaN (see section 'NaN boxing' below)
+*/
+typedef unsigned long long l_nbword;
+
+typedef union NBValue {
+  l_nbword w;
+  lua_Number n;
+} NBValue;
+
+#define TValuefields	NBValue nb_
+
+#endif
+
 
 typedef struct lua_TValue {
   TValuefields;
@@ -283,6 +302,248 @@ typedef struct lua_TValue {
 
 
 
+/*
+** {======================================================
+** NaN boxing
+** =======================================================
+*/
+
+#if defined(LUA_NANBOX_INT32)
+
+#if !defined(__x86_64__) || LUA_FLOAT_TYPE != LUA_FLOAT_DOUBLE || \
+    LUA_INT_TYPE != LUA_INT_INT
+#error "LUA_NANBOX_INT32 needs x86-64, double floats, and 'int' integers"
+#endif
+
+/*
+** A float is stored as itself. Any other value is a NaN with bits
+** 51-63 set; bits 47-50 keep its "box tag" and bits 0-46 its payload
+** (a pointer, a 32-bit integer, or a boolean). Box tag 0 is left to
+** floats, so that the default NaN produced by the hardware is still a
+** float; a float whose bits would look like a boxed value is stored
+** as that NaN. Box tags of collectable objects, of functions and of
+** strings are contiguous, so that these tests are range checks.
+*/
+#define NB_NIL		1
+#define NB_BOOLEAN	2
+#define NB_LIGHTUD	3
+#define NB_NUMINT	4
+#define NB_LCF		5
+#define NB_LCL		6
+#define NB_CCL		7
+#define NB_SHRSTR	8
+#define NB_LNGSTR	9
+#define NB_TABLE	10
+#define NB_USERDATA	11
+#define NB_THREAD	12
+#define NB_PROTO	13
+#define NB_DEADKEY	14
+
+#define NB_TAGSHIFT	47
+#define NB_TAG(b)	((~(l_nbword)0 << 51) | ((l_nbword)(b) << NB_TAGSHIFT))
+#define NB_TAGMASK	NB_TAG(15)
+#define NB_PAYLOAD	(~NB_TAGMASK)
+#define NB_NAN		NB_TAG(0)	/* canonical NaN for floats */
+
+/* box tag of a collectable object with (non-'ctb') tag 't' */
+#define nbgctag(t) \
+  ((t) == LUA_TSHRSTR ? NB_SHRSTR : (t) == LUA_TLNGSTR ? NB_LNGSTR : \
+   (t) == LUA_TTABLE ? NB_TABLE : (t) == LUA_TLCL ? NB_LCL : \
+   (t) == LUA_TCCL ? NB_CCL : (t) == LUA_TUSERDATA ? NB_USERDATA : \
+   (t) == LUA_TTHREAD ? NB_THREAD : NB_PROTO)
+
+#define nbw_(o)		((o)->nb_.w)
+#define nbbox(o)	cast_int((nbw_(o) >> NB_TAGSHIFT) & 0xF)
+#define nbptr(o)	cast(size_t, nbw_(o) & NB_PAYLOAD)
+#define nbisflt(o)	(nbw_(o) < NB_TAG(1))
+#define nbhas(o,b)	((nbw_(o) & NB_TAGMASK) == NB_TAG(b))
+/* is box tag of 'o' in range [a, b]? */
+#define nbin(o,a,b)	(nbw_(o) - NB_TAG(a) < NB_TAG((b) + 1) - NB_TAG(a))
+#define setnbw_(o,b,x)	(nbw_(o) = NB_TAG(b) | cast(l_nbword, (x)))
+
+
+#undef NILCONSTANT
+#define NILCONSTANT	{NB_TAG(NB_NIL)}
+
+#undef val_
+
+#undef rttype
+#define rttype(o)	(nbisflt(o) ? LUA_TNUMFLT : cast_int(luaO_nbtt[nbbox(o)]))
+
+
+#undef ttisnumber
+#undef ttisfloat
+#undef ttisinteger
+#undef ttisnil
+#undef ttisboolean
+#undef ttislightuserdata
+#undef ttisstring
+#undef ttisshrstring
+#undef ttislngstring
+#undef ttistable
+#undef ttisfunction
+#undef ttisclosure
+#undef ttisCclosure
+#undef ttisLclosure
+#undef ttislcf
+#undef ttisfulluserdata
+#undef ttisthread
+#undef ttisdeadkey
+#define ttisnumber(o)		(nbisflt(o) || nbhas(o, NB_NUMINT))
+#define ttisfloat(o)		nbisflt(o)
+#define ttisinteger(o)		nbhas(o, NB_NUMINT)
+#define ttisnil(o)		(nbw_(o) == NB_TAG(NB_NIL))
+#define ttisboolean(o)		nbhas(o, NB_BOOLEAN)
+#define ttislightuserdata(o)	nbhas(o, NB_LIGHTUD)
+#define ttisstring(o)		nbin(o, NB_SHRSTR, NB_LNGSTR)
+#define ttisshrstring(o)	nbhas(o, NB_SHRSTR)
+#define ttislngstring(o)	nbhas(o, NB_LNGSTR)
+#define ttistable(o)		nbhas(o, NB_TABLE)
+#define ttisfunction(o)		nbin(o, NB_LCF, NB_CCL)
+#define ttisclosure(o)		nbin(o, NB_LCL, NB_CCL)
+#define ttisCclosure(o)		nbhas(o, NB_CCL)
+#define ttisLclosure(o)		nbhas(o, NB_LCL)
+#define ttislcf(o)		nbhas(o, NB_LCF)
+#define ttisfulluserdata(o)	nbhas(o, NB_USERDATA)
+#define ttisthread(o)		nbhas(o, NB_THREAD)
+#define ttisdeadkey(o)		nbhas(o, NB_DEADKEY)
+
+
+#undef ivalue
+#undef fltvalue
+#undef gcvalue
+#undef pvalue
+#undef tsvalue
+#undef uvalue
+#undef clvalue
+#undef clLvalue
+#undef clCvalue
+#undef fvalue
+#undef hvalue
+#undef bvalue
+#undef thvalue
+#undef deadvalue
+#define ivalue(o)	check_exp(ttisinteger(o), \
+	l_castU2S(cast(lua_Unsigned, nbw_(o))))
+#define fltvalue(o)	check_exp(ttisfloat(o), (o)->nb_.n)
+#define gcvalue(o)	check_exp(iscollectable(o), cast(GCObject *, nbptr(o)))
+#define pvalue(o)	check_exp(ttislightuserdata(o), cast(void *, nbptr(o)))
+#define tsvalue(o)	check_exp(ttisstring(o), \
+	gco2ts(cast(GCObject *, nbptr(o))))
+#define uvalue(o)	check_exp(ttisfulluserdata(o), \
+	gco2u(cast(GCObject *, nbptr(o))))
+#define clvalue(o)	check_exp(ttisclosure(o), \
+	gco2cl(cast(GCObject *, nbptr(o))))
+#define clLvalue(o)	check_exp(ttisLclosure(o), \
+	gco2lcl(cast(GCObject *, nbptr(o))))
+#define clCvalue(o)	check_exp(ttisCclosure(o), \
+	gco2ccl(cast(GCObject *, nbptr(o))))
+#define fvalue(o)	check_exp(ttislcf(o), cast(lua_CFunction, nbptr(o)))
+#define hvalue(o)	check_exp(ttistable(o), \
+	gco2t(cast(GCObject *, nbptr(o))))
+#define bvalue(o)	check_exp(ttisboolean(o), cast_int(nbw_(o) & 1))
+#define thvalue(o)	check_exp(ttisthread(o), \
+	gco2th(cast(GCObject *, nbptr(o))))
+#define deadvalue(o)	check_exp(ttisdeadkey(o), cast(void *, nbptr(o)))
+
+
+#undef iscollectable
+#define iscollectable(o)	nbin(o, NB_LCL, NB_PROTO)
+
+
+#undef settt_
+#undef setfltvalue
+#undef chgfltvalue
+#undef setivalue
+#undef chgivalue
+#undef setnilvalue
+#undef setfvalue
+#undef setpvalue
+#undef setbvalue
+#undef setgcovalue
+#undef setsvalue
+#undef setuvalue
+#undef setthvalue
+#undef setclLvalue
+#undef setclCvalue
+#undef sethvalue
+#undef setdeadvalue
+
+#define setfltvalue(obj,x) \
+  { TValue *io=(obj); io->nb_.n=(x); \
+    if (nbw_(io) >= NB_TAG(1)) nbw_(io) = NB_NAN; }
+
+#define chgfltvalue(obj,x) \
+  { TValue *io=(obj); lua_assert(ttisfloat(io)); io->nb_.n=(x); \
+    if (nbw_(io) >= NB_TAG(1)) nbw_(io) = NB_NAN; }
+
+#define setivalue(obj,x) \
+  { TValue *io=(obj); setnbw_(io, NB_NUMINT, l_castS2U(x)); }
+
+#define chgivalue(obj,x) \
+  { TValue *io=(obj); lua_assert(ttisinteger(io)); \
+    setnbw_(io, NB_NUMINT, l_castS2U(x)); }
+
+#define setnilvalue(obj)	(nbw_(obj) = NB_TAG(NB_NIL))
+
+#define setfvalue(obj,x) \
+  { TValue *io=(obj); lua_CFunction x_ = (x); \
+    lua_assert((cast(size_t, x_) & ~NB_PAYLOAD) == 0); \
+    setnbw_(io, NB_LCF, cast(size_t, x_)); }
+
+#define setpvalue(obj,x) \
+  { TValue *io=(obj); void *x_ = (x); \
+    lua_assert((cast(size_t, x_) & ~NB_PAYLOAD) == 0); \
+    setnbw_(io, NB_LIGHTUD, cast(size_t, x_)); }
+
+#define setbvalue(obj,x) \
+  { TValue *io=(obj); setnbw_(io, NB_BOOLEAN, (x) != 0); }
+
+#define setgcovalue(L,obj,x) \
+  { TValue *io = (obj); GCObject *i_g=(x); \
+    setnbw_(io, nbgctag(i_g->tt), cast(size_t, i_g)); }
+
+#define setsvalue(L,obj,x) \
+  { TValue *io = (obj); TString *x_ = (x); \
+    setnbw_(io, x_->tt == LUA_TSHRSTR ? NB_SHRSTR : NB_LNGSTR, \
+                cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setuvalue(L,obj,x) \
+  { TValue *io = (obj); Udata *x_ = (x); \
+    setnbw_(io, NB_USERDATA, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setthvalue(L,obj,x) \
+  { TValue *io = (obj); lua_State *x_ = (x); \
+    setnbw_(io, NB_THREAD, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setclLvalue(L,obj,x) \
+  { TValue *io = (obj); LClosure *x_ = (x); \
+    setnbw_(io, NB_LCL, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setclCvalue(L,obj,x) \
+  { TValue *io = (obj); CClosure *x_ = (x); \
+    setnbw_(io, NB_CCL, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define sethvalue(L,obj,x) \
+  { TValue *io = (obj); Table *x_ = (x); \
+    setnbw_(io, NB_TABLE, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+/* keeps the pointer, so that 'next' can still find the dead key */
+#define setdeadvalue(obj) \
+	(nbw_(obj) = NB_TAG(NB_DEADKEY) | (nbw_(obj) & NB_PAYLOAD))
+
+#endif
+
+/* }====================================================== */
+
+
+
 
 /*
 ** {======================================================
@@ -302,7 +563,7 @@ typedef TValue *StkId;  /* index to stack elements */
 */
 typedef struct TString {
   CommonHeader;
-  lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
+  lu_byte extra;  /* reserved words for short strings; bits for longs */
   lu_byte shrlen;  /* length for short strings */
   unsigned int hash;
   union {
@@ -321,12 +582,47 @@ typedef union UTString {
 } UTString;
 
 
+/* bits in field 'extra' of long strings */
+#define LNGHASHBIT	1	/* field 'hash' has the hash of the string */
+#define BUILDERBIT	2	/* string keeps its bytes in a 'SBuffer' */
+
+
+#if defined(LUA_USE_STRBUILDER)
+
+/*
+** Buffer shared by builder strings (see 'lstring.c'): each of them is a
+** prefix of the buffer contents, which end with a '\0' at 'data[size]'.
+*/
+typedef struct SBuffer {
+  size_t size;  /* length of the last string in the buffer */
+  size_t capacity;  /* size of 'data' */
+  lu_mem nrefs;  /* number of strings using this buffer */
+  char data[1];
+} SBuffer;
+
+/* a builder string keeps a pointer to its buffer after its header */
+#define isbuilder(ts)	((ts)->tt == LUA_TLNGSTR && ((ts)->extra & BUILDERBIT))
+#define sbuffer(ts)	(*cast(SBuffer **, cast(char *, (ts)) + sizeof(UTString)))
+
+#else
+
+#define isbuilder(ts)	0
+
+#endif
+
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'.
 ** (Access to 'extra' ensures that value is really a 'TString'.)
 */
+#if defined(LUA_USE_STRBUILDER)
+#define getstr(ts)  \
+  check_exp(sizeof((ts)->extra), isbuilder(ts) ? sbuffer(ts)->data \
+                                 : cast(char *, (ts)) + sizeof(UTString))
+#else
 #define getstr(ts)  \
   check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(UTString))
+#endif
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -345,10 +641,16 @@ typedef union UTString {
 */
 typedef struct Udata {
   CommonHeader;
+#if !defined(LUA_NANBOX_INT32)
   lu_byte ttuv_;  /* user value's tag */
+#endif
   struct Table *metatable;
   size_t len;  /* number of bytes */
+#if !defined(LUA_NANBOX_INT32)
   union Value user_;  /* user value */
+#else
+  NBValue user_;  /* user value */
+#endif
 } Udata;
 
 
@@ -363,10 +665,12 @@ typedef union UUdata {
 
 /*
 **  Get the address of memory block inside 'Udata'.
-** (Access to 'ttuv_' ensures that value is really a 'Udata'.)
+** (Access to 'user_' ensures that value is really a 'Udata'.)
 */
 #define getudatamem(u)  \
-  check_exp(sizeof((u)->ttuv_), (cast(char*, (u)) + sizeof(UUdata)))
+  check_exp(sizeof((u)->user_), (cast(char*, (u)) + sizeof(UUdata)))
+
+#if !defined(LUA_NANBOX_INT32)
 
 #define setuservalue(L,u,o) \
 	{ const TValue *io=(o); Udata *iu = (u); \
@@ -379,6 +683,19 @@ typedef union UUdata {
 	  io->value_ = iu->user_; settt_(io, iu->ttuv_); \
 	  checkliveness(L,io); }
 
+#else
+
+#define setuservalue(L,u,o) \
+	{ const TValue *io=(o); Udata *iu = (u); \
+	  iu->user_ = io->nb_; checkliveness(L,io); }
+
+
+#define getuservalue(L,u,o) \
+	{ TValue *io=(o); const Udata *iu = (u); \
+	  io->nb_ = iu->user_; checkliveness(L,io); }
+
+#endif
+
 
 /*
 ** Description of an upvalue for function prototypes
@@ -409,21 +726,27 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed parameters */
   lu_byte is_vararg;  /* 2: declared vararg; 1: uses vararg */
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte mapped;  /* which vectors live in 'map' (see lfunc.h) */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
+  int sizeicache;  /* size of 'icache' (either 0 or 'sizecode') */
   int sizelineinfo;
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
+  int hotcount;  /* hot events left before compiling (see 'ljit.c') */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  unsigned int *icache;  /* inline caches of field accesses (indexed by pc) */
   struct Proto **p;  /* functions defined inside the function */
   int *lineinfo;  /* map from opcodes to source lines (debug information) */
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+  struct Mapping *map;  /* shared block holding some vectors (or NULL) */
+  struct JitCode *jit;  /* native code (or NULL) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -475,17 +798,25 @@ typedef union Closure {
 typedef union TKey {
   struct {
     TValuefields;
+#if !defined(LUA_USE_SWISSTABLE)
     int next;  /* for chaining (offset for next node) */
+#endif
   } nk;
   TValue tvk;
 } TKey;
 
 
 /* copy a value into a key without messing up field 'next' */
+#if !defined(LUA_NANBOX_INT32)
 #define setnodekey(L,key,obj) \
 	{ TKey *k_=(key); const TValue *io_=(obj); \
 	  k_->nk.value_ = io_->value_; k_->nk.tt_ = io_->tt_; \
 	  (void)L; checkliveness(L,io_); }
+#else
+#define setnodekey(L,key,obj) \
+	{ TKey *k_=(key); const TValue *io_=(obj); \
+	  k_->nk.nb_ = io_->nb_; (void)L; checkliveness(L,io_); }
+#endif
 
 
 typedef struct Node {
@@ -501,9 +832,22 @@ typedef struct Table {
   unsigned int sizearray;  /* size of 'array' array */
   TValue *array;  /* array part */
   Node *node;
+#if !defined(LUA_USE_SWISSTABLE)
   Node *lastfree;  /* any free position is before this position */
+#else
+  unsigned int hfree;  /* number of new keys the hash part can take */
+#endif
+#if defined(LUA_USE_INCRHASH)
+  Node *oldnode;  /* old hash part, still being migrated (or NULL) */
+  unsigned int oldmoved;  /* number of nodes of 'oldnode' already moved */
+  lu_byte oldlsize;  /* log2 of size of 'oldnode' */
+#endif
   struct Table *metatable;
   GCObject *gclist;
+#if defined(LUA_USE_SHAPES)
+  struct Shape *shape;  /* shared keys of 'slots' (NULL if no shape) */
+  TValue *slots;  /* values of the fields listed in 'shape' */
+#endif
 } Table;
 
 
@@ -527,6 +871,11 @@ typedef struct Table {
 
 LUAI_DDEC const TValue luaO_nilobject_;
 
+#if defined(LUA_NANBOX_INT32)
+/* tag of each box tag */
+LUAI_DDEC const lu_byte luaO_nbtt[16];
+#endif
+
 /* size of buffer for 'luaO_utf8esc' function */
 #define UTF8BUFFSZ	8
 
@@ -65,6 +65,17 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "GETFIELD",
+  "GETUPFIELD",
+  "SETFIELD",
+  "SETUPFIELD",
+  "ADDI",
+  "SUBI",
+  "EQK",
+  "LTI",
+  "LEI",
+  "GTI",
+  "GEI",
   NULL
 };
 
@@ -120,5 +131,16 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETFIELD */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETUPFIELD */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_SETFIELD */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_SETUPFIELD */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_ADDI */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_SUBI */
+ ,opmode(1, 0, OpArgR, OpArgK, iABC)		/* OP_EQK */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_LTI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_LEI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_GTI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_GEI */
 };
 
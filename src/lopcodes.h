@@ -113,6 +113,16 @@ enum OpMode {iABC, iABx, iAsBx, iAx};  /* basic instruction format */
 #define SETARG_sBx(i,b)	SETARG_Bx((i),cast(unsigned int, (b)+MAXARG_sBx))
 
 
+/*
+** 'sC' is a small signed integer kept in argument C (in excess-K
+** notation, like 'sBx'), used by the opcodes with an immediate operand
+*/
+#define MAXARG_sC	(MAXARG_C >> 1)
+#define int2sC(i)	((i) + MAXARG_sC)
+#define sC2int(i)	((i) - MAXARG_sC)
+#define fitssC(i)	(-MAXARG_sC <= (i) && (i) <= MAXARG_C - MAXARG_sC)
+
+
 #define CREATE_ABC(o,a,b,c)	((cast(Instruction, o)<<POS_OP) \
 			| (cast(Instruction, a)<<POS_A) \
 			| (cast(Instruction, b)<<POS_B) \
@@ -228,11 +238,27 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* specialized opcodes, for common shapes of operands */
+
+OP_GETFIELD,/*	A B C	R(A) := R(B)[K(C):shortstring]			*/
+OP_GETUPFIELD,/*	A B C	R(A) := UpValue[B][K(C):shortstring]		*/
+OP_SETFIELD,/*	A B C	R(A)[K(B):shortstring] := RK(C)			*/
+OP_SETUPFIELD,/*	A B C	UpValue[A][K(B):shortstring] := RK(C)		*/
+
+OP_ADDI,/*	A B sC	R(A) := R(B) + sC				*/
+OP_SUBI,/*	A B sC	R(A) := R(B) - sC				*/
+
+OP_EQK,/*	A B C	if ((R(B) == K(C)) ~= A) then pc++		*/
+OP_LTI,/*	A B sC	if ((R(B) <  sC) ~= A) then pc++		*/
+OP_LEI,/*	A B sC	if ((R(B) <= sC) ~= A) then pc++		*/
+OP_GTI,/*	A B sC	if ((R(B) >  sC) ~= A) then pc++		*/
+OP_GEI/*	A B sC	if ((R(B) >= sC) ~= A) then pc++		*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_GEI) + 1)
 
 
 
@@ -255,6 +281,12 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   (*) For comparisons, A specifies what condition the test should accept
   (true or false).
 
+  (*) The specialized opcodes are only a faster encoding of their
+  generic counterparts (GETTABLE, GETTABUP, SETTABLE, SETTABUP, ADD,
+  SUB, EQ, LT, and LE), with the same semantics, metamethods included.
+  Their constant operands K(B)/K(C) are still in RK format (always
+  constants), while 'sC' operands are integer immediates.
+
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
 ===========================================================================*/
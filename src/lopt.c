@@ -0,0 +1,996 @@
+/*
+** $Id: lopt.c $
+** Bytecode optimizer
+** See Copyright Notice in lua.h
+*/
+
+#define lopt_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lcode.h"
+#include "ldo.h"
+#include "llex.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lparser.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "lvm.h"
+#include "lzio.h"
+
+
+/*
+** The optimizer rewrites the code of a function after the parser has
+** finished it (see 'close_func'). It works in rounds: each round
+** analyzes the code (control flow, live registers, active local
+** variables), applies the transformations below where the analysis
+** allows them, and then removes the instructions marked as deleted,
+** correcting jumps and debug information. Rounds repeat while they
+** change something, as each transformation may create opportunities
+** for the others. At the end, 'maxstacksize' is cut to the registers
+** still in use.
+**
+** Transformations keep the observable behavior of the function,
+** metamethods and errors included. They also keep the values of
+** active local variables, so that the debug interface still shows
+** them right; only registers holding temporaries are reorganized.
+**
+** A transformation marks as DIRTY the instructions where it changed
+** the liveness of registers; other transformations do not touch (or
+** rely on the analysis of) those instructions until the next round.
+** Outside DIRTY instructions the old analysis stays conservative, as
+** registers can only become dead there.
+*/
+
+
+/* maximum number of rounds */
+#define MAXROUNDS	8
+
+/* maximum length of a chain of jumps followed by 'threadjumps' */
+#define MAXTHREAD	32
+
+
+/* a set of registers */
+typedef struct RegSet {
+  unsigned int w[(MAXARG_A + 32) / 32];
+} RegSet;
+
+#define rsbit(r)	(1u << ((r) & 31))
+#define rsin(s,r)	(((s)->w[(r) >> 5] & rsbit(r)) != 0)
+#define rsadd(s,r)	((s)->w[(r) >> 5] |= rsbit(r))
+
+
+/* instruction flags */
+#define LEADER		1	/* control may come from elsewhere than pc - 1 */
+#define REACHED		2	/* instruction is reachable */
+#define DIRTY		4	/* analysis is out of date */
+#define DELETED		8	/* instruction must be removed */
+
+
+typedef struct OptState {
+  FuncState *fs;
+  Proto *f;
+  int n;  /* number of instructions */
+  int top;  /* limit for ranges that go up to the stack top */
+  RegSet captured;  /* registers captured by closures */
+  RegSet *live;  /* registers live on entry to each instruction */
+  int *aux;  /* work array (for all instructions or constants) */
+  lu_byte *nactive;  /* number of active local variables at each pc */
+  lu_byte *flags;  /* flags of each instruction */
+} OptState;
+
+
+
+/*
+** {======================================================
+** Analysis
+** =======================================================
+*/
+
+static void rsrange (RegSet *s, int from, int to) {
+  if (to > MAXARG_A) to = MAXARG_A;
+  for (; from <= to; from++)
+    rsadd(s, from);
+}
+
+
+static void rsaddrk (RegSet *s, int x) {
+  if (!ISK(x)) rsadd(s, x);
+}
+
+
+/*
+** Collect the registers that instruction 'i' reads ('use'), those it
+** always writes ('def'), and those it may change ('mod', a superset of
+** 'def'; a call, for instance, changes all registers above its base).
+** Ranges that go up to the stack top are taken as going up to
+** 'os->top'.
+*/
+static void regrefs (OptState *os, Instruction i, RegSet *use, RegSet *def,
+                     RegSet *mod) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  int top = os->top - 1;
+  int k;
+  memset(use, 0, sizeof(RegSet));
+  memset(def, 0, sizeof(RegSet));
+  memset(mod, 0, sizeof(RegSet));
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+    case OP_GETFIELD: case OP_ADDI: case OP_SUBI: {
+      rsadd(use, b); rsadd(def, a);
+      break;
+    }
+    case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL: case OP_GETUPVAL:
+    case OP_NEWTABLE: case OP_GETUPFIELD: {
+      rsadd(def, a);
+      break;
+    }
+    case OP_LOADNIL: {
+      rsrange(def, a, a + b);
+      break;
+    }
+    case OP_GETTABUP: {
+      rsaddrk(use, c); rsadd(def, a);
+      break;
+    }
+    case OP_GETTABLE: {
+      rsadd(use, b); rsaddrk(use, c); rsadd(def, a);
+      break;
+    }
+    case OP_SELF: {
+      rsadd(use, b); rsaddrk(use, c); rsrange(def, a, a + 1);
+      break;
+    }
+    case OP_SETTABUP: case OP_SETUPFIELD:
+    case OP_EQ: case OP_LT: case OP_LE: {
+      rsaddrk(use, b); rsaddrk(use, c);
+      break;
+    }
+    case OP_SETUPVAL: case OP_TEST: {
+      rsadd(use, a);
+      break;
+    }
+    case OP_SETTABLE: case OP_SETFIELD: {
+      rsadd(use, a); rsaddrk(use, b); rsaddrk(use, c);
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: {
+      rsaddrk(use, b); rsaddrk(use, c); rsadd(def, a);
+      break;
+    }
+    case OP_CONCAT: {  /* works in place over its operands */
+      rsrange(use, b, c); rsadd(def, a); rsrange(mod, b, c);
+      break;
+    }
+    case OP_EQK: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      rsadd(use, b);
+      break;
+    }
+    case OP_TESTSET: {
+      rsadd(use, b); rsadd(mod, a);
+      break;
+    }
+    case OP_CALL: {
+      rsrange(use, a, (b != 0) ? a + b - 1 : top);
+      rsrange(def, a, a + c - 2);
+      rsrange(mod, a, top);
+      break;
+    }
+    case OP_TAILCALL: {
+      rsrange(use, a, (b != 0) ? a + b - 1 : top);
+      rsrange(mod, a, top);
+      break;
+    }
+    case OP_RETURN: {
+      rsrange(use, a, (b != 0) ? a + b - 2 : top);
+      break;
+    }
+    case OP_FORLOOP: {
+      rsrange(use, a, a + 2); rsadd(mod, a); rsadd(mod, a + 3);
+      break;
+    }
+    case OP_FORPREP: {
+      rsrange(use, a, a + 2); rsadd(def, a); rsrange(mod, a, a + 2);
+      break;
+    }
+    case OP_TFORCALL: {
+      rsrange(use, a, a + 2); rsrange(def, a + 3, a + 2 + c);
+      rsrange(mod, a + 3, top);
+      break;
+    }
+    case OP_TFORLOOP: {
+      rsadd(use, a + 1); rsadd(mod, a);
+      break;
+    }
+    case OP_SETLIST: {
+      rsrange(use, a, (b != 0) ? a + b : top);
+      break;
+    }
+    case OP_CLOSURE: {
+      Proto *p = os->f->p[GETARG_Bx(i)];
+      for (k = 0; k < p->sizeupvalues; k++) {
+        if (p->upvalues[k].instack)
+          rsadd(use, p->upvalues[k].idx);
+      }
+      rsadd(def, a);
+      break;
+    }
+    case OP_VARARG: {
+      rsrange(def, a, a + b - 2);
+      rsrange(mod, a, (b != 0) ? a + b - 2 : top);
+      break;
+    }
+    default: break;  /* OP_JMP, OP_EXTRAARG */
+  }
+  for (k = 0; k < (int)(sizeof(mod->w) / sizeof(mod->w[0])); k++)
+    mod->w[k] |= def->w[k];
+}
+
+
+/*
+** Store in 'succ' the possible successors of the instruction at 'pc'
+** and return how many there are.
+*/
+static int successors (OptState *os, int pc, int *succ) {
+  Instruction i = os->f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  switch (op) {
+    case OP_JMP: case OP_FORPREP: {
+      succ[0] = pc + 1 + GETARG_sBx(i);
+      return 1;
+    }
+    case OP_FORLOOP: case OP_TFORLOOP: {
+      succ[0] = pc + 1;
+      succ[1] = pc + 1 + GETARG_sBx(i);
+      return 2;
+    }
+    case OP_RETURN: return 0;
+    case OP_LOADBOOL: {
+      succ[0] = pc + 1 + (GETARG_C(i) != 0);
+      return 1;
+    }
+    default: {
+      succ[0] = pc + 1;
+      if (testTMode(op)) {  /* skips next instruction? */
+        succ[1] = pc + 2;
+        return 2;
+      }
+      return 1;
+    }
+  }
+}
+
+
+/* true if control always goes from instruction 'pc' to 'pc + 1' */
+static int fallsthrough (OptState *os, int pc) {
+  int succ[2];
+  return (successors(os, pc, succ) == 1 && succ[0] == pc + 1);
+}
+
+
+/* true if 'pc' is skipped by a 'LOADBOOL' (so it cannot be removed) */
+static int skipped (OptState *os, int pc) {
+  Instruction i;
+  if (pc == 0 || (os->flags[pc - 1] & DELETED)) return 0;
+  i = os->f->code[pc - 1];
+  return (GET_OPCODE(i) == OP_LOADBOOL && GETARG_C(i) != 0);
+}
+
+
+static void findleaders (OptState *os) {
+  int pc, k;
+  os->flags[0] |= LEADER;
+  for (pc = 0; pc < os->n; pc++) {
+    int succ[2];
+    int ns = successors(os, pc, succ);
+    for (k = 0; k < ns; k++) {
+      lua_assert(0 <= succ[k] && succ[k] < os->n);
+      if (succ[k] != pc + 1)
+        os->flags[succ[k]] |= LEADER;
+    }
+  }
+}
+
+
+static void findreached (OptState *os) {
+  int *stack = os->aux;
+  int top = 0;
+  stack[top++] = 0;
+  os->flags[0] |= REACHED;
+  while (top > 0) {
+    int succ[2];
+    int pc = stack[--top];
+    int k, ns = successors(os, pc, succ);
+    for (k = 0; k < ns; k++) {
+      if (!(os->flags[succ[k]] & REACHED)) {
+        os->flags[succ[k]] |= REACHED;
+        stack[top++] = succ[k];
+      }
+    }
+  }
+}
+
+
+/*
+** Count the active local variables at each instruction. (As locals
+** live in the first registers, they are registers 0 to nactive - 1.)
+*/
+static void findlocals (OptState *os) {
+  Proto *f = os->f;
+  int *delta = os->aux;
+  int pc, i, n = 0;
+  for (pc = 0; pc <= os->n; pc++)
+    delta[pc] = 0;
+  for (i = 0; i < os->fs->nlocvars; i++) {
+    LocVar *v = &f->locvars[i];
+    if (v->startpc < v->endpc && v->startpc < os->n) {
+      delta[v->startpc]++;
+      delta[(v->endpc < os->n) ? v->endpc : os->n]--;
+    }
+  }
+  for (pc = 0; pc < os->n; pc++) {
+    n += delta[pc];
+    os->nactive[pc] = cast_byte(n);
+  }
+}
+
+
+static void findcaptured (OptState *os) {
+  Proto *f = os->f;
+  int i, k;
+  memset(&os->captured, 0, sizeof(RegSet));
+  for (i = 0; i < os->fs->np; i++) {
+    Proto *p = f->p[i];
+    for (k = 0; k < p->sizeupvalues; k++) {
+      if (p->upvalues[k].instack)
+        rsadd(&os->captured, p->upvalues[k].idx);
+    }
+  }
+}
+
+
+/*
+** Backward data-flow analysis of live registers. Registers captured by
+** closures are always live, as the closures may read them at any time.
+*/
+static void findlive (OptState *os) {
+  int pc, k, w, changed;
+  const int nw = cast_int(sizeof(RegSet) / sizeof(os->captured.w[0]));
+  for (pc = 0; pc < os->n; pc++)
+    memset(&os->live[pc], 0, sizeof(RegSet));
+  do {
+    changed = 0;
+    for (pc = os->n - 1; pc >= 0; pc--) {
+      RegSet use, def, mod, in;
+      int succ[2];
+      int ns = successors(os, pc, succ);
+      in = os->captured;
+      for (k = 0; k < ns; k++) {
+        for (w = 0; w < nw; w++)
+          in.w[w] |= os->live[succ[k]].w[w];
+      }
+      regrefs(os, os->f->code[pc], &use, &def, &mod);
+      for (w = 0; w < nw; w++)
+        in.w[w] = (in.w[w] & ~def.w[w]) | use.w[w];
+      if (memcmp(&in, &os->live[pc], sizeof(RegSet)) != 0) {
+        os->live[pc] = in;
+        changed = 1;
+      }
+    }
+  } while (changed);
+}
+
+
+static void analyze (OptState *os) {
+  memset(os->flags, 0, os->n);
+  findleaders(os);
+  findreached(os);
+  findlocals(os);
+  findcaptured(os);
+  findlive(os);
+}
+
+
+/* true if no instruction in [from, to] is DIRTY or DELETED */
+static int isclean (OptState *os, int from, int to) {
+  for (; from <= to; from++) {
+    if (os->flags[from] & (DIRTY | DELETED))
+      return 0;
+  }
+  return 1;
+}
+
+
+static void markdirty (OptState *os, int from, int to) {
+  for (; from <= to; from++)
+    os->flags[from] |= DIRTY;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Transformations
+** =======================================================
+*/
+
+static Instruction createjump (int offset) {
+  return CREATE_ABx(OP_JMP, 0, offset + MAXARG_sBx);
+}
+
+
+/*
+** Comparisons between two constants become unconditional: the test
+** turns into a jump either to its own jump or over it.
+** (String order depends on the locale, so it is not folded.)
+*/
+static int foldcompare (OptState *os) {
+  Proto *f = os->f;
+  int pc, changed = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    const TValue *kb, *kc;
+    int res;
+    if ((op != OP_EQ && op != OP_LT && op != OP_LE) ||
+        !ISK(b) || !ISK(c) || !isclean(os, pc, pc))
+      continue;
+    kb = &f->k[INDEXK(b)];
+    kc = &f->k[INDEXK(c)];
+    if (op == OP_EQ)
+      res = luaV_rawequalobj(kb, kc);
+    else if (ttisnumber(kb) && ttisnumber(kc))
+      res = (op == OP_LT) ? luaV_lessthan(os->fs->ls->L, kb, kc)
+                          : luaV_lessequal(os->fs->ls->L, kb, kc);
+    else continue;
+    f->code[pc] = createjump((res != GETARG_A(i)) ? 1 : 0);
+    changed = 1;
+  }
+  return changed;
+}
+
+
+/* true if register 'r' is loaded by a 'LOADK' of a string or number */
+static int isconstop (OptState *os, int pc, int r) {
+  Instruction i;
+  if (pc < 0) return 0;
+  i = os->f->code[pc];
+  if (GET_OPCODE(i) != OP_LOADK || GETARG_A(i) != r) return 0;
+  else {
+    const TValue *k = &os->f->k[GETARG_Bx(i)];
+    return (ttisstring(k) || ttisnumber(k));
+  }
+}
+
+
+/* subtract 'd' from all register operands of '*pi' not below 'r' */
+static void renumber (Instruction *pi, int r, int d) {
+  Instruction i = *pi;
+  OpCode op = GET_OPCODE(i);
+  if (op != OP_SETTABUP && op != OP_SETUPFIELD && op != OP_JMP &&
+      op != OP_EXTRAARG && GETARG_A(i) >= r)
+    SETARG_A(i, GETARG_A(i) - d);
+  if (getOpMode(op) == iABC) {
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    if ((getBMode(op) == OpArgR || (getBMode(op) == OpArgK && !ISK(b))) &&
+        b >= r)
+      SETARG_B(i, b - d);
+    if ((getCMode(op) == OpArgR || (getCMode(op) == OpArgK && !ISK(c))) &&
+        c >= r)
+      SETARG_C(i, c - d);
+  }
+  *pi = i;
+}
+
+
+/*
+** Check whether the run of 'm' constant operands starting at register
+** 'r', loaded by consecutive instructions starting at 'p', can be
+** folded into register 'r' for the concatenation at 'pc'. After the
+** run, the registers of the other operands move down to fill the gap.
+*/
+static int canfoldrun (OptState *os, int pc, int r, int m, int p) {
+  RegSet use, def, mod;
+  int j, x;
+  if (!isclean(os, p, pc + 1)) return 0;
+  for (x = r; x <= MAXARG_A; x++) {  /* no value flows in or out */
+    if (rsin(&os->live[p], x) || (x > r && rsin(&os->live[pc + 1], x)))
+      return 0;
+  }
+  for (j = p + m; j < pc; j++) {
+    Instruction i = os->f->code[j];
+    if (GET_OPCODE(i) == OP_CLOSURE) return 0;  /* cannot move upvalues */
+    regrefs(os, i, &use, &def, &mod);
+    for (x = r; x < r + m; x++) {
+      if (rsin(&use, x) || rsin(&mod, x))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Replace the run of 'm' constant operands starting at register 'r'
+** (loaded at 'p') by its concatenation. Return whether it did it.
+*/
+static int foldrun (OptState *os, int pc, int r, int m, int p) {
+  FuncState *fs = os->fs;
+  lua_State *L = fs->ls->L;
+  Instruction *code = os->f->code;
+  Instruction i = code[pc];
+  int j, kidx, whole;
+  luaD_checkstack(L, m);
+  for (j = 0; j < m; j++) {
+    setobj2s(L, L->top, &os->f->k[GETARG_Bx(code[p + j])]);
+    L->top++;
+  }
+  luaV_concat(L, m);  /* same conversions as in run time */
+  kidx = luaK_stringK(fs, tsvalue(L->top - 1));
+  L->top--;
+  if (kidx > MAXARG_Bx) return 0;  /* cannot use 'LOADK' */
+  whole = (m == GETARG_C(i) - GETARG_B(i) + 1);  /* no other operands? */
+  code[p] = CREATE_ABx(OP_LOADK, whole ? GETARG_A(i) : r, kidx);
+  for (j = p + 1; j < p + m; j++)
+    os->flags[j] |= DELETED;
+  if (whole)
+    os->flags[pc] |= DELETED;
+  else {
+    for (j = p + m; j < pc; j++)
+      renumber(&code[j], r + m, m - 1);
+    SETARG_C(code[pc], GETARG_C(code[pc]) - (m - 1));
+  }
+  return 1;
+}
+
+
+/*
+** Fold runs of constant operands in concatenations. The code for those
+** operands must be straight, with each of them loaded by a 'LOADK' (as
+** the parser generates it). Concatenation goes from the last operand
+** to the first, so a run can be folded only when all operands after it
+** are constants too: a value that may have a '__concat' metamethod
+** gets the operand just before it, not the whole run. All runs are
+** checked against the original code and then folded from the last
+** one, so that folding a run does not change the registers of the runs
+** below it.
+*/
+static int foldconcat (OptState *os) {
+  int lastdef[MAXARG_A + 1];
+  int runs[MAXARG_A + 1][2];
+  int pc, changed = 0;
+  for (pc = 0; pc < os->n - 1; pc++) {
+    Instruction i = os->f->code[pc];
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    int j, r, x, nruns = 0, missing = c - b + 1;
+    if (GET_OPCODE(i) != OP_CONCAT || !isclean(os, pc, pc))
+      continue;
+    for (x = b; x <= c; x++) lastdef[x - b] = -1;
+    for (j = pc - 1; j >= 0 && missing > 0; j--) {  /* find last defs. */
+      RegSet use, def, mod;
+      if ((os->flags[j + 1] & LEADER) || !fallsthrough(os, j) ||
+          (os->flags[j] & DELETED))
+        break;
+      regrefs(os, os->f->code[j], &use, &def, &mod);
+      for (x = b; x <= c; x++) {
+        if (lastdef[x - b] < 0 && rsin(&mod, x)) {
+          lastdef[x - b] = j;
+          missing--;
+        }
+      }
+    }
+    for (r = c; r > b; r--) {  /* collect runs, from the last one */
+      int m = 1;
+      if (!isconstop(os, lastdef[r - b], r))
+        break;  /* no runs before a non-constant operand */
+      while (r - m >= b && isconstop(os, lastdef[r - m - b], r - m) &&
+             lastdef[r - m - b] == lastdef[r - b] - m)
+        m++;
+      r -= m - 1;  /* first register of the run */
+      if (m >= 2 && (m < c - b + 1 || GETARG_A(i) <= b) &&
+          canfoldrun(os, pc, r, m, lastdef[r - b])) {
+        runs[nruns][0] = r;
+        runs[nruns++][1] = m;
+      }
+    }
+    for (j = 0; j < nruns; j++) {
+      r = runs[j][0];
+      if (foldrun(os, pc, r, runs[j][1], lastdef[r - b])) {
+        markdirty(os, lastdef[r - b], pc);
+        changed = 1;
+      }
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Replace by 'nr' the reads of register 'r' in '*pi' that are plain
+** reads of one register (not part of a range). Return whether it
+** replaced something.
+*/
+static int replaceread (Instruction *pi, int r, int nr) {
+  Instruction i = *pi;
+  OpCode op = GET_OPCODE(i);
+  switch (op) {
+    case OP_SETTABLE: case OP_SETFIELD: case OP_SETUPVAL: case OP_TEST: {
+      if (GETARG_A(i) == r) SETARG_A(i, nr);
+      break;
+    }
+    case OP_RETURN: {
+      if (GETARG_B(i) == 2 && GETARG_A(i) == r) SETARG_A(i, nr);
+      break;
+    }
+    default: break;
+  }
+  if (getOpMode(op) == iABC && op != OP_CONCAT) {
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    if ((getBMode(op) == OpArgR || (getBMode(op) == OpArgK && !ISK(b))) &&
+        b == r)
+      SETARG_B(i, nr);
+    if (getCMode(op) == OpArgK && !ISK(c) && c == r)
+      SETARG_C(i, nr);
+  }
+  if (i == *pi) return 0;
+  *pi = i;
+  return 1;
+}
+
+
+/*
+** Copy propagation: after 'R(A) := R(B)', with A a temporary, the
+** following instructions of the same basic block read B instead of A,
+** while both keep their values. The move may then become a dead store.
+*/
+static int copyforward (OptState *os) {
+  Instruction *code = os->f->code;
+  int pc, changed = 0;
+  for (pc = 0; pc < os->n - 1; pc++) {
+    Instruction i = code[pc];
+    int a = GETARG_A(i);
+    int b = GETARG_B(i);
+    int j, last = -1;
+    if (GET_OPCODE(i) != OP_MOVE || a == b || a < os->nactive[pc + 1] ||
+        rsin(&os->captured, a) || rsin(&os->captured, b) ||
+        !isclean(os, pc, pc))
+      continue;
+    for (j = pc; fallsthrough(os, j); ) {
+      RegSet use, def, mod;
+      j++;
+      if ((os->flags[j] & (LEADER | DIRTY | DELETED)))
+        break;
+      if (replaceread(&code[j], a, b))
+        last = j;
+      regrefs(os, code[j], &use, &def, &mod);
+      if (rsin(&mod, a) || rsin(&mod, b))
+        break;
+    }
+    if (last >= 0) {
+      markdirty(os, pc, last);
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* instructions that only write their register A (with a fresh value) */
+static int isproducer (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_GETTABUP:
+    case OP_GETTABLE: case OP_NEWTABLE: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_MOD: case OP_POW: case OP_DIV: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: case OP_CONCAT:
+    case OP_CLOSURE: case OP_GETFIELD: case OP_GETUPFIELD: case OP_ADDI:
+    case OP_SUBI:
+      return 1;
+    case OP_LOADBOOL:
+      return (GETARG_C(i) == 0);
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Retarget producers: 'R(t) := x; ...; R(A) := R(t)', where t is a
+** temporary dead after the move, becomes 'R(A) := x; ...', provided
+** that the instructions in between do not touch A or t. (That is how
+** the parser generates multiple assignments to local variables.)
+*/
+static int retarget (OptState *os) {
+  Instruction *code = os->f->code;
+  int pc, changed = 0;
+  for (pc = 1; pc < os->n - 1; pc++) {
+    Instruction i = code[pc];
+    int a = GETARG_A(i);
+    int t = GETARG_B(i);
+    int j;
+    if (GET_OPCODE(i) != OP_MOVE || a == t || t < os->nactive[pc] ||
+        rsin(&os->captured, a) || rsin(&os->captured, t) ||
+        !isclean(os, pc, pc + 1) || rsin(&os->live[pc + 1], t))
+      continue;
+    for (j = pc - 1; j >= 0; j--) {
+      RegSet use, def, mod;
+      if ((os->flags[j + 1] & LEADER) || !fallsthrough(os, j) ||
+          !isclean(os, j, j) || t < os->nactive[j])
+        break;
+      regrefs(os, code[j], &use, &def, &mod);
+      if (rsin(&mod, t)) {  /* found the producer? */
+        if (isproducer(code[j]) && GETARG_A(code[j]) == t) {
+          SETARG_A(code[j], a);
+          os->flags[pc] |= DELETED;
+          markdirty(os, j, pc);
+          changed = 1;
+        }
+        break;
+      }
+      if (rsin(&use, t) || rsin(&use, a) || rsin(&mod, a))
+        break;
+    }
+  }
+  return changed;
+}
+
+
+/* remove loads into temporaries that are never read */
+static int deadstores (OptState *os) {
+  Instruction *code = os->f->code;
+  int pc, changed = 0;
+  for (pc = 0; pc < os->n - 1; pc++) {
+    Instruction i = code[pc];
+    int a = GETARG_A(i);
+    int last = a, x;
+    switch (GET_OPCODE(i)) {
+      case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: break;
+      case OP_LOADBOOL: if (GETARG_C(i) == 0) break; else continue;
+      case OP_LOADNIL: last = a + GETARG_B(i); break;
+      default: continue;
+    }
+    if (a < os->nactive[pc + 1] || skipped(os, pc) ||
+        !isclean(os, pc, pc + 1))
+      continue;
+    for (x = a; x <= last; x++) {
+      if (rsin(&os->live[pc + 1], x)) break;
+    }
+    if (x > last) {  /* no register live? */
+      os->flags[pc] |= DELETED;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* make jumps to unconditional jumps go directly to their final target */
+static int threadjumps (OptState *os) {
+  Instruction *code = os->f->code;
+  int pc, changed = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    int dest, final, hops = 0;
+    if (GET_OPCODE(code[pc]) != OP_JMP || (os->flags[pc] & DELETED))
+      continue;
+    dest = final = pc + 1 + GETARG_sBx(code[pc]);
+    while (final != pc && hops++ < MAXTHREAD &&
+           GET_OPCODE(code[final]) == OP_JMP && GETARG_A(code[final]) == 0 &&
+           !(os->flags[final] & DELETED))
+      final = final + 1 + GETARG_sBx(code[final]);
+    if (final != dest) {
+      SETARG_sBx(code[pc], final - pc - 1);
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* remove unreachable code and jumps to the next instruction */
+static int removedead (OptState *os) {
+  Instruction *code = os->f->code;
+  int pc, changed = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = code[pc];
+    if ((os->flags[pc] & DELETED) || skipped(os, pc))
+      continue;
+    if (!(os->flags[pc] & REACHED) ||
+        (GET_OPCODE(i) == OP_JMP && GETARG_A(i) == 0 &&
+         GETARG_sBx(i) == 0 &&
+         (pc == 0 || (os->flags[pc - 1] & DELETED) ||
+          !testTMode(GET_OPCODE(code[pc - 1]))))) {
+      os->flags[pc] |= DELETED;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Remove the deleted instructions, correcting jumps, line information
+** and the ranges of local variables.
+*/
+static void compact (OptState *os) {
+  FuncState *fs = os->fs;
+  Proto *f = os->f;
+  int *newpc = os->aux;
+  int pc, i, n = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    newpc[pc] = n;
+    if (!(os->flags[pc] & DELETED)) n++;
+  }
+  newpc[os->n] = n;
+  if (n == os->n) return;  /* nothing to remove */
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction ins = f->code[pc];
+    if (os->flags[pc] & DELETED) continue;
+    switch (GET_OPCODE(ins)) {
+      case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP: {
+        int dest = newpc[pc + 1 + GETARG_sBx(ins)];
+        SETARG_sBx(ins, dest - newpc[pc] - 1);
+        break;
+      }
+      default: break;
+    }
+    f->code[newpc[pc]] = ins;
+    f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+  }
+  for (i = 0; i < fs->nlocvars; i++) {
+    f->locvars[i].startpc = newpc[f->locvars[i].startpc];
+    f->locvars[i].endpc = newpc[f->locvars[i].endpc];
+  }
+  fs->pc = os->n = n;
+}
+
+
+/*
+** Visit the constant operands of instruction '*pi' (an 'OP_EXTRAARG'
+** after an 'OP_LOADKX' if 'isextra'). If 'mark', set 'newk[k]' for
+** each constant 'k' used; otherwise, change each 'k' to 'newk[k]'.
+*/
+static void visitk (Instruction *pi, int isextra, int *newk, int mark) {
+  Instruction i = *pi;
+  OpCode op = GET_OPCODE(i);
+  if (isextra) {
+    if (mark) newk[GETARG_Ax(i)] = 1;
+    else SETARG_Ax(i, newk[GETARG_Ax(i)]);
+  }
+  else if (op == OP_LOADK) {
+    if (mark) newk[GETARG_Bx(i)] = 1;
+    else SETARG_Bx(i, newk[GETARG_Bx(i)]);
+  }
+  else if (getOpMode(op) == iABC) {
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    if (getBMode(op) == OpArgK && ISK(b)) {
+      if (mark) newk[INDEXK(b)] = 1;
+      else SETARG_B(i, RKASK(newk[INDEXK(b)]));
+    }
+    if (getCMode(op) == OpArgK && ISK(c)) {
+      if (mark) newk[INDEXK(c)] = 1;
+      else SETARG_C(i, RKASK(newk[INDEXK(c)]));
+    }
+  }
+  *pi = i;
+}
+
+
+/*
+** Remove the constants no longer used by the code (such as the pieces
+** of folded concatenations). Constants only move down, so they keep
+** fitting in their operands.
+*/
+static void compactk (OptState *os) {
+  FuncState *fs = os->fs;
+  Proto *f = os->f;
+  int *newk = os->aux;
+  int pc, k, n = 0;
+  for (k = 0; k < fs->nk; k++)
+    newk[k] = 0;
+  for (pc = 0; pc < os->n; pc++)
+    visitk(&f->code[pc], pc > 0 && GET_OPCODE(f->code[pc - 1]) == OP_LOADKX,
+           newk, 1);
+  for (k = 0; k < fs->nk; k++) {
+    if (newk[k]) {
+      setobj(fs->ls->L, &f->k[n], &f->k[k]);
+      newk[k] = n++;
+    }
+  }
+  if (n == fs->nk) return;  /* all constants in use */
+  for (k = n; k < fs->nk; k++)
+    setnilvalue(&f->k[k]);
+  fs->nk = n;
+  for (pc = 0; pc < os->n; pc++)
+    visitk(&f->code[pc], pc > 0 && GET_OPCODE(f->code[pc - 1]) == OP_LOADKX,
+           newk, 0);
+}
+
+
+/*
+** Cut 'maxstacksize' to the registers used by the code (but keep the
+** parameters and the minimum of 2 registers set by the parser).
+*/
+static void shrinkstack (OptState *os) {
+  Proto *f = os->f;
+  int pc, x, need = (f->numparams > 2) ? f->numparams : 2;
+  os->top = 0;  /* do not count ranges up to the stack top */
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = f->code[pc];
+    RegSet use, def, mod;
+    OpCode op = GET_OPCODE(i);
+    int hi = os->nactive[pc];
+    regrefs(os, i, &use, &def, &mod);
+    for (x = MAXARG_A; x >= hi; x--) {
+      if (rsin(&use, x) || rsin(&mod, x)) {
+        hi = x + 1;
+        break;
+      }
+    }
+    if (op == OP_TFORCALL && GETARG_A(i) + 6 > hi)
+      hi = GETARG_A(i) + 6;  /* call uses 3 registers after the loop's */
+    else if (op != OP_SETTABUP && op != OP_SETUPFIELD && op != OP_JMP &&
+             op != OP_EXTRAARG && GETARG_A(i) >= hi)
+      hi = GETARG_A(i) + 1;
+    if (hi > need) need = hi;
+  }
+  if (need < f->maxstacksize)
+    f->maxstacksize = cast_byte(need);
+}
+
+/* }====================================================== */
+
+
+void luaK_optimize (FuncState *fs) {
+  lua_State *L = fs->ls->L;
+  Mbuffer *buff = &fs->ls->dyd->optbuff;
+  OptState os;
+  size_t n = cast(size_t, fs->pc);
+  size_t naux = n + 1 + cast(size_t, fs->nk);  /* fits all constants */
+  size_t size = n * sizeof(RegSet) + naux * sizeof(int) + 2 * n;
+  int round, changed = 1;
+  if (luaZ_sizebuffer(buff) < size)
+    luaZ_resizebuffer(L, buff, size);
+  os.fs = fs;
+  os.f = fs->f;
+  os.n = fs->pc;
+  os.top = fs->f->maxstacksize;
+  os.live = cast(RegSet *, luaZ_buffer(buff));
+  os.aux = cast(int *, os.live + n);
+  os.nactive = cast(lu_byte *, os.aux + naux);
+  os.flags = os.nactive + n;
+  for (round = 0; changed && round < MAXROUNDS; round++) {
+    analyze(&os);
+    changed = foldcompare(&os);
+    changed |= foldconcat(&os);
+    changed |= copyforward(&os);
+    changed |= retarget(&os);
+    changed |= deadstores(&os);
+    changed |= threadjumps(&os);
+    changed |= removedead(&os);
+    compact(&os);
+  }
+  findlocals(&os);
+  shrinkstack(&os);
+  compactk(&os);
+}
+
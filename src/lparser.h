@@ -100,6 +100,7 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  Mbuffer optbuff;  /* work space for the optimizer (lopt.c) */
 } Dyndata;
 
 
@@ -0,0 +1,354 @@
+/*
+** $Id: lproflib.c $
+** Sampling profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lproflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <signal.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** The profiler takes samples of the call stack of a running state and
+** counts how many times each distinct stack was seen. A sample is taken
+** by a count hook, which stays installed on the thread that started the
+** profiler (and on the main thread); new coroutines inherit it, so the
+** sample is taken in whichever thread is running. In "instr" mode, the
+** hook fires every 'interval' VM instructions. In "time" mode (available
+** on POSIX systems), it fires every LUA_PROFTICK instructions and only
+** checks the flag 'ticked', which a profiling timer (SIGPROF) sets each
+** 'interval' microseconds of CPU time.
+**
+** Samples are kept in the table registry[&SAMPLESKEY], which maps each
+** stack, in "folded" format ("f1;f2;...;fn", outermost function first)
+** to its count. Each frame is "name@source:line". The line is where the
+** function was defined or, with option "l", its current line.
+**
+** Because the timer is per process, only one state can be profiled at
+** a time.
+*/
+
+
+/* maximum number of frames recorded per sample */
+#if !defined(LUA_PROFMAXDEPTH)
+#define LUA_PROFMAXDEPTH	100
+#endif
+
+
+/* instructions between checks for a due sample in "time" mode */
+#if !defined(LUA_PROFTICK)
+#define LUA_PROFTICK	1000
+#endif
+
+
+/* key in the registry for the table of samples */
+static const int SAMPLESKEY = 0;
+
+
+/* profiler state (only one state can be profiled at a time) */
+static lua_State *volatile profL = NULL;  /* main thread being profiled */
+static int profmode;  /* 0 = time; 1 = instructions */
+static int bylines;  /* frames identify lines instead of functions */
+static lua_Integer nsamples;  /* samples taken */
+static lua_Integer ndropped;  /* samples lost to memory errors */
+static volatile sig_atomic_t ticked;  /* a sample is due ("time" mode) */
+
+/* hook in effect before 'profile.start' (restored after each sample) */
+static lua_Hook oldhook;
+static int oldmask;
+static int oldcount;
+
+
+
+/*
+** {======================================================
+** Timers
+** =======================================================
+*/
+
+#if !defined(l_settimer)	/* { */
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <sys/time.h>
+
+#define l_havetimer()	1
+
+static struct sigaction oldaction;
+
+/*
+** Signal handler: just mark that a sample is due; the hook of the
+** running thread takes it.
+*/
+static void proftick (int i) {
+  (void)i;
+  ticked = 1;
+}
+
+/* start ('usec' > 0) or stop ('usec' == 0) the profiling timer */
+static int l_settimer (long usec) {
+  struct itimerval t;
+  t.it_interval.tv_sec = usec / 1000000;
+  t.it_interval.tv_usec = usec % 1000000;
+  t.it_value = t.it_interval;
+  if (usec > 0) {
+    struct sigaction sa;
+    sa.sa_handler = proftick;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, &oldaction) != 0) return 0;
+    return (setitimer(ITIMER_PROF, &t, NULL) == 0);
+  }
+  else {
+    setitimer(ITIMER_PROF, &t, NULL);
+    sigaction(SIGPROF, &oldaction, NULL);
+    return 1;
+  }
+}
+
+#else				/* }{ */
+
+/* ISO C has no profiling timers; only "instr" mode is available */
+#define l_havetimer()	0
+#define l_settimer(usec)	((void)(usec), 0)
+
+#endif				/* } */
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Sampling
+** =======================================================
+*/
+
+/* add to 'b' the frame of function 'ar' */
+static void addframe (luaL_Buffer *b, lua_Debug *ar) {
+  char line[32];
+  const char *name = ar->name;
+  if (name == NULL)
+    name = (*ar->what == 'm') ? "main chunk" : "?";
+  luaL_addstring(b, name);
+  luaL_addchar(b, '@');
+  luaL_addstring(b, ar->short_src);
+  if (*ar->what != 'C') {
+    int l = bylines ? ar->currentline : ar->linedefined;
+    l_sprintf(line, sizeof(line), ":%d", l);
+    luaL_addstring(b, line);
+  }
+}
+
+
+/*
+** Record the stack of the function that was interrupted by the hook.
+** Called (in protected mode) by the hook, so level 0 is this function
+** itself.
+*/
+static int recordstack (lua_State *L) {
+  lua_Debug ar;
+  luaL_Buffer b;
+  int level;
+  int depth = 1;
+  while (depth <= LUA_PROFMAXDEPTH && lua_getstack(L, depth, &ar))
+    depth++;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &SAMPLESKEY);
+  luaL_buffinit(L, &b);
+  for (level = depth - 1; level >= 1; level--) {  /* outermost first */
+    lua_getstack(L, level, &ar);
+    lua_getinfo(L, bylines ? "Sln" : "Sn", &ar);
+    addframe(&b, &ar);
+    if (level > 1) luaL_addchar(&b, ';');
+  }
+  luaL_pushresult(&b);
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);  /* samples[stack] */
+  lua_pushinteger(L, lua_tointeger(L, -1) + 1);
+  lua_remove(L, -2);
+  lua_rawset(L, -3);  /* samples[stack] = samples[stack] + 1 */
+  return 0;
+}
+
+
+/*
+** The sampling hook. It runs in the middle of arbitrary code, so it
+** must not raise errors: sampling happens in protected mode, and a
+** sample that cannot be recorded is only counted.
+*/
+static void hookf (lua_State *L, lua_Debug *ar) {
+  int top = lua_gettop(L);
+  (void)ar;
+  if (profL == NULL) {  /* stopped? */
+    lua_sethook(L, oldhook, oldmask, oldcount);  /* remove this hook */
+    return;
+  }
+  if (profmode == 0) {  /* time mode? */
+    if (!ticked) return;  /* no sample due */
+    ticked = 0;
+  }
+  nsamples++;
+  if (!lua_checkstack(L, 6)) ndropped++;
+  else {
+    lua_pushcfunction(L, recordstack);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+      ndropped++;
+  }
+  lua_settop(L, top);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Library functions
+** =======================================================
+*/
+
+static int prof_start (lua_State *L) {
+  static const char *const modes[] = {"time", "instr", NULL};
+  int mode = luaL_checkoption(L, 2, l_havetimer() ? "time" : "instr", modes);
+  lua_Integer interval = luaL_optinteger(L, 1, (mode == 0) ? 10000 : 100000);
+  const char *opts = luaL_optstring(L, 3, "");
+  lua_State *mainth;
+  int count;
+  luaL_argcheck(L, 0 < interval && interval <= 0x7fffffff, 1,
+                   "interval out of range");
+  luaL_argcheck(L, mode == 1 || l_havetimer(), 2,
+                   "time mode not supported");
+  if (profL != NULL)
+    return luaL_error(L, "profiler already running");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  mainth = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &SAMPLESKEY) != LUA_TTABLE) {
+    lua_newtable(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &SAMPLESKEY);
+  }
+  lua_pop(L, 1);
+  profmode = mode;
+  bylines = (strchr(opts, 'l') != NULL);
+  oldhook = lua_gethook(L);
+  oldmask = lua_gethookmask(L);
+  oldcount = lua_gethookcount(L);
+  ticked = 0;
+  if (mode == 0 && !l_settimer((long)interval))
+    return luaL_error(L, "cannot start profiling timer");
+  profL = mainth;
+  count = (mode == 0) ? LUA_PROFTICK : (int)interval;
+  lua_sethook(L, hookf, LUA_MASKCOUNT, count);
+  if (mainth != L)  /* started in a coroutine? */
+    lua_sethook(mainth, hookf, LUA_MASKCOUNT, count);
+  return 0;
+}
+
+
+static int prof_stop (lua_State *L) {
+  if (profL == NULL)
+    return 0;  /* not running */
+  if (profmode == 0)
+    (void)l_settimer(0);
+  if (lua_gethook(L) == hookf)
+    lua_sethook(L, oldhook, oldmask, oldcount);
+  if (lua_gethook(profL) == hookf)
+    lua_sethook(profL, oldhook, oldmask, oldcount);
+  profL = NULL;  /* other threads with the hook will reset it */
+  return 0;
+}
+
+
+/* push the samples table (creating an empty one if needed) */
+static void getsamples (lua_State *L) {
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &SAMPLESKEY) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+  }
+}
+
+
+/* returns a copy of the samples table, the sample count and the losses */
+static int prof_samples (lua_State *L) {
+  lua_newtable(L);
+  getsamples(L);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, -5);
+  }
+  lua_pop(L, 1);
+  lua_pushinteger(L, nsamples);
+  lua_pushinteger(L, ndropped);
+  return 3;
+}
+
+
+/*
+** Returns the samples in folded format, one "stack count" per line,
+** as expected by flame-graph tools.
+*/
+static int prof_folded (lua_State *L) {
+  luaL_Buffer b;
+  lua_Integer i, n = 0;
+  int lines;
+  getsamples(L);
+  lua_newtable(L);
+  lines = lua_gettop(L);
+  lua_pushnil(L);
+  while (lua_next(L, lines - 1)) {
+    lua_pushvalue(L, -2);
+    lua_pushfstring(L, "%s %s\n", lua_tostring(L, -1),
+                                  lua_tostring(L, -2));
+    lua_rawseti(L, lines, ++n);
+    lua_pop(L, 2);
+  }
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, lines, i);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+static int prof_reset (lua_State *L) {
+  lua_newtable(L);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &SAMPLESKEY);
+  nsamples = ndropped = 0;
+  return 0;
+}
+
+
+static const luaL_Reg proflib[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"samples", prof_samples},
+  {"folded", prof_folded},
+  {"reset", prof_reset},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
+LUAMOD_API int luaopen_profile (lua_State *L) {
+  luaL_newlib(L, proflib);
+  return 1;
+}
+
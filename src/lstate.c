@@ -20,6 +20,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "llex.h"
 #include "lmem.h"
 #include "lstate.h"
@@ -204,6 +205,9 @@ static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
   stack_init(L, L);  /* init stack */
+#if defined(LUA_USE_SHAPES)
+  luaH_initshapes(L);
+#endif
   init_registry(L, g);
   luaS_init(L);
   luaT_init(L);
@@ -236,6 +240,7 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->nny = 1;
   L->status = LUA_OK;
   L->errfunc = 0;
+  memset(L->nextpos, 0, sizeof(L->nextpos));
 }
 
 
@@ -245,7 +250,10 @@ static void close_state (lua_State *L) {
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaM_freearray(L, G(L)->strt.hash, strtablen(&G(L)->strt));
+#if defined(LUA_USE_SHAPES)
+  luaH_freeshapes(L);
+#endif
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
@@ -311,14 +319,22 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->seed = makeseed(L);
   g->gcrunning = 0;  /* no GC while building state */
   g->GCestimate = 0;
-  g->strt.size = g->strt.nuse = 0;
+  g->strt.size = g->strt.oldsize = g->strt.nuse = 0;
+  g->strt.next = 0;
   g->strt.hash = NULL;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->version = NULL;
   g->gcstate = GCSpause;
-  g->gckind = KGC_NORMAL;
+  g->gckind = KGC_INC;
+  g->gcemergency = 0;
+  g->optimize = 0;
+  g->jiton = 0;
+  g->jithot = LUAI_JITHOT;
   g->allgc = g->finobj = g->tobefnz = g->fixedgc = NULL;
+  g->survival = g->old1 = g->reallyold = g->firstold1 = NULL;
+  g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
+  g->lastatomic = 0;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
@@ -328,7 +344,12 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->genminormul = LUAI_GENMINORMUL;
+  g->genmajormul = LUAI_GENMAJORMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+#if defined(LUA_USE_SHAPES)
+  g->rootshape = NULL;
+#endif
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
@@ -26,6 +26,20 @@
 ** 'tobefnz': all objects ready to be finalized; 
 ** 'fixedgc': all objects that are not to be collected (currently
 ** only small strings, such as reserved words).
+**
+** For the generational collector, some of these lists have marks for
+** generations. Each mark points to the first element in the list for
+** that particular generation; that generation goes until the next mark.
+**
+** 'allgc' -> 'survival': new objects;
+** 'survival' -> 'old1': objects that survived one collection;
+** 'old1' -> 'reallyold': objects that became old in last collection;
+** 'reallyold' -> NULL: objects old for more than one cycle.
+**
+** 'finobj' -> 'finobjsur': new objects marked for finalization;
+** 'finobjsur' -> 'finobjold1': survived   "";
+** 'finobjold1' -> 'finobjrold': just old   "";
+** 'finobjrold' -> NULL: really old       "".
 
 */
 
@@ -50,17 +64,20 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
 
-/* kinds of Garbage Collection */
-#define KGC_NORMAL	0
-#define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
-
-
+/*
+** String table. While it is resized (see 'lstring.c'), 'hash' keeps
+** the largest of its old and new sizes.
+*/
 typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
   int size;
+  int oldsize;  /* size before the resize in progress (or 'size') */
+  int next;  /* first list (of 'oldsize') whose strings did not move */
 } stringtable;
 
+#define strtablen(tb)	((tb)->size > (tb)->oldsize ? (tb)->size : (tb)->oldsize)
+
 
 /*
 ** Information about a call.
@@ -128,7 +145,10 @@ typedef struct global_State {
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
+  lu_byte gcemergency;  /* true if this is an emergency collection */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte optimize;  /* true to optimize the code of new functions */
+  lu_byte jiton;  /* true if the JIT compiler is on */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -139,10 +159,22 @@ typedef struct global_State {
   GCObject *allweak;  /* list of all-weak tables */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
+  /* fields for generational collector */
+  GCObject *survival;  /* start of objects that survived one GC cycle */
+  GCObject *old1;  /* start of old1 objects */
+  GCObject *reallyold;  /* objects more than one cycle old ("really old") */
+  GCObject *firstold1;  /* first OLD1 object in the list (if any) */
+  GCObject *finobjsur;  /* list of survival objects with finalizers */
+  GCObject *finobjold1;  /* list of old1 objects with finalizers */
+  GCObject *finobjrold;  /* list of really old objects with finalizers */
+  lu_mem lastatomic;  /* see function 'genstep' in file 'lgc.c' */
   struct lua_State *twups;  /* list of threads with open upvalues */
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  int genminormul;  /* control for minor generational collections */
+  int genmajormul;  /* control for major generational collections */
+  int jithot;  /* hot events before compiling a function */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
@@ -150,9 +182,25 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+#if defined(LUA_USE_SHAPES)
+  struct Shape *rootshape;  /* empty shape (see 'ltable.h') */
+#endif
 } global_State;
 
 
+/*
+** Position where a traversal step over table 't' stopped (see
+** 'luaH_next'); 't' may be dead, as it is only compared.
+*/
+typedef struct NextPos {
+  struct Table *t;
+  unsigned int pos;
+} NextPos;
+
+/* number of traversals (e.g., nested loops) each thread remembers */
+#define NEXTCACHE	2
+
+
 /*
 ** 'per thread' state
 */
@@ -180,6 +228,7 @@ struct lua_State {
   unsigned short nCcalls;  /* number of nested C calls */
   l_signalT hookmask;
   lu_byte allowhook;
+  NextPos nextpos[NEXTCACHE];  /* where recent 'luaH_next' steps stopped */
 };
 
 
@@ -25,6 +25,37 @@
 #define MEMERRMSG       "not enough memory"
 
 
+/*
+** equality for long strings. Strings whose hashes are known and differ
+** cannot be equal; otherwise, as long strings often share long prefixes
+** (paths, keys with counters, etc.), compare their last words before
+** the whole contents.
+*/
+int luaS_eqlngstr (TString *a, TString *b) {
+  size_t len = a->u.lnglen;
+  lua_assert(a->tt == LUA_TLNGSTR && b->tt == LUA_TLNGSTR);
+  if (a == b)  /* same instance? */
+    return 1;
+  else if (len != b->u.lnglen)  /* different lengths? */
+    return 0;
+  else if ((a->extra & b->extra & LNGHASHBIT) &&  /* both have hashes? */
+           a->hash != b->hash)  /* hashes differ? */
+    return 0;
+  else {
+    if (len >= sizeof(size_t)) {
+      size_t wa, wb;
+      memcpy(&wa, getstr(a) + len - sizeof(size_t), sizeof(size_t));
+      memcpy(&wb, getstr(b) + len - sizeof(size_t), sizeof(size_t));
+      if (wa != wb)
+        return 0;
+    }
+    return (memcmp(getstr(a), getstr(b), len) == 0);  /* equal contents? */
+  }
+}
+
+
+#if !defined(LUA_USE_WYHASH)	/* { */
+
 /*
 ** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
 ** compute its hash
@@ -34,18 +65,6 @@
 #endif
 
 
-/*
-** equality for long strings
-*/
-int luaS_eqlngstr (TString *a, TString *b) {
-  size_t len = a->u.lnglen;
-  lua_assert(a->tt == LUA_TLNGSTR && b->tt == LUA_TLNGSTR);
-  return (a == b) ||  /* same instance or... */
-    ((len == b->u.lnglen) &&  /* equal length and ... */
-     (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
-}
-
-
 unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   unsigned int h = seed ^ cast(unsigned int, l);
   size_t step = (l >> LUAI_HASHLIMIT) + 1;
@@ -54,45 +73,205 @@ unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   return h;
 }
 
+#else				/* }{ */
+
+/*
+** Hash in the style of wyhash (public domain, by Wang Yi): words of the
+** string are combined in pairs, each pair through a 64x64->128-bit
+** product whose halves are xor'ed ('mix'). Strings up to 16 bytes take
+** a single product; longer ones go through three independent chains
+** of products for each 48-byte block, which the processor overlaps.
+*/
+typedef unsigned long long Word;
+
+#define P0	0xa0761d6478bd642fULL
+#define P1	0xe7037ed1a0b428dbULL
+#define P2	0x8ebc6af09c88c6e3ULL
+#define P3	0x589965cc75374cc3ULL
+
+
+/* full product of 'a' and 'b': low half in 'a', high half in 'b' */
+static void mul128 (Word *a, Word *b) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 r = *a;
+  r *= *b;
+  *a = cast(Word, r);
+  *b = cast(Word, r >> 64);
+#else
+  Word ha = *a >> 32, hb = *b >> 32, la = cast(unsigned int, *a),
+       lb = cast(unsigned int, *b);
+  Word rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  Word t = rl + (rm0 << 32);
+  Word c = (t < rl);
+  Word lo = t + (rm1 << 32);
+  c += (lo < t);
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+
+static Word mix (Word a, Word b) {
+  mul128(&a, &b);
+  return a ^ b;
+}
+
+
+/* reads of 8, 4, and 1 to 3 bytes (in native order) */
+static Word read8 (const char *p) {
+  Word w;
+  memcpy(&w, p, 8);
+  return w;
+}
+
+static Word read4 (const char *p) {
+  unsigned int w;
+  memcpy(&w, p, 4);
+  return w;
+}
+
+static Word read3 (const char *p, size_t l) {
+  return (cast(Word, cast_byte(p[0])) << 16) |
+         (cast(Word, cast_byte(p[l >> 1])) << 8) | cast_byte(p[l - 1]);
+}
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  const char *p = str;
+  Word h = seed ^ P0;
+  Word a, b;
+  if (l <= 16) {
+    if (l >= 4) {  /* (two overlapping reads cover up to 16 bytes) */
+      size_t m = (l >> 3) << 2;
+      a = (read4(p) << 32) | read4(p + m);
+      b = (read4(p + l - 4) << 32) | read4(p + l - 4 - m);
+    }
+    else if (l > 0) {
+      a = read3(p, l);
+      b = 0;
+    }
+    else
+      a = b = 0;
+  }
+  else {
+    size_t i = l;
+    if (i > 48) {
+      Word h1 = h, h2 = h;
+      do {
+        h = mix(read8(p) ^ P1, read8(p + 8) ^ h);
+        h1 = mix(read8(p + 16) ^ P2, read8(p + 24) ^ h1);
+        h2 = mix(read8(p + 32) ^ P3, read8(p + 40) ^ h2);
+        p += 48; i -= 48;
+      } while (i > 48);
+      h ^= h1 ^ h2;
+    }
+    while (i > 16) {
+      h = mix(read8(p) ^ P1, read8(p + 8) ^ h);
+      p += 16; i -= 16;
+    }
+    a = read8(p + i - 16);  /* last 16 bytes (maybe already mixed) */
+    b = read8(p + i - 8);
+  }
+  a ^= P1;
+  b ^= h;
+  mul128(&a, &b);
+  h = mix(a ^ P0 ^ l, b ^ P1);
+  return cast(unsigned int, h ^ (h >> 32));
+}
+
+#endif				/* } */
+
 
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
-  if (ts->extra == 0) {  /* no hash? */
+  if (!(ts->extra & LNGHASHBIT)) {  /* no hash? */
     ts->hash = luaS_hash(getstr(ts), ts->u.lnglen, ts->hash);
-    ts->extra = 1;  /* now it has its hash */
+    ts->extra |= LNGHASHBIT;  /* now it has its hash */
   }
   return ts->hash;
 }
 
 
 /*
-** resizes the string table
+** The string table is resized incrementally: its lists move to their
+** positions for the new size in order, a few at each call to
+** 'internshrstr'. When growing, old list 'i' splits into lists 'i',
+** 'i + oldsize', ...; when shrinking, the lists from 'size' on merge
+** into the lists below 'size'. All lists before 'next' already moved,
+** so a string is in the list for the new size if its list for the old
+** size comes before 'next'.
 */
-void luaS_resize (lua_State *L, int newsize) {
-  int i;
-  stringtable *tb = &G(L)->strt;
-  if (newsize > tb->size) {  /* grow table if needed */
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
-    for (i = tb->size; i < newsize; i++)
-      tb->hash[i] = NULL;
-  }
-  for (i = 0; i < tb->size; i++) {  /* rehash */
-    TString *p = tb->hash[i];
-    tb->hash[i] = NULL;
+#define MOVESTEP	4
+
+
+/* list in table 'tb' for hash 'h' */
+static int strpos (const stringtable *tb, unsigned int h) {
+  int i = lmod(h, tb->oldsize);
+  return (i < tb->next) ? lmod(h, tb->size) : i;
+}
+
+
+/*
+** Move the strings of the next 'n' lists of the string table to their
+** lists for the new size; finish the resize after the last one.
+*/
+static void movelists (lua_State *L, stringtable *tb, int n) {
+  for (; n > 0 && tb->next < tb->oldsize; n--) {
+    TString *p = tb->hash[tb->next];
+    tb->hash[tb->next++] = NULL;
     while (p) {  /* for each node in the list */
       TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, newsize);  /* new position */
+      unsigned int h = lmod(p->hash, tb->size);  /* new position */
       p->u.hnext = tb->hash[h];  /* chain it */
       tb->hash[h] = p;
       p = hnext;
     }
   }
-  if (newsize < tb->size) {  /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
+  if (tb->next >= tb->oldsize) {  /* all lists moved? */
+    if (tb->size < tb->oldsize) {  /* shrink vector */
+      /* vanishing slice should be empty */
+      lua_assert(tb->hash[tb->size] == NULL &&
+                 tb->hash[tb->oldsize - 1] == NULL);
+      luaM_reallocvector(L, tb->hash, tb->oldsize, tb->size, TString *);
+    }
+    tb->oldsize = tb->next = tb->size;
+  }
+}
+
+
+/*
+** Start resizing the string table to 'newsize' lists, after completing
+** any resize still in progress
+*/
+void luaS_resize (lua_State *L, int newsize) {
+  int i;
+  stringtable *tb = &G(L)->strt;
+  movelists(L, tb, MAX_INT);
+  if (newsize > tb->size) {  /* grow table if needed */
     luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
+    for (i = tb->size; i < newsize; i++)
+      tb->hash[i] = NULL;
   }
+  /* lists below the new size need not move when shrinking */
+  tb->next = (newsize < tb->size) ? newsize : 0;
   tb->size = newsize;
+  movelists(L, tb, MOVESTEP);  /* first step (completes an empty table) */
+}
+
+
+/*
+** Make room in the string table for at least 'n' strings at once
+*/
+void luaS_reserve (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (n > tb->size) {
+    int size = (n > MAX_INT / 2) ? (MAX_INT / 2) + 1
+                                 : twoto(luaO_ceillog2(cast(unsigned int, n)));
+    if (size > tb->size) {
+      luaS_resize(L, size);
+      movelists(L, tb, MAX_INT);  /* complete it */
+    }
+  }
 }
 
 
@@ -151,9 +330,108 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 }
 
 
+#if defined(LUA_USE_STRBUILDER)	/* { */
+
+/*
+** {======================================================
+** Builder strings
+** =======================================================
+*/
+
+/*
+** The result of a concatenation whose first operand is a long string
+** keeps its bytes in a separate buffer ('SBuffer'), which it may share
+** with other such strings. Appending to the last string in a buffer
+** writes the new bytes right after it, in place, and makes the result
+** the new last string; so, a loop 's = s .. x' copies each piece once
+** (plus the whole buffer each time it must grow), instead of copying
+** all of 's' at each step. Every other string in a buffer is a prefix
+** of the last one, so its bytes need not be followed by a '\0'.
+** 'luaS_flatten' fixes that before the contents go to C.
+*/
+
+/* 'size' of a buffer that cannot grow in place anymore */
+#define SEALED		MAX_SIZE
+
+
+void luaS_freebuffer (lua_State *L, SBuffer *b) {
+  if (b != NULL && --b->nrefs == 0)
+    luaM_freemem(L, b, sizesbuffer(b->capacity));
+}
+
+
+static SBuffer *newbuffer (lua_State *L, size_t capacity) {
+  SBuffer *b = cast(SBuffer *, luaM_malloc(L, sizesbuffer(capacity)));
+  b->capacity = capacity;
+  b->nrefs = 1;
+  return b;
+}
+
+
+/*
+** Create a builder string with length 'l' whose first bytes are the
+** contents of long string 'ts'; the caller fills in the other bytes.
+*/
+TString *luaS_extend (lua_State *L, TString *ts, size_t l) {
+  size_t len = ts->u.lnglen;
+  SBuffer *b;
+  TString *res = gco2ts(luaC_newobj(L, LUA_TLNGSTR, sizebuilder));
+  lua_assert(ts->tt == LUA_TLNGSTR && len < l);
+  res->hash = G(L)->seed;
+  res->extra = BUILDERBIT;
+  res->u.lnglen = 0;
+  sbuffer(res) = NULL;
+  if (isbuilder(ts) && (b = sbuffer(ts))->size == len && l < b->capacity)
+    b->nrefs++;  /* 'ts' ends its buffer and there is room after it */
+  else {
+    /* leave room to grow only when 'ts' already ends a buffer (that is,
+       from the second append on); most results are never appended to */
+    size_t capacity = l + 1;
+    if (isbuilder(ts) && sbuffer(ts)->size == len && l < MAX_SIZE / 4)
+      capacity += l / 2;
+    setsvalue2s(L, L->top, res);  /* anchor new string (EXTRA_STACK) */
+    L->top++;
+    b = newbuffer(L, capacity);
+    L->top--;
+    memcpy(b->data, getstr(ts), len * sizeof(char));
+  }
+  b->size = l;
+  b->data[l] = '\0';  /* ending 0 */
+  sbuffer(res) = b;
+  res->u.lnglen = l;
+  return res;
+}
+
+
+/*
+** Make sure that the bytes of builder string 'ts' are followed by a
+** '\0' that no later concatenation will overwrite; return them.
+*/
+const char *luaS_flatten (lua_State *L, TString *ts) {
+  SBuffer *b = sbuffer(ts);
+  size_t l = ts->u.lnglen;
+  lua_assert(isbuilder(ts));
+  if (b->size == l)  /* 'ts' ends its buffer? */
+    b->size = SEALED;  /* keep its '\0' there */
+  else if (b->data[l] != '\0') {  /* give 'ts' a buffer of its own */
+    SBuffer *nb = newbuffer(L, l + 1);
+    memcpy(nb->data, b->data, l * sizeof(char));
+    nb->data[l] = '\0';
+    nb->size = SEALED;
+    sbuffer(ts) = nb;
+    luaS_freebuffer(L, b);
+  }
+  return sbuffer(ts)->data;
+}
+
+/* }====================================================== */
+
+#endif				/* } */
+
+
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = &tb->hash[strpos(tb, ts->hash)];
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -167,9 +445,13 @@ void luaS_remove (lua_State *L, TString *ts) {
 static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
   global_State *g = G(L);
+  stringtable *tb = &g->strt;
   unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &g->strt.hash[lmod(h, g->strt.size)];
+  TString **list;
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
+  if (tb->oldsize != tb->size)  /* resize in progress? */
+    movelists(L, tb, MOVESTEP);  /* move a few more lists */
+  list = &tb->hash[strpos(tb, h)];
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == ts->shrlen &&
         (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
@@ -179,16 +461,17 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
-    luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
+  if (tb->nuse >= tb->size && tb->size <= MAX_INT/2 &&
+      tb->oldsize == tb->size) {  /* not being resized already? */
+    luaS_resize(L, tb->size * 2);
+    list = &tb->hash[strpos(tb, h)];  /* recompute with new size */
   }
   ts = createstrobj(L, l, LUA_TSHRSTR, h);
   memcpy(getstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
   ts->u.hnext = *list;
   *list = ts;
-  g->strt.nuse++;
+  tb->nuse++;
   return ts;
 }
 
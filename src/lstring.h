@@ -17,6 +17,27 @@
 #define sizeludata(l)	(sizeof(union UUdata) + (l))
 #define sizeudata(u)	sizeludata((u)->len)
 
+
+#if defined(LUA_USE_STRBUILDER)
+
+#define sizebuilder	(sizeof(union UTString) + sizeof(SBuffer *))
+#define sizesbuffer(n)	(offsetof(SBuffer, data) + (n) * sizeof(char))
+
+/* size of a long string object */
+#define sizelngstr(ts)  \
+	(isbuilder(ts) ? sizebuilder : sizelstring((ts)->u.lnglen))
+
+/* contents of 'ts' as a C string that stays valid while 'ts' lives */
+#define getcstr(L,ts)	(isbuilder(ts) ? luaS_flatten(L, ts) : getstr(ts))
+
+#else
+
+#define sizelngstr(ts)	sizelstring((ts)->u.lnglen)
+#define getcstr(L,ts)	(UNUSED(L), getstr(ts))
+
+#endif
+
+
 #define luaS_newliteral(L, s)	(luaS_newlstr(L, "" s, \
                                  (sizeof(s)/sizeof(char))-1))
 
@@ -37,6 +58,7 @@ LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
 LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_reserve (lua_State *L, int n);
 LUAI_FUNC void luaS_clearcache (global_State *g);
 LUAI_FUNC void luaS_init (lua_State *L);
 LUAI_FUNC void luaS_remove (lua_State *L, TString *ts);
@@ -44,6 +66,11 @@ LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+#if defined(LUA_USE_STRBUILDER)
+LUAI_FUNC TString *luaS_extend (lua_State *L, TString *ts, size_t l);
+LUAI_FUNC const char *luaS_flatten (lua_State *L, TString *ts);
+LUAI_FUNC void luaS_freebuffer (lua_State *L, SBuffer *b);
+#endif
 
 
 #endif
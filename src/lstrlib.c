@@ -14,6 +14,7 @@
 #include <float.h>
 #include <limits.h>
 #include <locale.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -211,6 +212,9 @@ static int str_dump (lua_State *L) {
 #define CAP_POSITION	(-2)
 
 
+typedef struct CPattern CPattern;  /* compiled pattern */
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
@@ -218,6 +222,7 @@ typedef struct MatchState {
   lua_State *L;
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
+  const CPattern *cp;  /* compiled form of the pattern (NULL if none) */
   struct {
     const char *init;
     ptrdiff_t len;
@@ -322,30 +327,29 @@ static int matchbracketclass (int c, const char *p, const char *ec) {
 }
 
 
+/* check whether char 'c' is in the single-char class 'p' (ending at 'ep') */
+static int classmatch (int c, const char *p, const char *ep) {
+  switch (*p) {
+    case '.': return 1;  /* matches any char */
+    case L_ESC: return match_class(c, uchar(*(p+1)));
+    case '[': return matchbracketclass(c, p, ep-1);
+    default:  return (uchar(*p) == c);
+  }
+}
+
+
 static int singlematch (MatchState *ms, const char *s, const char *p,
                         const char *ep) {
   if (s >= ms->src_end)
     return 0;
-  else {
-    int c = uchar(*s);
-    switch (*p) {
-      case '.': return 1;  /* matches any char */
-      case L_ESC: return match_class(c, uchar(*(p+1)));
-      case '[': return matchbracketclass(c, p, ep-1);
-      default:  return (uchar(*p) == c);
-    }
-  }
+  else
+    return classmatch(uchar(*s), p, ep);
 }
 
 
-static const char *matchbalance (MatchState *ms, const char *s,
-                                   const char *p) {
-  if (p >= ms->p_end - 1)
-    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
-  if (*s != *p) return NULL;
+static const char *balance (MatchState *ms, const char *s, int b, int e) {
+  if (*s != b) return NULL;
   else {
-    int b = *p;
-    int e = *(p+1);
     int cont = 1;
     while (++s < ms->src_end) {
       if (*s == e) {
@@ -358,6 +362,14 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+  if (p >= ms->p_end - 1)
+    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+  return balance(ms, s, *p, *(p+1));
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -547,6 +559,545 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
+/*
+** Patterns up to this length are compiled into a list of items, so
+** that matching does not parse them again: each single-char class
+** becomes a set of chars, and each run of plain chars becomes a
+** literal string. 'cmatch' does the same steps as 'match', with the
+** same recursion and the same errors, so both give the same results.
+** Patterns that the compiler does not handle (e.g., malformed ones)
+** are left to 'match'.
+*/
+#if !defined(LUAI_MAXCPATTERN)
+#define LUAI_MAXCPATTERN	128
+#endif
+
+
+/* maximum number of items and of different sets in a compiled pattern */
+#define MAXCITEMS	64
+#define MAXCSETS	16
+
+/* number of entries in the cache of compiled patterns (a power of 2) */
+#define NCACHE		32
+
+
+/* kinds of items */
+#define CI_END		0	/* end of pattern */
+#define CI_LIT		1	/* literal string */
+#define CI_CLASS	2	/* single-char class plus optional suffix */
+#define CI_OPEN		3	/* '(' */
+#define CI_POSITION	4	/* '()' */
+#define CI_CLOSE	5	/* ')' */
+#define CI_DOLLAR	6	/* '$' at the end of the pattern */
+#define CI_BALANCE	7	/* '%b' */
+#define CI_FRONTIER	8	/* '%f' */
+#define CI_BACKREF	9	/* '%0'-'%9' */
+
+/* kinds of sets, for faster scans */
+#define SK_SET		0	/* any other set */
+#define SK_ANY		1	/* all chars */
+#define SK_ONE		2	/* only char 'schar' */
+#define SK_BUT		3	/* all chars but 'schar' */
+
+
+#define SETSIZE		(UCHAR_MAX / 8 + 1)
+
+#define testset(set,c)	((set)[(c) / 8] & (1 << ((c) % 8)))
+
+
+typedef struct CItem {
+  unsigned char op;  /* kind of item */
+  unsigned char rep;  /* suffix of a class ('*', '+', '-', '?', or 0) */
+  unsigned char set;  /* set of a class or of a frontier */
+  char c1, c2;  /* delimiters of '%b'; digit of a back reference */
+  unsigned short lit, len;  /* literal string (position in 'lits') */
+} CItem;
+
+
+struct CPattern {
+  size_t len;  /* length of the pattern */
+  int nitem;  /* number of items (0 if pattern was not compiled) */
+  int first;  /* first item that must match a char (-1 if none) */
+  int ctype;  /* true if pattern depends on the locale */
+  int nset;  /* number of sets */
+  unsigned char skind[MAXCSETS];  /* kind of each set */
+  unsigned char schar[MAXCSETS];  /* char of sets of kinds SK_ONE/SK_BUT */
+  unsigned char set[MAXCSETS][SETSIZE];
+  CItem item[MAXCITEMS];
+  char text[LUAI_MAXCPATTERN];  /* the pattern itself */
+  char lits[LUAI_MAXCPATTERN];  /* chars of the literal strings */
+  char locale[32];  /* name of the LC_CTYPE locale when compiled */
+};
+
+
+/* like 'classend', but returns NULL for a malformed class */
+static const char *cclassend (const char *p, const char *pe) {
+  switch (*p++) {
+    case L_ESC: {
+      return (p == pe) ? NULL : p+1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == pe)
+          return NULL;
+        if (*(p++) == L_ESC && p < pe)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+/*
+** Fill 'set' with the chars matched by class 'p' (ending at 'ep');
+** return the kind of the set, and its distinguished char in '*c'.
+*/
+static int makeset (const char *p, const char *ep, unsigned char *set,
+                    int *c) {
+  int i, n = 0, in = 0, out = 0;
+  memset(set, 0, SETSIZE);
+  for (i = 0; i <= UCHAR_MAX; i++) {
+    if (classmatch(i, p, ep)) {
+      set[i / 8] |= (unsigned char)(1 << (i % 8));
+      n++; in = i;
+    }
+    else out = i;
+  }
+  if (n == UCHAR_MAX + 1) return SK_ANY;
+  else if (n == 1) { *c = in; return SK_ONE; }
+  else if (n == UCHAR_MAX) { *c = out; return SK_BUT; }
+  else return SK_SET;
+}
+
+
+/* add a set to 'cp'; return its index, or -1 if there is no space */
+static int addset (CPattern *cp, const unsigned char *set, int kind, int c) {
+  int i;
+  for (i = 0; i < cp->nset; i++) {
+    if (memcmp(cp->set[i], set, SETSIZE) == 0)
+      return i;  /* reuse an equal set */
+  }
+  if (i == MAXCSETS)
+    return -1;
+  memcpy(cp->set[i], set, SETSIZE);
+  cp->skind[i] = (unsigned char)kind;
+  cp->schar[i] = (unsigned char)((kind == SK_ONE || kind == SK_BUT) ? c : 0);
+  return cp->nset++;
+}
+
+
+/*
+** Compile pattern 'p' into 'cp'. Return false if it cannot be
+** compiled; then it must be interpreted by 'match' (which also raises
+** the proper errors for malformed patterns).
+*/
+static int compile (CPattern *cp, const char *p, size_t lp) {
+  const char *pe = p + lp;
+  int n = 0;  /* number of items */
+  int nopen = 0;  /* number of captures */
+  int nlit = 0;  /* number of chars in 'lits' */
+  cp->nset = 0;
+  while (p < pe) {
+    CItem *it = &cp->item[n];
+    if (n == MAXCITEMS - 1)
+      return 0;  /* no space for this item plus the end */
+    it->rep = 0;
+    switch (*p) {
+      case '(': {
+        if (++nopen > LUA_MAXCAPTURES)
+          return 0;  /* let 'match' raise the error */
+        if (*(p + 1) == ')') {  /* position capture? */
+          it->op = CI_POSITION; p += 2;
+        }
+        else {
+          it->op = CI_OPEN; p++;
+        }
+        break;
+      }
+      case ')': {
+        it->op = CI_CLOSE; p++;
+        break;
+      }
+      case '$': {
+        if ((p + 1) != pe)  /* is the '$' the last char in pattern? */
+          goto dflt;
+        it->op = CI_DOLLAR; p++;
+        break;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= pe - 1)
+              return 0;  /* missing arguments */
+            it->op = CI_BALANCE;
+            it->c1 = *(p + 2); it->c2 = *(p + 3);
+            p += 4;
+            break;
+          }
+          case 'f': {
+            const char *ep;
+            unsigned char set[SETSIZE];
+            int kind, c = 0, k;
+            p += 2;
+            if (*p != '[' || (ep = cclassend(p, pe)) == NULL)
+              return 0;  /* malformed frontier */
+            kind = makeset(p, ep, set, &c);
+            if ((k = addset(cp, set, kind, c)) < 0)
+              return 0;
+            it->op = CI_FRONTIER; it->set = (unsigned char)k;
+            p = ep;
+            break;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            it->op = CI_BACKREF; it->c1 = *(p + 1);
+            p += 2;
+            break;
+          }
+          default: goto dflt;
+        }
+        break;
+      }
+      default: dflt: {  /* single-char class plus optional suffix */
+        const char *ep = cclassend(p, pe);
+        unsigned char set[SETSIZE];
+        int kind, c = 0, k;
+        if (ep == NULL)
+          return 0;  /* malformed class */
+        kind = makeset(p, ep, set, &c);
+        if (ep < pe && (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?'))
+          it->rep = uchar(*ep++);
+        p = ep;
+        if (it->rep == 0 && kind == SK_ONE) {  /* plain char? */
+          cp->lits[nlit] = (char)c;
+          if (n > 0 && (it - 1)->op == CI_LIT) {  /* extend previous string */
+            (it - 1)->len++; nlit++;
+            continue;
+          }
+          it->op = CI_LIT;
+          it->lit = (unsigned short)nlit++; it->len = 1;
+        }
+        else {
+          if ((k = addset(cp, set, kind, c)) < 0)
+            return 0;
+          it->op = CI_CLASS; it->set = (unsigned char)k;
+        }
+        break;
+      }
+    }
+    n++;
+  }
+  cp->item[n].op = CI_END;
+  cp->nitem = n + 1;
+  /* find the first item that must match a char, after only captures */
+  for (n = 0; cp->item[n].op == CI_OPEN || cp->item[n].op == CI_POSITION; n++)
+    ;
+  if (cp->item[n].op == CI_LIT ||
+      (cp->item[n].op == CI_CLASS &&
+       (cp->item[n].rep == 0 || cp->item[n].rep == '+')))
+    cp->first = n;
+  return 1;
+}
+
+
+/* check whether a class in the pattern may depend on the locale */
+static int usesctype (const char *p, size_t lp) {
+  size_t i;
+  for (i = 0; i + 1 < lp; i++) {
+    if (p[i] == L_ESC && isalpha(uchar(p[i + 1])))
+      return 1;
+  }
+  return 0;
+}
+
+
+/* check whether the LC_CTYPE locale is the one 'cp' was compiled with */
+static int samelocale (const CPattern *cp) {
+  const char *lc = setlocale(LC_CTYPE, NULL);
+  return (lc != NULL && strcmp(lc, cp->locale) == 0);
+}
+
+
+/*
+** Push the entry for pattern 'p' from the cache of compiled patterns
+** (the first upvalue of the library functions), compiling it if it is
+** not there. Return the compiled pattern, or NULL if it must be
+** interpreted. Entries are indexed by the address of the pattern, which
+** is the same for all uses of an (internalized) string, and checked
+** against its contents. A new entry is always a new userdata, so an
+** entry in use (kept in the stack or in a 'gmatch' closure) never
+** changes.
+*/
+static const CPattern *getcpattern (lua_State *L, const char *p, size_t lp) {
+  CPattern *cp;
+  int slot, ctype;
+  if (lp > LUAI_MAXCPATTERN) {
+    lua_pushnil(L);  /* too long to be compiled */
+    return NULL;
+  }
+  slot = (int)((((size_t)p >> 4) ^ lp) & (NCACHE - 1)) + 1;
+  if (lua_rawgeti(L, lua_upvalueindex(1), slot) == LUA_TUSERDATA) {
+    cp = (CPattern *)lua_touserdata(L, -1);
+    if (cp->len == lp && memcmp(cp->text, p, lp) == 0 &&
+        (!cp->ctype || samelocale(cp)))
+      return (cp->nitem > 0) ? cp : NULL;
+  }
+  lua_pop(L, 1);
+  cp = (CPattern *)lua_newuserdata(L, sizeof(CPattern));
+  cp->len = lp;
+  memcpy(cp->text, p, lp);
+  cp->nitem = 0;
+  cp->first = -1;
+  cp->ctype = 0;
+  ctype = usesctype(p, lp);
+  if (ctype) {  /* must keep the locale? */
+    const char *lc = setlocale(LC_CTYPE, NULL);
+    if (lc != NULL && strlen(lc) < sizeof(cp->locale)) {
+      strcpy(cp->locale, lc);
+      cp->ctype = 1;
+    }
+  }
+  if (cp->ctype || !ctype)  /* else keep it as an entry not compiled */
+    compile(cp, p, lp);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, lua_upvalueindex(1), slot);
+  return (cp->nitem > 0) ? cp : NULL;
+}
+
+
+/* end of the span of chars from set 'k' starting at 's' */
+static const char *spanset (const CPattern *cp, int k, const char *s,
+                                                const char *e) {
+  switch (cp->skind[k]) {
+    case SK_ANY: return e;
+    case SK_BUT: {
+      const char *c = (const char *)memchr(s, cp->schar[k], e - s);
+      return (c != NULL) ? c : e;
+    }
+    default: {
+      const unsigned char *set = cp->set[k];
+      while (s < e && testset(set, uchar(*s)))
+        s++;
+      return s;
+    }
+  }
+}
+
+
+/*
+** Check whether item 'it' may match at 's'. (False only when it fails
+** at once, so that calling 'cmatch' would have no effect.)
+*/
+static int canstart (MatchState *ms, const char *s, const CItem *it) {
+  if (it->op == CI_LIT)
+    return (s < ms->src_end && *s == ms->cp->lits[it->lit]);
+  else if (it->op == CI_CLASS && (it->rep == 0 || it->rep == '+'))
+    return (s < ms->src_end && testset(ms->cp->set[it->set], uchar(*s)));
+  else
+    return 1;
+}
+
+
+/* 'cmatch', skipping calls that fail at once (but not depth errors) */
+#define trymatch(ms,s,it)  \
+  ((ms)->matchdepth == 0 || canstart(ms, s, it) ? cmatch(ms, s, it) : NULL)
+
+
+/* recursive function */
+static const char *cmatch (MatchState *ms, const char *s, const CItem *it);
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                  const CItem *it) {
+  /* counts maximum expand for item */
+  ptrdiff_t i = spanset(ms->cp, it->set, s, ms->src_end) - s;
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = trymatch(ms, s + i, it + 1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                  const CItem *it) {
+  const unsigned char *set = ms->cp->set[it->set];
+  for (;;) {
+    const char *res = trymatch(ms, s, it + 1);
+    if (res != NULL)
+      return res;
+    else if (s < ms->src_end && testset(set, uchar(*s)))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                     const CItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                   const CItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s, const CItem *it) {
+  const CPattern *cp = ms->cp;
+  if (ms->matchdepth-- == 0)
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto's to optimize tail recursion */
+  switch (it->op) {
+    case CI_END: break;  /* end of pattern */
+    case CI_LIT: {
+      size_t len = it->len;
+      if ((size_t)(ms->src_end - s) >= len &&
+          memcmp(s, cp->lits + it->lit, len) == 0) {
+        s += len; it++; goto init;  /* return cmatch(ms, s + len, it + 1) */
+      }
+      s = NULL;  /* fail */
+      break;
+    }
+    case CI_OPEN: {
+      s = cstart_capture(ms, s, it + 1, CAP_UNFINISHED);
+      break;
+    }
+    case CI_POSITION: {
+      s = cstart_capture(ms, s, it + 1, CAP_POSITION);
+      break;
+    }
+    case CI_CLOSE: {
+      s = cend_capture(ms, s, it + 1);
+      break;
+    }
+    case CI_DOLLAR: {
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    }
+    case CI_BALANCE: {
+      s = balance(ms, s, it->c1, it->c2);
+      if (s != NULL) {
+        it++; goto init;  /* return cmatch(ms, s, it + 1); */
+      }
+      break;
+    }
+    case CI_FRONTIER: {
+      const unsigned char *set = cp->set[it->set];
+      int previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+      if (!testset(set, previous) && testset(set, uchar(*s))) {
+        it++; goto init;  /* return cmatch(ms, s, it + 1); */
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case CI_BACKREF: {
+      s = match_capture(ms, s, uchar(it->c1));
+      if (s != NULL) {
+        it++; goto init;  /* return cmatch(ms, s, it + 1) */
+      }
+      break;
+    }
+    default: {  /* CI_CLASS */
+      /* does not match at least once? */
+      if (!(s < ms->src_end && testset(cp->set[it->set], uchar(*s)))) {
+        if (it->rep == '*' || it->rep == '?' || it->rep == '-') {
+          it++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (it->rep) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = trymatch(ms, s + 1, it + 1)) != NULL)
+              s = res;
+            else {
+              it++; goto init;  /* else return cmatch(ms, s, it + 1); */
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = cmax_expand(ms, s, it);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = cmin_expand(ms, s, it);
+            break;
+          default:  /* no suffix */
+            s++; it++; goto init;  /* return cmatch(ms, s + 1, it + 1); */
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/*
+** Return the first position from 's' where a match may start, or NULL
+** if there is none. Only for compiled patterns with a 'first' item,
+** which cannot match an empty string.
+*/
+static const char *nextstart (MatchState *ms, const char *s) {
+  const CPattern *cp = ms->cp;
+  const CItem *it = &cp->item[cp->first];
+  size_t l = ms->src_end - s;
+  if (it->op == CI_LIT)
+    return lmemfind(s, l, cp->lits + it->lit, it->len);
+  else {
+    int k = it->set;
+    switch (cp->skind[k]) {
+      case SK_ANY: return (l > 0) ? s : NULL;
+      case SK_ONE: return (const char *)memchr(s, cp->schar[k], l);
+      default: {
+        const unsigned char *set = cp->set[k];
+        const char *e = ms->src_end;
+        while (s < e && !testset(set, uchar(*s)))
+          s++;
+        return (s < e) ? s : NULL;
+      }
+    }
+  }
+}
+
+
+/* can unanchored searches skip to 'nextstart'? */
+#define canskip(ms)	((ms)->cp != NULL && (ms)->cp->first >= 0)
+
+
+#define domatch(ms,s,p)  \
+  ((ms)->cp != NULL ? cmatch(ms, s, (ms)->cp->item) : match(ms, s, p))
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
@@ -591,6 +1142,7 @@ static int nospecials (const char *p, size_t l) {
 static void prepstate (MatchState *ms, lua_State *L,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
+  ms->cp = NULL;
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
@@ -632,10 +1184,13 @@ static int str_find_aux (lua_State *L, int find) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
+    ms.cp = getcpattern(L, p, lp);
     do {
       const char *res;
+      if (!anchor && canskip(&ms) && (s1 = nextstart(&ms, s1)) == NULL)
+        break;  /* no more places where pattern can match */
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res=domatch(&ms, s1, p)) != NULL) {
         if (find) {
           lua_pushinteger(L, (s1 - s) + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -676,8 +1231,10 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (canskip(&gm->ms) && (src = nextstart(&gm->ms, src)) == NULL)
+      break;  /* no more places where pattern can match */
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    if ((e = domatch(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -694,8 +1251,9 @@ static int gmatch (lua_State *L) {
   lua_settop(L, 2);  /* keep them on closure to avoid being collected */
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
   prepstate(&gm->ms, L, s, ls, p, lp);
+  gm->ms.cp = getcpattern(L, p, lp);  /* also kept on closure */
   gm->src = s; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -773,15 +1331,23 @@ static int str_gsub (lua_State *L) {
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
-  luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
   prepstate(&ms, L, src, srcl, p, lp);
+  ms.cp = getcpattern(L, p, lp);  /* (before the buffer, which uses the stack) */
+  luaL_buffinit(L, &b);
   while (n < max_s) {
     const char *e;
+    if (!anchor && canskip(&ms)) {
+      const char *next = nextstart(&ms, src);
+      if (next == NULL)
+        break;  /* no more matches; add the rest of the subject */
+      luaL_addlstring(&b, src, next - src);  /* keep text before match */
+      src = next;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    if ((e = domatch(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
       add_value(&ms, &b, src, e, tr);  /* add replacement to buffer */
       src = lastmatch = e;
@@ -813,8 +1379,6 @@ static int str_gsub (lua_State *L) {
 ** Hexadecimal floating-point formatter
 */
 
-#include <math.h>
-
 #define SIZELENMOD	(sizeof(LUA_NUMBER_FRMLEN)/sizeof(char))
 
 
@@ -977,11 +1541,19 @@ static void addliteral (lua_State *L, luaL_Buffer *b, int arg) {
 }
 
 
-static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
+/*
+** Read a format specification (without the '%') into 'form' (with a
+** '%'). Return a pointer to its conversion char, or NULL (with an
+** error message in '*msg') if the specification is invalid.
+*/
+static const char *getformat (const char *strfrmt, char *form,
+                              const char **msg) {
   const char *p = strfrmt;
   while (*p != '\0' && strchr(FLAGS, *p) != NULL) p++;  /* skip flags */
-  if ((size_t)(p - strfrmt) >= sizeof(FLAGS)/sizeof(char))
-    luaL_error(L, "invalid format (repeated flags)");
+  if ((size_t)(p - strfrmt) >= sizeof(FLAGS)/sizeof(char)) {
+    *msg = "invalid format (repeated flags)";
+    return NULL;
+  }
   if (isdigit(uchar(*p))) p++;  /* skip width */
   if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
   if (*p == '.') {
@@ -989,8 +1561,10 @@ static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
     if (isdigit(uchar(*p))) p++;  /* skip precision */
     if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
   }
-  if (isdigit(uchar(*p)))
-    luaL_error(L, "invalid format (width or precision too long)");
+  if (isdigit(uchar(*p))) {
+    *msg = "invalid format (width or precision too long)";
+    return NULL;
+  }
   *(form++) = '%';
   memcpy(form, strfrmt, ((p - strfrmt) + 1) * sizeof(char));
   form += (p - strfrmt) + 1;
@@ -999,6 +1573,15 @@ static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
 }
 
 
+static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
+  const char *msg;
+  const char *p = getformat(strfrmt, form, &msg);
+  if (p == NULL)
+    luaL_error(L, "%s", msg);
+  return p;
+}
+
+
 /*
 ** add length modifier into formats
 */
@@ -1012,80 +1595,458 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
-static int str_format (lua_State *L) {
-  int top = lua_gettop(L);
-  int arg = 1;
-  size_t sfl;
-  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
-  const char *strfrmt_end = strfrmt+sfl;
-  luaL_Buffer b;
-  luaL_buffinit(L, &b);
-  while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
-    else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
-    else { /* format item */
-      char form[MAX_FORMAT];  /* to store the format ('%...') */
-      char *buff = luaL_prepbuffsize(&b, MAX_ITEM);  /* to put formatted item */
-      int nb = 0;  /* number of bytes in added item */
-      if (++arg > top)
-        luaL_argerror(L, arg, "no value");
-      strfrmt = scanformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          nb = l_sprintf(buff, MAX_ITEM, form, (int)luaL_checkinteger(L, arg));
-          break;
-        }
-        case 'd': case 'i':
-        case 'o': case 'u': case 'x': case 'X': {
-          lua_Integer n = luaL_checkinteger(L, arg);
-          addlenmod(form, LUA_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, MAX_ITEM, form, n);
-          break;
-        }
-        case 'a': case 'A':
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = lua_number2strx(L, buff, MAX_ITEM, form,
-                                  luaL_checknumber(L, arg));
-          break;
-        case 'e': case 'E': case 'f':
-        case 'g': case 'G': {
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, MAX_ITEM, form, luaL_checknumber(L, arg));
-          break;
-        }
-        case 'q': {
-          addliteral(L, &b, arg);
-          break;
-        }
-        case 's': {
-          size_t l;
-          const char *s = luaL_tolstring(L, arg, &l);
-          if (form[2] == '\0')  /* no modifiers? */
-            luaL_addvalue(&b);  /* keep entire string */
-          else {
-            luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            if (!strchr(form, '.') && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, MAX_ITEM, form, s);
-              lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
-            }
-          }
-          break;
-        }
-        default: {  /* also treat cases 'pnLlh' */
-          return luaL_error(L, "invalid option '%%%c' to 'format'",
-                               *(strfrmt - 1));
-        }
-      }
-      lua_assert(nb < MAX_ITEM);
-      luaL_addsize(&b, nb);
+/* add the proper length modifier to a format with conversion 'conv' */
+static void fixformat (char *form, int conv) {
+  switch (conv) {
+    case 'd': case 'i':
+    case 'o': case 'u': case 'x': case 'X':
+      addlenmod(form, LUA_INTEGER_FRMLEN);
+      break;
+    case 'a': case 'A':
+    case 'e': case 'E': case 'f':
+    case 'g': case 'G':
+      addlenmod(form, LUA_NUMBER_FRMLEN);
+      break;
+    default: break;
+  }
+}
+
+
+/*
+** Add to the buffer the argument 'arg' formatted with 'form' (which
+** already has its length modifier), whose conversion is 'conv'
+*/
+static void addformat (lua_State *L, luaL_Buffer *b, int arg,
+                       const char *form, int conv) {
+  char *buff = luaL_prepbuffsize(b, MAX_ITEM);  /* to put formatted item */
+  int nb = 0;  /* number of bytes in added item */
+  switch (conv) {
+    case 'c': {
+      nb = l_sprintf(buff, MAX_ITEM, form, (int)luaL_checkinteger(L, arg));
+      break;
+    }
+    case 'd': case 'i':
+    case 'o': case 'u': case 'x': case 'X': {
+      lua_Integer n = luaL_checkinteger(L, arg);
+      nb = l_sprintf(buff, MAX_ITEM, form, n);
+      break;
+    }
+    case 'a': case 'A':
+      nb = lua_number2strx(L, buff, MAX_ITEM, form,
+                              luaL_checknumber(L, arg));
+      break;
+    case 'e': case 'E': case 'f':
+    case 'g': case 'G': {
+      nb = l_sprintf(buff, MAX_ITEM, form, luaL_checknumber(L, arg));
+      break;
+    }
+    case 'q': {
+      addliteral(L, b, arg);
+      break;
+    }
+    case 's': {
+      size_t l;
+      const char *s = luaL_tolstring(L, arg, &l);
+      if (form[2] == '\0')  /* no modifiers? */
+        luaL_addvalue(b);  /* keep entire string */
+      else {
+        luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        if (!strchr(form, '.') && l >= 100) {
+          /* no precision and string is too long to be formatted */
+          luaL_addvalue(b);  /* keep entire string */
+        }
+        else {  /* format the string into 'buff' */
+          nb = l_sprintf(buff, MAX_ITEM, form, s);
+          lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+        }
+      }
+      break;
+    }
+    default: {  /* also treat cases 'pnLlh' */
+      luaL_error(L, "invalid option '%%%c' to 'format'", conv);
+    }
+  }
+  lua_assert(nb < MAX_ITEM);
+  luaL_addsize(b, nb);
+}
+
+
+/*
+** {------------------------------------------------------
+** Compiled formats
+** -------------------------------------------------------
+*/
+
+/*
+** Formats up to this length are split once into items, each with its
+** literal text and its (already checked) specification, and kept in
+** the cache of the library (after the compiled patterns). Plain
+** integer conversions, and '%f' where possible, are done here instead
+** of by 'l_sprintf'; they give the same results.
+*/
+#if !defined(LUAI_MAXCFORMAT)
+#define LUAI_MAXCFORMAT		200
+#endif
+
+/* maximum number of items in a compiled format */
+#define MAXFITEMS	24
+
+
+/*
+** Conversions '%f' of doubles can be done with 128-bit integers, which
+** give the exact (correctly rounded) digits, as 'printf' does.
+*/
+#if !defined(LUA_USE_C89) && defined(__SIZEOF_INT128__) && \
+    LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE
+#define L_FIXEDFMT
+#endif
+
+
+/* how an item is formatted */
+#define FK_NONE		0	/* no specification (only literal text) */
+#define FK_GENERIC	1	/* by 'addformat' */
+#define FK_INT		2	/* integer by 'addint' */
+#define FK_FIXED	3	/* float '%f' by 'addfixed' */
+
+/* flags of FK_INT and FK_FIXED items */
+#define FF_LEFT		1	/* '-' */
+#define FF_PLUS		2	/* '+' */
+#define FF_SPACE	4	/* ' ' */
+#define FF_ZERO		8	/* '0' */
+
+
+typedef struct FItem {
+  unsigned short lit, nlit;  /* literal text before the item */
+  unsigned char kind;  /* how to format the item */
+  unsigned char conv;  /* conversion char */
+  unsigned char flags;
+  unsigned char width;
+  unsigned char prec;  /* precision (for FK_FIXED) */
+  char form[MAX_FORMAT];  /* format for 'addformat' */
+} FItem;
+
+
+typedef struct CFormat {
+  size_t len;  /* length of the format */
+  int nitem;  /* number of items (0 if format was not compiled) */
+  FItem item[MAXFITEMS];
+  char text[LUAI_MAXCFORMAT];  /* the format itself */
+} CFormat;
+
+
+/*
+** Choose how to format the item with specification 'form' (with its
+** '%' and conversion char but no length modifier)
+*/
+static void setkind (FItem *it, const char *form) {
+  const char *p = form + 1;
+  int flags = 0, width = 0, prec = -1;
+  it->kind = FK_GENERIC;
+  for (; *p != '\0' && strchr(FLAGS, *p) != NULL; p++) {
+    switch (*p) {
+      case '-': flags |= FF_LEFT; break;
+      case '+': flags |= FF_PLUS; break;
+      case ' ': flags |= FF_SPACE; break;
+      case '0': flags |= FF_ZERO; break;
+      default: return;  /* '#' */
+    }
+  }
+  while (isdigit(uchar(*p)))
+    width = width * 10 + (*p++ - '0');
+  if (*p == '.') {
+    prec = 0;
+    while (isdigit(uchar(*++p)))
+      prec = prec * 10 + (*p - '0');
+  }
+  it->flags = (unsigned char)flags;
+  it->width = (unsigned char)width;
+  switch (*p) {
+    case 'd': case 'i':
+    case 'o': case 'u': case 'x': case 'X': {
+      if (prec < 0)  /* no precision? */
+        it->kind = FK_INT;
+      break;
+    }
+#if defined(L_FIXEDFMT)
+    case 'f': {
+      if (prec < 0) prec = 6;  /* default precision */
+      if (prec <= 9) {
+        it->kind = FK_FIXED;
+        it->prec = (unsigned char)prec;
+      }
+      break;
+    }
+#endif
+    default: break;
+  }
+}
+
+
+/*
+** Split format 'fmt' into the items of 'cf'. Return false if it cannot
+** be compiled; then it is formatted as usual (which also raises the
+** errors for invalid specifications).
+*/
+static int compileformat (CFormat *cf, const char *fmt, size_t l) {
+  const char *p = fmt;
+  const char *e = fmt + l;
+  const char *lit = fmt;  /* start of current literal text */
+  int n = 0;
+  while (p < e) {
+    if (*p++ != L_ESC)
+      continue;
+    else {
+      FItem *it = &cf->item[n];
+      const char *msg;
+      if (n == MAXFITEMS - 1)
+        return 0;  /* no space for this item plus the end */
+      it->lit = (unsigned short)(lit - fmt);
+      if (*p == L_ESC) {  /* %% */
+        it->nlit = (unsigned short)(p - lit);  /* text includes one '%' */
+        it->kind = FK_NONE;
+        lit = ++p;
+      }
+      else {
+        it->nlit = (unsigned short)(p - 1 - lit);
+        if ((p = getformat(p, it->form, &msg)) == NULL ||
+            *p == '\0' || strchr("cdiouxXaAeEfgGqs", *p) == NULL)
+          return 0;  /* invalid specification */
+        it->conv = uchar(*p);
+        setkind(it, it->form);
+        fixformat(it->form, *p);
+        lit = ++p;
+      }
+      n++;
+    }
+  }
+  cf->item[n].lit = (unsigned short)(lit - fmt);
+  cf->item[n].nlit = (unsigned short)(e - lit);
+  cf->item[n].kind = FK_NONE;
+  cf->nitem = n + 1;
+  return 1;
+}
+
+
+/*
+** Push the entry for format 'fmt' from the cache, compiling it if it
+** is not there (see 'getcpattern'). Return the compiled format, or NULL
+** if it must be interpreted.
+*/
+static const CFormat *getcformat (lua_State *L, const char *fmt, size_t l) {
+  CFormat *cf;
+  int slot;
+  if (l > LUAI_MAXCFORMAT) {
+    lua_pushnil(L);  /* too long to be compiled */
+    return NULL;
+  }
+  slot = (int)((((size_t)fmt >> 4) ^ l) & (NCACHE - 1)) + NCACHE + 1;
+  if (lua_rawgeti(L, lua_upvalueindex(1), slot) == LUA_TUSERDATA) {
+    cf = (CFormat *)lua_touserdata(L, -1);
+    if (cf->len == l && memcmp(cf->text, fmt, l) == 0)
+      return (cf->nitem > 0) ? cf : NULL;
+  }
+  lua_pop(L, 1);
+  cf = (CFormat *)lua_newuserdata(L, sizeof(CFormat));
+  cf->len = l;
+  memcpy(cf->text, fmt, l);
+  cf->nitem = 0;
+  compileformat(cf, fmt, l);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, lua_upvalueindex(1), slot);
+  return (cf->nitem > 0) ? cf : NULL;
+}
+
+
+/*
+** Add to the buffer the sign 'sign' (or 0) and the 'n' chars in 'digits',
+** padded to the width of item 'it'
+*/
+static void addpadded (luaL_Buffer *b, const FItem *it, int sign,
+                       const char *digits, int n) {
+  char *buff = luaL_prepbuffsize(b, MAX_ITEM);
+  int pad = it->width - n - (sign != 0);
+  int nb = 0;
+  if (pad > 0 && !(it->flags & (FF_LEFT | FF_ZERO))) {
+    memset(buff, ' ', pad);  /* pad on the left */
+    nb = pad;
+  }
+  if (sign) buff[nb++] = (char)sign;
+  if (pad > 0 && (it->flags & (FF_LEFT | FF_ZERO)) == FF_ZERO) {
+    memset(buff + nb, '0', pad);  /* pad with zeros after the sign */
+    nb += pad;
+  }
+  memcpy(buff + nb, digits, n);
+  nb += n;
+  if (pad > 0 && (it->flags & FF_LEFT)) {
+    memset(buff + nb, ' ', pad);  /* pad on the right */
+    nb += pad;
+  }
+  luaL_addsize(b, nb);
+}
+
+
+/* sign of a signed conversion, as given by the flags of item 'it' */
+static int possign (const FItem *it) {
+  return (it->flags & FF_PLUS) ? '+' : (it->flags & FF_SPACE) ? ' ' : 0;
+}
+
+
+/* format an integer with conversion 'd', 'i', 'o', 'u', 'x', or 'X' */
+static void addint (luaL_Buffer *b, const FItem *it, lua_Integer n) {
+  char digits[3 * sizeof(lua_Integer)];
+  char *d = digits + sizeof(digits);
+  lua_Unsigned u = (lua_Unsigned)n;
+  int sign = 0;
+  switch (it->conv) {
+    case 'x': case 'X': {
+      const char *hex = (it->conv == 'x') ? "0123456789abcdef"
+                                          : "0123456789ABCDEF";
+      do { *--d = hex[u & 15]; u >>= 4; } while (u != 0);
+      break;
+    }
+    case 'o': {
+      do { *--d = (char)('0' + (u & 7)); u >>= 3; } while (u != 0);
+      break;
+    }
+    default: {
+      if (it->conv != 'u') {  /* signed conversion? */
+        if (n < 0) {
+          u = 0u - u;
+          sign = '-';
+        }
+        else sign = possign(it);
+      }
+      do { *--d = (char)('0' + u % 10); u /= 10; } while (u != 0);
+      break;
+    }
+  }
+  addpadded(b, it, sign, d, (int)(digits + sizeof(digits) - d));
+}
+
+
+#if defined(L_FIXEDFMT)
+
+/*
+** Format 'x' with conversion '%f' and the precision of item 'it', if
+** its integer part fits in 64 bits; return false otherwise. With
+** 'x' = m * 2^e (an integer 'm' with 53 bits), x * 10^prec has at most
+** 53 + 30 bits before the shift by 'e', so it is exact in 128 bits;
+** ties are rounded to even, as 'printf' does.
+*/
+static int addfixed (luaL_Buffer *b, const FItem *it, lua_Number x) {
+  static const unsigned long long pow10[] = {1, 10, 100, 1000, 10000,
+    100000, 1000000, 10000000, 100000000, 1000000000};
+  char digits[32];
+  char *d = digits + sizeof(digits);
+  unsigned long long p10 = pow10[it->prec];
+  unsigned long long ip, fp;  /* integer and fractional parts */
+  unsigned __int128 q;
+  int sign = signbit(x) ? '-' : possign(it);
+  int e, i;
+  x = l_mathop(fabs)(x);
+  if (!(x < 0x1p63))
+    return 0;  /* too large, inf, or NaN */
+  q = (unsigned __int128)(l_mathop(ldexp)(l_mathop(frexp)(x, &e), 53));
+  e -= 53;  /* x == q * 2^e */
+  q *= p10;
+  if (e >= 0)
+    q <<= e;
+  else if (e > -100) {
+    unsigned __int128 rest = q & ((((unsigned __int128)1) << -e) - 1);
+    unsigned __int128 half = ((unsigned __int128)1) << (-e - 1);
+    q >>= -e;
+    if (rest > half || (rest == half && (q & 1)))
+      q++;  /* round up */
+  }
+  else
+    q = 0;  /* less than half a unit in the last digit */
+  ip = (unsigned long long)(q / p10);
+  fp = (unsigned long long)(q % p10);
+  if (it->prec > 0) {
+    for (i = 0; i < it->prec; i++) {
+      *--d = (char)('0' + fp % 10);
+      fp /= 10;
+    }
+    *--d = lua_getlocaledecpoint();
+  }
+  do { *--d = (char)('0' + ip % 10); ip /= 10; } while (ip != 0);
+  addpadded(b, it, sign, d, (int)(digits + sizeof(digits) - d));
+  return 1;
+}
+
+#endif
+
+
+/* format 'arg' as specified by item 'it' of a compiled format */
+static void additem (lua_State *L, luaL_Buffer *b, int arg, const FItem *it) {
+  switch (it->kind) {
+    case FK_INT: {
+      addint(b, it, luaL_checkinteger(L, arg));
+      break;
+    }
+#if defined(L_FIXEDFMT)
+    case FK_FIXED: {
+      if (!addfixed(b, it, luaL_checknumber(L, arg)))
+        addformat(L, b, arg, it->form, 'f');
+      break;
+    }
+#endif
+    default: {
+      addformat(L, b, arg, it->form, it->conv);
+      break;
+    }
+  }
+}
+
+/* }------------------------------------------------------ */
+
+
+/*
+** Add to buffer 'b' the result of formatting the values at indices
+** 'arg' + 1 to 'top' with the format at index 'arg'. The buffer is
+** initialized here, after the entry for the compiled format is pushed.
+*/
+static void formatvalues (lua_State *L, luaL_Buffer *b, int arg, int top) {
+  size_t sfl;
+  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
+  const char *strfrmt_end = strfrmt+sfl;
+  const CFormat *cf = getcformat(L, strfrmt, sfl);
+  luaL_buffinit(L, b);
+  if (cf != NULL) {  /* compiled format? */
+    const FItem *it;
+    for (it = cf->item; ; it++) {
+      luaL_addlstring(b, strfrmt + it->lit, it->nlit);
+      if (it->kind != FK_NONE) {
+        if (++arg > top)
+          luaL_argerror(L, arg, "no value");
+        additem(L, b, arg, it);
+      }
+      else if (it == cf->item + cf->nitem - 1)
+        break;  /* end of format */
+    }
+  }
+  else {
+    while (strfrmt < strfrmt_end) {
+      if (*strfrmt != L_ESC)
+        luaL_addchar(b, *strfrmt++);
+      else if (*++strfrmt == L_ESC)
+        luaL_addchar(b, *strfrmt++);  /* %% */
+      else { /* format item */
+        char form[MAX_FORMAT];  /* to store the format ('%...') */
+        if (++arg > top)
+          luaL_argerror(L, arg, "no value");
+        strfrmt = scanformat(L, strfrmt, form);
+        fixformat(form, *strfrmt);
+        addformat(L, b, arg, form, *strfrmt++);
+      }
     }
   }
+}
+
+
+static int str_format (lua_State *L) {
+  luaL_Buffer b;
+  formatvalues(L, &b, 1, lua_gettop(L));
   luaL_pushresult(&b);
   return 1;
 }
@@ -1152,6 +2113,7 @@ typedef struct Header {
   lua_State *L;
   int islittle;
   int maxalign;
+  int fmtarg;  /* stack index of the format (for error messages) */
 } Header;
 
 
@@ -1206,10 +2168,11 @@ static int getnumlimit (Header *h, const char **fmt, int df) {
 /*
 ** Initialize Header
 */
-static void initheader (lua_State *L, Header *h) {
+static void initheader (lua_State *L, Header *h, int fmtarg) {
   h->L = L;
   h->islittle = nativeendian.little;
   h->maxalign = 1;
+  h->fmtarg = fmtarg;
 }
 
 
@@ -1269,7 +2232,7 @@ static KOption getdetails (Header *h, size_t totalsize,
   int align = *psize;  /* usually, alignment follows size */
   if (opt == Kpaddalign) {  /* 'X' gets alignment from following option */
     if (**fmt == '\0' || getoption(h, fmt, &align) == Kchar || align == 0)
-      luaL_argerror(h->L, 1, "invalid next option for option 'X'");
+      luaL_argerror(h->L, h->fmtarg, "invalid next option for option 'X'");
   }
   if (align <= 1 || opt == Kchar)  /* need no alignment? */
     *ntoalign = 0;
@@ -1277,7 +2240,8 @@ static KOption getdetails (Header *h, size_t totalsize,
     if (align > h->maxalign)  /* enforce maximum alignment */
       align = h->maxalign;
     if ((align & (align - 1)) != 0)  /* is 'align' not a power of 2? */
-      luaL_argerror(h->L, 1, "format asks for alignment not power of 2");
+      luaL_argerror(h->L, h->fmtarg,
+                       "format asks for alignment not power of 2");
     *ntoalign = (align - (int)(totalsize & (align - 1))) & (align - 1);
   }
   return opt;
@@ -1325,21 +2289,23 @@ static void copywithendian (volatile char *dest, volatile const char *src,
 }
 
 
-static int str_pack (lua_State *L) {
-  luaL_Buffer b;
+/*
+** Add to buffer 'b' the values after index 'arg' packed as specified
+** by the format at index 'arg'. The buffer is initialized here.
+*/
+static void packvalues (lua_State *L, luaL_Buffer *b, int arg) {
   Header h;
-  const char *fmt = luaL_checkstring(L, 1);  /* format string */
-  int arg = 1;  /* current argument to pack */
+  const char *fmt = luaL_checkstring(L, arg);  /* format string */
   size_t totalsize = 0;  /* accumulate total size of result */
-  initheader(L, &h);
+  initheader(L, &h, arg);
   lua_pushnil(L);  /* mark to separate arguments from string buffer */
-  luaL_buffinit(L, &b);
+  luaL_buffinit(L, b);
   while (*fmt != '\0') {
     int size, ntoalign;
     KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
     totalsize += ntoalign + size;
     while (ntoalign-- > 0)
-     luaL_addchar(&b, LUAL_PACKPADBYTE);  /* fill alignment */
+     luaL_addchar(b, LUAL_PACKPADBYTE);  /* fill alignment */
     arg++;
     switch (opt) {
       case Kint: {  /* signed integers */
@@ -1348,7 +2314,7 @@ static int str_pack (lua_State *L) {
           lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
           luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
         }
-        packint(&b, (lua_Unsigned)n, h.islittle, size, (n < 0));
+        packint(b, (lua_Unsigned)n, h.islittle, size, (n < 0));
         break;
       }
       case Kuint: {  /* unsigned integers */
@@ -1356,19 +2322,19 @@ static int str_pack (lua_State *L) {
         if (size < SZINT)  /* need overflow check? */
           luaL_argcheck(L, (lua_Unsigned)n < ((lua_Unsigned)1 << (size * NB)),
                            arg, "unsigned overflow");
-        packint(&b, (lua_Unsigned)n, h.islittle, size, 0);
+        packint(b, (lua_Unsigned)n, h.islittle, size, 0);
         break;
       }
       case Kfloat: {  /* floating-point options */
         volatile Ftypes u;
-        char *buff = luaL_prepbuffsize(&b, size);
+        char *buff = luaL_prepbuffsize(b, size);
         lua_Number n = luaL_checknumber(L, arg);  /* get argument */
         if (size == sizeof(u.f)) u.f = (float)n;  /* copy it into 'u' */
         else if (size == sizeof(u.d)) u.d = (double)n;
         else u.n = n;
         /* move 'u' to final result, correcting endianness if needed */
         copywithendian(buff, u.buff, size, h.islittle);
-        luaL_addsize(&b, size);
+        luaL_addsize(b, size);
         break;
       }
       case Kchar: {  /* fixed-size string */
@@ -1376,9 +2342,9 @@ static int str_pack (lua_State *L) {
         const char *s = luaL_checklstring(L, arg, &len);
         luaL_argcheck(L, len <= (size_t)size, arg,
                          "string longer than given size");
-        luaL_addlstring(&b, s, len);  /* add string */
+        luaL_addlstring(b, s, len);  /* add string */
         while (len++ < (size_t)size)  /* pad extra space */
-          luaL_addchar(&b, LUAL_PACKPADBYTE);
+          luaL_addchar(b, LUAL_PACKPADBYTE);
         break;
       }
       case Kstring: {  /* strings with length count */
@@ -1387,8 +2353,8 @@ static int str_pack (lua_State *L) {
         luaL_argcheck(L, size >= (int)sizeof(size_t) ||
                          len < ((size_t)1 << (size * NB)),
                          arg, "string length does not fit in given size");
-        packint(&b, (lua_Unsigned)len, h.islittle, size, 0);  /* pack length */
-        luaL_addlstring(&b, s, len);
+        packint(b, (lua_Unsigned)len, h.islittle, size, 0);  /* pack length */
+        luaL_addlstring(b, s, len);
         totalsize += len;
         break;
       }
@@ -1396,17 +2362,23 @@ static int str_pack (lua_State *L) {
         size_t len;
         const char *s = luaL_checklstring(L, arg, &len);
         luaL_argcheck(L, strlen(s) == len, arg, "string contains zeros");
-        luaL_addlstring(&b, s, len);
-        luaL_addchar(&b, '\0');  /* add zero at the end */
+        luaL_addlstring(b, s, len);
+        luaL_addchar(b, '\0');  /* add zero at the end */
         totalsize += len + 1;
         break;
       }
-      case Kpadding: luaL_addchar(&b, LUAL_PACKPADBYTE);  /* FALLTHROUGH */
+      case Kpadding: luaL_addchar(b, LUAL_PACKPADBYTE);  /* FALLTHROUGH */
       case Kpaddalign: case Knop:
         arg--;  /* undo increment */
         break;
     }
   }
+}
+
+
+static int str_pack (lua_State *L) {
+  luaL_Buffer b;
+  packvalues(L, &b, 1);
   luaL_pushresult(&b);
   return 1;
 }
@@ -1416,7 +2388,7 @@ static int str_packsize (lua_State *L) {
   Header h;
   const char *fmt = luaL_checkstring(L, 1);  /* format string */
   size_t totalsize = 0;  /* accumulate total size of result */
-  initheader(L, &h);
+  initheader(L, &h, 1);
   while (*fmt != '\0') {
     int size, ntoalign;
     KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
@@ -1471,20 +2443,24 @@ static lua_Integer unpackint (lua_State *L, const char *str,
 }
 
 
-static int str_unpack (lua_State *L) {
+/*
+** Push the values in 'data' (of length 'ld', at index 'dataarg') from
+** position '*ppos' on, unpacked as specified by the format at index
+** 'fmtarg'. Update '*ppos' to the position after the last value read
+** and return the number of values pushed.
+*/
+static int unpackvalues (lua_State *L, int fmtarg, const char *data,
+                         size_t ld, int dataarg, size_t *ppos) {
   Header h;
-  const char *fmt = luaL_checkstring(L, 1);
-  size_t ld;
-  const char *data = luaL_checklstring(L, 2, &ld);
-  size_t pos = (size_t)posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+  const char *fmt = luaL_checkstring(L, fmtarg);
+  size_t pos = *ppos;
   int n = 0;  /* number of results */
-  luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
-  initheader(L, &h);
+  initheader(L, &h, fmtarg);
   while (*fmt != '\0') {
     int size, ntoalign;
     KOption opt = getdetails(&h, pos, &fmt, &size, &ntoalign);
     if ((size_t)ntoalign + size > ~pos || pos + ntoalign + size > ld)
-      luaL_argerror(L, 2, "data string too short");
+      luaL_argerror(L, dataarg, "data string too short");
     pos += ntoalign;  /* skip alignment */
     /* stack space for item + next position */
     luaL_checkstack(L, 2, "too many results");
@@ -1513,13 +2489,18 @@ static int str_unpack (lua_State *L) {
       }
       case Kstring: {
         size_t len = (size_t)unpackint(L, data + pos, h.islittle, size, 0);
-        luaL_argcheck(L, pos + len + size <= ld, 2, "data string too short");
+        luaL_argcheck(L, len <= ld - pos - size, dataarg,
+                         "data string too short");
         lua_pushlstring(L, data + pos + size, len);
         pos += len;  /* skip string */
         break;
       }
       case Kzstr: {
-        size_t len = (int)strlen(data + pos);
+        const char *z = (const char *)memchr(data + pos, '\0', ld - pos);
+        size_t len;
+        luaL_argcheck(L, z != NULL, dataarg,
+                         "unfinished string for format 'z'");
+        len = (size_t)(z - (data + pos));
         lua_pushlstring(L, data + pos, len);
         pos += len + 1;  /* skip string plus final '\0' */
         break;
@@ -1530,6 +2511,18 @@ static int str_unpack (lua_State *L) {
     }
     pos += size;
   }
+  *ppos = pos;
+  return n;
+}
+
+
+static int str_unpack (lua_State *L) {
+  size_t ld;
+  const char *data = luaL_checklstring(L, 2, &ld);
+  size_t pos = (size_t)posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+  int n;
+  luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  n = unpackvalues(L, 1, data, ld, 2, &pos);
   lua_pushinteger(L, pos + 1);  /* next position */
   return n + 1;
 }
@@ -1537,7 +2530,287 @@ static int str_unpack (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+
+#define checkbuffer(L,i)  \
+	((luaL_StrBuffer *)luaL_checkudata(L, i, LUA_BUFFERHANDLE))
+
+
+/*
+** Make room for 'sz' (> 0) more bytes after the contents of 'sb' and
+** return the address of that room. Bytes already read are dropped
+** when they are at least as many as the contents, so that moving the
+** contents costs no more than the space it frees; otherwise the block
+** grows as the one of a 'luaL_Buffer' (see 'luaL_prepbuffsize').
+*/
+static char *prepbuffer (lua_State *L, luaL_StrBuffer *sb, size_t sz) {
+  if (sb->size - sb->n < sz) {  /* not enough space? */
+    size_t len = sb->n - sb->r;  /* length of the contents */
+    if (sb->r > 0 && sb->r >= len) {  /* move contents to the start */
+      memmove(sb->b, sb->b + sb->r, len);
+      sb->r = 0;
+      sb->n = len;
+    }
+    if (sb->size - sb->n < sz) {  /* still not enough space? */
+      void *ud;
+      lua_Alloc allocf = lua_getallocf(L, &ud);
+      size_t newsize = sb->size * 2;  /* double block size */
+      char *newb;
+      if (newsize - sb->n < sz)  /* not big enough? */
+        newsize = sb->n + sz;
+      if (newsize < sb->n || newsize - sb->n < sz)
+        luaL_error(L, "buffer too large");
+      if (newsize < LUAL_BUFFERSIZE)
+        newsize = LUAL_BUFFERSIZE;
+      newb = (char *)allocf(ud, sb->b, sb->size, newsize);
+      if (newb == NULL)
+        luaL_error(L, "not enough memory");
+      sb->b = newb;
+      sb->size = newsize;
+    }
+  }
+  return sb->b + sb->n;
+}
+
+
+static void putlstring (lua_State *L, luaL_StrBuffer *sb,
+                        const char *s, size_t l) {
+  if (l > 0) {
+    memcpy(prepbuffer(L, sb, l), s, l);
+    sb->n += l;
+  }
+}
+
+
+/* push the first 'l' bytes of the contents of 'sb' */
+static void pushcontents (lua_State *L, luaL_StrBuffer *sb, size_t l) {
+  if (l == 0)
+    lua_pushliteral(L, "");  /* 'sb->b' may be NULL */
+  else
+    lua_pushlstring(L, sb->b + sb->r, l);
+}
+
+
+/* drop the first 'l' bytes of the contents of 'sb' */
+static void consume (luaL_StrBuffer *sb, size_t l) {
+  sb->r += l;
+  if (sb->r == sb->n)  /* buffer is empty? */
+    sb->r = sb->n = 0;  /* reuse the whole block */
+}
+
+
+/*
+** Add to 'sb' the value at index 'arg': a string, a number (integers
+** are written in place, without creating a string), or the contents
+** of a string buffer (which may be 'sb' itself).
+*/
+static void putvalue (lua_State *L, luaL_StrBuffer *sb, int arg) {
+  switch (lua_type(L, arg)) {
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, arg, &l);
+      putlstring(L, sb, s, l);
+      break;
+    }
+    case LUA_TNUMBER: {
+      if (lua_isinteger(L, arg)) {
+        char digits[3 * sizeof(lua_Integer)];
+        char *d = digits + sizeof(digits);
+        lua_Integer n = lua_tointeger(L, arg);
+        lua_Unsigned u = (n < 0) ? 0u - (lua_Unsigned)n : (lua_Unsigned)n;
+        do { *--d = (char)('0' + u % 10); u /= 10; } while (u != 0);
+        if (n < 0) *--d = '-';
+        putlstring(L, sb, d, (size_t)(digits + sizeof(digits) - d));
+      }
+      else {
+        size_t l;
+        const char *s = lua_tolstring(L, arg, &l);
+        putlstring(L, sb, s, l);
+      }
+      break;
+    }
+    default: {
+      luaL_StrBuffer *src =
+          (luaL_StrBuffer *)luaL_testudata(L, arg, LUA_BUFFERHANDLE);
+      size_t l;
+      if (src == NULL)
+        luaL_argerror(L, arg, lua_pushfstring(L,
+                      "string or buffer expected, got %s",
+                      luaL_typename(L, arg)));
+      l = src->n - src->r;
+      if (l > 0) {
+        char *p = prepbuffer(L, sb, l);  /* may move 'src' if it is 'sb' */
+        memcpy(p, src->b + src->r, l);
+        sb->n += l;
+      }
+      break;
+    }
+  }
+}
+
+
+static int buf_new (lua_State *L) {
+  lua_Integer sz = luaL_optinteger(L, 1, 0);
+  luaL_StrBuffer *sb;
+  luaL_argcheck(L, 0 <= sz && (lua_Unsigned)sz <= MAXSIZE, 1, "invalid size");
+  sb = (luaL_StrBuffer *)lua_newuserdata(L, sizeof(luaL_StrBuffer));
+  sb->b = NULL;
+  sb->size = sb->r = sb->n = 0;
+  luaL_setmetatable(L, LUA_BUFFERHANDLE);
+  if (sz > 0)
+    prepbuffer(L, sb, (size_t)sz);
+  return 1;
+}
+
+
+static int buf_put (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  int top = lua_gettop(L);
+  int arg;
+  for (arg = 2; arg <= top; arg++)
+    putvalue(L, sb, arg);
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int buf_putf (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  luaL_Buffer b;
+  formatvalues(L, &b, 2, lua_gettop(L));
+  putlstring(L, sb, b.b, b.n);
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int buf_pack (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  luaL_Buffer b;
+  packvalues(L, &b, 2);
+  putlstring(L, sb, b.b, b.n);
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int buf_get (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  size_t len = sb->n - sb->r;
+  size_t l = len;
+  if (!lua_isnoneornil(L, 2)) {
+    lua_Integer n = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n >= 0, 2, "negative count");
+    if ((lua_Unsigned)n < len)
+      l = (size_t)n;
+  }
+  pushcontents(L, sb, l);
+  consume(sb, l);
+  return 1;
+}
+
+
+/*
+** Unpack values from the start of the contents, as 'string.unpack'
+** does, and consume the bytes read. On errors, nothing is consumed.
+*/
+static int buf_unpack (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  size_t len = sb->n - sb->r;
+  size_t pos = 0;
+  int n = unpackvalues(L, 2, (len > 0) ? sb->b + sb->r : "", len, 1, &pos);
+  consume(sb, pos);
+  return n;
+}
+
+
+static int buf_reserve (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  lua_Integer sz = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, 0 <= sz && (lua_Unsigned)sz <= MAXSIZE, 2, "invalid size");
+  if (sz > 0)
+    prepbuffer(L, sb, (size_t)sz);
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int buf_reset (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  sb->r = sb->n = 0;  /* keep the block for new contents */
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int buf_tostring (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  pushcontents(L, sb, sb->n - sb->r);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  lua_pushinteger(L, (lua_Integer)(sb->n - sb->r));
+  return 1;
+}
+
+
+static int buf_gc (lua_State *L) {
+  luaL_StrBuffer *sb = checkbuffer(L, 1);
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  allocf(ud, sb->b, sb->size, 0);
+  sb->b = NULL;  /* buffer may still be used by other finalizers */
+  sb->size = sb->r = sb->n = 0;
+  return 0;
+}
+
+
+/*
+** methods for string buffers
+*/
+static const luaL_Reg buflib[] = {
+  {"get", buf_get},
+  {"pack", buf_pack},
+  {"put", buf_put},
+  {"putf", buf_putf},
+  {"reserve", buf_reserve},
+  {"reset", buf_reset},
+  {"tostring", buf_tostring},
+  {"unpack", buf_unpack},
+  {"__gc", buf_gc},
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+/*
+** Create the metatable for string buffers, which is also the table of
+** their methods. The methods share the cache of the library, which
+** must be at the top of the stack.
+*/
+static void createbuffermeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_BUFFERHANDLE);
+  lua_pushvalue(L, -2);  /* cache */
+  luaL_setfuncs(L, buflib, 1);
+  lua_pushvalue(L, -1);  /* push metatable */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg strlib[] = {
+  {"buffer", buf_new},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
@@ -1575,7 +2848,10 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
-  luaL_newlib(L, strlib);
+  luaL_newlibtable(L, strlib);
+  lua_createtable(L, 2 * NCACHE, 0);  /* cache of patterns and formats */
+  createbuffermeta(L);
+  luaL_setfuncs(L, strlib, 1);  /* all functions share the cache */
   createmetatable(L);
   return 1;
 }
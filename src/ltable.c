@@ -15,16 +15,29 @@
 ** Tables keep its elements in two parts: an array part and a hash part.
 ** Non-negative integer keys are all candidates to be kept in the array
 ** part. The actual size of the array is the largest 'n' such that
-** more than half the slots between 1 and n are in use.
+** more than half the slots between 1 and n are in use. An array part
+** holding only integers or only floats keeps them unboxed (see section
+** 'Unboxed arrays').
 ** Hash uses a mix of chained scatter table with Brent's variation.
 ** A main invariant of these tables is that, if an element is not
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** Alternatively (LUA_USE_SWISSTABLE), the hash part is an open-addressing
+** table probed in groups of nodes (see section 'Swiss table').
+** With LUA_USE_SHAPES, a table with no hash part may keep its string
+** fields in slots described by a shared shape (see section 'Shapes').
+** With LUA_USE_INCRHASH, a large hash part grows incrementally (see
+** section 'Incremental growth').
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
+
+#if defined(LUA_USE_SWISSTABLE) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "lua.h"
 
@@ -55,6 +68,8 @@
 #define MAXHBITS	(MAXABITS - 1)
 
 
+#if !defined(LUA_USE_SWISSTABLE)	/* { */
+
 #define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
 
 #define hashstr(t,str)		hashpow2(t, (str)->hash)
@@ -82,6 +97,165 @@ static const Node dummynode_ = {
 };
 
 
+#define freenodevector(L,n,lsize) \
+	luaM_freearray(L, n, cast(size_t, twoto(lsize)))
+
+#else				/* }{ */
+
+/*
+** {=============================================================
+** Swiss table
+** ==============================================================
+*/
+
+/*
+** The hash part is an open-addressing table. Right after its nodes, in
+** the same block, it keeps a control byte for each node: CTRL_EMPTY for
+** a free node, or the low 7 bits of the hash of the key in the node.
+** Nodes are probed in groups of GROUPSIZE, comparing all the control
+** bytes of a group with the searched hash at once. Keys are never
+** removed from a hash part (only their values become nil) until it is
+** rebuilt, so there are no "deleted" nodes: a group with a free node
+** ends any search. A hash part smaller than a group pads its control
+** bytes up to GROUPSIZE with CTRL_PAD, which matches nothing.
+*/
+
+#define GROUPSIZE	16
+#define CTRL_EMPTY	0x80
+#define CTRL_PAD	0xFE
+
+/* number of control bytes of a hash part with 2^lsize nodes */
+#define ctrlsize(lsize) \
+	(twoto(lsize) < GROUPSIZE ? GROUPSIZE : twoto(lsize))
+
+/* size of the block holding a hash part with 2^lsize nodes */
+#define nodevecsize(lsize) \
+	(cast(size_t, twoto(lsize)) * sizeof(Node) + ctrlsize(lsize))
+
+#define freenodevector(L,n,lsize)	luaM_freemem(L, n, nodevecsize(lsize))
+
+#define gctrl(t)	cast(lu_byte *, (t)->node + sizenode(t))
+
+/* number of groups in a hash part (always a power of 2) */
+#define numgroups(t)	cast(unsigned int, ctrlsize((t)->lsizenode) / GROUPSIZE)
+
+/* maximum number of keys in a hash part with 2^lsize nodes */
+#define maxload(lsize)	cast(unsigned int, twoto(lsize) - (twoto(lsize) >> 3))
+
+
+static const struct {
+  Node n;
+  lu_byte ctrl[GROUPSIZE];
+} dummy_ = {
+  {{NILCONSTANT}, {{NILCONSTANT}}},
+  {CTRL_EMPTY, CTRL_PAD, CTRL_PAD, CTRL_PAD, CTRL_PAD, CTRL_PAD, CTRL_PAD,
+   CTRL_PAD, CTRL_PAD, CTRL_PAD, CTRL_PAD, CTRL_PAD, CTRL_PAD, CTRL_PAD,
+   CTRL_PAD, CTRL_PAD}
+};
+
+#define dummynode		(&dummy_.n)
+
+#define isdummy(n)		((n) == dummynode)
+
+
+/*
+** 'matchbyte' returns a mask with bit 'i' set for each control byte
+** 'i' in group 'g' equal to 'b'
+*/
+typedef unsigned int Bitmask;
+
+#if defined(__SSE2__)
+
+static Bitmask matchbyte (const lu_byte *g, int b) {
+  __m128i grp = _mm_loadu_si128(cast(const __m128i *, g));
+  __m128i eq = _mm_cmpeq_epi8(grp, _mm_set1_epi8(cast(char, b)));
+  return cast(Bitmask, _mm_movemask_epi8(eq));
+}
+
+#else
+
+static Bitmask matchbyte (const lu_byte *g, int b) {
+  Bitmask m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++) {
+    if (g[i] == b)
+      m |= 1u << i;
+  }
+  return m;
+}
+
+#endif
+
+
+/* index of the lowest bit set in a (non-zero) mask */
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#else
+static int firstbit (Bitmask m) {
+  int i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+/*
+** Search table 't' for a key with hash 'h' such that 'eq(n,k)' holds
+** for its node 'n'; leave in 'n' that node, or NULL if there is none.
+** Groups are probed in triangular steps, which visit each group once.
+*/
+#define probe(t,h,n,eq,k) \
+  { const lu_byte *ctrl_ = gctrl(t); \
+    unsigned int mask_ = numgroups(t) - 1; \
+    unsigned int g_ = ((h) >> 7) & mask_; \
+    unsigned int s_ = 0; \
+    for (n = NULL;;) { \
+      const lu_byte *grp_ = ctrl_ + g_ * GROUPSIZE; \
+      Bitmask m_; \
+      for (m_ = matchbyte(grp_, (h) & 0x7F); m_ != 0; m_ &= m_ - 1) { \
+        Node *c_ = gnode(t, g_ * GROUPSIZE + firstbit(m_)); \
+        if (eq(c_, k)) { n = c_; break; } \
+      } \
+      if (n != NULL || matchbyte(grp_, CTRL_EMPTY) != 0 || s_ == mask_) \
+        break; \
+      g_ = (g_ + ++s_) & mask_; \
+    } }
+
+#define eqint(n,k)	(ttisinteger(gkey(n)) && ivalue(gkey(n)) == (k))
+#define eqshrkey(n,k)	(ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), k))
+#define eqkey(n,k)	luaV_rawequalobj(gkey(n), k)
+
+/* key may be dead already, but it is ok to use it in 'next' */
+#define eqnextkey(n,k)	(eqkey(n,k) || \
+	(ttisdeadkey(gkey(n)) && iscollectable(k) && \
+	 deadvalue(gkey(n)) == gcvalue(k)))
+
+
+/*
+** Mix the bits of a raw hash, as the raw hashes of integers and
+** pointers are far from random in their low bits, which choose the
+** control byte, and in their high bits, which choose the first group.
+*/
+static unsigned int mixhash (unsigned int h) {
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  h *= 0x846ca68bu;
+  return h ^ (h >> 16);
+}
+
+
+static unsigned int hashint (lua_Integer i) {
+  lua_Unsigned u = l_castS2U(i);
+  return mixhash(cast(unsigned int, u ^ (u >> 31 >> 1)));
+}
+
+
+/* }============================================================= */
+
+#endif				/* } */
+
+
 /*
 ** Hash for floating-point numbers.
 ** The main computation should be just
@@ -112,6 +286,8 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 /*
 ** returns the 'main' position of an element in a table (that is, the index
 ** of its hash value)
@@ -138,6 +314,35 @@ static Node *mainposition (const Table *t, const TValue *key) {
   }
 }
 
+#else
+
+/*
+** returns the hash of a key
+*/
+static unsigned int hashkey (const TValue *key) {
+  switch (ttype(key)) {
+    case LUA_TNUMINT:
+      return hashint(ivalue(key));
+    case LUA_TNUMFLT:
+      return mixhash(cast(unsigned int, l_hashfloat(fltvalue(key))));
+    case LUA_TSHRSTR:
+      return mixhash(tsvalue(key)->hash);
+    case LUA_TLNGSTR:
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
+    case LUA_TBOOLEAN:
+      return mixhash(cast(unsigned int, bvalue(key)));
+    case LUA_TLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_TLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      lua_assert(!ttisdeadkey(key));
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+#endif
+
 
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
@@ -153,6 +358,373 @@ static unsigned int arrayindex (const TValue *key) {
 }
 
 
+/*
+** {=============================================================
+** Unboxed arrays
+** ==============================================================
+*/
+
+/*
+** A new array part starts unboxed and empty, as a vector of 'UValue's
+** (half the size of a vector of TValues) after an 'ArrayHeader'. The
+** first non-nil value stored into it sets its kind: integers or floats.
+** A nil element is an integer equal to NILINT or a float NaN. Storing
+** any other value (including NILINT or a NaN) converts the array part
+** to TValues, where it stays. With NaN boxing, TValues are as small as
+** 'UValue's, and array parts are never unboxed.
+*/
+
+#define NILFLT		(cast_num(HUGE_VAL) - cast_num(HUGE_VAL))  /* a NaN */
+
+#define canunbox()	(sizeof(UValue) < sizeof(TValue))
+
+#define setarraykind(t,k)  \
+	((t)->flags = cast_byte(((t)->flags & maskflags) | ((k) << 6)))
+
+
+static int unboxednil (const Table *t, unsigned int i) {
+  switch (arraykind(t)) {
+    case ARRINT: return (uarray(t)[i].i == NILINT);
+    case ARRFLT: return luai_numisnan(uarray(t)[i].n);
+    default: return 1;  /* empty array */
+  }
+}
+
+
+/* is element 'i' (0-based) of the array part nil? */
+#define arraynil(t,i) \
+	(isunboxed(t) ? unboxednil(t, i) : ttisnil(&(t)->array[i]))
+
+
+/* copy element 'i' (0-based) of the array part of 't' into 'res' */
+static void getarray (const Table *t, unsigned int i, TValue *res) {
+  if (!isunboxed(t))
+    { setobj(cast(lua_State *, NULL), res, &t->array[i]); }
+  else if (unboxednil(t, i))
+    setnilvalue(res);
+  else if (arraykind(t) == ARRINT)
+    { setivalue(res, uarray(t)[i].i); }
+  else
+    { setfltvalue(res, uarray(t)[i].n); }
+}
+
+
+/* set elements 'from' to 'to - 1' of an unboxed array part to nil */
+static void unboxedclear (Table *t, unsigned int from, unsigned int to) {
+  UValue *u = uarray(t);
+  switch (arraykind(t)) {
+    case ARRINT: for (; from < to; from++) u[from].i = NILINT; break;
+    case ARRFLT: for (; from < to; from++) u[from].n = NILFLT; break;
+    default: break;  /* empty array has no contents */
+  }
+}
+
+
+static void freearray (lua_State *L, Table *t, unsigned int size) {
+  if (isunboxed(t))
+    luaM_freearray(L, uarray(t) - HEADERSIZE, size + HEADERSIZE);
+  else
+    luaM_freearray(L, t->array, size);
+}
+
+
+/*
+** Change the size of the array part of 't' from 'oldsize' to 'size',
+** with new elements set to nil
+*/
+static void setarrayvector (lua_State *L, Table *t, unsigned int oldsize,
+                                                    unsigned int size) {
+  if (size == 0) {
+    freearray(L, t, oldsize);
+    t->array = NULL;
+    setarraykind(t, ARRBOXED);
+  }
+  else if (oldsize == 0 && canunbox()) {  /* new array part? */
+    UValue *u = luaM_newvector(L, size + HEADERSIZE, UValue);
+    t->array = cast(TValue *, u + HEADERSIZE);
+    setarraykind(t, ARREMPTY);
+  }
+  else if (isunboxed(t)) {
+    UValue *u = uarray(t) - HEADERSIZE;
+    luaM_reallocvector(L, u, oldsize + HEADERSIZE, size + HEADERSIZE, UValue);
+    t->array = cast(TValue *, u + HEADERSIZE);
+    unboxedclear(t, oldsize, size);
+  }
+  else {
+    unsigned int i;
+    luaM_reallocvector(L, t->array, oldsize, size, TValue);
+    for (i = oldsize; i < size; i++)
+      setnilvalue(&t->array[i]);
+  }
+  t->sizearray = size;
+}
+
+
+/* convert the array part of 't' to TValues */
+static void boxarray (lua_State *L, Table *t) {
+  unsigned int i;
+  TValue *v = luaM_newvector(L, t->sizearray, TValue);
+  for (i = 0; i < t->sizearray; i++)
+    getarray(t, i, &v[i]);
+  freearray(L, t, t->sizearray);
+  t->array = v;
+  setarraykind(t, ARRBOXED);
+}
+
+
+/* store 'v' as element 'i' (0-based) of the array part of 't' */
+static void setarray (lua_State *L, Table *t, unsigned int i,
+                                             const TValue *v) {
+  if (isunboxed(t)) {
+    UValue *u = &uarray(t)[i];
+    int k = arraykind(t);
+    if (k == ARREMPTY && ttisnumber(v)) {  /* first value? */
+      k = ttisinteger(v) ? ARRINT : ARRFLT;
+      setarraykind(t, k);
+      unboxedclear(t, 0, t->sizearray);
+    }
+    if (ttisnil(v)) {
+      unboxedclear(t, i, i + 1);
+      return;
+    }
+    else if (k == ARRINT && ttisinteger(v) && ivalue(v) != NILINT) {
+      u->i = ivalue(v);
+      return;
+    }
+    else if (k == ARRFLT && ttisfloat(v) && !luai_numisnan(fltvalue(v))) {
+      u->n = fltvalue(v);
+      return;
+    }
+    boxarray(L, t);  /* value does not fit; go on with TValues */
+  }
+  setobj2t(L, &t->array[i], v);
+}
+
+
+/*
+** Store 'v' in the element of the unboxed array part of 't' last
+** accessed by 'luaH_getint' (see 'luaH_setslot')
+*/
+void luaH_setunboxed (lua_State *L, Table *t, const TValue *v) {
+  setarray(L, t, arrayheader(t)->i, v);
+}
+
+
+/* }============================================================= */
+
+
+
+#if defined(LUA_USE_SHAPES)
+
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/*
+** A table gets a shape when it receives a short-string key while its
+** hash part is empty. Its fields then live in vector 'slots', in the
+** order of the keys of its shape. Setting a field to nil keeps its key
+** in the shape (as a dead key keeps its node), so the shape does not
+** change while fields come and go. A table leaves its shape for a hash
+** part when it gets any other key or more than LUAI_MAXSHAPE fields
+** (see 'luaH_resize').
+*/
+
+
+static Shape *newshape (lua_State *L, Shape *parent, TString *key) {
+  int n = (parent == NULL) ? 0 : parent->nkeys + 1;
+  Shape *s = cast(Shape *, luaM_malloc(L, sizeshape(n)));
+  s->parent = parent;
+  s->child = NULL;
+  s->refs = 0;
+  s->nkeys = cast_byte(n);
+  s->size = (n == 0) ? 0 : cast_byte(twoto(luaO_ceillog2(n)));
+  if (parent == NULL)
+    s->sibling = NULL;
+  else {
+    memcpy(s->keys, parent->keys, sizeof(TString *) * parent->nkeys);
+    s->keys[n - 1] = key;
+    s->sibling = parent->child;  /* link it as a child of 'parent' */
+    parent->child = s;
+    parent->refs++;
+  }
+  return s;
+}
+
+
+/* shape with the keys of 's' plus 'key' */
+static Shape *addkey (lua_State *L, Shape *s, TString *key) {
+  Shape *c;
+  for (c = s->child; c != NULL; c = c->sibling) {
+    if (c->keys[s->nkeys] == key)
+      return c;
+  }
+  return newshape(L, s, key);
+}
+
+
+/* a table or a child stopped using shape 's' */
+static void releaseshape (lua_State *L, Shape *s) {
+  while (--s->refs == 0 && s->parent != NULL) {  /* shape not used? */
+    Shape *p = s->parent;
+    Shape **c = &p->child;
+    while (*c != s)
+      c = &(*c)->sibling;
+    *c = s->sibling;  /* unlink it */
+    luaM_freemem(L, s, sizeshape(s->nkeys));
+    s = p;  /* its parent lost a child */
+  }
+}
+
+
+static int shapeindex (const Shape *s, const TString *key) {
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key)
+      return i;
+  }
+  return -1;
+}
+
+
+/*
+** Create a slot for new field 'key' in table 't' (which has no hash
+** part); return NULL if its shape cannot grow.
+*/
+static TValue *newslot (lua_State *L, Table *t, TString *key) {
+  Shape *s = (t->shape != NULL) ? t->shape : G(L)->rootshape;
+  Shape *ns;
+  if (s->nkeys == LUAI_MAXSHAPE)
+    return NULL;
+  ns = addkey(L, s, key);
+  if (ns->size != s->size)
+    luaM_reallocvector(L, t->slots, s->size, ns->size, TValue);
+  ns->refs++;
+  if (t->shape != NULL)
+    releaseshape(L, t->shape);
+  t->shape = ns;
+  setnilvalue(&t->slots[s->nkeys]);
+  return &t->slots[s->nkeys];
+}
+
+
+static void freeshape (lua_State *L, Shape *s) {
+  while (s->child != NULL) {
+    Shape *c = s->child;
+    s->child = c->sibling;
+    freeshape(L, c);
+  }
+  luaM_freemem(L, s, sizeshape(s->nkeys));
+}
+
+
+void luaH_initshapes (lua_State *L) {
+  G(L)->rootshape = newshape(L, NULL, NULL);
+}
+
+
+/* free all shapes (including unused ones left by memory errors) */
+void luaH_freeshapes (lua_State *L) {
+  if (G(L)->rootshape != NULL)
+    freeshape(L, G(L)->rootshape);
+}
+
+/* }============================================================= */
+
+#endif
+
+
+
+#if defined(LUA_USE_INCRHASH)	/* { */
+
+/*
+** {=============================================================
+** Incremental growth
+** ==============================================================
+*/
+
+/*
+** When a hash part with at least 2^LUAI_INCRHBITS nodes is resized
+** (keeping the array part), its nodes stay in 'oldnode' and move to the
+** new hash part a few at a time, in order: each new key first moves
+** MIGRATESTEP more nodes (see 'luaH_newkey'). A moved node is cleared,
+** key included, so that the old part holds only keys that were not
+** moved yet; a search that misses the hash part goes on into the old
+** one. Lookups never move nodes, as they must keep previous results
+** valid and run inside the collector.
+*/
+#if !defined(LUAI_INCRHBITS)
+#define LUAI_INCRHBITS	16
+#endif
+
+#define MIGRATESTEP	8
+
+
+/*
+** Fill 'old' as the header of a table with no array part whose hash
+** part is the old hash part of 't', so that the search functions can
+** look into that part.
+*/
+static Table *oldpart (const Table *t, Table *old) {
+  old->sizearray = 0;
+  old->node = t->oldnode;
+  old->lsizenode = t->oldlsize;
+  old->oldnode = NULL;
+#if defined(LUA_USE_SHAPES)
+  old->shape = NULL;
+#endif
+  return old;
+}
+
+
+/* search function 'f' missed the hash part of 't'; try its old part */
+#define searchold(t,f,k) \
+  { if ((t)->oldnode != NULL) { Table old_; return f(oldpart(t, &old_), k); } }
+
+/* }============================================================= */
+
+#else				/* }{ */
+
+#define searchold(t,f,k)	((void)0)
+
+#endif				/* } */
+
+
+#if !defined(LUA_USE_SWISSTABLE)
+
+/*
+** Node of key 'key' in the hash part of 't', or NULL if it is not
+** there. The key may be dead already, but it is ok to use it in 'next'.
+*/
+static Node *findnode (const Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    int nx;
+    if (luaV_rawequalobj(gkey(n), key) ||
+          (ttisdeadkey(gkey(n)) && iscollectable(key) &&
+           deadvalue(gkey(n)) == gcvalue(key)))
+      return n;
+    nx = gnext(n);
+    if (nx == 0)
+      return NULL;  /* key not found */
+    n += nx;
+  }
+}
+
+#else
+
+static Node *findnode (const Table *t, const TValue *key) {
+  Node *n;
+  unsigned int h = hashkey(key);
+  probe(t, h, n, eqnextkey, key);
+  return n;
+}
+
+#endif
+
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
@@ -164,47 +736,149 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   i = arrayindex(key);
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+#if defined(LUA_USE_SHAPES)
+  else if (t->shape != NULL && ttisshrstring(key)) {
+    int k = shapeindex(t->shape, tsvalue(key));
+    if (k < 0)
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    /* slots are numbered after the hash part */
+    return (k + 1) + t->sizearray + sizenode(t);
+  }
+#endif
   else {
-    int nx;
-    Node *n = mainposition(t, key);
-    for (;;) {  /* check whether 'key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in 'next' */
-      if (luaV_rawequalobj(gkey(n), key) ||
-            (ttisdeadkey(gkey(n)) && iscollectable(key) &&
-             deadvalue(gkey(n)) == gcvalue(key))) {
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return (i + 1) + t->sizearray;
+    Node *n = findnode(t, key);
+    if (n != NULL) {
+      i = cast_int(n - gnode(t, 0));  /* key index in hash table */
+      /* hash elements are numbered after array ones */
+      return (i + 1) + t->sizearray;
+    }
+#if defined(LUA_USE_INCRHASH)
+    if (t->oldnode != NULL) {
+      Table old;
+      n = findnode(oldpart(t, &old), key);
+      if (n != NULL) {
+        i = cast_int(n - t->oldnode);
+        /* elements of the old hash part are numbered after hash ones */
+        return (i + 1) + t->sizearray + sizenode(t);
       }
-      nx = gnext(n);
-      if (nx == 0)
-        luaG_runerror(L, "invalid key to 'next'");  /* key not found */
-      else n += nx;
     }
+#endif
+    luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    return 0;  /* to avoid warnings */
   }
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
-  unsigned int i = findindex(L, t, key);  /* find original element */
+/*
+** Is 'key' the key of the element just before position 'i', where a
+** previous traversal step stopped?
+*/
+static int keybefore (const Table *t, unsigned int i, const TValue *key) {
+  if (i-- == 0 || ttisnil(key))  /* (a nil key starts a new traversal) */
+    return 0;
+  else if (i < t->sizearray)
+    return (ttisinteger(key) && l_castS2U(ivalue(key)) == i + 1);
+  i -= t->sizearray;
+  if (i < cast(unsigned int, sizenode(t))) {
+    const TValue *k = gkey(gnode(t, i));
+    return (ttype(k) == ttype(key) && luaV_rawequalobj(k, key));
+  }
+  i -= sizenode(t);
+#if defined(LUA_USE_INCRHASH)
+  if (t->oldnode != NULL) {  /* (then there are no slots) */
+    const TValue *k;
+    if (i >= cast(unsigned int, twoto(t->oldlsize)))
+      return 0;
+    k = gkey(t->oldnode + i);
+    return (ttype(k) == ttype(key) && luaV_rawequalobj(k, key));
+  }
+#endif
+#if defined(LUA_USE_SHAPES)
+  if (i < cast(unsigned int, numslots(t)))
+    return (ttisshrstring(key) && t->shape->keys[i] == tsvalue(key));
+#endif
+  return 0;
+}
+
+
+/*
+** Traverse table 't' from position '*cursor' (0 at the beginning):
+** put the next element into 'key' and 'key + 1' and move the cursor
+** past it. Returns 0 when there are no more elements.
+*/
+int luaH_nextcursor (lua_State *L, Table *t, unsigned int *cursor,
+                     StkId key) {
+  unsigned int i = *cursor;
   for (; i < t->sizearray; i++) {  /* try first array part */
-    if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
+    if (!arraynil(t, i)) {  /* a non-nil value? */
       setivalue(key, i + 1);
-      setobj2s(L, key+1, &t->array[i]);
+      getarray(t, i, key + 1);
+      *cursor = i + 1;
       return 1;
     }
   }
-  for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
+  for (i -= t->sizearray; i < cast(unsigned int, sizenode(t)); i++) {
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
+      *cursor = (i + 1) + t->sizearray;
+      return 1;
+    }
+  }
+#if defined(LUA_USE_INCRHASH)
+  if (t->oldnode != NULL) {
+    Node *old = t->oldnode;
+    for (i -= sizenode(t); i < cast(unsigned int, twoto(t->oldlsize)); i++) {
+      if (!ttisnil(gval(old + i))) {
+        setobj2s(L, key, gkey(old + i));
+        setobj2s(L, key+1, gval(old + i));
+        *cursor = (i + 1) + t->sizearray + sizenode(t);
+        return 1;
+      }
+    }
+    return 0;  /* a table with an old hash part has no slots */
+  }
+#endif
+#if defined(LUA_USE_SHAPES)
+  for (i -= sizenode(t); i < cast(unsigned int, numslots(t)); i++) {
+    if (!ttisnil(&t->slots[i])) {
+      setsvalue2s(L, key, t->shape->keys[i]);
+      setobj2s(L, key+1, &t->slots[i]);
+      *cursor = (i + 1) + t->sizearray + sizenode(t);
       return 1;
     }
   }
+#endif
   return 0;  /* no more elements */
 }
 
 
+/*
+** Each thread remembers where its last steps stopped (in different
+** tables), so that loops traversing tables find their positions
+** without searching for the previous keys.
+*/
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  NextPos *np = L->nextpos;
+  unsigned int i;
+  int c;
+  for (c = 0; c < NEXTCACHE - 1; c++) {
+    if (np[c].t == t) break;
+  }
+  if (np[c].t == t && keybefore(t, np[c].pos, key))
+    i = np[c].pos;  /* go on from the last step */
+  else
+    i = findindex(L, t, key);  /* find original element */
+  if (!luaH_nextcursor(L, t, &i, key))
+    return 0;  /* no more elements */
+  for (; c > 0; c--)  /* entry 'c' goes to the front */
+    np[c] = np[c - 1];
+  np[0].t = t;
+  np[0].pos = i;
+  return 1;
+}
+
+
 /*
 ** {=============================================================
 ** Rehash
@@ -272,7 +946,7 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
     }
     /* count elements in range (2^(lg - 1), 2^lg] */
     for (; i <= lim; i++) {
-      if (!ttisnil(&t->array[i-1]))
+      if (!arraynil(t, i - 1))
         lc++;
     }
     nums[lg] += lc;
@@ -282,12 +956,13 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
 }
 
 
-static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
+static int numusenodes (const Node *node, int size, unsigned int *nums,
+                        unsigned int *pna) {
   int totaluse = 0;  /* total number of elements */
   int ause = 0;  /* elements added to 'nums' (can go to array part) */
-  int i = sizenode(t);
+  int i = size;
   while (i--) {
-    Node *n = &t->node[i];
+    const Node *n = &node[i];
     if (!ttisnil(gval(n))) {
       ause += countint(gkey(n), nums);
       totaluse++;
@@ -298,15 +973,18 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 }
 
 
-static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
-  unsigned int i;
-  luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
-  for (i=t->sizearray; i<size; i++)
-     setnilvalue(&t->array[i]);
-  t->sizearray = size;
+static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
+  int totaluse = numusenodes(t->node, sizenode(t), nums, pna);
+#if defined(LUA_USE_INCRHASH)
+  if (t->oldnode != NULL)  /* count also elements not moved yet */
+    totaluse += numusenodes(t->oldnode, twoto(t->oldlsize), nums, pna);
+#endif
+  return totaluse;
 }
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   int lsize;
   if (size == 0) {  /* no elements to hash part? */
@@ -331,39 +1009,144 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   t->lastfree = gnode(t, size);  /* all positions are free */
 }
 
+#else
+
+static void setnodevector (lua_State *L, Table *t, unsigned int size) {
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
+    t->lsizenode = 0;
+    t->hfree = 0;
+  }
+  else {
+    int i;
+    int lsize = luaO_ceillog2(size);
+    if (maxload(lsize) < size)  /* cannot take 'size' keys? */
+      lsize++;
+    if (lsize > MAXHBITS)
+      luaG_runerror(L, "table overflow");
+    t->node = cast(Node *, luaM_malloc(L, nodevecsize(lsize)));
+    t->lsizenode = cast_byte(lsize);
+    for (i = 0; i < twoto(lsize); i++) {
+      Node *n = gnode(t, i);
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+    memset(gctrl(t), CTRL_EMPTY, twoto(lsize));
+    if (twoto(lsize) < GROUPSIZE)
+      memset(gctrl(t) + twoto(lsize), CTRL_PAD, GROUPSIZE - twoto(lsize));
+    t->hfree = maxload(lsize);
+  }
+}
+
+#endif
+
+
+/*
+** Slot for 'key' in table 't', creating it if needed. For an element
+** of an unboxed array, it is only a copy (see 'luaH_setslot').
+*/
+static TValue *setslot (lua_State *L, Table *t, const TValue *key) {
+  const TValue *p = luaH_get(t, key);
+  if (p != luaO_nilobject)
+    return cast(TValue *, p);
+  else return luaH_newkey(L, t, key);
+}
+
+
+/*
+** Re-insert the elements of hash part 'nold' (with 2^'lsize' nodes)
+** into table 't'
+*/
+static void reinsert (lua_State *L, Table *t, Node *nold, int lsize) {
+  int j;
+  for (j = twoto(lsize) - 1; j >= 0; j--) {
+    Node *old = nold + j;
+    if (!ttisnil(gval(old))) {
+      /* doesn't need barrier/invalidate cache, as entry was
+         already present in the table */
+      const TValue *slot = setslot(L, t, gkey(old));
+      luaH_setslot(L, t, slot, gval(old));
+    }
+  }
+}
+
 
 void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                           unsigned int nhsize) {
   unsigned int i;
-  int j;
   unsigned int oldasize = t->sizearray;
   int oldhsize = t->lsizenode;
   Node *nold = t->node;  /* save old hash ... */
+#if defined(LUA_USE_INCRHASH)
+  Node *nolder = t->oldnode;  /* ... and the part it is still moving */
+#endif
+#if defined(LUA_USE_SHAPES)
+  Shape *sold = t->shape;
+  if (sold != NULL && nhsize > 0)  /* table needs a hash part? */
+    nhsize += sold->nkeys;  /* its fields go there too */
+  else
+    sold = NULL;  /* keep shape (if any) */
+#endif
+#if defined(LUA_USE_INCRHASH)
+  if (nolder == NULL && nasize == oldasize && oldhsize >= LUAI_INCRHBITS &&
+      nhsize > 0) {  /* grow incrementally? */
+    /* leave room for the keys inserted while the old nodes move */
+    setnodevector(L, t, nhsize + nhsize / 3);
+    t->oldnode = nold;
+    t->oldlsize = cast_byte(oldhsize);
+    t->oldmoved = 0;
+    return;
+  }
+#endif
   if (nasize > oldasize)  /* array part must grow? */
-    setarrayvector(L, t, nasize);
+    setarrayvector(L, t, oldasize, nasize);
   /* create new hash part with appropriate size */
   setnodevector(L, t, nhsize);
+#if defined(LUA_USE_INCRHASH)
+  t->oldnode = NULL;  /* elements from 'nolder' are re-inserted below */
+#endif
+#if defined(LUA_USE_SHAPES)
+  if (sold != NULL)
+    t->shape = NULL;  /* slots are re-inserted below */
+#endif
   if (nasize < oldasize) {  /* array part must shrink? */
     t->sizearray = nasize;
     /* re-insert elements from vanishing slice */
     for (i=nasize; i<oldasize; i++) {
-      if (!ttisnil(&t->array[i]))
-        luaH_setint(L, t, i + 1, &t->array[i]);
+      if (!arraynil(t, i)) {
+        TValue v;
+        getarray(t, i, &v);
+        luaH_setint(L, t, i + 1, &v);
+      }
     }
     /* shrink array */
-    luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
+    setarrayvector(L, t, oldasize, nasize);
   }
   /* re-insert elements from hash part */
-  for (j = twoto(oldhsize) - 1; j >= 0; j--) {
-    Node *old = nold + j;
-    if (!ttisnil(gval(old))) {
-      /* doesn't need barrier/invalidate cache, as entry was
-         already present in the table */
-      setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
+  reinsert(L, t, nold, oldhsize);
+  if (!isdummy(nold))
+    freenodevector(L, nold, oldhsize);  /* free old hash */
+#if defined(LUA_USE_INCRHASH)
+  if (nolder != NULL) {
+    reinsert(L, t, nolder, t->oldlsize);
+    freenodevector(L, nolder, t->oldlsize);
+  }
+#endif
+#if defined(LUA_USE_SHAPES)
+  if (sold != NULL) {  /* re-insert fields from slots */
+    int j;
+    for (j = 0; j < sold->nkeys; j++) {
+      if (!ttisnil(&t->slots[j])) {
+        TValue k;
+        setsvalue(L, &k, sold->keys[j]);
+        setobj2t(L, luaH_newkey(L, t, &k), &t->slots[j]);
+      }
     }
+    luaM_freearray(L, t->slots, sold->size);
+    t->slots = NULL;
+    releaseshape(L, sold);
   }
-  if (!isdummy(nold))
-    luaM_freearray(L, nold, cast(size_t, twoto(oldhsize))); /* free old hash */
+#endif
 }
 
 
@@ -372,6 +1155,22 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Ensure that the array part of 't' has room for at least 'n' elements.
+** It grows at least geometrically, so that a series of bulk appends
+** costs amortized constant time per element and never goes through
+** 'rehash'. Sizes beyond MAXASIZE are left to the hash part.
+*/
+void luaH_reservearray (lua_State *L, Table *t, lua_Unsigned n) {
+  if (n > t->sizearray && n <= MAXASIZE) {
+    unsigned int size = (t->sizearray <= MAXASIZE / 2) ? t->sizearray * 2
+                                                       : MAXASIZE;
+    if (size < n) size = cast(unsigned int, n);
+    luaH_resizearray(L, t, size);
+  }
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -405,9 +1204,16 @@ Table *luaH_new (lua_State *L) {
   GCObject *o = luaC_newobj(L, LUA_TTABLE, sizeof(Table));
   Table *t = gco2t(o);
   t->metatable = NULL;
-  t->flags = cast_byte(~0);
+  t->flags = cast_byte(maskflags);
   t->array = NULL;
   t->sizearray = 0;
+#if defined(LUA_USE_SHAPES)
+  t->shape = NULL;
+  t->slots = NULL;
+#endif
+#if defined(LUA_USE_INCRHASH)
+  t->oldnode = NULL;
+#endif
   setnodevector(L, t, 0);
   return t;
 }
@@ -415,12 +1221,24 @@ Table *luaH_new (lua_State *L) {
 
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t->node))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
-  luaM_freearray(L, t->array, t->sizearray);
+    freenodevector(L, t->node, t->lsizenode);
+#if defined(LUA_USE_INCRHASH)
+  if (t->oldnode != NULL)
+    freenodevector(L, t->oldnode, t->oldlsize);
+#endif
+  freearray(L, t, t->sizearray);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {
+    luaM_freearray(L, t->slots, t->shape->size);
+    releaseshape(L, t->shape);
+  }
+#endif
   luaM_free(L, t);
 }
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 static Node *getfreepos (Table *t) {
   while (t->lastfree > t->node) {
     t->lastfree--;
@@ -430,37 +1248,29 @@ static Node *getfreepos (Table *t) {
   return NULL;  /* could not find a free place */
 }
 
+#endif
+
 
 
 /*
-** inserts a new key into a hash table; first, check whether key's main
-** position is free. If not, check whether colliding node is in its main
-** position or not: if it is not, move colliding node to an empty place and
-** put new key in its main position; otherwise (colliding node is in its main
-** position), new key goes to an empty position.
+** Insert 'key', not present in the hash part of 't', into that part and
+** return its (nil) value, or return NULL if the part is full. First,
+** check whether key's main position is free. If not, check whether
+** colliding node is in its main position or not: if it is not, move
+** colliding node to an empty place and put new key in its main
+** position; otherwise (colliding node is in its main position), new key
+** goes to an empty position. (A Swiss table puts the new key in the
+** first free node along its probe sequence.)
 */
-TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key) {
   Node *mp;
-  TValue aux;
-  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
-  else if (ttisfloat(key)) {
-    lua_Integer k;
-    if (luaV_tointeger(key, &k, 0)) {  /* index is int? */
-      setivalue(&aux, k);
-      key = &aux;  /* insert it as an integer */
-    }
-    else if (luai_numisnan(fltvalue(key)))
-      luaG_runerror(L, "table index is NaN");
-  }
+#if !defined(LUA_USE_SWISSTABLE)
   mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(mp)) {  /* main position is taken? */
     Node *othern;
     Node *f = getfreepos(t);  /* get a free place */
-    if (f == NULL) {  /* cannot find a free place? */
-      rehash(L, t, key);  /* grow table */
-      /* whatever called 'newkey' takes care of TM cache */
-      return luaH_set(L, t, key);  /* insert key into grown table */
-    }
+    if (f == NULL)  /* cannot find a free place? */
+      return NULL;
     lua_assert(!isdummy(f));
     othern = mainposition(t, gkey(mp));
     if (othern != mp) {  /* is colliding node out of its main position? */
@@ -484,21 +1294,123 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       mp = f;
     }
   }
+#else
+  if (t->hfree == 0)  /* no room for another key? */
+    return NULL;
+  else {
+    lu_byte *ctrl = gctrl(t);
+    unsigned int h = hashkey(key);
+    unsigned int mask = numgroups(t) - 1;
+    unsigned int g = (h >> 7) & mask;
+    unsigned int s = 0;
+    Bitmask m;
+    /* there is a free node, so this loop ends */
+    while ((m = matchbyte(ctrl + g * GROUPSIZE, CTRL_EMPTY)) == 0)
+      g = (g + ++s) & mask;
+    g = g * GROUPSIZE + firstbit(m);
+    ctrl[g] = cast_byte(h & 0x7F);
+    t->hfree--;
+    mp = gnode(t, g);
+  }
+#endif
   setnodekey(L, &mp->i_key, key);
-  luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
   return gval(mp);
 }
 
 
+#if defined(LUA_USE_INCRHASH)
+
+/*
+** Move up to 'n' more nodes from the old hash part of 't' into its
+** hash part; free the old part when all its nodes have moved. Stop
+** early if the hash part gets full: the next rehash takes care of the
+** remaining nodes.
+*/
+static void migrate (lua_State *L, Table *t, int n) {
+  Node *old = t->oldnode;
+  unsigned int size = twoto(t->oldlsize);
+  for (; n > 0 && t->oldmoved < size; n--) {
+    Node *o = old + t->oldmoved;
+    if (!ttisnil(gval(o))) {  /* (a dead key has a nil value) */
+      TValue *v = insertkey(L, t, gkey(o));
+      if (v == NULL)  /* hash part is full? */
+        return;
+      setobj2t(L, v, gval(o));
+      setnilvalue(gval(o));
+    }
+    setnilvalue(wgkey(o));  /* old part no longer has this key */
+    t->oldmoved++;
+  }
+  if (t->oldmoved == size) {  /* all nodes moved? */
+    t->oldnode = NULL;
+    freenodevector(L, old, t->oldlsize);
+  }
+}
+
+#endif
+
+
+/*
+** inserts a new key into a table (see 'insertkey'), growing it when
+** needed. If the table has to grow, the key may end up in an unboxed
+** array part; so, the value must be stored in the result with
+** 'luaH_setslot'.
+*/
+TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
+  TValue *slot;
+  TValue aux;
+  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
+  else if (ttisfloat(key)) {
+    lua_Integer k;
+    if (luaV_tointeger(key, &k, 0)) {  /* index is int? */
+      setivalue(&aux, k);
+      key = &aux;  /* insert it as an integer */
+    }
+    else if (luai_numisnan(fltvalue(key)))
+      luaG_runerror(L, "table index is NaN");
+  }
+#if defined(LUA_USE_SHAPES)
+  if (ttisshrstring(key) && isdummy(t->node)) {  /* no hash part? */
+    slot = newslot(L, t, tsvalue(key));
+    if (slot != NULL) {
+      luaC_barrierback(L, t, key);
+      return slot;
+    }
+  }
+#endif
+#if defined(LUA_USE_INCRHASH)
+  if (t->oldnode != NULL)  /* hash part still growing? */
+    migrate(L, t, MIGRATESTEP);
+#endif
+  slot = insertkey(L, t, key);
+  if (slot == NULL) {  /* no room for the key? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return setslot(L, t, key);  /* insert key into grown table */
+  }
+  luaC_barrierback(L, t, key);
+  return slot;
+}
+
+
 /*
 ** search function for integers
 */
 const TValue *luaH_getint (Table *t, lua_Integer key) {
   /* (1 <= key && key <= t->sizearray) */
-  if (l_castS2U(key) - 1 < t->sizearray)
-    return &t->array[key - 1];
+  if (l_castS2U(key) - 1 < t->sizearray) {
+    if (!isunboxed(t))
+      return &t->array[key - 1];
+    else {  /* return a copy of the element */
+      ArrayHeader *h = arrayheader(t);
+      h->i = cast(unsigned int, key - 1);
+      getarray(t, h->i, &h->v);
+      return &h->v;
+    }
+  }
   else {
+#if !defined(LUA_USE_SWISSTABLE)
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
@@ -509,6 +1421,14 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
         n += nx;
       }
     }
+#else
+    Node *n;
+    unsigned int h = hashint(key);
+    probe(t, h, n, eqint, key);
+    if (n != NULL)
+      return gval(n);
+#endif
+    searchold(t, luaH_getint, key);
     return luaO_nilobject;
   }
 }
@@ -518,19 +1438,92 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(key->tt == LUA_TSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {
+    int i = shapeindex(t->shape, key);
+    return (i >= 0) ? &t->slots[i] : luaO_nilobject;
+  }
+#endif
+#if !defined(LUA_USE_SWISSTABLE)
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     const TValue *k = gkey(n);
     if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
+      if (nx == 0) break;
+      n += nx;
+    }
+  }
+#else
+  {
+    unsigned int h = mixhash(key->hash);
+    probe(t, h, n, eqshrkey, key);
+    if (n != NULL)
+      return gval(n);
+  }
+#endif
+  searchold(t, luaH_getshortstr, key);
+  return luaO_nilobject;  /* not found */
+}
+
+
+/*
+** search function for short strings with an inline cache: '*hint' is
+** the index of the node (or slot, in a table with a shape) where the
+** key was found by a previous search (maybe in another table). A hit costs only one key comparison;
+** otherwise, do a regular search and update the hint.
+*/
+const TValue *luaH_getshortstrcached (Table *t, TString *key,
+                                      unsigned int *hint) {
+  Node *n;
+  lua_assert(key->tt == LUA_TSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {  /* '*hint' is a slot index */
+    int i;
+    if (*hint < t->shape->nkeys && t->shape->keys[*hint] == key)
+      return &t->slots[*hint];  /* cache hit */
+    i = shapeindex(t->shape, key);
+    if (i < 0)
+      return luaO_nilobject;  /* not found */
+    *hint = cast(unsigned int, i);  /* remember position */
+    return &t->slots[i];
+  }
+#endif
+  if (*hint < cast(unsigned int, sizenode(t))) {
+    const TValue *k = gkey(gnode(t, *hint));
+    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
+      return gval(gnode(t, *hint));  /* cache hit */
+  }
+#if !defined(LUA_USE_SWISSTABLE)
+  n = hashstr(t, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    const TValue *k = gkey(n);
+    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key)) {
+      *hint = cast(unsigned int, n - gnode(t, 0));  /* remember position */
+      return gval(n);  /* that's it */
+    }
+    else {
+      int nx = gnext(n);
+      if (nx == 0) break;
       n += nx;
     }
   }
+#else
+  {
+    unsigned int h = mixhash(key->hash);
+    probe(t, h, n, eqshrkey, key);
+    if (n != NULL) {
+      *hint = cast(unsigned int, n - gnode(t, 0));  /* remember position */
+      return gval(n);
+    }
+  }
+#endif
+  searchold(t, luaH_getshortstr, key);  /* (not cached) */
+  return luaO_nilobject;  /* not found */
 }
 
 
@@ -539,17 +1532,26 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
+#if !defined(LUA_USE_SWISSTABLE)
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (luaV_rawequalobj(gkey(n), key))
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
+      if (nx == 0) break;
       n += nx;
     }
   }
+#else
+  Node *n;
+  unsigned int h = hashkey(key);
+  probe(t, h, n, eqkey, key);
+  if (n != NULL)
+    return gval(n);
+#endif
+  searchold(t, getgeneric, key);
+  return luaO_nilobject;  /* not found */
 }
 
 
@@ -589,24 +1591,29 @@ const TValue *luaH_get (Table *t, const TValue *key) {
 ** barrier and invalidate the TM cache.
 */
 TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
-  const TValue *p = luaH_get(t, key);
-  if (p != luaO_nilobject)
-    return cast(TValue *, p);
-  else return luaH_newkey(L, t, key);
+  TValue *p = setslot(L, t, key);
+  if (isunboxedslot(t, p)) {  /* caller needs the real element */
+    unsigned int i = arrayheader(t)->i;
+    boxarray(L, t);
+    p = &t->array[i];
+  }
+  return p;
 }
 
 
-void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
-  const TValue *p = luaH_getint(t, key);
-  TValue *cell;
-  if (p != luaO_nilobject)
-    cell = cast(TValue *, p);
+void luaH_setint (lua_State *L, Table *t, lua_Integer key,
+                                          const TValue *value) {
+  if (l_castS2U(key) - 1 < t->sizearray)  /* in the array part? */
+    setarray(L, t, cast(unsigned int, key - 1), value);
   else {
-    TValue k;
-    setivalue(&k, key);
-    cell = luaH_newkey(L, t, &k);
+    const TValue *p = luaH_getint(t, key);
+    if (p == luaO_nilobject) {
+      TValue k;
+      setivalue(&k, key);
+      p = luaH_newkey(L, t, &k);
+    }
+    luaH_setslot(L, t, p, value);
   }
-  setobj2t(L, cell, value);
 }
 
 
@@ -640,12 +1647,12 @@ static int unbound_search (Table *t, unsigned int j) {
 */
 int luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
-  if (j > 0 && ttisnil(&t->array[j - 1])) {
+  if (j > 0 && arraynil(t, j - 1)) {
     /* there is a boundary in the array part: (binary) search for it */
     unsigned int i = 0;
     while (j - i > 1) {
       unsigned int m = (i+j)/2;
-      if (ttisnil(&t->array[m - 1])) j = m;
+      if (arraynil(t, m - 1)) j = m;
       else i = m;
     }
     return i;
@@ -660,9 +1667,11 @@ int luaH_getn (Table *t) {
 
 #if defined(LUA_DEBUG)
 
+#if !defined(LUA_USE_SWISSTABLE)
 Node *luaH_mainposition (const Table *t, const TValue *key) {
   return mainposition(t, key);
 }
+#endif
 
 int luaH_isdummy (Node *n) { return isdummy(n); }
 
@@ -12,7 +12,9 @@
 
 #define gnode(t,i)	(&(t)->node[i])
 #define gval(n)		(&(n)->i_val)
+#if !defined(LUA_USE_SWISSTABLE)
 #define gnext(n)	((n)->i_key.nk.next)
+#endif
 
 
 /* 'const' to avoid wrong writings that can mess up field 'next' */ 
@@ -24,7 +26,105 @@
 */
 #define wgkey(n)		(&(n)->i_key.nk)
 
-#define invalidateTMcache(t)	((t)->flags = 0)
+/*
+** Bits 0-5 of field 'flags' cache absent tag methods (up to TM_EQ);
+** bits 6-7 keep the kind of the array part.
+*/
+#define maskflags		0x3F
+
+#define invalidateTMcache(t)	((t)->flags &= cast_byte(~maskflags))
+
+
+/*
+** Kinds of array part. An unboxed array keeps only the numbers of its
+** elements (see 'ltable.c'), so it holds no TValues that could be
+** addressed directly.
+*/
+#define ARRBOXED	0	/* array of TValues */
+#define ARREMPTY	1	/* unboxed, with no element yet */
+#define ARRINT		2	/* unboxed integers */
+#define ARRFLT		3	/* unboxed floats */
+
+/* integer marking a nil element in an unboxed array of integers */
+#define NILINT		LUA_MININTEGER
+
+#define arraykind(t)	((t)->flags >> 6)
+#define isunboxed(t)	((t)->flags > maskflags)
+
+/* number of TValues in the array part (none when it is unboxed) */
+#define sizeboxed(t)	(isunboxed(t) ? 0 : (t)->sizearray)
+
+
+/*
+** An unboxed array is preceded by a header, where 'luaH_getint' leaves
+** a copy of the element it accessed (with its index), as it cannot
+** return the address of the element itself.
+*/
+typedef union UValue {
+  lua_Integer i;
+  lua_Number n;
+} UValue;
+
+typedef struct ArrayHeader {
+  TValue v;  /* copy of the element last accessed */
+  unsigned int i;  /* its (0-based) index */
+} ArrayHeader;
+
+/* number of 'UValue's taken by the header */
+#define HEADERSIZE  \
+	((sizeof(ArrayHeader) + sizeof(UValue) - 1) / sizeof(UValue))
+
+#define uarray(t)	cast(UValue *, (t)->array)
+#define arrayheader(t)	cast(ArrayHeader *, uarray(t) - HEADERSIZE)
+
+/* is 'slot' the copy of an element of an unboxed array? */
+#define isunboxedslot(t,slot)	(isunboxed(t) && (slot) == &arrayheader(t)->v)
+
+/*
+** Store value 'v' into 'slot', the result of a previous 'luaH_get'
+** or 'luaH_getint' over table 't'
+*/
+#define luaH_setslot(L,t,slot,v) \
+  (isunboxedslot(t,slot) ? luaH_setunboxed(L,t,v) \
+                         : setobj2t(L, cast(TValue *, slot), v))
+
+
+#if defined(LUA_USE_SHAPES)
+
+/* maximum number of fields kept in a shape */
+#if !defined(LUAI_MAXSHAPE)
+#define LUAI_MAXSHAPE	16
+#endif
+
+/*
+** A shape lists the keys of the slots of its tables. Shapes form a
+** tree, rooted at the empty shape in 'global_State': the children of
+** a shape extend it with one more key. A shape lives while some table
+** or child uses it.
+*/
+typedef struct Shape {
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *child;  /* list of shapes extending this one */
+  struct Shape *sibling;  /* next in the 'child' list of the parent */
+  lu_mem refs;  /* number of tables and children using this shape */
+  lu_byte nkeys;  /* number of keys */
+  lu_byte size;  /* size of the 'slots' vector of its tables */
+  TString *keys[1];  /* keys of the slots (short strings) */
+} Shape;
+
+#define sizeshape(n)	(offsetof(Shape, keys) + sizeof(TString *) * (n))
+
+/* number of fields in the slots of table 't' */
+#define numslots(t)	((t)->shape == NULL ? 0 : (t)->shape->nkeys)
+
+/* a new table with a few fields does better with a shape */
+#define luaH_hashhint(n)	((n) <= LUAI_MAXSHAPE ? 0 : (n))
+
+#else
+
+#define luaH_hashhint(n)	(n)
+
+#endif
 
 
 /* returns the key, given the value of a table entry */
@@ -34,8 +134,11 @@
 
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
-                                                    TValue *value);
+                                                    const TValue *value);
+LUAI_FUNC void luaH_setunboxed (lua_State *L, Table *t, const TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getshortstrcached (Table *t, TString *key,
+                                                unsigned int *hint);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
@@ -44,13 +147,22 @@ LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_reservearray (lua_State *L, Table *t, lua_Unsigned n);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_nextcursor (lua_State *L, Table *t, unsigned int *cursor,
+                               StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
+#if defined(LUA_USE_SHAPES)
+LUAI_FUNC void luaH_initshapes (lua_State *L);
+LUAI_FUNC void luaH_freeshapes (lua_State *L);
+#endif
 
 
 #if defined(LUA_DEBUG)
+#if !defined(LUA_USE_SWISSTABLE)
 LUAI_FUNC Node *luaH_mainposition (const Table *t, const TValue *key);
+#endif
 LUAI_FUNC int luaH_isdummy (Node *n);
 #endif
 
@@ -166,6 +166,30 @@ static void addfield (lua_State *L, luaL_Buffer *b, lua_Integer i) {
 }
 
 
+/*
+** Create a table with room for 'narr' sequence elements and 'nhash'
+** other fields.
+*/
+static int tcreate (lua_State *L) {
+  lua_Integer narr = luaL_checkinteger(L, 1);
+  lua_Integer nhash = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr <= INT_MAX, 1, "size out of range");
+  luaL_argcheck(L, 0 <= nhash && nhash <= INT_MAX, 2, "size out of range");
+  lua_createtable(L, (int)narr, (int)nhash);
+  return 1;
+}
+
+
+/*
+** Append all values after the table to its end, as raw assignments.
+*/
+static int tappend (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_rawappend(L, 1, lua_gettop(L) - 1);
+  return 0;
+}
+
+
 static int tconcat (lua_State *L) {
   luaL_Buffer b;
   lua_Integer last = aux_getn(L, 1, TAB_R);
@@ -424,7 +448,9 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"append", tappend},
   {"concat", tconcat},
+  {"create", tcreate},
 #if defined(LUA_COMPAT_MAXN)
   {"maxn", maxn},
 #endif
@@ -93,7 +93,7 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
     const TValue *name = luaH_getshortstr(mt, luaS_new(L, "__name"));
     if (ttisstring(name))  /* is '__name' a string? */
-      return getstr(tsvalue(name));  /* use it as type name */
+      return getcstr(L, tsvalue(name));  /* use it as type name */
   }
   return ttypename(ttnov(o));  /* else use standard type name */
 }
@@ -210,6 +210,10 @@ static int docall (lua_State *L, int narg, int nres) {
 static void print_version (void) {
   lua_writestring(LUA_COPYRIGHT, strlen(LUA_COPYRIGHT));
   lua_writeline();
+#if defined(LUA_NANBOX_INT32)
+  lua_writestringerror("%s\n",
+      "warning: integers have only 32 bits in this build (LUA_NANBOX_INT32)");
+#endif
 }
 
 
@@ -110,6 +110,13 @@ typedef int (*lua_CFunction) (lua_State *L);
 typedef int (*lua_KFunction) (lua_State *L, int status, lua_KContext ctx);
 
 
+/*
+** Type for functions that release a block of memory loaded with
+** 'lua_loadmapped'
+*/
+typedef void (*lua_Unmap) (void *ud);
+
+
 /*
 ** Type for functions that read/write blocks when loading/dumping Lua chunks
 */
@@ -262,6 +269,7 @@ LUA_API void  (lua_seti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
+LUA_API void  (lua_rawappend) (lua_State *L, int idx, int n);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_setuservalue) (lua_State *L, int idx);
 
@@ -279,6 +287,9 @@ LUA_API int   (lua_pcallk) (lua_State *L, int nargs, int nresults, int errfunc,
 
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
+LUA_API int   (lua_loadmapped) (lua_State *L, const char *chunk, size_t size,
+                                const char *chunkname, const char *mode,
+                                lua_Unmap unmap, void *ud);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
@@ -308,10 +319,26 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCSETMINORMUL	12
+#define LUA_GCSETMAJORMUL	13
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** JIT-compiler control function and options
+*/
+
+#define LUA_JITOFF		0
+#define LUA_JITON		1
+#define LUA_JITISON		2
+#define LUA_JITSETHOT		3
+
+LUA_API int (lua_jit) (lua_State *L, int what, int data);
+
+
 /*
 ** miscellaneous functions
 */
@@ -319,12 +346,15 @@ LUA_API int (lua_gc) (lua_State *L, int what, int data);
 LUA_API int   (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
+LUA_API int   (lua_nextcursor) (lua_State *L, int idx, lua_Unsigned *cursor);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
 
 LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 
+LUA_API void  (lua_reservestrings) (lua_State *L, int n);
+
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
 
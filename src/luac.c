@@ -31,6 +31,8 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int aligning=0;			/* align vectors for loading in place? */
+static int optimizing=0;		/* optimize bytecodes? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -56,8 +58,10 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -a       align code for loading in place from memory mappings\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O       optimize bytecodes\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -86,6 +90,8 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-a"))			/* align vectors */
+   aligning=1;
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -95,6 +101,8 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -169,6 +177,7 @@ static int pmain(lua_State* L)
  const Proto* f;
  int i;
  if (!lua_checkstack(L,argc)) fatal("too many input files");
+ G(L)->optimize=(lu_byte)optimizing;
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
@@ -181,7 +190,7 @@ static int pmain(lua_State* L)
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
+  luaU_dump(L,f,writer,D,stripping,aligning);
   lua_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
@@ -284,6 +293,8 @@ static void PrintConstant(const Proto* f, int i)
 
 #define UPVALNAME(x) ((f->upvalues[x].name) ? getstr(f->upvalues[x].name) : "-")
 #define MYK(x)		(-1-(x))
+#define ISIMMC(o)	((o)==OP_ADDI || (o)==OP_SUBI || (o)==OP_LTI || \
+			 (o)==OP_LEI || (o)==OP_GTI || (o)==OP_GEI)
 
 static void PrintCode(const Proto* f)
 {
@@ -308,7 +319,8 @@ static void PrintCode(const Proto* f)
    case iABC:
     printf("%d",a);
     if (getBMode(o)!=OpArgN) printf(" %d",ISK(b) ? (MYK(INDEXK(b))) : b);
-    if (getCMode(o)!=OpArgN) printf(" %d",ISK(c) ? (MYK(INDEXK(c))) : c);
+    if (ISIMMC(o)) printf(" %d",sC2int(c));
+    else if (getCMode(o)!=OpArgN) printf(" %d",ISK(c) ? (MYK(INDEXK(c))) : c);
     break;
    case iABx:
     printf("%d",a);
@@ -340,11 +352,21 @@ static void PrintCode(const Proto* f)
     if (ISK(b)) { printf(" "); PrintConstant(f,INDEXK(b)); }
     if (ISK(c)) { printf(" "); PrintConstant(f,INDEXK(c)); }
     break;
+   case OP_GETUPFIELD:
+    printf("\t; %s ",UPVALNAME(b)); PrintConstant(f,INDEXK(c));
+    break;
+   case OP_SETUPFIELD:
+    printf("\t; %s ",UPVALNAME(a)); PrintConstant(f,INDEXK(b));
+    if (ISK(c)) { printf(" "); PrintConstant(f,INDEXK(c)); }
+    break;
    case OP_GETTABLE:
+   case OP_GETFIELD:
    case OP_SELF:
+   case OP_EQK:
     if (ISK(c)) { printf("\t; "); PrintConstant(f,INDEXK(c)); }
     break;
    case OP_SETTABLE:
+   case OP_SETFIELD:
    case OP_ADD:
    case OP_SUB:
    case OP_MUL:
@@ -36,6 +36,23 @@
 /* #define LUA_32BITS */
 
 
+/*
+@@ LUA_NANBOX_INT32 packs every Lua value in 8 bytes, keeping non-float
+** values inside the payload of NaNs (see 'lobject.h'), instead of the
+** usual 16-byte value-plus-tag pair. Stacks, arrays, and hash nodes
+** get about half the size. Integers must fit in the payload, so this
+** option also makes them 32-bit (with 'double' floats), as its name
+** says: programs that need 64-bit integers will break. Pointers must
+** fit in 47 bits, as user-space addresses do on x86-64. Everything
+** connected to Lua must be compiled with the same setting.
+*/
+/* #define LUA_NANBOX_INT32 */
+
+#if defined(LUA_NANBOXING)
+#error "LUA_NANBOXING is now LUA_NANBOX_INT32 (it makes integers 32-bit)"
+#endif
+
+
 /*
 @@ LUA_USE_C89 controls the use of non-ISO-C89 features.
 ** Define it if you want Lua to avoid the use of a few C99 features
@@ -126,6 +143,13 @@
 #endif
 #define LUA_FLOAT_TYPE	LUA_FLOAT_FLOAT
 
+#elif defined(LUA_NANBOX_INT32)	/* }{ */
+/*
+** 32-bit integers (to fit in a NaN payload) and 'double'
+*/
+#define LUA_INT_TYPE	LUA_INT_INT
+#define LUA_FLOAT_TYPE	LUA_FLOAT_DOUBLE
+
 #elif defined(LUA_C89_NUMBERS)	/* }{ */
 /*
 ** largest types available for C89 ('long' and 'double')
@@ -390,6 +414,16 @@
 */
 /* #define LUA_COMPAT_FLOATSTRING */
 
+
+/*
+@@ LUA_COMPAT_NUMBER2STR makes Lua convert floats to strings with
+@@ LUA_NUMBER_FMT (which may lose precision), instead of using the
+@@ shortest numeral that reads back as the same float.
+** (The shortest conversion needs C99 and IEEE doubles; otherwise Lua
+** always uses LUA_NUMBER_FMT.)
+*/
+/* #define LUA_COMPAT_NUMBER2STR */
+
 /* }================================================================== */
 
 
@@ -657,6 +691,95 @@
 #define lua_getlocaledecpoint()		(localeconv()->decimal_point[0])
 #endif
 
+
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter loop dispatch opcodes through
+** a table of label addresses ("computed goto", a GNU C extension)
+** instead of a 'switch'. By default it is on for gcc and compatible
+** compilers. Define it as 0 to force the portable 'switch'.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__) && !defined(LUA_USE_C89)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_JIT compiles in the template JIT compiler (file 'ljit.c'),
+** which translates hot Lua functions into x86-64 machine code. It needs
+** gcc (or a compatible compiler) and POSIX 'mmap'. Even when compiled in,
+** the JIT only runs after being turned on with 'lua_jit' (or 'jit.on').
+** Define it as 0 to leave it out. (The JIT does not support
+** LUA_NANBOX_INT32.)
+*/
+#if !defined(LUA_USE_JIT)
+#if defined(__x86_64__) && defined(LUA_USE_POSIX) && defined(__GNUC__) && \
+    !defined(__cplusplus) && !defined(LUA_NANBOX_INT32)
+#define LUA_USE_JIT	1
+#else
+#define LUA_USE_JIT	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_SWISSTABLE replaces the chained scatter table used for the
+** hash part of tables by an open-addressing table that keeps a control
+** byte per node and probes nodes in groups of 16, comparing a whole
+** group at once (with SSE2 when available). Lookups touch fewer cache
+** lines, which pays off mainly in large tables keyed by strings; in
+** exchange, a hash part is kept at most 7/8 full.
+*/
+/* #define LUA_USE_SWISSTABLE */
+
+
+/*
+@@ LUA_USE_SHAPES lets tables used as records share their keys. A table
+** whose hash part is empty keeps its short-string keys in a 'shape',
+** shared by all tables that got the same keys in the same order, and
+** only the values in a dense vector of slots; so, each record carries
+** no keys, and a field access through an inline cache costs one
+** comparison. A table moves its fields to a regular hash part when it
+** gets any other key or too many fields (see LUAI_MAXSHAPE in ltable.h).
+*/
+/* #define LUA_USE_SHAPES */
+
+
+/*
+@@ LUA_USE_INCRHASH makes large tables grow their hash parts
+** incrementally. Instead of moving all its entries at once, a table
+** keeps its old hash part alongside the new one and each new key moves
+** a few more entries, so that no single insertion pays for a whole
+** resize; meanwhile, lookups that miss the new part also search the
+** old one. Only hash parts with at least 2^LUAI_INCRHBITS nodes (see
+** ltable.c) grow this way.
+*/
+/* #define LUA_USE_INCRHASH */
+
+
+/*
+@@ LUA_USE_WYHASH replaces the hash function for strings by one in the
+** style of wyhash: it reads strings a word (8 bytes) at a time, mixing
+** words through 64x64->128-bit products, and hashes long strings whole
+** instead of sampling them. Short strings hash faster and long ones
+** collide much less. (It needs a 64-bit 'unsigned long long'.)
+*/
+/* #define LUA_USE_WYHASH */
+
+
+/*
+@@ LUA_USE_STRBUILDER makes repeated appends to a long string cheap.
+** The result of a concatenation whose first operand is a long string
+** keeps its bytes in a buffer with room to spare, shared with later
+** results that extend it in place; so, a loop like 's = s .. x' takes
+** linear instead of quadratic time. (An older string in a buffer gets
+** a copy of its own if it ever goes to C through 'lua_tolstring'.)
+*/
+/* #define LUA_USE_STRBUILDER */
+
 /* }================================================================== */
 
 
@@ -738,6 +861,16 @@
 #define LUAL_BUFFERSIZE   ((int)(0x80 * sizeof(void*) * sizeof(lua_Integer)))
 #endif
 
+
+/*
+@@ LUAL_POOLMAXBLOCK is the largest block served from the pools of
+** states created by 'luaL_newstate_pooled'; larger blocks go to
+** 'realloc'. It must be a multiple of LUAL_POOLGRAIN (16 by default).
+*/
+#if !defined(LUAL_POOLMAXBLOCK)
+#define LUAL_POOLMAXBLOCK	256
+#endif
+
 /* }================================================================== */
 
 
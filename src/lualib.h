@@ -44,6 +44,15 @@ LUAMOD_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUAMOD_API int (luaopen_package) (lua_State *L);
 
+#define LUA_PROFLIBNAME	"profile"
+LUAMOD_API int (luaopen_profile) (lua_State *L);
+
+#define LUA_WORKLIBNAME	"workers"
+LUAMOD_API int (luaopen_workers) (lua_State *L);
+
+#define LUA_JITLIBNAME	"jit"
+LUAMOD_API int (luaopen_jit) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
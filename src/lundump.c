@@ -33,6 +33,8 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  size_t offset;  /* bytes read so far (from the signature) */
+  int aligned;  /* true if vectors are padded (LUAC_FORMATALIGNED) */
 } LoadState;
 
 
@@ -51,6 +53,47 @@ static l_noret error(LoadState *S, const char *why) {
 static void LoadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated");
+  S->offset += size;
+}
+
+
+/*
+** Skip the padding before a vector of elements of size 'align'
+*/
+static void LoadAlign (LoadState *S, size_t align) {
+  if (S->aligned) {
+    char pad[16];
+    size_t n = (align - S->offset % align) % align;
+    lua_assert(align <= sizeof(pad));
+    LoadBlock(S, pad, n);
+  }
+}
+
+
+/*
+** Try to use in place the next 'size' bytes of the input, which is
+** possible only when the input is a block that outlives the load (see
+** 'lua_loadmapped'), the bytes are all in the buffer and they are
+** suitably aligned. In that case, the prototype 'f' keeps a reference
+** to the block. Returns NULL if the bytes must be copied.
+*/
+static void *LoadDirect (LoadState *S, Proto *f, size_t size, size_t align) {
+  ZIO *z = S->Z;
+  void *b;
+  if (z->unmap == NULL || size == 0 || z->n < size ||
+      point2uint(z->p) % align != 0)
+    return NULL;
+  if (z->map == NULL)  /* first use of the block? */
+    z->map = luaF_newmapping(S->L, z->unmap, z->ud);
+  if (f->map == NULL) {
+    f->map = z->map;
+    f->map->refs++;
+  }
+  b = cast(void *, z->p);
+  z->p += size;
+  z->n -= size;
+  S->offset += size;
+  return b;
 }
 
 
@@ -106,9 +149,19 @@ static TString *LoadString (LoadState *S) {
 
 static void LoadCode (LoadState *S, Proto *f) {
   int n = LoadInt(S);
-  f->code = luaM_newvector(S->L, n, Instruction);
-  f->sizecode = n;
-  LoadVector(S, f->code, n);
+  LoadAlign(S, sizeof(Instruction));
+  f->code = cast(Instruction *,
+                 LoadDirect(S, f, n * sizeof(Instruction), sizeof(Instruction)));
+  if (f->code != NULL) {
+    f->mapped |= MAPCODE;
+    f->sizecode = n;
+  }
+  else {
+    f->code = luaM_newvector(S->L, n, Instruction);
+    f->sizecode = n;
+    LoadVector(S, f->code, n);
+  }
+  luaF_newicache(S->L, f);
 }
 
 
@@ -180,9 +233,17 @@ static void LoadUpvalues (LoadState *S, Proto *f) {
 static void LoadDebug (LoadState *S, Proto *f) {
   int i, n;
   n = LoadInt(S);
-  f->lineinfo = luaM_newvector(S->L, n, int);
-  f->sizelineinfo = n;
-  LoadVector(S, f->lineinfo, n);
+  LoadAlign(S, sizeof(int));
+  f->lineinfo = cast(int *, LoadDirect(S, f, n * sizeof(int), sizeof(int)));
+  if (f->lineinfo != NULL) {
+    f->mapped |= MAPLINEINFO;
+    f->sizelineinfo = n;
+  }
+  else {
+    f->lineinfo = luaM_newvector(S->L, n, int);
+    f->sizelineinfo = n;
+    LoadVector(S, f->lineinfo, n);
+  }
   n = LoadInt(S);
   f->locvars = luaM_newvector(S->L, n, LocVar);
   f->sizelocvars = n;
@@ -234,11 +295,14 @@ static void fchecksize (LoadState *S, size_t size, const char *tname) {
 #define checksize(S,t)	fchecksize(S,sizeof(t),#t)
 
 static void checkHeader (LoadState *S) {
+  int format;
   checkliteral(S, LUA_SIGNATURE + 1, "not a");  /* 1st char already checked */
   if (LoadByte(S) != LUAC_VERSION)
     error(S, "version mismatch in");
-  if (LoadByte(S) != LUAC_FORMAT)
+  format = LoadByte(S);
+  if ((format & ~(LUAC_FORMATALIGNED | LUAC_FORMATEXT)) != 0)
     error(S, "format mismatch in");
+  S->aligned = (format & LUAC_FORMATALIGNED);
   checkliteral(S, LUAC_DATA, "corrupted");
   checksize(S, int);
   checksize(S, size_t);
@@ -266,6 +330,7 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.offset = 1;  /* 1st char of the signature already read */
   checkHeader(&S);
   cl = luaF_newLclosure(L, LoadByte(&S));
   setclLvalue(L, L->top, cl);
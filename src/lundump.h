@@ -20,13 +20,27 @@
 
 #define MYINT(s)	(s[0]-'0')
 #define LUAC_VERSION	(MYINT(LUA_VERSION_MAJOR)*16+MYINT(LUA_VERSION_MINOR))
-#define LUAC_FORMAT	0	/* this is the official format */
+/*
+** The format byte is a set of flags; 0 is the official format. With
+** LUAC_FORMATALIGNED, the code and line-information vectors are padded
+** to start at offsets (from the signature) aligned to their element
+** sizes, so that a chunk in an aligned block can use them in place (see
+** 'lua_loadmapped'); 'luac -a' writes it. LUAC_FORMATEXT marks code for
+** the extended instruction set (opcodes after OP_EXTRAARG), which other
+** Lua 5.3 implementations cannot run; their loaders accept only format
+** 0, so they reject such chunks instead of misbehaving. The dumper sets
+** it unless it finds only official opcodes in the chunk. The loader
+** accepts any combination of these flags.
+*/
+#define LUAC_FORMAT	0
+#define LUAC_FORMATALIGNED	1
+#define LUAC_FORMATEXT	2
 
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
-                         void* data, int strip);
+                         void* data, int strip, int aligned);
 
 #endif
@@ -22,6 +22,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -65,6 +66,32 @@
 
 
 
+#if defined(LUA_USE_STRBUILDER)
+
+/*
+** Convert string value 'obj' to a number in 'v'. The bytes of a builder
+** string may be followed by others in its buffer, so the conversion puts
+** a '\0' after them for a while.
+*/
+static int l_strton (const TValue *obj, TValue *v) {
+  TString *ts = tsvalue(obj);
+  char *s = getstr(ts);
+  size_t l = tsslen(ts);
+  char c = s[l];
+  int res;
+  s[l] = '\0';
+  res = (luaO_str2num(s, v) == l + 1);
+  s[l] = c;
+  return res;
+}
+
+#else
+
+#define l_strton(obj,v)	(luaO_str2num(svalue(obj), v) == vslen(obj) + 1)
+
+#endif
+
+
 /*
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
@@ -76,7 +103,7 @@ int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
     return 1;
   }
   else if (cvt2num(obj) &&  /* string convertible to number? */
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+            l_strton(obj, &v)) {
     *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
     return 1;
   }
@@ -108,8 +135,7 @@ int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
     *p = ivalue(obj);
     return 1;
   }
-  else if (cvt2num(obj) &&
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+  else if (cvt2num(obj) && l_strton(obj, &v)) {
     obj = &v;
     goto again;  /* convert result from 'luaO_str2num' to an integer */
   }
@@ -152,6 +178,39 @@ static int forlimit (const TValue *obj, lua_Integer *p, lua_Integer step,
 }
 
 
+/*
+** Prepare a numeric for loop (OP_FORPREP) with control variables
+** starting at 'ra': convert them all to integers or all to floats and
+** pre-decrement the initial value.
+*/
+void luaV_forprep (lua_State *L, StkId ra) {
+  TValue *init = ra;
+  TValue *plimit = ra + 1;
+  TValue *pstep = ra + 2;
+  lua_Integer ilimit;
+  int stopnow;
+  if (ttisinteger(init) && ttisinteger(pstep) &&
+      forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
+    /* all values are integer */
+    lua_Integer initv = (stopnow ? 0 : ivalue(init));
+    setivalue(plimit, ilimit);
+    setivalue(init, intop(-, initv, ivalue(pstep)));
+  }
+  else {  /* try making all values floats */
+    lua_Number ninit; lua_Number nlimit; lua_Number nstep;
+    if (!tonumber(plimit, &nlimit))
+      luaG_runerror(L, "'for' limit must be a number");
+    setfltvalue(plimit, nlimit);
+    if (!tonumber(pstep, &nstep))
+      luaG_runerror(L, "'for' step must be a number");
+    setfltvalue(pstep, nstep);
+    if (!tonumber(init, &ninit))
+      luaG_runerror(L, "'for' initial value must be a number");
+    setfltvalue(init, luai_numsub(L, ninit, nstep));
+  }
+}
+
+
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
@@ -213,7 +272,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
         if (slot == luaO_nilobject)  /* no previous entry? */
           slot = luaH_newkey(L, h, key);  /* create one */
         /* no metamethod and (now) there is an entry with given key */
-        setobj2t(L, cast(TValue *, slot), val);  /* set its new value */
+        luaH_setslot(L, h, slot, val);  /* set its new value */
         invalidateTMcache(h);
         luaC_barrierback(L, h, val);
         return;
@@ -245,10 +304,10 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** and it uses 'strcoll' (to respect locales) for each segments
 ** of the strings.
 */
-static int l_strcmp (const TString *ls, const TString *rs) {
-  const char *l = getstr(ls);
+static int l_strcmp (lua_State *L, TString *ls, TString *rs) {
+  const char *l = getcstr(L, ls);
   size_t ll = tsslen(ls);
-  const char *r = getstr(rs);
+  const char *r = getcstr(L, rs);
   size_t lr = tsslen(rs);
   for (;;) {  /* for each segment */
     int temp = strcoll(l, r);
@@ -366,7 +425,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LTnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LT)) < 0)  /* no metamethod? */
     luaG_ordererror(L, l, r);  /* error */
   return res;
@@ -386,7 +445,7 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LEnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LE)) >= 0)  /* try 'le' */
     return res;
   else {  /* try 'lt': */
@@ -499,6 +558,13 @@ void luaV_concat (lua_State *L, int total) {
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = luaS_newlstr(L, buff, tl);
       }
+#if defined(LUA_USE_STRBUILDER)
+      else if (ttislngstring(top - n)) {  /* appending to a long string? */
+        size_t l = vslen(top - n);
+        ts = luaS_extend(L, tsvalue(top - n), tl);
+        copy2buff(top, n - 1, getstr(ts) + l);  /* copy the other strings */
+      }
+#endif
       else {  /* long string; copy strings directly to final result */
         ts = luaS_createlngstrobj(L, tl);
         copy2buff(top, n, getstr(ts));
@@ -645,11 +711,27 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
     ncl->upvals[i]->refcount++;
     /* new closure is white, so we do not need a barrier here */
   }
-  if (!isblack(p))  /* cache will not break GC invariant? */
+  /* cache will not break GC invariant? (In generational mode, an old
+     prototype could keep a young closure alive without a barrier.) */
+  if (!isblack(p) && G(L)->gckind == KGC_INC)
     p->cache = ncl;  /* save it on cache for reuse */
 }
 
 
+/*
+** put in 'ra' a closure of prototype 'p' (OP_CLOSURE), reusing the
+** cached one when possible
+*/
+void luaV_closure (lua_State *L, Proto *p, UpVal **encup, StkId base,
+                   StkId ra) {
+  LClosure *ncl = getcached(p, encup, base);  /* cached closure */
+  if (ncl == NULL)  /* no match? */
+    pushclosure(L, p, encup, base, ra);  /* create a new one */
+  else
+    setclLvalue(L, ra, ncl);  /* push cashed closure */
+}
+
+
 /*
 ** finish execution of an opcode interrupted by an yield
 */
@@ -663,15 +745,17 @@ void luaV_finishOp (lua_State *L) {
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
     case OP_MOD: case OP_POW:
     case OP_UNM: case OP_BNOT: case OP_LEN:
-    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF: {
+    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF:
+    case OP_GETFIELD: case OP_GETUPFIELD: case OP_ADDI: case OP_SUBI: {
       setobjs2s(L, base + GETARG_A(inst), --L->top);
       break;
     }
-    case OP_LE: case OP_LT: case OP_EQ: {
+    case OP_LE: case OP_LT: case OP_EQ:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
       int res = !l_isfalse(L->top - 1);
       L->top--;
       if (ci->callstatus & CIST_LEQ) {  /* "<=" using "<" instead? */
-        lua_assert(op == OP_LE);
+        lua_assert(op == OP_LE || op == OP_LEI || op == OP_GEI);
         ci->callstatus ^= CIST_LEQ;  /* clear mark */
         res = !res;  /* negate result */
       }
@@ -705,6 +789,7 @@ void luaV_finishOp (lua_State *L) {
       break;
     }
     case OP_TAILCALL: case OP_SETTABUP: case OP_SETTABLE:
+    case OP_SETFIELD: case OP_SETUPFIELD:
       break;
     default: lua_assert(0);
   }
@@ -732,6 +817,8 @@ void luaV_finishOp (lua_State *L) {
 	ISK(GETARG_B(i)) ? k+INDEXK(GETARG_B(i)) : base+GETARG_B(i))
 #define RKC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgK, \
 	ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
+#define KB(i)	check_exp(ISK(GETARG_B(i)), k+INDEXK(GETARG_B(i)))
+#define KC(i)	check_exp(ISK(GETARG_C(i)), k+INDEXK(GETARG_C(i)))
 
 
 /* execute a jump instruction */
@@ -762,6 +849,12 @@ void luaV_finishOp (lua_State *L) {
   lua_assert(base <= L->top && L->top < L->stack + L->stacksize); \
 }
 
+/*
+** Default dispatch of the main loop: a plain 'switch'. When
+** LUA_USE_JUMPTABLE is on, 'luaV_execute' includes "ljumptab.h", which
+** redefines these macros to jump directly through a table of label
+** addresses, giving each opcode its own indirect branch.
+*/
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
@@ -782,18 +875,174 @@ void luaV_finishOp (lua_State *L) {
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
+/*
+** Fast track for OP_GETTABLE with an integer key 'k' inside the array
+** part of table 'h': read the element in place (unboxed arrays would
+** otherwise go through the copy in their header). Return true if 'v'
+** got a non-nil result.
+*/
+static int arrayget (lua_State *L, Table *h, lua_Integer k, StkId v) {
+  lua_Unsigned i = l_castS2U(k) - 1;
+  if (i >= h->sizearray)
+    return 0;
+  switch (arraykind(h)) {
+    case ARRBOXED: {
+      if (ttisnil(&h->array[i])) return 0;
+      setobj2s(L, v, &h->array[i]);
+      return 1;
+    }
+    case ARRINT: {
+      if (uarray(h)[i].i == NILINT) return 0;
+      setivalue(v, uarray(h)[i].i);
+      return 1;
+    }
+    case ARRFLT: {
+      if (luai_numisnan(uarray(h)[i].n)) return 0;
+      setfltvalue(v, uarray(h)[i].n);
+      return 1;
+    }
+    default: return 0;  /* empty array */
+  }
+}
+
+
+/*
+** Same for OP_SETTABLE: replace a non-nil element by value 'v' in place,
+** when that keeps the array kind. Return true if done.
+*/
+static int arrayset (lua_State *L, Table *h, lua_Integer k,
+                     const TValue *v) {
+  lua_Unsigned i = l_castS2U(k) - 1;
+  if (i >= h->sizearray)
+    return 0;
+  switch (arraykind(h)) {
+    case ARRBOXED: {
+      if (ttisnil(&h->array[i])) return 0;
+      luaC_barrierback(L, h, v);
+      setobj2t(L, &h->array[i], v);
+      return 1;
+    }
+    case ARRINT: {
+      if (!ttisinteger(v) || ivalue(v) == NILINT ||
+          uarray(h)[i].i == NILINT) return 0;
+      uarray(h)[i].i = ivalue(v);  /* numbers need no barrier */
+      return 1;
+    }
+    case ARRFLT: {
+      if (!ttisfloat(v) || luai_numisnan(fltvalue(v)) ||
+          luai_numisnan(uarray(h)[i].n)) return 0;
+      uarray(h)[i].n = fltvalue(v);
+      return 1;
+    }
+    default: return 0;  /* empty array */
+  }
+}
+
+
+#define fastarrayget(L,t,k,v) \
+  (ttistable(t) && ttisinteger(k) && arrayget(L, hvalue(t), ivalue(k), v))
+
+#define fastarrayset(L,t,k,v) \
+  (ttistable(t) && ttisinteger(k) && arrayset(L, hvalue(t), ivalue(k), v))
+
+
+/* inline cache of the running instruction (see 'luaF_newicache') */
+#define icache(ci,cl)	check_exp(cl->p->icache != NULL, \
+	cl->p->icache + (ci->u.l.savedpc - cl->p->code - 1))
+
+/* raw access to a short-string key through the inline cache */
+#define getshrcached(h,key)	luaH_getshortstrcached(h, key, icache(ci, cl))
+
+
+/* variants for keys known to be short strings (see OP_GETFIELD etc.) */
+#define getfieldProtected(L,t,k,v)  { const TValue *slot; \
+  if (luaV_fastget(L,t,tsvalue(k),slot,getshrcached)) \
+    { setobj2s(L, v, slot); } \
+  else Protect(luaV_finishget(L,t,k,v,slot)); }
+
+#define setfieldProtected(L,t,k,v) { const TValue *slot; \
+  if (!luaV_fastset(L,t,tsvalue(k),slot,getshrcached,v)) \
+    Protect(luaV_finishset(L,t,k,v,slot)); }
+
+
+/*
+** arithmetic with an immediate integer operand 'sC' (OP_ADDI/OP_SUBI)
+*/
+#define op_arithI(L,op,fop,tm) {  \
+  TValue *rb = RB(i);  \
+  int ic = sC2int(GETARG_C(i));  \
+  lua_Number nb;  \
+  if (ttisinteger(rb)) {  \
+    setivalue(ra, intop(op, ivalue(rb), ic));  \
+  }  \
+  else if (tonumber(rb, &nb)) {  \
+    setfltvalue(ra, fop(L, nb, cast_num(ic)));  \
+  }  \
+  else {  \
+    TValue vc; setivalue(&vc, ic);  \
+    Protect(luaT_trybinTM(L, rb, &vc, ra, tm));  \
+  } }
+
+
+/*
+** order comparison between a register and an immediate integer 'sC'.
+** 'inv' tells that the immediate was the left operand in the source
+** code, so that the generic comparison 'f' must receive it first.
+*/
+#define op_orderI(L,op,inv,f) {  \
+  TValue *rb = RB(i);  \
+  int ic = sC2int(GETARG_C(i));  \
+  int res;  \
+  if (ttisinteger(rb)) res = (ivalue(rb) op ic);  \
+  else if (ttisfloat(rb)) res = (fltvalue(rb) op cast_num(ic));  \
+  else {  \
+    TValue vc; setivalue(&vc, ic);  \
+    Protect(res = (inv) ? f(L, &vc, rb) : f(L, rb, &vc));  \
+  }  \
+  if (res != GETARG_A(i))  \
+    ci->u.l.savedpc++;  \
+  else  \
+    donextjump(ci); }
+
+
+
+/*
+** Count a hot event (call, return, or loop back edge) of the running
+** function; when the count runs out, hand execution to the JIT
+** compiler, which may run native code and change (or return from)
+** the running frame.
+*/
+#if LUA_USE_JIT
+#define jithot(ci,cl)  \
+  { if (--cl->p->hotcount <= 0) {  \
+      int st_ = luaJ_hot(L, ci);  \
+      if (st_ != JIT_CONTINUE) {  /* 'ci' may be gone */  \
+        if (st_ == JIT_RETURN) return;  /* fresh frame returned */  \
+        ci = L->ci;  \
+        goto newframe;  \
+      }  \
+      base = ci->u.l.base;  \
+    } }
+#else
+#define jithot(ci,cl)	((void)0)
+#endif
+
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
+  jithot(ci, cl);
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
@@ -842,7 +1091,8 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_GETTABLE) {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        if (!fastarrayget(L, rb, rc, ra))
+          gettableProtected(L, rb, rc, ra);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -861,7 +1111,8 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_SETTABLE) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        settableProtected(L, ra, rb, rc);
+        if (!fastarrayset(L, ra, rb, rc))
+          settableProtected(L, ra, rb, rc);
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -870,7 +1121,7 @@ void luaV_execute (lua_State *L) {
         Table *t = luaH_new(L);
         sethvalue(L, ra, t);
         if (b != 0 || c != 0)
-          luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));
+          luaH_resize(L, t, luaO_fb2int(b), luaH_hashhint(luaO_fb2int(c)));
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -880,10 +1131,26 @@ void luaV_execute (lua_State *L) {
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+        if (!ttisshrstring(rc)) {  /* no cache for long names */
+          if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+            setobj2s(L, ra, aux);
+          }
+          else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        }
+        else if (luaV_fastget(L, rb, key, aux, getshrcached)) {
           setobj2s(L, ra, aux);
         }
-        else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        else {
+          /* methods usually live in a table that is the '__index' of
+             the object's metatable; the cache also serves that lookup */
+          const TValue *tm = (aux == NULL) ? NULL
+                           : fasttm(L, hvalue(rb)->metatable, TM_INDEX);
+          const TValue *mslot;
+          if (tm != NULL && luaV_fastget(L, tm, key, mslot, getshrcached)) {
+            setobj2s(L, ra, mslot);
+          }
+          else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        }
         vmbreak;
       }
       vmcase(OP_ADD) {
@@ -1079,6 +1346,8 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sBx(i) < 0)  /* loop back edge? */
+          jithot(ci, cl);
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1196,6 +1465,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            jithot(ci, cl);
           }
         }
         else {  /* floating loop */
@@ -1207,35 +1477,13 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            jithot(ci, cl);
           }
         }
         vmbreak;
       }
       vmcase(OP_FORPREP) {
-        TValue *init = ra;
-        TValue *plimit = ra + 1;
-        TValue *pstep = ra + 2;
-        lua_Integer ilimit;
-        int stopnow;
-        if (ttisinteger(init) && ttisinteger(pstep) &&
-            forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
-          /* all values are integer */
-          lua_Integer initv = (stopnow ? 0 : ivalue(init));
-          setivalue(plimit, ilimit);
-          setivalue(init, intop(-, initv, ivalue(pstep)));
-        }
-        else {  /* try making all values floats */
-          lua_Number ninit; lua_Number nlimit; lua_Number nstep;
-          if (!tonumber(plimit, &nlimit))
-            luaG_runerror(L, "'for' limit must be a number");
-          setfltvalue(plimit, nlimit);
-          if (!tonumber(pstep, &nstep))
-            luaG_runerror(L, "'for' step must be a number");
-          setfltvalue(pstep, nstep);
-          if (!tonumber(init, &ninit))
-            luaG_runerror(L, "'for' initial value must be a number");
-          setfltvalue(init, luai_numsub(L, ninit, nstep));
-        }
+        luaV_forprep(L, ra);
         ci->u.l.savedpc += GETARG_sBx(i);
         vmbreak;
       }
@@ -1257,6 +1505,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+          jithot(ci, cl);
         }
         vmbreak;
       }
@@ -1283,12 +1532,7 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CLOSURE) {
-        Proto *p = cl->p->p[GETARG_Bx(i)];
-        LClosure *ncl = getcached(p, cl->upvals, base);  /* cached closure */
-        if (ncl == NULL)  /* no match? */
-          pushclosure(L, p, cl->upvals, base, ra);  /* create a new one */
-        else
-          setclLvalue(L, ra, ncl);  /* push cashed closure */
+        luaV_closure(L, cl->p->p[GETARG_Bx(i)], cl->upvals, base, ra);
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -1314,6 +1558,71 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_GETFIELD) {
+        StkId rb = RB(i);
+        TValue *rc = KC(i);
+        getfieldProtected(L, rb, rc, ra);
+        vmbreak;
+      }
+      vmcase(OP_GETUPFIELD) {
+        TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        TValue *rc = KC(i);
+        getfieldProtected(L, upval, rc, ra);
+        vmbreak;
+      }
+      vmcase(OP_SETFIELD) {
+        TValue *rb = KB(i);
+        TValue *rc = RKC(i);
+        setfieldProtected(L, ra, rb, rc);
+        vmbreak;
+      }
+      vmcase(OP_SETUPFIELD) {
+        TValue *upval = cl->upvals[GETARG_A(i)]->v;
+        TValue *rb = KB(i);
+        TValue *rc = RKC(i);
+        setfieldProtected(L, upval, rb, rc);
+        vmbreak;
+      }
+      vmcase(OP_ADDI) {
+        op_arithI(L, +, luai_numadd, TM_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBI) {
+        op_arithI(L, -, luai_numsub, TM_SUB);
+        vmbreak;
+      }
+      vmcase(OP_EQK) {
+        TValue *rb = RB(i);
+        TValue *rc = KC(i);
+        int res;
+        if (ttisshrstring(rc))  /* short strings are internalized */
+          res = ttisshrstring(rb) && eqshrstr(tsvalue(rb), tsvalue(rc));
+        else if (ttisinteger(rc) && ttisinteger(rb))
+          res = (ivalue(rb) == ivalue(rc));
+        else  /* a constant has no '__eq' metamethod; no need to 'Protect' */
+          res = luaV_rawequalobj(rb, rc);
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_LTI) {
+        op_orderI(L, <, 0, luaV_lessthan);
+        vmbreak;
+      }
+      vmcase(OP_LEI) {
+        op_orderI(L, <=, 0, luaV_lessequal);
+        vmbreak;
+      }
+      vmcase(OP_GTI) {
+        op_orderI(L, >, 1, luaV_lessthan);
+        vmbreak;
+      }
+      vmcase(OP_GEI) {
+        op_orderI(L, >=, 1, luaV_lessequal);
+        vmbreak;
+      }
     }
   }
 }
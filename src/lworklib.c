@@ -0,0 +1,1152 @@
+/*
+** $Id: lworklib.c $
+** Worker states on system threads, connected by channels
+** See Copyright Notice in lua.h
+*/
+
+#define lworklib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A worker is an independent Lua state, created by
+** 'luaL_newstate_pooled', that runs a chunk on its own system thread.
+** Workers share nothing; they exchange values only through channels.
+** A channel is a bounded multi-producer/multi-consumer queue of
+** messages. It is lock free: the queue follows D. Vyukov's design,
+** with a sequence number in each cell. Channels are reference counted
+** C objects, so the same channel can be held by several states.
+**
+** A message is a serialized copy of a list of Lua values. It can hold
+** nil, booleans, numbers, strings, channels, and tables (without
+** metatables) of such values. Shared subtables and cycles are kept.
+*/
+
+
+#if !defined(LUA_WORKCHANNELSIZE)
+#define LUA_WORKCHANNELSIZE	1024	/* default capacity of a channel */
+#endif
+
+/* maximum nesting of tables in a message */
+#if !defined(LUA_WORKMAXDEPTH)
+#define LUA_WORKMAXDEPTH	200
+#endif
+
+
+#define CHANNELTYPE	"workers.channel"
+#define WORKERTYPE	"workers.worker"
+#define POOLTYPE	"workers.pool"
+
+
+/*
+** {======================================================
+** Atomic operations
+** =======================================================
+*/
+
+#if !defined(l_atomicload)	/* { */
+
+#if defined(LUA_USE_POSIX) && defined(__GNUC__)	/* { */
+
+#define l_atomicload(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define l_atomicstore(p,v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define l_atomiccas(p,e,v)  \
+	__atomic_compare_exchange_n(p, e, v, 1, __ATOMIC_RELAXED, \
+	                            __ATOMIC_RELAXED)
+#define l_atomicinc(p)		__atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#define l_atomicdec(p)		__atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+
+#endif				/* } */
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
+#if defined(l_atomicload)	/* { */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+
+typedef struct Channel Channel;
+
+
+/*
+** {======================================================
+** Messages
+** =======================================================
+*/
+
+/* value tags in messages */
+#define MT_NIL		0
+#define MT_FALSE	1
+#define MT_TRUE		2
+#define MT_INT		3
+#define MT_FLT		4
+#define MT_STR		5
+#define MT_TABLE	6	/* followed by sizes, pairs, and MT_END */
+#define MT_END		7
+#define MT_REF		8	/* table already in the message */
+#define MT_CHANNEL	9
+
+
+typedef struct Message {
+  size_t size;  /* size of 'data' */
+  size_t nchan;  /* number of channels in the message */
+  Channel **chans;  /* channels (the message holds a reference to each) */
+  char *data;  /* encoded values */
+} Message;
+
+
+static void releasechannel (Channel *ch);
+
+
+static void freemsg (Message *m) {
+  size_t i;
+  for (i = 0; i < m->nchan; i++)
+    releasechannel(m->chans[i]);
+  free(m);
+}
+
+
+/*
+** Growable buffer, kept as a userdata at stack index 'idx' so that it
+** is collected if encoding raises an error.
+*/
+typedef struct Buf {
+  char *b;
+  size_t n;
+  size_t size;
+  int idx;
+} Buf;
+
+
+static void bufinit (lua_State *L, Buf *B) {
+  B->size = 128;
+  B->n = 0;
+  B->b = (char *)lua_newuserdata(L, B->size);
+  B->idx = lua_gettop(L);
+}
+
+
+static char *bufprep (lua_State *L, Buf *B, size_t sz) {
+  if (B->size - B->n < sz) {
+    char *newb;
+    size_t newsize = B->size * 2;
+    if (newsize - B->n < sz)
+      newsize = B->n + sz;
+    newb = (char *)lua_newuserdata(L, newsize);
+    memcpy(newb, B->b, B->n);
+    lua_replace(L, B->idx);
+    B->b = newb;
+    B->size = newsize;
+  }
+  return B->b + B->n;
+}
+
+
+static void bufadd (lua_State *L, Buf *B, const void *p, size_t sz) {
+  memcpy(bufprep(L, B, sz), p, sz);
+  B->n += sz;
+}
+
+
+static void bufaddtag (lua_State *L, Buf *B, int tag) {
+  char c = (char)tag;
+  bufadd(L, B, &c, 1);
+}
+
+
+typedef struct EncState {
+  lua_State *L;
+  Buf data;  /* encoded values */
+  Buf chans;  /* channels referred by the message */
+  int seen;  /* stack index of table: table -> position in message */
+  lua_Integer ntables;  /* number of tables already encoded */
+} EncState;
+
+
+static Channel *tochannel (lua_State *L, int idx);
+
+static void encode (EncState *E, int idx, int depth);
+
+
+static void encodetable (EncState *E, int idx, int depth) {
+  lua_State *L = E->L;
+  size_t sizes[2] = {0, 0};  /* array items and other items */
+  size_t pos;
+  lua_Integer n = 0;
+  if (lua_getmetatable(L, idx))
+    luaL_error(L, "cannot send a table with a metatable");
+  lua_pushvalue(L, idx);
+  if (lua_rawget(L, E->seen) != LUA_TNIL) {  /* table already sent? */
+    lua_Integer ref = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    bufaddtag(L, &E->data, MT_REF);
+    bufadd(L, &E->data, &ref, sizeof(ref));
+    return;
+  }
+  lua_pop(L, 1);
+  lua_pushvalue(L, idx);
+  lua_pushinteger(L, ++E->ntables);
+  lua_rawset(L, E->seen);
+  if (depth > LUA_WORKMAXDEPTH)
+    luaL_error(L, "tables nested too deeply in message");
+  bufaddtag(L, &E->data, MT_TABLE);
+  pos = E->data.n;
+  bufadd(L, &E->data, sizes, sizeof(sizes));  /* corrected below */
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    lua_Integer k;
+    int top = lua_gettop(L);
+    if (lua_isinteger(L, -2) && (k = lua_tointeger(L, -2)) == n + 1) {
+      n = k;  /* still in sequence */
+      sizes[0]++;
+    }
+    else sizes[1]++;
+    encode(E, top - 1, depth + 1);
+    encode(E, top, depth + 1);
+    lua_pop(L, 1);
+  }
+  bufaddtag(L, &E->data, MT_END);
+  memcpy(E->data.b + pos, sizes, sizeof(sizes));
+}
+
+
+static void encode (EncState *E, int idx, int depth) {
+  lua_State *L = E->L;
+  Buf *B = &E->data;
+  luaL_checkstack(L, 4, "message too complex");
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL: bufaddtag(L, B, MT_NIL); break;
+    case LUA_TBOOLEAN:
+      bufaddtag(L, B, lua_toboolean(L, idx) ? MT_TRUE : MT_FALSE);
+      break;
+    case LUA_TNUMBER: {
+      if (lua_isinteger(L, idx)) {
+        lua_Integer i = lua_tointeger(L, idx);
+        bufaddtag(L, B, MT_INT);
+        bufadd(L, B, &i, sizeof(i));
+      }
+      else {
+        lua_Number n = lua_tonumber(L, idx);
+        bufaddtag(L, B, MT_FLT);
+        bufadd(L, B, &n, sizeof(n));
+      }
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, idx, &l);
+      bufaddtag(L, B, MT_STR);
+      bufadd(L, B, &l, sizeof(l));
+      bufadd(L, B, s, l);
+      break;
+    }
+    case LUA_TTABLE:
+      encodetable(E, idx, depth);
+      break;
+    default: {
+      Channel *ch = tochannel(L, idx);
+      size_t i = E->chans.n / sizeof(Channel *);
+      if (ch == NULL)
+        luaL_error(L, "cannot send a %s value", luaL_typename(L, idx));
+      bufadd(L, &E->chans, &ch, sizeof(ch));
+      bufaddtag(L, B, MT_CHANNEL);
+      bufadd(L, B, &i, sizeof(i));
+      break;
+    }
+  }
+}
+
+
+static void acquirechannel (Channel *ch);
+
+
+/*
+** Encode the values from stack index 'first' to the top into a new
+** message. Errors in encoding are raised as Lua errors.
+*/
+static Message *newmessage (lua_State *L, int first) {
+  EncState E;
+  Message *m;
+  Channel **chans;
+  int top = lua_gettop(L);
+  int i;
+  size_t nchan;
+  E.L = L;
+  lua_newtable(L);
+  E.seen = lua_gettop(L);
+  E.ntables = 0;
+  bufinit(L, &E.data);
+  bufinit(L, &E.chans);
+  for (i = first; i <= top; i++)
+    encode(&E, i, 0);
+  nchan = E.chans.n / sizeof(Channel *);
+  m = (Message *)malloc(sizeof(Message) + E.chans.n + E.data.n);
+  if (m == NULL)
+    luaL_error(L, "not enough memory");
+  m->size = E.data.n;
+  m->nchan = nchan;
+  m->chans = (Channel **)(m + 1);
+  m->data = (char *)(m->chans + nchan);
+  memcpy(m->chans, E.chans.b, E.chans.n);
+  memcpy(m->data, E.data.b, E.data.n);
+  chans = m->chans;
+  for (i = 0; (size_t)i < nchan; i++)
+    acquirechannel(chans[i]);
+  lua_settop(L, top);
+  return m;
+}
+
+
+/* build a message with one string without using any Lua state */
+static Message *newstrmessage (const char *s, size_t l) {
+  Message *m = (Message *)malloc(sizeof(Message) + 1 + sizeof(l) + l);
+  if (m != NULL) {
+    m->size = 1 + sizeof(l) + l;
+    m->nchan = 0;
+    m->chans = NULL;
+    m->data = (char *)(m + 1);
+    m->data[0] = MT_STR;
+    memcpy(m->data + 1, &l, sizeof(l));
+    memcpy(m->data + 1 + sizeof(l), s, l);
+  }
+  return m;
+}
+
+
+typedef struct DecState {
+  lua_State *L;
+  const Message *m;
+  const char *p;  /* current position in message */
+  int tables;  /* stack index of table: position -> decoded table */
+  lua_Integer ntables;  /* number of tables already decoded */
+} DecState;
+
+
+static void pushchannel (lua_State *L, Channel *ch);
+
+
+static void readbytes (DecState *D, void *v, size_t sz) {
+  memcpy(v, D->p, sz);
+  D->p += sz;
+}
+
+
+static void decode (DecState *D) {
+  lua_State *L = D->L;
+  luaL_checkstack(L, 4, "message too complex");
+  switch (*D->p++) {
+    case MT_NIL: lua_pushnil(L); break;
+    case MT_FALSE: lua_pushboolean(L, 0); break;
+    case MT_TRUE: lua_pushboolean(L, 1); break;
+    case MT_INT: {
+      lua_Integer i;
+      readbytes(D, &i, sizeof(i));
+      lua_pushinteger(L, i);
+      break;
+    }
+    case MT_FLT: {
+      lua_Number n;
+      readbytes(D, &n, sizeof(n));
+      lua_pushnumber(L, n);
+      break;
+    }
+    case MT_STR: {
+      size_t l;
+      readbytes(D, &l, sizeof(l));
+      lua_pushlstring(L, D->p, l);
+      D->p += l;
+      break;
+    }
+    case MT_TABLE: {
+      size_t sizes[2];
+      readbytes(D, sizes, sizeof(sizes));
+      lua_createtable(L, (int)sizes[0], (int)sizes[1]);
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, D->tables, ++D->ntables);
+      while (*D->p != MT_END) {
+        decode(D);  /* key */
+        decode(D);  /* value */
+        lua_rawset(L, -3);
+      }
+      D->p++;  /* skip MT_END */
+      break;
+    }
+    case MT_REF: {
+      lua_Integer ref;
+      readbytes(D, &ref, sizeof(ref));
+      lua_rawgeti(L, D->tables, ref);
+      break;
+    }
+    case MT_CHANNEL: {
+      size_t i;
+      readbytes(D, &i, sizeof(i));
+      pushchannel(L, D->m->chans[i]);
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+/* push all values in message 'm'; returns their number */
+static int pushmessage (lua_State *L, const Message *m) {
+  DecState D;
+  int top = lua_gettop(L);
+  int n = 0;
+  D.L = L;
+  D.m = m;
+  D.p = m->data;
+  D.ntables = 0;
+  lua_newtable(L);
+  D.tables = lua_gettop(L);
+  while (D.p < m->data + m->size) {
+    decode(&D);
+    n++;
+  }
+  lua_remove(L, D.tables);
+  lua_assert(lua_gettop(L) == top + n);
+  (void)top;
+  return n;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Channels
+** =======================================================
+*/
+
+typedef struct Cell {
+  size_t seq;  /* sequence number (see 'trypush' and 'trypop') */
+  Message *msg;
+} Cell;
+
+
+struct Channel {
+  int refs;  /* number of references (handles and messages) */
+  size_t mask;  /* number of cells minus 1 (a power of 2 minus 1) */
+  char pad1[64];  /* keep producers and consumers in different lines */
+  size_t tail;  /* next position to write */
+  char pad2[64];
+  size_t head;  /* next position to read */
+  char pad3[64];
+  Cell cells[1];  /* variable length */
+};
+
+
+static Channel *newchannel (size_t capacity) {
+  size_t size = 2;
+  size_t i;
+  Channel *ch;
+  while (size < capacity) size *= 2;
+  ch = (Channel *)malloc(sizeof(Channel) + (size - 1) * sizeof(Cell));
+  if (ch == NULL) return NULL;
+  ch->refs = 1;
+  ch->mask = size - 1;
+  ch->tail = ch->head = 0;
+  for (i = 0; i < size; i++)
+    ch->cells[i].seq = i;
+  return ch;
+}
+
+
+/* try to add a message to the channel; returns 0 if it is full */
+static int trypush (Channel *ch, Message *m) {
+  size_t pos = l_atomicload(&ch->tail);
+  Cell *c;
+  for (;;) {
+    size_t seq;
+    c = &ch->cells[pos & ch->mask];
+    seq = l_atomicload(&c->seq);
+    if (seq == pos) {  /* cell is free for this position? */
+      if (l_atomiccas(&ch->tail, &pos, pos + 1))
+        break;  /* got it */
+    }
+    else if ((ptrdiff_t)(seq - pos) < 0)
+      return 0;  /* cell still holds a message from the previous round */
+    else
+      pos = l_atomicload(&ch->tail);  /* other producer got it; retry */
+  }
+  c->msg = m;
+  l_atomicstore(&c->seq, pos + 1);  /* publish it */
+  return 1;
+}
+
+
+/* try to remove a message from the channel; returns NULL if empty */
+static Message *trypop (Channel *ch) {
+  size_t pos = l_atomicload(&ch->head);
+  Cell *c;
+  Message *m;
+  for (;;) {
+    size_t seq;
+    c = &ch->cells[pos & ch->mask];
+    seq = l_atomicload(&c->seq);
+    if (seq == pos + 1) {  /* cell has a message for this position? */
+      if (l_atomiccas(&ch->head, &pos, pos + 1))
+        break;  /* got it */
+    }
+    else if ((ptrdiff_t)(seq - (pos + 1)) < 0)
+      return NULL;  /* empty */
+    else
+      pos = l_atomicload(&ch->head);  /* other consumer got it; retry */
+  }
+  m = c->msg;
+  l_atomicstore(&c->seq, pos + ch->mask + 1);  /* free cell for next round */
+  return m;
+}
+
+
+static void acquirechannel (Channel *ch) {
+  l_atomicinc(&ch->refs);
+}
+
+
+static void releasechannel (Channel *ch) {
+  if (l_atomicdec(&ch->refs) == 0) {
+    Message *m;
+    while ((m = trypop(ch)) != NULL)  /* free pending messages */
+      freemsg(m);
+    free(ch);
+  }
+}
+
+
+/*
+** Back off while waiting for a channel or a worker: spin for a while,
+** then yield the processor, then sleep for increasing periods (up to
+** one millisecond).
+*/
+static void backoff (int *n) {
+  if (*n < 64) (*n)++;
+  else if (*n < 128) { (*n)++; sched_yield(); }
+  else {
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000L * ((*n < 1128) ? (*n)++ - 127 : 1000);
+    nanosleep(&ts, NULL);
+  }
+}
+
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static Channel *tochannel (lua_State *L, int idx) {
+  Channel **p = (Channel **)luaL_testudata(L, idx, CHANNELTYPE);
+  return (p == NULL) ? NULL : *p;
+}
+
+
+static Channel *checkchannel (lua_State *L) {
+  Channel **p = (Channel **)luaL_checkudata(L, 1, CHANNELTYPE);
+  luaL_argcheck(L, *p != NULL, 1, "channel is closed");
+  return *p;
+}
+
+
+static int ch_trysend (lua_State *L) {
+  Channel *ch = checkchannel(L);
+  Message *m;
+  luaL_checkany(L, 2);
+  m = newmessage(L, 2);
+  if (!trypush(ch, m)) {
+    freemsg(m);
+    lua_pushboolean(L, 0);
+  }
+  else lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int ch_send (lua_State *L) {
+  Channel *ch = checkchannel(L);
+  Message *m;
+  int n = 0;
+  luaL_checkany(L, 2);
+  m = newmessage(L, 2);
+  while (!trypush(ch, m))
+    backoff(&n);
+  return 0;
+}
+
+
+static int ch_tryreceive (lua_State *L) {
+  Message *m = trypop(checkchannel(L));
+  int n;
+  if (m == NULL) return 0;
+  n = pushmessage(L, m);  /* cannot raise errors (but for memory) */
+  freemsg(m);
+  return n;
+}
+
+
+/*
+** Receive a message from 'ch' and push its values, waiting at most the
+** number of seconds at index 'targ' (if given). Returns the number of
+** values pushed (none on timeouts).
+*/
+static int receivemsg (lua_State *L, Channel *ch, int targ) {
+  double timeout = luaL_optnumber(L, targ, -1);
+  double limit = (timeout >= 0) ? now() + timeout : 0;
+  Message *m;
+  int n = 0;
+  while ((m = trypop(ch)) == NULL) {
+    if (timeout >= 0 && now() >= limit)
+      return 0;  /* timeout */
+    backoff(&n);
+  }
+  n = pushmessage(L, m);
+  freemsg(m);
+  return n;
+}
+
+
+static int ch_receive (lua_State *L) {
+  return receivemsg(L, checkchannel(L), 2);
+}
+
+
+static int ch_capacity (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkchannel(L)->mask + 1);
+  return 1;
+}
+
+
+static int ch_gc (lua_State *L) {
+  Channel **p = (Channel **)luaL_checkudata(L, 1, CHANNELTYPE);
+  if (*p != NULL) {
+    releasechannel(*p);
+    *p = NULL;
+  }
+  return 0;
+}
+
+
+static int ch_tostring (lua_State *L) {
+  lua_pushfstring(L, "channel (%p)", (void *)checkchannel(L));
+  return 1;
+}
+
+
+static const luaL_Reg chanmeths[] = {
+  {"send", ch_send},
+  {"trysend", ch_trysend},
+  {"receive", ch_receive},
+  {"tryreceive", ch_tryreceive},
+  {"capacity", ch_capacity},
+  {"__gc", ch_gc},
+  {"__tostring", ch_tostring},
+  {NULL, NULL}
+};
+
+
+static void pushchannel (lua_State *L, Channel *ch) {
+  Channel **p = (Channel **)lua_newuserdata(L, sizeof(Channel *));
+  *p = ch;
+  acquirechannel(ch);
+  if (luaL_newmetatable(L, CHANNELTYPE)) {  /* first channel in state? */
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, chanmeths, 0);
+  }
+  lua_setmetatable(L, -2);
+}
+
+
+
+static int w_channel (lua_State *L) {
+  lua_Integer cap = luaL_optinteger(L, 1, LUA_WORKCHANNELSIZE);
+  Channel *ch;
+  luaL_argcheck(L, 0 < cap && cap <= (1 << 24), 1, "invalid capacity");
+  ch = newchannel((size_t)cap);
+  if (ch == NULL)
+    return luaL_error(L, "not enough memory");
+  pushchannel(L, ch);
+  releasechannel(ch);  /* now only the new handle refers to it */
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Workers
+** =======================================================
+*/
+
+typedef struct Worker {
+  int refs;  /* 2 while both thread and handle are alive */
+  int done;  /* thread finished */
+  int joined;  /* thread was joined */
+  int status;  /* status of the worker chunk */
+  pthread_t thread;
+  Message *code;  /* chunk to run (as a string) */
+  Message *args;  /* its arguments */
+  Message *results;  /* its results or error message */
+} Worker;
+
+
+static void releaseworker (Worker *w) {
+  if (l_atomicdec(&w->refs) == 0) {
+    if (w->code) freemsg(w->code);
+    if (w->args) freemsg(w->args);
+    if (w->results) freemsg(w->results);
+    free(w);
+  }
+}
+
+
+/* body of a worker, run in protected mode */
+static int runworker (lua_State *L) {
+  Worker *w = (Worker *)lua_touserdata(L, 1);
+  size_t l;
+  const char *code;
+  int n;
+  lua_settop(L, 0);
+  pushmessage(L, w->code);
+  code = lua_tolstring(L, 1, &l);
+  if (luaL_loadbuffer(L, code, l, "=worker") != LUA_OK)
+    return lua_error(L);
+  lua_remove(L, 1);
+  n = pushmessage(L, w->args);
+  lua_call(L, n, LUA_MULTRET);
+  w->results = newmessage(L, 1);
+  return 0;
+}
+
+
+static void *workermain (void *ud) {
+  Worker *w = (Worker *)ud;
+  lua_State *L = luaL_newstate_pooled();
+  if (L == NULL)
+    w->status = LUA_ERRMEM;
+  else {
+    luaL_openlibs(L);
+    lua_pushcfunction(L, runworker);
+    lua_pushlightuserdata(L, w);
+    w->status = lua_pcall(L, 1, 0, 0);
+    if (w->status != LUA_OK) {
+      size_t l;
+      const char *msg = lua_tolstring(L, -1, &l);
+      if (msg == NULL) {
+        msg = "(error object is not a string)";
+        l = strlen(msg);
+      }
+      w->results = newstrmessage(msg, l);
+    }
+    lua_close(L);
+  }
+  l_atomicstore(&w->done, 1);
+  releaseworker(w);
+  return NULL;
+}
+
+
+static Worker *checkworker (lua_State *L) {
+  return *(Worker **)luaL_checkudata(L, 1, WORKERTYPE);
+}
+
+
+static int writer (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+/* replace the chunk (a string or a function) at index 'idx' by a string */
+static void tochunk (lua_State *L, int idx) {
+  if (lua_type(L, idx) == LUA_TFUNCTION) {  /* dump it to a string */
+    luaL_Buffer b;
+    lua_pushvalue(L, idx);
+    luaL_buffinit(L, &b);
+    if (lua_dump(L, writer, &b, 0) != 0)
+      luaL_error(L, "unable to dump given function");
+    luaL_pushresult(&b);
+    lua_replace(L, idx);
+    lua_pop(L, 1);  /* function copy */
+  }
+  else luaL_checktype(L, idx, LUA_TSTRING);
+}
+
+
+static int w_spawn (lua_State *L) {
+  Worker **p;
+  Worker *w;
+  tochunk(L, 1);
+  p = (Worker **)lua_newuserdata(L, sizeof(Worker *));
+  *p = NULL;
+  luaL_setmetatable(L, WORKERTYPE);
+  lua_insert(L, 1);  /* handle goes below arguments */
+  w = (Worker *)malloc(sizeof(Worker));
+  if (w == NULL)
+    return luaL_error(L, "not enough memory");
+  memset(w, 0, sizeof(Worker));
+  w->refs = 1;
+  w->joined = 1;  /* no thread to join yet */
+  *p = w;  /* now the handle owns 'w' */
+  lua_pushvalue(L, 2);
+  w->code = newmessage(L, lua_gettop(L));
+  lua_pop(L, 1);
+  w->args = newmessage(L, 3);
+  w->refs = 2;  /* one for the thread */
+  if (pthread_create(&w->thread, NULL, workermain, w) != 0) {
+    w->refs = 1;
+    return luaL_error(L, "cannot create thread");
+  }
+  w->joined = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int w_join (lua_State *L) {
+  Worker *w = checkworker(L);
+  int n;
+  if (w->joined)
+    return luaL_error(L, "worker already joined");
+  pthread_join(w->thread, NULL);
+  w->joined = 1;
+  if (w->results == NULL)  /* could not create state or results? */
+    return luaL_error(L, "not enough memory in worker");
+  n = pushmessage(L, w->results);
+  if (w->status != LUA_OK)
+    return lua_error(L);
+  return n;
+}
+
+
+static int w_done (lua_State *L) {
+  lua_pushboolean(L, l_atomicload(&checkworker(L)->done));
+  return 1;
+}
+
+
+static int w_gc (lua_State *L) {
+  Worker **p = (Worker **)luaL_checkudata(L, 1, WORKERTYPE);
+  Worker *w = *p;
+  if (w != NULL) {
+    if (!w->joined)
+      pthread_detach(w->thread);  /* it will release itself */
+    *p = NULL;
+    releaseworker(w);
+  }
+  return 0;
+}
+
+
+static int cpus (void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (int)n : 1;
+}
+
+
+static int w_cpus (lua_State *L) {
+  lua_pushinteger(L, cpus());
+  return 1;
+}
+
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Pools
+** =======================================================
+*/
+
+/* maximum number of workers in a pool */
+#if !defined(LUA_WORKMAXPOOL)
+#define LUA_WORKMAXPOOL		1024
+#endif
+
+
+/*
+** Chunk run by each worker of a pool. It loads the job function once
+** and calls it for each job, a message (true, args...) in 'jobs',
+** sending the results of 'pcall' to 'results'. An empty message stops
+** it.
+*/
+static const char poolchunk[] =
+  "local code, jobs, results = ...\n"
+  "local f = assert(load(code, '=pool'))\n"
+  "local function run (go, ...)\n"
+  "  if not go then return false end\n"
+  "  if not pcall(results.send, results, pcall(f, ...)) then\n"
+  "    results:send(false, 'job results cannot be sent')\n"
+  "  end\n"
+  "  return true\n"
+  "end\n"
+  "while run(jobs:receive()) do end\n";
+
+
+typedef struct Pool {
+  Channel *jobs;  /* jobs for the workers */
+  Channel *results;  /* results of the jobs */
+  int n;  /* number of workers */
+  int closed;  /* workers were stopped */
+  Worker *w[1];  /* variable length; the pool holds a reference to each */
+} Pool;
+
+
+static Pool *checkpool (lua_State *L) {
+  Pool *p = (Pool *)luaL_checkudata(L, 1, POOLTYPE);
+  luaL_argcheck(L, !p->closed, 1, "pool is closed");
+  return p;
+}
+
+
+/* free all messages pending in channel 'ch' */
+static void discard (Channel *ch) {
+  Message *m;
+  while ((m = trypop(ch)) != NULL)
+    freemsg(m);
+}
+
+
+/*
+** Send a stop message to each worker of pool 'p', unless all of them
+** have finished (so that no one will ever take the messages). Results
+** are discarded meanwhile, so that no worker stays blocked on them.
+*/
+static void stopworkers (lua_State *L, Pool *p) {
+  int i, k;
+  for (i = 0; i < p->n; i++) {
+    Message *m = newmessage(L, lua_gettop(L) + 1);  /* empty message */
+    int n = 0;
+    while (!trypush(p->jobs, m)) {
+      for (k = 0; k < p->n && l_atomicload(&p->w[k]->done); k++) ;
+      if (k == p->n) {  /* all workers finished? */
+        freemsg(m);
+        return;
+      }
+      discard(p->results);
+      backoff(&n);
+    }
+  }
+}
+
+
+/* release the channels of pool 'p' and its references to workers */
+static void freepool (Pool *p) {
+  int i;
+  for (i = 0; i < p->n; i++) {
+    if (!p->w[i]->joined)
+      pthread_detach(p->w[i]->thread);  /* it will release itself */
+    releaseworker(p->w[i]);
+  }
+  p->n = 0;
+  if (p->jobs) releasechannel(p->jobs);
+  if (p->results) releasechannel(p->results);
+  p->jobs = p->results = NULL;
+  p->closed = 1;
+}
+
+
+static int w_pool (lua_State *L) {
+  lua_Integer n = luaL_optinteger(L, 2, cpus());
+  Pool *p;
+  luaL_argcheck(L, 0 < n && n <= LUA_WORKMAXPOOL, 2,
+                   "invalid number of workers");
+  tochunk(L, 1);
+  lua_settop(L, 1);
+  p = (Pool *)lua_newuserdata(L, sizeof(Pool) + (n - 1) * sizeof(Worker *));
+  p->jobs = p->results = NULL;
+  p->n = 0;
+  p->closed = 1;  /* not ready yet */
+  luaL_setmetatable(L, POOLTYPE);
+  /* channels hold at least one message per worker (see 'pool_gc') */
+  p->jobs = newchannel((n > LUA_WORKCHANNELSIZE) ? n : LUA_WORKCHANNELSIZE);
+  p->results = newchannel((n > LUA_WORKCHANNELSIZE) ? n : LUA_WORKCHANNELSIZE);
+  if (p->jobs == NULL || p->results == NULL)
+    return luaL_error(L, "not enough memory");
+  p->closed = 0;
+  while (p->n < n) {
+    Worker **h;
+    lua_pushcfunction(L, w_spawn);
+    lua_pushlstring(L, poolchunk, sizeof(poolchunk) - 1);
+    lua_pushvalue(L, 1);
+    pushchannel(L, p->jobs);
+    pushchannel(L, p->results);
+    lua_call(L, 4, 1);
+    h = (Worker **)lua_touserdata(L, -1);
+    p->w[p->n++] = *h;  /* the pool takes the reference of the handle */
+    *h = NULL;
+    lua_pop(L, 1);
+  }
+  return 1;
+}
+
+
+static int pool_submit (lua_State *L) {
+  Pool *p = checkpool(L);
+  Message *m;
+  int n = 0;
+  lua_pushboolean(L, 1);
+  lua_insert(L, 2);
+  m = newmessage(L, 2);
+  while (!trypush(p->jobs, m))
+    backoff(&n);
+  return 0;
+}
+
+
+static int pool_receive (lua_State *L) {
+  return receivemsg(L, checkpool(L)->results, 2);
+}
+
+
+static int pool_size (lua_State *L) {
+  lua_pushinteger(L, checkpool(L)->n);
+  return 1;
+}
+
+
+/*
+** Stop the workers after they finish the pending jobs and wait for
+** them. Raises the error of a worker that failed (and not because of
+** a job). Results not yet received are discarded.
+*/
+static int pool_close (lua_State *L) {
+  Pool *p = checkpool(L);
+  int i, err = 0;
+  stopworkers(L, p);
+  for (i = 0; i < p->n; i++) {
+    Worker *w = p->w[i];
+    int n = 0;
+    while (!l_atomicload(&w->done)) {
+      discard(p->results);
+      backoff(&n);
+    }
+    pthread_join(w->thread, NULL);
+    w->joined = 1;
+    if (w->status != LUA_OK && !err) {
+      err = 1;
+      if (w->results == NULL)
+        lua_pushliteral(L, "not enough memory in worker");
+      else
+        pushmessage(L, w->results);
+    }
+  }
+  freepool(p);
+  return err ? lua_error(L) : 0;
+}
+
+
+/*
+** Drop pending jobs and results and stop the workers without waiting
+** for them. After the jobs are dropped each worker sends at most one
+** more result, so neither channel can be full and this never blocks.
+*/
+static int pool_gc (lua_State *L) {
+  Pool *p = (Pool *)luaL_checkudata(L, 1, POOLTYPE);
+  if (!p->closed) {
+    discard(p->jobs);
+    discard(p->results);
+    stopworkers(L, p);
+  }
+  freepool(p);
+  return 0;
+}
+
+
+static const luaL_Reg poolmeths[] = {
+  {"submit", pool_submit},
+  {"receive", pool_receive},
+  {"size", pool_size},
+  {"close", pool_close},
+  {"__gc", pool_gc},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg workmeths[] = {
+  {"join", w_join},
+  {"done", w_done},
+  {"__gc", w_gc},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg worklib[] = {
+  {"spawn", w_spawn},
+  {"pool", w_pool},
+  {"channel", w_channel},
+  {"cpus", w_cpus},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, WORKERTYPE);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_setfuncs(L, workmeths, 0);
+  lua_pop(L, 1);
+  luaL_newmetatable(L, POOLTYPE);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_setfuncs(L, poolmeths, 0);
+  lua_pop(L, 1);
+}
+
+/* }====================================================== */
+
+
+#else				/* }{ */
+
+/* no threads or atomic operations in ISO C */
+
+static int w_notsup (lua_State *L) {
+  return luaL_error(L, "workers not supported by this Lua installation");
+}
+
+static const luaL_Reg worklib[] = {
+  {"spawn", w_notsup},
+  {"pool", w_notsup},
+  {"channel", w_notsup},
+  {"cpus", w_notsup},
+  {NULL, NULL}
+};
+
+#define createmeta(L)	((void)L)
+
+#endif				/* } */
+
+
+LUAMOD_API int luaopen_workers (lua_State *L) {
+  luaL_newlib(L, worklib);
+  createmeta(L);
+  return 1;
+}
+
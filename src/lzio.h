@@ -58,6 +58,10 @@ struct Zio {
   lua_Reader reader;		/* reader function */
   void *data;			/* additional data */
   lua_State *L;			/* Lua state (for reader) */
+  lua_Unmap unmap;		/* if not NULL, the input is a single block
+				   that may outlive the load */
+  void *ud;			/* argument to 'unmap' */
+  struct Mapping *map;		/* that block, once a prototype uses it */
 };
 
 
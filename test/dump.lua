@@ -0,0 +1,20 @@
+-- Tests for precompiled chunks (ldump.c, lundump.c)
+
+local FORMATEXT = 2    -- LUAC_FORMATEXT in lundump.h
+
+-- code for the extended instruction set has its own format
+local function getx (t) return t.x end
+local s = string.dump(getx)
+assert(s:byte(6) & FORMATEXT ~= 0)
+assert(load(s)({x = 10}) == 10)
+
+-- code with only official opcodes has the official format
+local function id (...) return ... end
+s = string.dump(id)
+assert(s:byte(6) == 0)
+assert(load(s)(1, 2) == 1)
+
+-- the loader accepts only known format flags
+assert(not load(s:sub(1, 5) .. "\x80" .. s:sub(7)))
+
+print("OK")
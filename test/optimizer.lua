@@ -0,0 +1,20 @@
+-- Tests for the bytecode optimizer (lopt.c). The script must behave
+-- the same when run from source and after 'luac -O'.
+
+-- concatenation is right associative: a constant run followed by a
+-- value with a '__concat' metamethod cannot be folded
+do
+  local m = setmetatable({}, {__concat = function (a, b)
+    if type(a) == "table" then return "<" .. b .. ">" end
+    return "[" .. a .. "]"
+  end})
+  assert("x" .. "y" .. m == "x[y]")
+  assert("x" .. "y" .. "z" .. m == "xy[z]")
+  assert(m .. "x" .. "y" == "<xy>")
+  assert("a" .. "b" .. m .. "c" .. "d" == "ab<cd>")
+  local s = "s"
+  assert("a" .. "b" .. s .. "c" .. "d" .. 1 .. 2.5 == "absc" .. "d12.5")
+  assert("a" .. 1 .. 2 == "a12")
+end
+
+print("OK")
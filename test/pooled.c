@@ -0,0 +1,58 @@
+/*
+** Test of the pooled allocator (luaL_newstate_pooled in lauxlib.c).
+** The Makefile builds it with a copy of lauxlib.c compiled with a large
+** LUAL_POOLMAXBLOCK, so that even the main block of a state fits in a
+** pooled size class.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const char chunk[] =
+  "local t = {}\n"
+  "for i = 1, 10000 do t[i] = {i, tostring(i), string.rep('x', i % 3000)} end\n"
+  "for i = 1, 10000 do t[i] = nil end\n"
+  "collectgarbage()\n"
+  "local co = coroutine.wrap(function (n) for i = 1, n do coroutine.yield(i) end end)\n"
+  "for i = 1, 100 do assert(co(100) == i) end\n"
+  "return #table.concat({'a', 'b', 'c'})\n";
+
+
+int main (void) {
+  luaL_PoolStats st;
+  size_t npages;
+  int i, c, n;
+  for (i = 0; i < 20; i++) {
+    lua_State *L = luaL_newstate_pooled();
+    if (L == NULL) {
+      fprintf(stderr, "cannot create state\n");
+      return EXIT_FAILURE;
+    }
+    luaL_openlibs(L);
+    if (luaL_dostring(L, chunk) != LUA_OK || lua_tointeger(L, -1) != 3) {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      return EXIT_FAILURE;
+    }
+    n = luaL_poolstats(L, 0, NULL);
+    if (n != LUAL_POOLMAXBLOCK / 16 + 1) {
+      fprintf(stderr, "state does not use the expected pool\n");
+      return EXIT_FAILURE;
+    }
+    for (c = 0, npages = 0; c < n; c++) {
+      luaL_poolstats(L, c, &st);
+      npages += st.npages;
+    }
+    if (npages == 0) {
+      fprintf(stderr, "state has no pages\n");
+      return EXIT_FAILURE;
+    }
+    lua_close(L);  /* frees the main block and all pages */
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
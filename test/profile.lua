@@ -0,0 +1,43 @@
+-- Tests for the profiler library (lproflib.c)
+
+local profile = require "profile"
+
+local function spin (n)
+  local s = 0
+  for i = 1, n do s = s + i % 7 end
+  return s
+end
+
+-- time spent in a coroutine is sampled in the coroutine
+local function cobusy ()
+  local t0 = os.clock()
+  while os.clock() - t0 < 0.3 do spin(10000) end
+end
+
+for _, mode in ipairs{"time", "instr"} do
+  profile.reset()
+  if pcall(profile.start, 1000, mode) then
+    coroutine.wrap(cobusy)()
+    profile.stop()
+    local samples, n = profile.samples()
+    local inco = 0
+    for stack, c in pairs(samples) do
+      if stack:find("spin@") then inco = inco + c end
+    end
+    assert(n >= 10, mode)
+    assert(inco >= n * 0.9, mode)
+  else
+    assert(mode == "time")  -- no profiling timer in this platform
+  end
+end
+
+-- the hook is removed from the coroutines after 'stop'
+profile.reset()
+profile.start(1000, "instr")
+local co = coroutine.create(function () coroutine.yield(debug.gethook()) end)
+assert(select(2, coroutine.resume(co)) ~= nil)
+profile.stop()
+assert(debug.gethook() == nil)
+assert(coroutine.resume(co))
+
+print("OK")
@@ -0,0 +1,57 @@
+-- Tests for the workers library (lworklib.c)
+
+local workers = require "workers"
+
+if not pcall(workers.cpus) then
+  print("workers not supported")
+  return
+end
+
+-- a pool reuses its workers for many jobs
+local p = workers.pool(function (x)
+  if x == 3 then error("three") end
+  n = (n or 0) + 1     -- global state persists across jobs of a worker
+  return x * x, n
+end, 3)
+assert(p:size() == 3)
+for i = 1, 100 do p:submit(i) end
+local sum, errs, maxn = 0, 0, 0
+for i = 1, 100 do
+  local ok, v, n = p:receive()
+  if ok then
+    sum = sum + v
+    if n > maxn then maxn = n end
+  else
+    errs = errs + 1
+    assert(v:find("three"))
+  end
+end
+assert(sum == 100 * 101 * 201 // 6 - 9 and errs == 1)
+assert(maxn >= 100 // 3)      -- some worker ran at least its share
+assert(select('#', p:receive(0)) == 0)
+p:close()
+assert(not pcall(p.submit, p, 1))
+
+-- closing waits for pending jobs and discards their results
+p = workers.pool("local x = ... return x", 2)
+for i = 1, 1500 do p:submit(i) end
+p:close()
+
+-- a collected pool stops its workers
+p = workers.pool(function (x)
+  local s = 0
+  for i = 1, x do s = s + i end
+  return s
+end, 2)
+for i = 1, 1000 do p:submit(1000) end
+p = nil
+collectgarbage()
+
+-- failures outside jobs are raised by 'close'
+p = workers.pool("syntax error", 2)
+local ok, msg = pcall(p.close, p)
+assert(not ok and msg:find("syntax error"))
+assert(not pcall(workers.pool, print))     -- C functions cannot be sent
+assert(not pcall(workers.pool, "", 0))
+
+print("OK")